@@ -0,0 +1,229 @@
+#include "assemble.h"
+#include "assembler.h"
+#include "data_image.h"
+#include "first_pass.h"
+#include "helpers.h"
+#include "instruction_image.h"
+#include "peephole.h"
+#include "preprocessor.h"
+#include "second_pass.h"
+#include "symbol_table.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/* assemble -- the stages of one file, with their progress messages */
+
+static bool run_stages(char *filename, const MacroLibrary *macro_lib,
+                       OutputFormat format, LineCache *cache);
+static bool optimize(char *filename, FILE **am_file, Symbol **symtab,
+                     int *icf, int *dcf);
+
+/* -O, for every file */
+static bool is_optimizing = false;
+
+/* ======================================================================= */
+/* ===================== public api -- see header ======================== */
+/* ======================================================================= */
+
+bool assemble_file(char *filename, const MacroLibrary *macro_lib,
+                   OutputFormat format) {
+  return assemble_file_cached(filename, macro_lib, format, NULL);
+}
+
+bool assemble_file_cached(char *filename, const MacroLibrary *macro_lib,
+                          OutputFormat format, LineCache *cache) {
+  bool ok;
+
+  trace_begin(TRACE_FILE, filename);
+  ok = run_stages(filename, macro_lib, format, cache);
+  trace_end();
+  return ok;
+}
+
+void assemble_set_optimize(bool is_on) { is_optimizing = is_on; }
+
+/* ======================================================================= */
+
+/* run_stages -- assemble_file_cached, inside the span of the file */
+static bool run_stages(char *filename, const MacroLibrary *macro_lib,
+                       OutputFormat format, LineCache *cache) {
+  Symbol *symtab = NULL;
+  LineCache *repeat_cache = NULL; /* this build's, see below */
+  bool ok;
+  int icf, dcf;
+
+  /* for first pass */
+  FILE *am_file;
+  int repeated_lines = 0;
+
+  printf("=== PREPROCESSING STAGE ===\n");
+  printf("Input:  %s.as\n", filename);
+  printf("Output: %s.am\n", filename);
+  printf("Expanding macros...\n");
+
+  trace_begin(TRACE_STAGE, "preprocess_file");
+  ok = preprocess_file(filename, macro_lib, &repeated_lines) == 0;
+  trace_end();
+  if (!ok) {
+    /* log error & skip file */
+    fprintf(stderr,
+            "(ERROR) [assembler] failed the preprocessing stage for '%s'\n",
+            filename);
+    return false;
+  }
+  printf("Preprocessing completed successfully!\n");
+
+  am_file = open_file_with_ext(filename, ".am", "r");
+  if (!am_file) {
+    fprintf(stderr, "(ERROR) [assembler] failed to open '%s.am'\n", filename);
+
+    /* skip on error */
+    return false;
+  }
+
+  /* lines repeated by .rept are copies, with a cache of its own the first
+   * pass parses the first and replays the rest */
+  if (!cache && repeated_lines > 0)
+    cache = repeat_cache = line_cache_new();
+
+  /* first pass */
+  printf("\n=== FIRST PASS - SYMBOL TABLE CONSTRUCTION ===\n");
+  printf("Processing: %s.am\n", filename);
+  printf("Building symbol table and analyzing instructions...\n");
+  trace_begin(TRACE_STAGE, "first_pass");
+  ok = first_pass_cached(am_file, cache, &symtab, &icf, &dcf) == 0;
+  trace_end();
+  line_cache_free(repeat_cache);
+  if (!ok) {
+    fprintf(stderr, "(ERROR) [assembler] first_pass failed for '%s.am'\n",
+            filename);
+    fclose(am_file);
+    free_directives();
+    free_symbol_table(symtab);
+    return false;
+  }
+  printf("First pass completed! IC=%d, DC=%d\n", icf, dcf);
+
+  /* -O: shrink the code before its size is checked */
+  if (is_optimizing && !optimize(filename, &am_file, &symtab, &icf, &dcf)) {
+    if (am_file)
+      fclose(am_file);
+    free_directives();
+    free_commands();
+    free_symbol_table(symtab);
+    return false;
+  }
+
+  /* check memory overflow */
+  if (icf + dcf > MAX_WORDS_MEMORY) {
+    fprintf(stderr,
+            "(ERROR) [assembler] memory overflow: program requires %d words "
+            "but maximum is %d words\n",
+            icf + dcf, MAX_WORDS_MEMORY);
+    fclose(am_file);
+    free_directives();
+    free_symbol_table(symtab);
+    return false;
+  }
+
+  /* close am_file, we're done reading it */
+  fclose(am_file);
+
+  /* second_pass */
+  printf("\n=== SECOND PASS - CODE GENERATION ===\n");
+  printf("Processing: %s.am\n", filename);
+  printf("Resolving symbols and generating output files...\n");
+  trace_begin(TRACE_STAGE, "second_pass");
+  ok = second_pass(symtab, icf, filename, format) == 0;
+  trace_end();
+  if (!ok) {
+    char ob_file[MAX_FILENAME_LENGTH];
+    char obj_file[MAX_FILENAME_LENGTH];
+    char ent_file[MAX_FILENAME_LENGTH];
+    char ext_file[MAX_FILENAME_LENGTH];
+
+    fprintf(stderr, "(ERROR) [assembler] second_pass failed for '%s'\n",
+            filename);
+
+    /* remove any partially generated output files on error */
+    sprintf(ob_file, "%s.ob", filename);
+    sprintf(obj_file, "%s.obj", filename);
+    sprintf(ent_file, "%s.ent", filename);
+    sprintf(ext_file, "%s.ext", filename);
+    remove(ob_file);
+    remove(obj_file);
+    remove(ent_file);
+    remove(ext_file);
+  } else {
+    FILE *check_file;
+    printf("Second pass completed successfully!\n");
+    printf("Generated files:\n");
+    if (format == OUTPUT_BINARY)
+      printf("  - %s.obj (binary object file)\n", filename);
+    else
+      printf("  - %s.ob (object file)\n", filename);
+
+    /* check if .ent file was generated */
+    check_file = open_file_with_ext(filename, ".ent", "r");
+    if (check_file) {
+      printf("  - %s.ent (entry symbols)\n", filename);
+      fclose(check_file);
+    }
+
+    /* check if .ext file was generated */
+    check_file = open_file_with_ext(filename, ".ext", "r");
+    if (check_file) {
+      printf("  - %s.ext (external references)\n", filename);
+      fclose(check_file);
+    }
+
+    printf("Assembly complete for %s!\n\n", filename);
+  }
+
+  /* cleanup directives, commands and symbols */
+  free_directives();
+  free_commands();
+  free_symbol_table(symtab);
+  return ok;
+}
+
+/* optimize -- the -O pass (peephole.h) and, if it saved anything, the
+ * first pass again over the .am it rewrote, which lays out every label and
+ * address anew. *am_file is reopened for it (NULL if that failed)
+ *
+ * returns true on success, false on error (error printed)
+ */
+static bool optimize(char *filename, FILE **am_file, Symbol **symtab,
+                     int *icf, int *dcf) {
+  PeepholeStats stats;
+  bool ok;
+
+  printf("\n=== PEEPHOLE PASS ===\n");
+  printf("Processing: %s.am\n", filename);
+
+  trace_begin(TRACE_STAGE, "peephole_optimize");
+  ok = peephole_optimize(filename, &stats);
+  if (ok && stats.words_saved > 0) {
+    fclose(*am_file);
+    free_directives();
+    free_commands();
+    free_symbol_table(*symtab);
+    *symtab = NULL;
+
+    *am_file = open_file_with_ext(filename, ".am", "r");
+    ok = *am_file && first_pass(*am_file, symtab, icf, dcf) == 0;
+  }
+  trace_end();
+
+  if (!ok) {
+    fprintf(stderr, "(ERROR) [assembler] peephole pass failed for '%s.am'\n",
+            filename);
+    return false;
+  }
+
+  printf("Removed %d instructions, rewrote %d: %d words saved, IC=%d, "
+         "DC=%d\n",
+         stats.removed, stats.rewritten, stats.words_saved, *icf, *dcf);
+  return true;
+}
@@ -0,0 +1,31 @@
+#ifndef ASSEMBLE_H
+#define ASSEMBLE_H
+
+#include "line_cache.h"
+#include "macro_library.h"
+#include "types.h"
+
+/* assemble.h -- assembles one file, what the assembler does for each file it
+ * is given (and the check runner for each fixture) */
+
+/* assemble_file -- run every stage for one file (without .as extension),
+ * printing the progress to stdout. the macros of macro_lib (may be NULL) are
+ * visible to it, the object goes out in format. errors are reported and the
+ * file is skipped
+ *
+ * returns true if the file was assembled, false if it was skipped
+ */
+bool assemble_file(char *filename, const MacroLibrary *macro_lib,
+                   OutputFormat format);
+
+/* assemble_file_cached -- assemble_file, with the first pass going through
+ * cache (may be NULL), which keeps the file's lines for its next build
+ */
+bool assemble_file_cached(char *filename, const MacroLibrary *macro_lib,
+                          OutputFormat format, LineCache *cache);
+
+/* assemble_set_optimize -- run the -O pass (peephole.h) on every file
+ * assembled from now on, after its first pass */
+void assemble_set_optimize(bool is_on);
+
+#endif /* ASSEMBLE_H */
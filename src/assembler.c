@@ -4,135 +4,222 @@
  * https://github.com/oasido
  */
 
+#include "assemble.h"
 #include "assembler.h"
-#include "data_image.h"
-#include "first_pass.h"
+#include "build.h"
+#include "conditional.h"
 #include "helpers.h"
-#include "instruction_image.h"
+#include "linker.h"
 #include "preprocessor.h"
-#include "second_pass.h"
-#include "symbol_table.h"
+#include "trace.h"
+#include "watch.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+static int compile_macros(const char *lib_filename, const char *out_filename);
 
 /* main -- assembler's main function
  *
- * for each input file, runs preprocessing to expand macros,
- * then first pass to build symbol table and parse instructions,
- * then second pass to resolve symbols & generate output files
+ * handles the options first (they apply to every file), then for each input
+ * file runs preprocessing to expand macros, then first pass to build symbol
+ * table and parse instructions, then second pass to resolve symbols &
+ * generate output files
  */
 int main(int argc, char **argv) {
   int idx = 0;
-  Symbol *symtab = NULL;
-  int icf, dcf;
+  int file_count = 0;
+  char **filenames;
+  MacroLibrary *macro_lib = NULL;
+  const char *macro_lib_filename = NULL;
+  OutputFormat format = OUTPUT_TEXT;
+  const char *trace_filename = NULL;
+  bool is_watching = false;
+  bool ok = true;
+
+  /* tool mode: compile a macro library and exit */
+  if (argc > 1 && strcmp(argv[1], COMPILE_MACROS_OPTION) == 0) {
+    if (argc != 4) {
+      fprintf(stderr, "(ERROR) [assembler] usage: %s %s [file] [output]\n",
+              argv[0], COMPILE_MACROS_OPTION);
+      exit(EXIT_FAILURE);
+    }
+    return compile_macros(argv[2], argv[3]);
+  }
 
-  /* for first pass */
-  FILE *am_file;
+  /* tool mode: link assembled modules and exit */
+  if (argc > 1 && strcmp(argv[1], LINK_OPTION) == 0) {
+    if (argc < 4) {
+      fprintf(stderr, "(ERROR) [assembler] usage: %s %s [output] [module-1]...\n",
+              argv[0], LINK_OPTION);
+      exit(EXIT_FAILURE);
+    }
+    if (link_modules(argv[2], argv + 3, argc - 3) != 0) {
+      fprintf(stderr, "(ERROR) [assembler] linking failed\n");
+      return EXIT_FAILURE;
+    }
+    printf("Linked %d modules into %s.ob\n", argc - 3, argv[2]);
+    return EXIT_SUCCESS;
+  }
 
-  /* if no parameters were passed */
-  if (argc < 2) {
-    fprintf(stderr, "(ERROR) [assembler] usage: %s [filename-1]...\n", argv[0]);
-    exit(EXIT_FAILURE);
+  /* tool mode: reassemble and relink what changed since the last build */
+  if (argc > 1 && strcmp(argv[1], BUILD_OPTION) == 0) {
+    if (argc < 5) {
+      fprintf(stderr,
+              "(ERROR) [assembler] usage: %s %s [manifest] [output] "
+              "[module-1]...\n",
+              argv[0], BUILD_OPTION);
+      exit(EXIT_FAILURE);
+    }
+    if (build_modules(argv[2], argv[3], argv + 4, argc - 4) != 0) {
+      fprintf(stderr, "(ERROR) [assembler] build failed\n");
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
   }
 
-  /* iterate over each filename passed to us as arguements */
+  /* the files, in the order given */
+  filenames = safe_calloc((size_t)argc, sizeof(char *));
+  if (!filenames)
+    exit(EXIT_FAILURE);
+
+  /* options */
   for (idx = 1; idx < argc; ++idx) {
-    printf("=== PREPROCESSING STAGE ===\n");
-    printf("Input:  %s.as\n", argv[idx]);
-    printf("Output: %s.am\n", argv[idx]);
-    printf("Expanding macros...\n");
+    if (strcmp(argv[idx], MACRO_LIB_OPTION) == 0) {
+      if (idx + 1 >= argc) {
+        fprintf(stderr, "(ERROR) [assembler] %s requires a filename\n",
+                MACRO_LIB_OPTION);
+        exit(EXIT_FAILURE);
+      }
 
-    if (preprocess_file(argv[idx]) != 0) {
-      /* log error & skip file */
-      fprintf(stderr,
-              "(ERROR) [assembler] failed the preprocessing stage for '%s'\n",
-              argv[idx]);
+      /* loaded after the options, so every -D applies to it */
+      macro_lib_filename = argv[++idx];
       continue;
     }
-    printf("Preprocessing completed successfully!\n");
 
-    am_file = open_file_with_ext(argv[idx], ".am", "r");
-    if (!am_file) {
-      fprintf(stderr, "(ERROR) [assembler] failed to open '%s.am'\n",
-              argv[idx]);
+    if (strncmp(argv[idx], DEFINE_OPTION, strlen(DEFINE_OPTION)) == 0) {
+      /* -DNAME or -D NAME */
+      const char *definition = argv[idx] + strlen(DEFINE_OPTION);
+
+      if (*definition == '\0') {
+        if (idx + 1 >= argc) {
+          fprintf(stderr, "(ERROR) [assembler] %s requires NAME[=value]\n",
+                  DEFINE_OPTION);
+          exit(EXIT_FAILURE);
+        }
+        definition = argv[++idx];
+      }
 
-      /* skip on error */
+      if (!cond_define(definition)) {
+        cond_forget_defines();
+        exit(EXIT_FAILURE);
+      }
       continue;
     }
 
-    /* first pass */
-    printf("\n=== FIRST PASS - SYMBOL TABLE CONSTRUCTION ===\n");
-    printf("Processing: %s.am\n", argv[idx]);
-    printf("Building symbol table and analyzing instructions...\n");
-    if (first_pass(am_file, &symtab, &icf, &dcf)) {
-      fprintf(stderr, "(ERROR) [assembler] first_pass failed for '%s.am'\n",
-              argv[idx]);
-      fclose(am_file);
-      free_directives();
+    if (strcmp(argv[idx], WATCH_OPTION) == 0) {
+      is_watching = true;
       continue;
     }
-    printf("First pass completed! IC=%d, DC=%d\n", icf, dcf);
 
-    /* check memory overflow */
-    if (icf + dcf > MAX_WORDS_MEMORY) {
-      fprintf(stderr,
-              "(ERROR) [assembler] memory overflow: program requires %d words "
-              "but maximum is %d words\n",
-              icf + dcf, MAX_WORDS_MEMORY);
-      fclose(am_file);
-      free_directives();
+    if (strcmp(argv[idx], OPTIMIZE_OPTION) == 0) {
+      assemble_set_optimize(true);
       continue;
     }
 
-    /* close am_file, we're done reading it */
-    fclose(am_file);
-
-    /* second_pass */
-    printf("\n=== SECOND PASS - CODE GENERATION ===\n");
-    printf("Processing: %s.am\n", argv[idx]);
-    printf("Resolving symbols and generating output files...\n");
-    if (second_pass(symtab, icf, argv[idx]) != 0) {
-      char ob_file[MAX_FILENAME_LENGTH];
-      char ent_file[MAX_FILENAME_LENGTH];
-      char ext_file[MAX_FILENAME_LENGTH];
-
-      fprintf(stderr, "(ERROR) [assembler] second_pass failed for '%s'\n",
-              argv[idx]);
-
-      /* remove any partially generated output files on error */
-      sprintf(ob_file, "%s.ob", argv[idx]);
-      sprintf(ent_file, "%s.ent", argv[idx]);
-      sprintf(ext_file, "%s.ext", argv[idx]);
-      remove(ob_file);
-      remove(ent_file);
-      remove(ext_file);
-    } else {
-      FILE *check_file;
-      printf("Second pass completed successfully!\n");
-      printf("Generated files:\n");
-      printf("  - %s.ob (object file)\n", argv[idx]);
-
-      /* check if .ent file was generated */
-      check_file = open_file_with_ext(argv[idx], ".ent", "r");
-      if (check_file) {
-        printf("  - %s.ent (entry symbols)\n", argv[idx]);
-        fclose(check_file);
+    if (strncmp(argv[idx], FORMAT_OPTION, strlen(FORMAT_OPTION)) == 0) {
+      const char *value = argv[idx] + strlen(FORMAT_OPTION);
+
+      if (strcmp(value, FORMAT_TEXT) == 0) {
+        format = OUTPUT_TEXT;
+      } else if (strcmp(value, FORMAT_BINARY) == 0) {
+        format = OUTPUT_BINARY;
+      } else {
+        fprintf(stderr,
+                "(ERROR) [assembler] unknown output format '%s' (expected "
+                "%s or %s)\n",
+                value, FORMAT_TEXT, FORMAT_BINARY);
+        cond_forget_defines();
+        exit(EXIT_FAILURE);
       }
+      continue;
+    }
 
-      /* check if .ext file was generated */
-      check_file = open_file_with_ext(argv[idx], ".ext", "r");
-      if (check_file) {
-        printf("  - %s.ext (external references)\n", argv[idx]);
-        fclose(check_file);
+    if (strncmp(argv[idx], TRACE_OPTION, strlen(TRACE_OPTION)) == 0) {
+      trace_filename = argv[idx] + strlen(TRACE_OPTION);
+      if (*trace_filename == '\0') {
+        fprintf(stderr, "(ERROR) [assembler] %s requires a filename\n",
+                TRACE_OPTION);
+        cond_forget_defines();
+        exit(EXIT_FAILURE);
       }
+      continue;
+    }
+
+    filenames[file_count++] = argv[idx];
+  }
 
-      printf("Assembly complete for %s!\n\n", argv[idx]);
+  /* if no files were passed */
+  if (file_count == 0) {
+    fprintf(stderr,
+            "(ERROR) [assembler] usage: %s [%s file] [%sNAME[=value]] "
+            "[%s] [%s%s|%s] [%sfile] [%s] [filename-1]...\n",
+            argv[0], MACRO_LIB_OPTION, DEFINE_OPTION, OPTIMIZE_OPTION,
+            FORMAT_OPTION, FORMAT_TEXT, FORMAT_BINARY, TRACE_OPTION,
+            WATCH_OPTION);
+    cond_forget_defines();
+    exit(EXIT_FAILURE);
+  }
+
+  /* parsed once, shared (read-only) by every file */
+  if (macro_lib_filename) {
+    macro_lib = macro_library_load(macro_lib_filename);
+    if (!macro_lib) {
+      cond_forget_defines();
+      exit(EXIT_FAILURE);
     }
+  }
 
-    /* cleanup directives and commands */
-    free_directives();
-    free_commands();
-  } /* end loop */
+  if (trace_filename)
+    trace_start();
+
+  if (is_watching) {
+    /* builds every file, then keeps rebuilding until interrupted */
+    ok = watch_files(filenames, file_count, macro_lib_filename, &macro_lib,
+                     format);
+  } else {
+    /* iterate over each filename passed to us as arguements */
+    for (idx = 0; idx < file_count; ++idx)
+      assemble_file(filenames[idx], macro_lib, format);
+  }
+
+  macro_library_free(macro_lib);
+  preprocess_forget_includes();
+  cond_forget_defines();
+  free(filenames);
+
+  /* the spans of every file, written once at exit */
+  if (trace_filename && !trace_write(trace_filename, "assembler"))
+    return EXIT_FAILURE;
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* compile_macros -- parse a text macro library and save its image, so later
+ * runs can map it with --macro-lib instead of parsing it again */
+static int compile_macros(const char *lib_filename, const char *out_filename) {
+  MacroLibrary *macro_lib = macro_library_load(lib_filename);
+  bool ok;
+
+  if (!macro_lib)
+    return EXIT_FAILURE;
+
+  ok = macro_library_save(macro_lib, out_filename);
+  if (ok) {
+    printf("Compiled macro library: %s -> %s (%lu bytes)\n", lib_filename,
+           out_filename, (unsigned long)macro_lib->image_size);
+  }
 
-  return EXIT_SUCCESS;
+  macro_library_free(macro_lib);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -11,9 +11,28 @@
 #define MAX_SYMBOL_LENGTH 31
 #define MAX_LINE_LENGTH 81
 #define MAX_FILENAME_LENGTH 100
+/* the machine has 256 words, the benchmark build raises it (-D) to assemble
+ * longer sources */
+#ifndef MAX_WORDS_MEMORY
 #define MAX_WORDS_MEMORY 256
+#endif
 #define WORD_SIZE 10
 
+/* command line options */
+#define MACRO_LIB_OPTION "--macro-lib" /* --macro-lib <file> */
+#define COMPILE_MACROS_OPTION                                                  \
+  "--compile-macros" /* --compile-macros <file> <out>, then exit */
+#define LINK_OPTION "--link" /* --link <out> <module>..., then exit */
+#define BUILD_OPTION                                                           \
+  "--build" /* --build <manifest> <out> <module>..., then exit */
+#define FORMAT_OPTION "--format=" /* --format=text (.ob) or bin (.obj) */
+#define FORMAT_TEXT "text"
+#define FORMAT_BINARY "bin"
+#define TRACE_OPTION "--trace=" /* --trace=<file>, see trace.h */
+#define WATCH_OPTION "--watch" /* rebuild on change until ^C, see watch.h */
+#define DEFINE_OPTION "-D" /* -D NAME[=value], see conditional.h */
+#define OPTIMIZE_OPTION "-O" /* peephole pass, see peephole.h */
+
 /* we use two's-complement with 10 bits (1 word), so:
  * min = -2^(n-1)=-512,  max = 2^(n-1) - 1=511 */
 #define MIN_WORD_VAL (-512)
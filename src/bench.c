@@ -0,0 +1,398 @@
+#include "assembler.h"
+#include "bench_corpus.h"
+#include "data_image.h"
+#include "first_pass.h"
+#include "helpers.h"
+#include "instruction_image.h"
+#include "line_cache.h"
+#include "preprocessor.h"
+#include "second_pass.h"
+#include "symbol_table.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* bench -- times the assembler on synthetic sources (make bench)
+ *
+ *   benchmark [-n size] [-s steps] [-i] [-k] [workload]...
+ *
+ * every workload (all of them by default, see bench_corpus.h) is generated
+ * at size, then doubled steps - 1 times, and each source is run through
+ * preprocess_file, first_pass and second_pass in this process, each stage
+ * timed on its own. a row per run gives the stage times and lines/s and
+ * words/s over all three.
+ *
+ * the work grows linearly with the size, so each doubling should about
+ * double a stage's time. a stage that grows more than BENCH_GROWTH_LIMIT
+ * times (quadratic is 4x) is reported and the benchmark exits with failure,
+ * times under BENCH_NOISE_SECONDS are too short to tell. the generated files
+ * are removed afterwards unless -k
+ *
+ * with -i every run also goes through a line cache (line_cache.h), then one
+ * line is inserted at the top of the source, moving every address after it,
+ * and the edited source is assembled again with the cache the run filled.
+ * that "warm" row is the edit-assemble loop's latency */
+
+#define SIZE_OPTION "-n"
+#define STEPS_OPTION "-s"
+#define KEEP_OPTION "-k"
+#define INCREMENTAL_OPTION "-i"
+#define EDIT_LINE "inc r0\n" /* what -i inserts */
+#define DEFAULT_SIZE 2000
+#define DEFAULT_STEPS 4
+#define BENCH_GROWTH_LIMIT 3.0
+#define BENCH_NOISE_SECONDS 0.05
+
+/* stages timed for each run */
+typedef enum {
+  STAGE_PREPROCESS,
+  STAGE_FIRST_PASS,
+  STAGE_SECOND_PASS,
+  STAGE_COUNT
+} BenchStage;
+
+/* bench_run -- what one source took */
+typedef struct BenchRun {
+  int lines; /* of the .as */
+  int words; /* of the image */
+  double seconds[STAGE_COUNT];
+} BenchRun;
+
+static const char *stage_names[STAGE_COUNT] = {"preprocess", "first_pass",
+                                               "second_pass"};
+
+static bool bench_workload(BenchWorkload workload, int size, int steps,
+                           bool is_kept, bool is_incremental, int *flagged);
+static bool run_stages(char *base, LineCache *cache, BenchRun *run);
+static bool run_warm(BenchWorkload workload, int n, char *base,
+                     LineCache *cache, const BenchRun *cold);
+static bool edit_source(const char *filename);
+static void print_run(BenchWorkload workload, int n, const BenchRun *run);
+static int check_growth(BenchWorkload workload, int n, const BenchRun *prev,
+                        const BenchRun *run);
+static void remove_outputs(const char *base);
+static double seconds_since(clock_t start);
+
+int main(int argc, char **argv) {
+  bool selected[BENCH_WORKLOAD_COUNT];
+  bool any_selected = false;
+  bool is_kept = false;
+  bool is_incremental = false;
+  int size = DEFAULT_SIZE;
+  int steps = DEFAULT_STEPS;
+  int flagged = 0;
+  int failed = 0;
+  int idx, workload;
+
+  memset(selected, 0, sizeof(selected));
+
+  /* options */
+  for (idx = 1; idx < argc; idx++) {
+    if (strcmp(argv[idx], SIZE_OPTION) == 0) {
+      if (idx + 1 >= argc ||
+          parse_number(argv[++idx], 1, INT_MAX, &size) != NUM_OK) {
+        fprintf(stderr, "(ERROR) [bench] %s expects a size\n", SIZE_OPTION);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[idx], STEPS_OPTION) == 0) {
+      if (idx + 1 >= argc ||
+          parse_number(argv[++idx], 1, 16, &steps) != NUM_OK) {
+        fprintf(stderr, "(ERROR) [bench] %s expects 1-16 steps\n",
+                STEPS_OPTION);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[idx], KEEP_OPTION) == 0) {
+      is_kept = true;
+    } else if (strcmp(argv[idx], INCREMENTAL_OPTION) == 0) {
+      is_incremental = true;
+    } else {
+      for (workload = 0; workload < BENCH_WORKLOAD_COUNT; workload++) {
+        if (strcmp(argv[idx], bench_workload_name(workload)) == 0)
+          break;
+      }
+
+      if (workload == BENCH_WORKLOAD_COUNT) {
+        fprintf(stderr,
+                "(ERROR) [bench] usage: %s [%s size] [%s steps] [%s] [%s] "
+                "[workload]...\n",
+                argv[0], SIZE_OPTION, STEPS_OPTION, INCREMENTAL_OPTION,
+                KEEP_OPTION);
+        return EXIT_FAILURE;
+      }
+      selected[workload] = true;
+      any_selected = true;
+    }
+  }
+
+  printf("%-8s %7s %7s %7s %11s %11s %11s %10s %10s %7s\n", "workload", "n",
+         "lines", "words", stage_names[STAGE_PREPROCESS],
+         stage_names[STAGE_FIRST_PASS], stage_names[STAGE_SECOND_PASS],
+         "lines/s", "words/s", "growth");
+
+  for (workload = 0; workload < BENCH_WORKLOAD_COUNT; workload++) {
+    if (any_selected && !selected[workload])
+      continue;
+
+    if (!bench_workload(workload, size, steps, is_kept, is_incremental,
+                        &flagged))
+      failed++;
+  }
+
+  if (flagged)
+    fprintf(stderr,
+            "(ERROR) [bench] %d stage(s) grew superlinearly, see above\n",
+            flagged);
+
+  return failed || flagged ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* bench_workload -- generate and run workload at size, doubled steps - 1
+ * times, adding the stages that grew too fast to flagged, and run each
+ * again warm after an edit if is_incremental
+ *
+ * returns true on success, false if a run failed (error printed) */
+static bool bench_workload(BenchWorkload workload, int size, int steps,
+                           bool is_kept, bool is_incremental, int *flagged) {
+  BenchRun prev, run;
+  char base[MAX_FILENAME_LENGTH];
+  char filename[MAX_FILENAME_LENGTH + EXT_LENGTH];
+  int step;
+
+  for (step = 0; step < steps; step++) {
+    LineCache *cache = NULL;
+    int n = size << step;
+    bool ok;
+
+    sprintf(base, "bench_%s_%d", bench_workload_name(workload), n);
+    sprintf(filename, "%s.as", base);
+
+    if (!bench_corpus_write(workload, n, filename, &run.lines))
+      return false;
+
+    if (is_incremental) {
+      cache = line_cache_new();
+      if (!cache)
+        return false;
+    }
+
+    ok = run_stages(base, cache, &run);
+    if (ok) {
+      print_run(workload, n, &run);
+
+      if (step == 0) {
+        printf(" %7s\n", "-");
+      } else {
+        double prev_total = prev.seconds[STAGE_PREPROCESS] +
+                            prev.seconds[STAGE_FIRST_PASS] +
+                            prev.seconds[STAGE_SECOND_PASS];
+        double total = run.seconds[STAGE_PREPROCESS] +
+                       run.seconds[STAGE_FIRST_PASS] +
+                       run.seconds[STAGE_SECOND_PASS];
+
+        if (prev_total > 0)
+          printf(" %6.2fx\n", total / prev_total);
+        else
+          printf(" %7s\n", "-");
+        *flagged += check_growth(workload, n, &prev, &run);
+      }
+    } else {
+      fprintf(stderr, "(ERROR) [bench] '%s' failed to assemble\n", filename);
+    }
+
+    if (ok && cache)
+      ok = run_warm(workload, n, base, cache, &run);
+
+    line_cache_free(cache);
+    if (!is_kept) {
+      remove(filename);
+      remove_outputs(base);
+    }
+    if (!ok)
+      return false;
+
+    fflush(stdout);
+    prev = run;
+  }
+
+  return true;
+}
+
+/* run_warm -- insert EDIT_LINE into base.as (cold already ran it with cache)
+ * and assemble it again with the cache, printing the run
+ *
+ * returns true on success, false on error (error printed) */
+static bool run_warm(BenchWorkload workload, int n, char *base,
+                     LineCache *cache, const BenchRun *cold) {
+  char filename[MAX_FILENAME_LENGTH + EXT_LENGTH];
+  BenchRun warm;
+
+  sprintf(filename, "%s.as", base);
+  if (!edit_source(filename))
+    return false;
+
+  warm.lines = cold->lines + 1;
+  if (!run_stages(base, cache, &warm)) {
+    fprintf(stderr, "(ERROR) [bench] '%s' failed to assemble after an edit\n",
+            filename);
+    return false;
+  }
+
+  print_run(workload, n, &warm);
+  printf(" %7s\n", "warm");
+  printf("%-8s %7d   ^ %d of %d lines from the cache\n",
+         bench_workload_name(workload), n, cache->hits,
+         cache->hits + cache->misses);
+  return true;
+}
+
+/* edit_source -- put EDIT_LINE after the first line of filename (the
+ * comment bench_corpus_write starts with)
+ *
+ * returns true on success, false on error (error printed) */
+static bool edit_source(const char *filename) {
+  FILE *fp = fopen(filename, "r");
+  char *text, *rest;
+  size_t length;
+  bool ok;
+
+  if (!fp) {
+    fprintf(stderr, "(ERROR) [bench] failed to open '%s'\n", filename);
+    return false;
+  }
+  text = read_file_contents(fp, &length);
+  fclose(fp);
+  if (!text)
+    return false;
+
+  fp = fopen(filename, "w");
+  if (!fp) {
+    fprintf(stderr, "(ERROR) [bench] failed to create '%s'\n", filename);
+    free(text);
+    return false;
+  }
+
+  rest = strchr(text, '\n');
+  rest = rest ? rest + 1 : text + length;
+  fwrite(text, 1, (size_t)(rest - text), fp);
+  fputs(EDIT_LINE, fp);
+  fputs(rest, fp);
+  free(text);
+
+  ok = !ferror(fp);
+  if (fclose(fp) != 0)
+    ok = false;
+  if (!ok)
+    fprintf(stderr, "(ERROR) [bench] failed to write '%s'\n", filename);
+  return ok;
+}
+
+/* print_run -- a row of the table, up to the growth column */
+static void print_run(BenchWorkload workload, int n, const BenchRun *run) {
+  double total = run->seconds[STAGE_PREPROCESS] +
+                 run->seconds[STAGE_FIRST_PASS] +
+                 run->seconds[STAGE_SECOND_PASS];
+
+  if (total <= 0)
+    total = 1.0 / CLOCKS_PER_SEC; /* too fast for the clock */
+
+  printf("%-8s %7d %7d %7d %10.3fs %10.3fs %10.3fs %10.0f %10.0f",
+         bench_workload_name(workload), n, run->lines, run->words,
+         run->seconds[STAGE_PREPROCESS], run->seconds[STAGE_FIRST_PASS],
+         run->seconds[STAGE_SECOND_PASS], run->lines / total,
+         run->words / total);
+}
+
+/* run_stages -- preprocess, first pass (through cache, may be NULL) and
+ * second pass of base (.as written), timing each, like assemble_file does
+ * without its messages
+ *
+ * returns true on success, false on error (error printed) */
+static bool run_stages(char *base, LineCache *cache, BenchRun *run) {
+  Symbol *symtab = NULL;
+  FILE *am_file;
+  clock_t start;
+  int icf = 0, dcf = 0;
+  bool ok;
+
+  start = clock();
+  ok = preprocess_file(base, NULL, NULL) == 0;
+  run->seconds[STAGE_PREPROCESS] = seconds_since(start);
+  if (!ok)
+    return false;
+
+  am_file = open_file_with_ext(base, ".am", "r");
+  if (!am_file)
+    return false;
+
+  start = clock();
+  ok = first_pass_cached(am_file, cache, &symtab, &icf, &dcf) == 0;
+  run->seconds[STAGE_FIRST_PASS] = seconds_since(start);
+  fclose(am_file);
+
+  if (ok && icf + dcf > MAX_WORDS_MEMORY) {
+    fprintf(stderr,
+            "(ERROR) [bench] '%s' needs %d words, build with a larger "
+            "MAX_WORDS_MEMORY (now %d)\n",
+            base, icf + dcf, MAX_WORDS_MEMORY);
+    ok = false;
+  }
+
+  if (ok) {
+    start = clock();
+    ok = second_pass(symtab, icf, base, OUTPUT_TEXT) == 0;
+    run->seconds[STAGE_SECOND_PASS] = seconds_since(start);
+  }
+
+  run->words = icf - IC_INIT_VALUE + dcf;
+
+  free_directives();
+  free_commands();
+  free_symbol_table(symtab);
+  return ok;
+}
+
+/* check_growth -- compare each stage of run (size n) with prev (size n / 2),
+ * printing the ones that grew more than BENCH_GROWTH_LIMIT times
+ *
+ * returns the number of stages printed */
+static int check_growth(BenchWorkload workload, int n, const BenchRun *prev,
+                        const BenchRun *run) {
+  int flagged = 0;
+  int stage;
+
+  for (stage = 0; stage < STAGE_COUNT; stage++) {
+    double growth;
+
+    if (prev->seconds[stage] < BENCH_NOISE_SECONDS ||
+        run->seconds[stage] < BENCH_NOISE_SECONDS)
+      continue;
+
+    growth = run->seconds[stage] / prev->seconds[stage];
+    if (growth > BENCH_GROWTH_LIMIT) {
+      printf("%-8s %7d   ^ %s grew %.2fx when n doubled (superlinear)\n",
+             bench_workload_name(workload), n, stage_names[stage], growth);
+      flagged++;
+    }
+  }
+
+  return flagged;
+}
+
+/* remove_outputs -- delete what assembling base left behind */
+static void remove_outputs(const char *base) {
+  const char *exts[] = {".am", ".ob", ".ent", ".ext", NULL};
+  char filename[MAX_FILENAME_LENGTH + EXT_LENGTH];
+  int idx;
+
+  for (idx = 0; exts[idx] != NULL; idx++) {
+    sprintf(filename, "%s%s", base, exts[idx]);
+    remove(filename);
+  }
+}
+
+/* seconds_since -- processor time since start */
+static double seconds_since(clock_t start) {
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
@@ -0,0 +1,203 @@
+#include "bench_corpus.h"
+#include "assembler.h"
+#include <stdio.h>
+
+/* bench_corpus -- writes the benchmark's synthetic sources */
+
+#define REGISTER_COUNT 8
+#define LONG_LINES_PER_UNIT 4 /* the long workload is 4n lines */
+#define LONG_COMMENT_EVERY 16 /* a comment line every that many lines */
+#define ENTRY_EVERY 8         /* every 8th label is also an .entry */
+
+static const char *workload_names[BENCH_WORKLOAD_COUNT] = {
+    "labels", "macros", "tables", "externs", "long"};
+
+static int write_labels(FILE *fp, int n);
+static int write_macros(FILE *fp, int n);
+static int write_tables(FILE *fp, int n);
+static int write_externs(FILE *fp, int n);
+static int write_long(FILE *fp, int n);
+
+/* ======================================================================= */
+/* ===================== public api -- see header ======================== */
+/* ======================================================================= */
+
+const char *bench_workload_name(BenchWorkload workload) {
+  if ((int)workload < 0 || workload >= BENCH_WORKLOAD_COUNT)
+    return "?";
+  return workload_names[workload];
+}
+
+bool bench_corpus_write(BenchWorkload workload, int n, const char *filename,
+                        int *line_count) {
+  FILE *fp = fopen(filename, "w");
+  int lines = 0;
+  bool ok;
+
+  if (!fp) {
+    fprintf(stderr, "(ERROR) [bench_corpus] failed to create '%s'\n",
+            filename);
+    return false;
+  }
+
+  fprintf(fp, "; %s workload, n = %d (generated by make bench)\n",
+          bench_workload_name(workload), n);
+
+  switch (workload) {
+  case BENCH_LABELS:
+    lines = write_labels(fp, n);
+    break;
+  case BENCH_MACROS:
+    lines = write_macros(fp, n);
+    break;
+  case BENCH_TABLES:
+    lines = write_tables(fp, n);
+    break;
+  case BENCH_EXTERNS:
+    lines = write_externs(fp, n);
+    break;
+  default:
+    lines = write_long(fp, n);
+    break;
+  }
+
+  ok = !ferror(fp);
+  if (fclose(fp) != 0)
+    ok = false;
+
+  if (!ok) {
+    fprintf(stderr, "(ERROR) [bench_corpus] failed to write '%s'\n",
+            filename);
+    return false;
+  }
+
+  *line_count = lines + 1; /* the comment on top */
+  return true;
+}
+
+/* ======================================================================= */
+
+/* write_labels -- "L<i>: mov L<i/2>, r<k>", so every lookup goes to a
+ * label already in the table, every 8th label exported
+ *
+ * returns the lines written */
+static int write_labels(FILE *fp, int n) {
+  int lines = 0;
+  int idx;
+
+  for (idx = 0; idx < n; idx += ENTRY_EVERY) {
+    fprintf(fp, ".entry L%d\n", idx);
+    lines++;
+  }
+
+  for (idx = 0; idx < n; idx++) {
+    fprintf(fp, "L%d: mov L%d, r%d\n", idx, idx / 2, idx % REGISTER_COUNT);
+    lines++;
+  }
+
+  fprintf(fp, "stop\n");
+  return lines + 1;
+}
+
+/* write_macros -- n two-line macros, then a call of each
+ *
+ * returns the lines written */
+static int write_macros(FILE *fp, int n) {
+  int lines = 0;
+  int idx;
+
+  for (idx = 0; idx < n; idx++) {
+    fprintf(fp, "mcro m%d\n", idx);
+    fprintf(fp, "    add #%d, r%d\n", idx % MAX_IMMEDIATE_VAL,
+            idx % REGISTER_COUNT);
+    fprintf(fp, "    prn r%d\n", idx % REGISTER_COUNT);
+    fprintf(fp, "mcroend\n");
+    lines += 4;
+  }
+
+  for (idx = 0; idx < n; idx++) {
+    fprintf(fp, "m%d\n", idx);
+    lines++;
+  }
+
+  fprintf(fp, "stop\n");
+  return lines + 1;
+}
+
+/* write_tables -- a few instructions reading TABLE, then n lines of data,
+ * .data and .mat taking turns
+ *
+ * returns the lines written */
+static int write_tables(FILE *fp, int n) {
+  int idx, value;
+
+  fprintf(fp, "lea TABLE[r1][r2], r3\n");
+  fprintf(fp, "stop\n");
+
+  for (idx = 0; idx < n; idx++) {
+    fprintf(fp, "%s", idx == 0 ? "TABLE: " : "");
+    if (idx % 2 == 0)
+      fprintf(fp, ".data ");
+    else
+      fprintf(fp, ".mat [2][%d] ", BENCH_TABLE_VALUES / 2);
+
+    for (value = 0; value < BENCH_TABLE_VALUES; value++)
+      fprintf(fp, "%s%d", value ? ", " : "",
+              (idx * BENCH_TABLE_VALUES + value) % MAX_WORD_VAL);
+    fprintf(fp, "\n");
+  }
+
+  return n + 2;
+}
+
+/* write_externs -- n .extern symbols, then a jsr to each
+ *
+ * returns the lines written */
+static int write_externs(FILE *fp, int n) {
+  int idx;
+
+  for (idx = 0; idx < n; idx++)
+    fprintf(fp, ".extern X%d\n", idx);
+
+  for (idx = 0; idx < n; idx++)
+    fprintf(fp, "jsr X%d\n", idx);
+
+  fprintf(fp, "stop\n");
+  return 2 * n + 1;
+}
+
+/* write_long -- 4n lines of register and immediate instructions, with a
+ * comment now and then
+ *
+ * returns the lines written */
+static int write_long(FILE *fp, int n) {
+  int line_total = n * LONG_LINES_PER_UNIT;
+  int idx;
+
+  for (idx = 0; idx < line_total; idx++) {
+    int reg = idx % REGISTER_COUNT;
+
+    if (idx % LONG_COMMENT_EVERY == 0) {
+      fprintf(fp, "; block %d\n", idx / LONG_COMMENT_EVERY);
+      continue;
+    }
+
+    switch (idx % 4) {
+    case 0:
+      fprintf(fp, "mov r%d, r%d\n", reg, (reg + 1) % REGISTER_COUNT);
+      break;
+    case 1:
+      fprintf(fp, "add #%d, r%d\n", idx % MAX_IMMEDIATE_VAL, reg);
+      break;
+    case 2:
+      fprintf(fp, "inc r%d\n", reg);
+      break;
+    default:
+      fprintf(fp, "prn #-%d\n", idx % MAX_IMMEDIATE_VAL);
+      break;
+    }
+  }
+
+  fprintf(fp, "stop\n");
+  return line_total + 1;
+}
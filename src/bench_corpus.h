@@ -0,0 +1,45 @@
+#ifndef BENCH_CORPUS_H
+#define BENCH_CORPUS_H
+
+#include "types.h"
+
+/* bench_corpus.h -- synthetic sources for the benchmark (make bench)
+ *
+ * every workload is written for a size n (the number of units it repeats)
+ * and grows linearly with it, so the assembler's time should too: doubling n
+ * and seeing the time go up 4x is a quadratic path. each one leans on a
+ * different part of the assembler:
+ *
+ *   labels  - n labeled instructions, each referring to an earlier label
+ *             (symbol table inserts and lookups)
+ *   macros  - n macros defined, then each called (macro table)
+ *   tables  - n .data/.mat lines of BENCH_TABLE_VALUES values (data image)
+ *   externs - n .extern symbols, each used by a jsr (extern references)
+ *   long    - 4n plain instructions, no labels or macros (line throughput)
+ *
+ * the sources only assemble as a whole with MAX_WORDS_MEMORY raised past the
+ * machine's 256 words (the bench build does) */
+
+#define BENCH_TABLE_VALUES 8 /* values in one .data/.mat line */
+
+typedef enum {
+  BENCH_LABELS,
+  BENCH_MACROS,
+  BENCH_TABLES,
+  BENCH_EXTERNS,
+  BENCH_LONG,
+  BENCH_WORKLOAD_COUNT
+} BenchWorkload;
+
+/* bench_workload_name -- the workload's name, as listed above */
+const char *bench_workload_name(BenchWorkload workload);
+
+/* bench_corpus_write -- write the source of workload for size n to filename
+ * (the full filename, extension included), its line count to line_count
+ *
+ * returns true on success, false on error (error printed)
+ */
+bool bench_corpus_write(BenchWorkload workload, int n, const char *filename,
+                        int *line_count);
+
+#endif /* BENCH_CORPUS_H */
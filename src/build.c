@@ -0,0 +1,521 @@
+#include "build.h"
+#include "assemble.h"
+#include "assembler.h"
+#include "helpers.h"
+#include "linker.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* build -- incremental multi-module builds, see header */
+
+#define BUILD_LINE_LENGTH (2 * MAX_FILENAME_LENGTH) /* a manifest line */
+#define NO_OUTPUT "-"
+
+/* build_module -- a module of this build, with its manifest records */
+typedef struct BuildModule {
+  char *name;
+  unsigned long hash;       /* of its .as now */
+  unsigned long last_hash;  /* in the manifest */
+  int last_position;        /* in the manifest, -1 if it's not there */
+  bool is_assembled;        /* reassembled by this build */
+  bool is_failed;           /* couldn't be assembled */
+  LinkSymbol *last_exports; /* in the manifest */
+  LinkSymbol *exports;      /* now */
+  LinkSymbol *imports;      /* now, one per symbol */
+} BuildModule;
+
+/* export_index -- every module's exports by name, open addressing */
+typedef struct ExportIndex {
+  LinkSymbol **slots;
+  size_t slot_count; /* power of 2, at least twice the exports */
+} ExportIndex;
+
+static bool load_manifest(const char *manifest, BuildModule *modules,
+                          int module_count, char *last_output,
+                          int *last_count);
+static int find_module(BuildModule *modules, int module_count,
+                       const char *name, int hint);
+static bool hash_source(BuildModule *module);
+static bool has_object(const char *name);
+static bool assemble_module(BuildModule *module, int module_idx);
+static void remove_duplicates(LinkSymbol *list);
+static void collect_changes(const BuildModule *module, LinkSymbol **changed);
+static LinkSymbol *find_in_list(LinkSymbol *list, const char *name);
+static bool push_symbol(LinkSymbol **list, const char *name, int address,
+                        int module_idx);
+static int index_exports(ExportIndex *index, BuildModule *modules,
+                         int module_count);
+static LinkSymbol **find_slot(const ExportIndex *index, const char *name);
+static int check_imports(const BuildModule *module, const ExportIndex *index);
+static bool write_manifest(const char *manifest, const char *output,
+                           const BuildModule *modules, int module_count);
+
+/* ======================================================================= */
+/* ===================== public api -- see header ======================== */
+/* ======================================================================= */
+
+int build_modules(const char *manifest, const char *output,
+                  char **module_names, int module_count) {
+  BuildModule *modules;
+  ExportIndex index = {NULL, 0};
+  LinkSymbol *changed = NULL; /* exports added, removed or moved */
+  char last_output[MAX_FILENAME_LENGTH];
+  int last_count = 0;
+  int assembled = 0, rechecked = 0;
+  int error_count = 0;
+  bool is_linked = false;
+  bool needs_link;
+  int idx;
+
+  modules = safe_calloc((size_t)module_count, sizeof(BuildModule));
+  if (!modules)
+    return 1;
+
+  for (idx = 0; idx < module_count; idx++) {
+    modules[idx].name = module_names[idx];
+    modules[idx].last_position = -1;
+  }
+
+  /* no manifest (or a bad one) leaves every module unknown */
+  if (!load_manifest(manifest, modules, module_count, last_output,
+                     &last_count)) {
+    for (idx = 0; idx < module_count; idx++)
+      modules[idx].last_position = -1;
+    strcpy(last_output, NO_OUTPUT);
+  }
+
+  /* reassemble what changed, the rest keeps its records */
+  for (idx = 0; idx < module_count; idx++) {
+    BuildModule *module = &modules[idx];
+
+    if (!hash_source(module)) {
+      module->is_failed = true;
+      error_count++;
+      continue;
+    }
+
+    if (module->last_position >= 0 && module->hash == module->last_hash &&
+        has_object(module->name)) {
+      module->exports = module->last_exports;
+      module->last_exports = NULL;
+      continue;
+    }
+
+    if (!assemble_module(module, idx)) {
+      module->is_failed = true;
+      error_count++;
+      continue;
+    }
+
+    module->is_assembled = true;
+    assembled++;
+    collect_changes(module, &changed);
+  }
+
+  /* check the modules that were reassembled or import a changed entry */
+  if (!error_count)
+    error_count += index_exports(&index, modules, module_count);
+
+  for (idx = 0; idx < module_count && !error_count; idx++) {
+    BuildModule *module = &modules[idx];
+    LinkSymbol *import;
+    bool is_dependent = false;
+
+    for (import = module->imports; import && !is_dependent;
+         import = import->next)
+      is_dependent = find_in_list(changed, import->name) != NULL;
+
+    if (!module->is_assembled && !is_dependent)
+      continue;
+
+    error_count += check_imports(module, &index);
+    if (!module->is_assembled) {
+      printf("Rechecked %s (an entry it imports changed)\n", module->name);
+      rechecked++;
+    }
+  }
+
+  /* link again if anything it reads changed */
+  needs_link = assembled > 0 || strcmp(last_output, output) != 0 ||
+               last_count != module_count || !has_object(output);
+  for (idx = 0; idx < module_count; idx++) {
+    if (modules[idx].last_position != idx)
+      needs_link = true;
+  }
+
+  if (!error_count && needs_link) {
+    int link_errors = link_modules(output, module_names, module_count);
+
+    error_count += link_errors;
+    is_linked = link_errors == 0;
+    if (is_linked)
+      printf("Linked %d modules into %s.ob\n", module_count, output);
+  } else if (!error_count) {
+    printf("%s.ob is up to date\n", output);
+    is_linked = true;
+  }
+
+  printf("Build: %d of %d module(s) reassembled, %d rechecked, %d error(s)\n",
+         assembled, module_count, rechecked, error_count);
+
+  if (!write_manifest(manifest, is_linked ? output : NO_OUTPUT, modules,
+                      module_count))
+    error_count++;
+
+  free(index.slots);
+  link_free_symbols(changed);
+  for (idx = 0; idx < module_count; idx++) {
+    link_free_symbols(modules[idx].last_exports);
+    link_free_symbols(modules[idx].exports);
+    link_free_symbols(modules[idx].imports);
+  }
+  free(modules);
+  return error_count;
+}
+
+/* ======================================================================= */
+/* ========================== static helpers ============================== */
+/* ======================================================================= */
+
+/* load_manifest -- read the records of the last build into modules (those
+ * of modules not in this build are skipped), the output it linked and how
+ * many modules it had. a missing manifest is a first build
+ *
+ * returns true if there was a manifest, false if not or it's bad (error
+ * printed) */
+static bool load_manifest(const char *manifest, BuildModule *modules,
+                          int module_count, char *last_output,
+                          int *last_count) {
+  char line[BUILD_LINE_LENGTH];
+  FILE *fp = fopen(manifest, "r");
+  int current = -1; /* module of the last module record */
+  int line_number = 0;
+
+  strcpy(last_output, NO_OUTPUT);
+  *last_count = 0;
+  if (!fp)
+    return false;
+
+  while (fgets(line, sizeof(line), fp)) {
+    char keyword[BUILD_LINE_LENGTH];
+    char name[BUILD_LINE_LENGTH];
+    char symbol[BUILD_LINE_LENGTH];
+    unsigned long hash;
+    int address;
+    int idx;
+    bool ok = true;
+
+    line_number++;
+    if (sscanf(line, "%s", keyword) != 1)
+      continue; /* blank */
+
+    if (strcmp(keyword, "output") == 0) {
+      ok = sscanf(line, "%*s %s", name) == 1 &&
+           strlen(name) < MAX_FILENAME_LENGTH;
+      if (ok)
+        strcpy(last_output, name);
+    } else if (strcmp(keyword, "module") == 0) {
+      ok = sscanf(line, "%*s %s %lx", name, &hash) == 2;
+      current = ok ? find_module(modules, module_count, name, current) : -1;
+      if (current >= 0) {
+        modules[current].last_hash = hash;
+        modules[current].last_position = *last_count;
+      }
+      (*last_count)++;
+    } else if (strcmp(keyword, "export") == 0) {
+      ok = sscanf(line, "%*s %s %s %d", name, symbol, &address) == 3 &&
+           strlen(symbol) < MAX_SYMBOL_LENGTH;
+      idx = ok ? find_module(modules, module_count, name, current) : -1;
+      if (idx >= 0)
+        ok = push_symbol(&modules[idx].last_exports, symbol, address, idx);
+    } else if (strcmp(keyword, "import") == 0) {
+      ok = sscanf(line, "%*s %s %s", name, symbol) == 2 &&
+           strlen(symbol) < MAX_SYMBOL_LENGTH;
+      idx = ok ? find_module(modules, module_count, name, current) : -1;
+      if (idx >= 0)
+        ok = push_symbol(&modules[idx].imports, symbol, 0, idx);
+    } else {
+      ok = false;
+    }
+
+    if (!ok) {
+      fprintf(stderr,
+              "(ERROR) [build] bad record in '%s' at line %d, building "
+              "everything\n",
+              manifest, line_number);
+      fclose(fp);
+      return false;
+    }
+  }
+
+  fclose(fp);
+  return true;
+}
+
+/* find_module -- index of the module named name, trying hint first (records
+ * come grouped by module)
+ *
+ * returns the index or -1 if it's not in this build */
+static int find_module(BuildModule *modules, int module_count,
+                       const char *name, int hint) {
+  int idx;
+
+  if (hint >= 0 && strcmp(modules[hint].name, name) == 0)
+    return hint;
+
+  for (idx = 0; idx < module_count; idx++) {
+    if (strcmp(modules[idx].name, name) == 0)
+      return idx;
+  }
+
+  return -1;
+}
+
+/* hash_source -- hash <module>.as into module->hash
+ *
+ * returns true on success, false on error (error printed) */
+static bool hash_source(BuildModule *module) {
+  FILE *fp = open_file_with_ext(module->name, ".as", "r");
+  size_t length;
+  char *text;
+
+  if (!fp) {
+    fprintf(stderr, "(ERROR) [build] cannot open '%s.as'\n", module->name);
+    return false;
+  }
+
+  text = read_file_contents(fp, &length);
+  fclose(fp);
+  if (!text)
+    return false;
+
+  module->hash = hash_string(text) ^ (unsigned long)length;
+  free(text);
+  return true;
+}
+
+/* has_object -- true if <name>.ob exists (asked quietly) */
+static bool has_object(const char *name) {
+  char filename[MAX_FILENAME_LENGTH + EXT_LENGTH];
+  FILE *fp;
+
+  sprintf(filename, "%.*s.ob", MAX_FILENAME_LENGTH, name);
+  fp = fopen(filename, "r");
+  if (!fp)
+    return false;
+
+  fclose(fp);
+  return true;
+}
+
+/* assemble_module -- assemble the module (its old .ent/.ext removed first,
+ * a file without entries or externals doesn't rewrite them) and load the
+ * exports and imports it now has
+ *
+ * returns true on success, false on error (error printed) */
+static bool assemble_module(BuildModule *module, int module_idx) {
+  char filename[MAX_FILENAME_LENGTH + EXT_LENGTH];
+
+  link_free_symbols(module->imports);
+  module->imports = NULL;
+
+  sprintf(filename, "%.*s.ent", MAX_FILENAME_LENGTH, module->name);
+  remove(filename);
+  sprintf(filename, "%.*s.ext", MAX_FILENAME_LENGTH, module->name);
+  remove(filename);
+
+  if (!assemble_file(module->name, NULL, OUTPUT_TEXT)) {
+    fprintf(stderr, "(ERROR) [build] failed to assemble '%s'\n",
+            module->name);
+    return false;
+  }
+
+  if (!link_load_symbols(module->name, module_idx, ".ent",
+                         &module->exports) ||
+      !link_load_symbols(module->name, module_idx, ".ext", &module->imports))
+    return false;
+
+  /* .ext has a row per reference, we want each symbol once */
+  remove_duplicates(module->imports);
+  return true;
+}
+
+/* remove_duplicates -- drop the later nodes of list with a name already
+ * seen (a module's imports, a few at most) */
+static void remove_duplicates(LinkSymbol *list) {
+  LinkSymbol *sym;
+
+  for (sym = list; sym; sym = sym->next) {
+    LinkSymbol **link = &sym->next;
+
+    while (*link) {
+      if (strcmp((*link)->name, sym->name) == 0) {
+        LinkSymbol *duplicate = *link;
+
+        *link = duplicate->next;
+        free(duplicate);
+      } else {
+        link = &(*link)->next;
+      }
+    }
+  }
+}
+
+/* collect_changes -- add to changed the entries of a reassembled module
+ * that are new, gone or at another address than in the manifest */
+static void collect_changes(const BuildModule *module, LinkSymbol **changed) {
+  LinkSymbol *sym;
+
+  for (sym = module->exports; sym; sym = sym->next) {
+    LinkSymbol *last = find_in_list(module->last_exports, sym->name);
+
+    if (module->last_position < 0 || !last || last->address != sym->address)
+      push_symbol(changed, sym->name, sym->address, sym->module);
+  }
+
+  for (sym = module->last_exports; sym; sym = sym->next) {
+    if (!find_in_list(module->exports, sym->name))
+      push_symbol(changed, sym->name, sym->address, sym->module);
+  }
+}
+
+/* find_in_list -- the node of list named name, or NULL */
+static LinkSymbol *find_in_list(LinkSymbol *list, const char *name) {
+  for (; list; list = list->next) {
+    if (strcmp(list->name, name) == 0)
+      return list;
+  }
+
+  return NULL;
+}
+
+/* push_symbol -- add a symbol to the front of list
+ *
+ * returns true on success, false if out of memory */
+static bool push_symbol(LinkSymbol **list, const char *name, int address,
+                        int module_idx) {
+  LinkSymbol *sym = safe_calloc(1, sizeof(LinkSymbol));
+
+  if (!sym)
+    return false;
+
+  strcpy(sym->name, name);
+  sym->address = address;
+  sym->module = module_idx;
+  sym->next = *list;
+  *list = sym;
+  return true;
+}
+
+/* index_exports -- put every module's exports in index, an entry exported
+ * by two modules is an error (like the linker reports it)
+ *
+ * returns the number of errors */
+static int index_exports(ExportIndex *index, BuildModule *modules,
+                         int module_count) {
+  size_t export_count = 0;
+  int error_count = 0;
+  LinkSymbol *sym;
+  int idx;
+
+  for (idx = 0; idx < module_count; idx++) {
+    for (sym = modules[idx].exports; sym; sym = sym->next)
+      export_count++;
+  }
+
+  index->slot_count = 64;
+  while (index->slot_count < export_count * 2)
+    index->slot_count *= 2;
+
+  index->slots = safe_calloc(index->slot_count, sizeof(LinkSymbol *));
+  if (!index->slots)
+    return 1;
+
+  for (idx = 0; idx < module_count; idx++) {
+    for (sym = modules[idx].exports; sym; sym = sym->next) {
+      LinkSymbol **slot = find_slot(index, sym->name);
+
+      if (*slot) {
+        fprintf(stderr,
+                "(ERROR) [build] entry '%s' is exported by both '%s' and "
+                "'%s'\n",
+                sym->name, modules[(*slot)->module].name, modules[idx].name);
+        error_count++;
+        continue;
+      }
+      *slot = sym;
+    }
+  }
+
+  return error_count;
+}
+
+/* find_slot -- the slot holding name's export, or the empty one it would
+ * go in */
+static LinkSymbol **find_slot(const ExportIndex *index, const char *name) {
+  size_t slot = hash_string(name) & (index->slot_count - 1);
+
+  while (index->slots[slot] && strcmp(index->slots[slot]->name, name) != 0)
+    slot = (slot + 1) & (index->slot_count - 1);
+
+  return &index->slots[slot];
+}
+
+/* check_imports -- every import of module must be some module's export
+ *
+ * returns the number of errors */
+static int check_imports(const BuildModule *module, const ExportIndex *index) {
+  LinkSymbol *import;
+  int error_count = 0;
+
+  for (import = module->imports; import; import = import->next) {
+    if (!*find_slot(index, import->name)) {
+      fprintf(stderr,
+              "(ERROR) [build] undefined external symbol '%s' in '%s'\n",
+              import->name, module->name);
+      error_count++;
+    }
+  }
+
+  return error_count;
+}
+
+/* write_manifest -- record this build for the next one, modules that
+ * failed are left out so they're assembled again
+ *
+ * returns true on success, false on error (error printed) */
+static bool write_manifest(const char *manifest, const char *output,
+                           const BuildModule *modules, int module_count) {
+  FILE *fp = fopen(manifest, "w");
+  LinkSymbol *sym;
+  bool ok;
+  int idx;
+
+  if (!fp) {
+    fprintf(stderr, "(ERROR) [build] failed to create '%s'\n", manifest);
+    return false;
+  }
+
+  fprintf(fp, "output %s\n", output);
+  for (idx = 0; idx < module_count; idx++) {
+    const BuildModule *module = &modules[idx];
+
+    if (module->is_failed)
+      continue;
+
+    fprintf(fp, "module %s %lx\n", module->name, module->hash);
+    for (sym = module->exports; sym; sym = sym->next)
+      fprintf(fp, "export %s %s %d\n", module->name, sym->name, sym->address);
+    for (sym = module->imports; sym; sym = sym->next)
+      fprintf(fp, "import %s %s\n", module->name, sym->name);
+  }
+
+  ok = !ferror(fp);
+  if (fclose(fp) != 0)
+    ok = false;
+
+  if (!ok)
+    fprintf(stderr, "(ERROR) [build] failed to write '%s'\n", manifest);
+  return ok;
+}
@@ -0,0 +1,34 @@
+#ifndef BUILD_H
+#define BUILD_H
+
+/* build.h -- the assembler's --build mode: assemble and link a program of
+ * several modules, redoing only what changed since the last build
+ *
+ * a manifest file keeps, from the last build, a hash of every module's
+ * source and what it exports (its .ent) and imports (its .ext). a module is
+ * reassembled only if its source changed or its .ob is gone, the rest keep
+ * their outputs and their manifest records. the entries a reassembly added,
+ * removed or moved are looked up in the other modules' imports, and only
+ * those dependents (and the reassembled modules) are checked: each of their
+ * imports must be exported by exactly one module. the program is linked
+ * again (link_modules) only if a module was reassembled, the modules or
+ * their order changed, or the output is gone.
+ *
+ * the manifest is text, a record per line:
+ *
+ *   output <name>                          (- if the link failed)
+ *   module <name> <source hash>            (in link order)
+ *   export <module> <symbol> <address>
+ *   import <module> <symbol>
+ */
+
+/* build_modules -- bring output.ob up to date with the module_count modules
+ * (base filenames, in link order), reading and then rewriting manifest (it
+ * may not exist yet, then everything is built)
+ *
+ * returns the number of errors found (0 on success)
+ */
+int build_modules(const char *manifest, const char *output,
+                  char **module_names, int module_count);
+
+#endif /* BUILD_H */
@@ -0,0 +1,129 @@
+#include "char_scan.h"
+#include <stddef.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* char_scan -- vectorized (SSE2) scanning with a scalar fallback */
+
+/* the null terminator always ends a scan */
+#define SCAN_END 0x01
+
+#define SCAN_BLOCK 16 /* bytes per SSE2 register */
+
+/* class of every char below 64, the rest are all 0 (no class) */
+static const unsigned char char_class[256] = {
+    SCAN_END,     0,          0,          0,          /* 0x00 - 0x03 */
+    0,            0,          0,          0,          /* 0x04 - 0x07 */
+    0,            SCAN_SPACE, SCAN_SPACE, SCAN_SPACE, /* 0x08 - 0x0b */
+    SCAN_SPACE,   SCAN_SPACE, 0,          0,          /* 0x0c - 0x0f */
+    0,            0,          0,          0,          /* 0x10 - 0x13 */
+    0,            0,          0,          0,          /* 0x14 - 0x17 */
+    0,            0,          0,          0,          /* 0x18 - 0x1b */
+    0,            0,          0,          0,          /* 0x1c - 0x1f */
+    SCAN_SPACE,   0,          SCAN_QUOTE, 0,          /* ' ' ! " # */
+    0,            0,          0,          SCAN_QUOTE, /* $ % & ' */
+    0,            0,          0,          0,          /* ( ) * + */
+    SCAN_COMMA,   0,          0,          0,          /* , - . / */
+    0,            0,          0,          0,          /* 0 - 3 */
+    0,            0,          0,          0,          /* 4 - 7 */
+    0,            0,          SCAN_COLON, SCAN_COMMENT, /* 8 9 : ; */
+    0,            0,          0,          0           /* < = > ? */
+};
+
+#ifdef __SSE2__
+
+/* class_mask -- one bit per byte of the 16 byte block, set when the byte
+ * belongs to one of 'classes' (SCAN_END for the terminator) */
+static unsigned int class_mask(const char *block, int classes) {
+  __m128i bytes = _mm_load_si128((const __m128i *)block);
+  __m128i hits = _mm_setzero_si128();
+
+  if (classes & SCAN_END)
+    hits = _mm_cmpeq_epi8(bytes, _mm_setzero_si128());
+
+  if (classes & SCAN_SPACE) {
+    /* '\t'..'\r' are 9..13, so (c - 9) <= 4 as unsigned, plus ' ' */
+    __m128i shifted = _mm_sub_epi8(bytes, _mm_set1_epi8('\t'));
+    __m128i ctrl = _mm_cmpeq_epi8(
+        _mm_min_epu8(shifted, _mm_set1_epi8('\r' - '\t')), shifted);
+
+    hits = _mm_or_si128(hits, ctrl);
+    hits = _mm_or_si128(hits, _mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')));
+  }
+
+  if (classes & SCAN_QUOTE) {
+    hits = _mm_or_si128(hits, _mm_cmpeq_epi8(bytes, _mm_set1_epi8('"')));
+    hits = _mm_or_si128(hits, _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\'')));
+  }
+
+  if (classes & SCAN_COMMA)
+    hits = _mm_or_si128(hits, _mm_cmpeq_epi8(bytes, _mm_set1_epi8(',')));
+
+  if (classes & SCAN_COLON)
+    hits = _mm_or_si128(hits, _mm_cmpeq_epi8(bytes, _mm_set1_epi8(':')));
+
+  if (classes & SCAN_COMMENT)
+    hits = _mm_or_si128(hits, _mm_cmpeq_epi8(bytes, _mm_set1_epi8(';')));
+
+  return (unsigned int)_mm_movemask_epi8(hits);
+}
+
+/* scan_blocks -- shared driver for both scans
+ *
+ * we only do aligned loads: an aligned 16 byte block never crosses a page,
+ * so reading past the terminator is safe. bits for bytes before str in the
+ * first block are masked off. 'invert' turns "find a match" into "find the
+ * first non-match" (then the terminator must not be in 'classes', so that we
+ * still stop on it) */
+static const char *scan_blocks(const char *str, int classes, int invert) {
+  size_t offset = (size_t)str & (SCAN_BLOCK - 1);
+  const char *block = str - offset;
+  unsigned int mask = class_mask(block, classes);
+
+  if (invert)
+    mask = ~mask & 0xFFFF;
+  mask &= 0xFFFFu << offset;
+
+  while (mask == 0) {
+    block += SCAN_BLOCK;
+    mask = class_mask(block, classes);
+    if (invert)
+      mask = ~mask & 0xFFFF;
+  }
+
+  return block + __builtin_ctz(mask);
+}
+
+const char *scan_until(const char *str, int classes) {
+  return scan_blocks(str, classes | SCAN_END, 0);
+}
+
+const char *scan_past_space(const char *str) {
+  return scan_blocks(str, SCAN_SPACE, 1);
+}
+
+#else /* !__SSE2__ */
+
+const char *scan_until(const char *str, int classes) {
+  int stop = classes | SCAN_END;
+
+  while (!(char_class[(unsigned char)*str] & stop))
+    str++;
+
+  return str;
+}
+
+const char *scan_past_space(const char *str) {
+  while (char_class[(unsigned char)*str] & SCAN_SPACE)
+    str++;
+
+  return str;
+}
+
+#endif /* __SSE2__ */
+
+int is_space_char(char c) {
+  return (char_class[(unsigned char)c] & SCAN_SPACE) != 0;
+}
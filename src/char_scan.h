@@ -0,0 +1,31 @@
+#ifndef CHAR_SCAN_H
+#define CHAR_SCAN_H
+
+/* char_scan.h -- block-at-a-time character class scanning for the cleanup
+ * path (comments, whitespace, quotes and separators)
+ *
+ * with SSE2 available (always the case on x86-64) we classify 16 bytes per
+ * step, otherwise we fall back to a scalar table lookup. both versions give
+ * the same results, so callers don't care which one is compiled in */
+
+/* character classes, may be OR'ed together */
+#define SCAN_SPACE 0x02   /* ' ', '\t', '\n', '\v', '\f', '\r' (isspace) */
+#define SCAN_QUOTE 0x04   /* '"' and '\'' */
+#define SCAN_COMMA 0x08   /* ',' */
+#define SCAN_COLON 0x10   /* ':' */
+#define SCAN_COMMENT 0x20 /* ';' */
+
+/* scan_until -- find the first char in str that belongs to one of 'classes'
+ *
+ * returns a pointer to that char, or to the null terminator if none found */
+const char *scan_until(const char *str, int classes);
+
+/* scan_past_space -- skip a run of whitespace
+ *
+ * returns a pointer to the first non-whitespace char (or the terminator) */
+const char *scan_past_space(const char *str);
+
+/* is_space_char -- table driven isspace() for the "C" locale */
+int is_space_char(char c);
+
+#endif /* CHAR_SCAN_H */
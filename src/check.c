@@ -0,0 +1,725 @@
+/* fork, waitpid, directories and the monotonic clock are POSIX, not ANSI C */
+#define _POSIX_C_SOURCE 200112L
+
+#include "assemble.h"
+#include "assembler.h"
+#include "conditional.h"
+#include "helpers.h"
+#include "preprocessor.h"
+#include "trace.h"
+#include <dirent.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* check -- runs the golden fixtures (make check)
+ *
+ *   check_runner [-j jobs] [-o scratch] [--trace=file] [directory]...
+ *
+ * every <name>.as in the directories (tests/valid and tests/invalid by
+ * default) is a fixture. it's assembled the way "./assembler <dir>/<name>"
+ * would from here, but on a copy of the .as at the same path under scratch
+ * (so the messages name the same files and the goldens aren't overwritten).
+ * its .am, .ob, .ent, .ext and stdout/stderr together are compared byte for
+ * byte with the goldens next to the .as: <name>.<ext> and
+ * <name>-stdout-stderr.txt. an output without a golden fails, and so does a
+ * golden without an output (stdout/stderr is only compared if it has one).
+ * <name>.flags, if there is one, holds the assembler options the fixture
+ * is assembled with (see apply_flags).
+ *
+ * the assembler keeps its state in globals and prints to stdout/stderr, so
+ * every fixture is assembled in a child forked from this process (the
+ * assembler is linked in, nothing is exec'ed), jobs of them at once (one per
+ * core by default). every fixture gets a PASS/FAIL row with its time, in
+ * order, then the totals with fixtures/s. outputs of passing fixtures are
+ * removed, those of failing ones are left under scratch.
+ *
+ * --trace records each child's spans (see trace.h) and puts them together
+ * in one trace, a thread per job slot, to see how the workers overlap */
+
+#define JOBS_OPTION "-j"
+#define SCRATCH_OPTION "-o"
+#define DEFAULT_SCRATCH "_check"
+#define GOLDEN_OUTPUT_SUFFIX "-stdout-stderr.txt"
+#define TRACE_SUFFIX ".trace" /* a child's spans, until they're merged */
+#define FLAGS_SUFFIX ".flags" /* a fixture's options, see apply_flags */
+#define CHECK_TIMEOUT_SECONDS 10 /* a fixture running longer is killed */
+#define CHECK_MIN_FIXTURES 64
+#define CHECK_PATH_LENGTH (2 * MAX_FILENAME_LENGTH)
+#define CHECK_MESSAGE_LENGTH (2 * CHECK_PATH_LENGTH + 64)
+#define CHILD_SETUP_FAILED 2 /* exit status of a child that couldn't start */
+
+/* fixture -- one .as and (once it ran) its result */
+typedef struct Fixture {
+  char *base; /* <directory>/<name> */
+  pid_t pid;  /* of its child while it runs, else 0 */
+  int worker; /* job slot it runs in, from 1 */
+  double started;
+  double seconds;
+  bool passed;
+  char failure[CHECK_MESSAGE_LENGTH]; /* why not */
+} Fixture;
+
+/* fixture_list -- every fixture found, sorted by base */
+typedef struct FixtureList {
+  Fixture *fixtures;
+  size_t count;
+  size_t capacity;
+} FixtureList;
+
+/* what a fixture writes, and its golden's suffix */
+static const char *output_suffixes[] = {".am", ".ob", ".ent", ".ext",
+                                        GOLDEN_OUTPUT_SUFFIX, NULL};
+
+static bool collect_fixtures(const char *directory, FixtureList *list);
+static int compare_bases(const void *a, const void *b);
+static bool make_path(const char *path);
+static bool start_fixture(Fixture *fixture, const char *scratch,
+                          bool is_traced);
+static void run_child(const char *base, const char *scratch, int trace_tid);
+static bool apply_flags(const char *source, MacroLibrary **library_out);
+static void finish_fixture(Fixture *fixture, int status, const char *scratch);
+static void compare_outputs(Fixture *fixture, const char *scratch);
+static long first_difference(const char *expected_name,
+                             const char *actual_name);
+static bool copy_file(const char *from, const char *to);
+static bool file_exists(const char *filename);
+static const char *relative_base(const char *base);
+static void remove_outputs(const char *base, const char *scratch);
+static int report(const FixtureList *list, double seconds, int job_count);
+static bool merge_traces(const FixtureList *list, const char *scratch,
+                         const char *filename, int job_count);
+static int core_count(void);
+static double wall_seconds(void);
+
+int main(int argc, char **argv) {
+  const char *default_directories[] = {"tests/valid", "tests/invalid"};
+  const char *scratch = DEFAULT_SCRATCH;
+  const char *trace_filename = NULL;
+  FixtureList list;
+  size_t *running; /* fixture index of each job slot, count if free */
+  size_t next = 0;
+  int job_count = 0;
+  int running_count = 0;
+  int directory_count = 0;
+  double started;
+  int failed;
+  int idx;
+
+  memset(&list, 0, sizeof(list));
+
+  /* options */
+  for (idx = 1; idx < argc; idx++) {
+    if (strcmp(argv[idx], JOBS_OPTION) == 0) {
+      if (idx + 1 >= argc ||
+          parse_number(argv[++idx], 1, INT_MAX, &job_count) != NUM_OK) {
+        fprintf(stderr, "(ERROR) [check] %s expects a number of jobs\n",
+                JOBS_OPTION);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[idx], SCRATCH_OPTION) == 0) {
+      if (idx + 1 >= argc) {
+        fprintf(stderr, "(ERROR) [check] %s requires a directory\n",
+                SCRATCH_OPTION);
+        return EXIT_FAILURE;
+      }
+      scratch = argv[++idx];
+      if (strlen(scratch) >= MAX_FILENAME_LENGTH) {
+        fprintf(stderr, "(ERROR) [check] scratch directory name too long\n");
+        return EXIT_FAILURE;
+      }
+    } else if (strncmp(argv[idx], TRACE_OPTION, strlen(TRACE_OPTION)) == 0) {
+      trace_filename = argv[idx] + strlen(TRACE_OPTION);
+      if (*trace_filename == '\0') {
+        fprintf(stderr, "(ERROR) [check] %s requires a filename\n",
+                TRACE_OPTION);
+        return EXIT_FAILURE;
+      }
+    } else {
+      directory_count++;
+    }
+  }
+
+  for (idx = 1; idx < argc; idx++) {
+    if (strcmp(argv[idx], JOBS_OPTION) == 0 ||
+        strcmp(argv[idx], SCRATCH_OPTION) == 0) {
+      idx++; /* skip the option and its value */
+      continue;
+    }
+    if (strncmp(argv[idx], TRACE_OPTION, strlen(TRACE_OPTION)) == 0)
+      continue;
+    if (!collect_fixtures(argv[idx], &list))
+      return EXIT_FAILURE;
+  }
+
+  for (idx = 0; directory_count == 0 && idx < 2; idx++) {
+    if (!collect_fixtures(default_directories[idx], &list))
+      return EXIT_FAILURE;
+  }
+
+  if (list.count == 0) {
+    fprintf(stderr, "(ERROR) [check] no fixtures (.as files) found\n");
+    return EXIT_FAILURE;
+  }
+
+  qsort(list.fixtures, list.count, sizeof(Fixture), compare_bases);
+
+  if (job_count <= 0)
+    job_count = core_count();
+  if ((size_t)job_count > list.count)
+    job_count = (int)list.count;
+
+  running = safe_calloc((size_t)job_count, sizeof(size_t));
+  if (!running)
+    return EXIT_FAILURE;
+  for (idx = 0; idx < job_count; idx++)
+    running[idx] = list.count;
+
+  started = wall_seconds();
+
+  /* keep job_count children busy, reap them as they finish */
+  while (next < list.count || running_count > 0) {
+    pid_t pid;
+    int status;
+
+    for (idx = 0; idx < job_count && next < list.count; idx++) {
+      if (running[idx] != list.count)
+        continue;
+
+      list.fixtures[next].worker = idx + 1;
+      if (start_fixture(&list.fixtures[next], scratch,
+                        trace_filename != NULL)) {
+        running[idx] = next;
+        running_count++;
+      }
+      next++;
+    }
+
+    if (running_count == 0)
+      continue;
+
+    pid = waitpid(-1, &status, 0);
+    if (pid < 0) {
+      fprintf(stderr, "(ERROR) [check] lost track of the running fixtures\n");
+      free(running);
+      return EXIT_FAILURE;
+    }
+
+    for (idx = 0; idx < job_count; idx++) {
+      if (running[idx] != list.count &&
+          list.fixtures[running[idx]].pid == pid) {
+        finish_fixture(&list.fixtures[running[idx]], status, scratch);
+        running[idx] = list.count;
+        running_count--;
+        break;
+      }
+    }
+  }
+
+  failed = report(&list, wall_seconds() - started, job_count);
+  if (trace_filename &&
+      !merge_traces(&list, scratch, trace_filename, job_count))
+    failed++;
+
+  for (next = 0; next < list.count; next++)
+    free(list.fixtures[next].base);
+  free(list.fixtures);
+  free(running);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* collect_fixtures -- add every .as of directory to list
+ *
+ * returns true on success, false on error (error printed) */
+static bool collect_fixtures(const char *directory, FixtureList *list) {
+  DIR *dir = opendir(directory);
+  struct dirent *entry;
+
+  if (!dir) {
+    fprintf(stderr, "(ERROR) [check] cannot open directory '%s'\n",
+            directory);
+    return false;
+  }
+
+  while ((entry = readdir(dir)) != NULL) {
+    size_t name_length = strlen(entry->d_name);
+    size_t base_length;
+    Fixture *fixture;
+
+    if (name_length <= 3 ||
+        strcmp(entry->d_name + name_length - 3, ".as") != 0)
+      continue;
+
+    base_length = strlen(directory) + 1 + name_length - 3;
+    if (base_length + strlen(GOLDEN_OUTPUT_SUFFIX) >= MAX_FILENAME_LENGTH) {
+      fprintf(stderr, "(ERROR) [check] fixture name too long: '%s/%s'\n",
+              directory, entry->d_name);
+      closedir(dir);
+      return false;
+    }
+
+    if (list->count == list->capacity) {
+      size_t grown_capacity =
+          list->capacity ? list->capacity * 2 : CHECK_MIN_FIXTURES;
+      Fixture *grown =
+          realloc(list->fixtures, grown_capacity * sizeof(Fixture));
+
+      if (!grown) {
+        fprintf(stderr, "(ERROR) [check] out of memory for %lu fixtures\n",
+                (unsigned long)grown_capacity);
+        closedir(dir);
+        return false;
+      }
+      list->fixtures = grown;
+      list->capacity = grown_capacity;
+    }
+
+    fixture = &list->fixtures[list->count];
+    memset(fixture, 0, sizeof(Fixture));
+    fixture->base = safe_calloc(base_length + 1, 1);
+    if (!fixture->base) {
+      closedir(dir);
+      return false;
+    }
+    sprintf(fixture->base, "%s/%.*s", directory, (int)(name_length - 3),
+            entry->d_name);
+    list->count++;
+  }
+
+  closedir(dir);
+  return true;
+}
+
+/* compare_bases -- qsort order of fixtures, by base */
+static int compare_bases(const void *a, const void *b) {
+  return strcmp(((const Fixture *)a)->base, ((const Fixture *)b)->base);
+}
+
+/* make_path -- create the directory path and its parents (mkdir -p)
+ *
+ * returns true on success, false on error (not printed) */
+static bool make_path(const char *path) {
+  char partial[CHECK_PATH_LENGTH];
+  size_t idx;
+
+  if (strlen(path) >= sizeof(partial))
+    return false;
+
+  strcpy(partial, path);
+  for (idx = 1; partial[idx]; idx++) {
+    if (partial[idx] != '/')
+      continue;
+
+    partial[idx] = '\0';
+    if (mkdir(partial, 0777) != 0 && !file_exists(partial))
+      return false;
+    partial[idx] = '/';
+  }
+
+  return mkdir(partial, 0777) == 0 || file_exists(partial);
+}
+
+/* start_fixture -- fork the child that assembles fixture (the fixture
+ * fails right away if that can't be done)
+ *
+ * returns true if the child is running */
+static bool start_fixture(Fixture *fixture, const char *scratch,
+                          bool is_traced) {
+  pid_t pid;
+
+  /* what we buffered would be written again by the child */
+  fflush(stdout);
+  fflush(stderr);
+
+  fixture->started = wall_seconds();
+  pid = fork();
+  if (pid < 0) {
+    sprintf(fixture->failure, "could not start a process for it");
+    return false;
+  }
+
+  if (pid == 0)
+    run_child(fixture->base, scratch, is_traced ? fixture->worker : 0);
+
+  fixture->pid = pid;
+  return true;
+}
+
+/* run_child -- (in the child) copy base.as under scratch, then assemble it
+ * there with its flags and stdout and stderr going to
+ * base-stdout-stderr.txt, which is what "./assembler <flags> base > file
+ * 2>&1" does (an absolute base is assembled as relative to scratch). with a
+ * trace_tid, the spans go to base.trace as that thread. doesn't return */
+static void run_child(const char *base, const char *scratch, int trace_tid) {
+  char path[CHECK_PATH_LENGTH];
+  char source[CHECK_PATH_LENGTH];
+  char copy[CHECK_PATH_LENGTH + EXT_LENGTH];
+  MacroLibrary *library = NULL;
+  char *slash;
+
+  sprintf(source, "%s.as", base);
+  base = relative_base(base);
+  sprintf(path, "%s/%s", scratch, base);
+  sprintf(copy, "%s.as", path);
+
+  slash = strrchr(path, '/');
+  *slash = '\0';
+
+  remove_outputs(base, scratch);
+  if (!apply_flags(source, &library) || !make_path(path) || !copy_file(source, copy) ||
+      chdir(scratch) != 0)
+    exit(CHILD_SETUP_FAILED);
+
+  sprintf(path, "%s%s", base, GOLDEN_OUTPUT_SUFFIX);
+  if (!freopen(path, "w", stdout) ||
+      dup2(fileno(stdout), STDERR_FILENO) < 0)
+    exit(CHILD_SETUP_FAILED);
+
+  alarm(CHECK_TIMEOUT_SECONDS);
+  if (trace_tid)
+    trace_start();
+  assemble_file((char *)base, library, OUTPUT_TEXT);
+
+  if (trace_tid) {
+    FILE *trace_fp;
+
+    sprintf(path, "%s%s", base, TRACE_SUFFIX);
+    trace_fp = fopen(path, "w");
+    if (!trace_fp || !trace_write_events(trace_fp, trace_tid))
+      fprintf(stderr, "(ERROR) [check] failed to write '%s'\n", path);
+    if (trace_fp)
+      fclose(trace_fp);
+  }
+
+  exit(EXIT_SUCCESS);
+}
+
+/* apply_flags -- (in the child) set the options in the flags file of the
+ * fixture whose .as is source, if it has one: -O, -DNAME[=value] or -D
+ * NAME[=value] and --macro-lib file (next to the .as, loaded into
+ * *library_out), separated by blanks or newlines
+ *
+ * returns true on success, false on error (error printed) */
+static bool apply_flags(const char *source, MacroLibrary **library_out) {
+  char filename[CHECK_PATH_LENGTH];
+  char library_name[CHECK_PATH_LENGTH];
+  const char *slash = strrchr(source, '/');
+  char *text, *token;
+  bool ok = true;
+  FILE *fp;
+
+  sprintf(filename, "%.*s%s", (int)(strlen(source) - 3), source,
+          FLAGS_SUFFIX);
+  fp = fopen(filename, "r");
+  if (!fp)
+    return true; /* no options */
+
+  text = read_file_contents(fp, NULL);
+  fclose(fp);
+  if (!text)
+    return false;
+
+  /* the child is alone, strtok's static is its own */
+  for (token = strtok(text, " \t\r\n"); ok && token;
+       token = strtok(NULL, " \t\r\n")) {
+    if (strcmp(token, OPTIMIZE_OPTION) == 0) {
+      assemble_set_optimize(true);
+    } else if (strcmp(token, MACRO_LIB_OPTION) == 0) {
+      const char *name = strtok(NULL, " \t\r\n");
+      int directory_length = slash ? (int)(slash - source + 1) : 0;
+
+      if (!name || *library_out ||
+          directory_length + strlen(name) >= sizeof(library_name)) {
+        fprintf(stderr, "(ERROR) [check] %s requires one file in '%s'\n",
+                MACRO_LIB_OPTION, filename);
+        ok = false;
+      } else {
+        sprintf(library_name, "%.*s%s", directory_length, source, name);
+        *library_out = macro_library_load(library_name);
+        ok = *library_out != NULL;
+      }
+    } else if (strncmp(token, DEFINE_OPTION, strlen(DEFINE_OPTION)) == 0) {
+      const char *definition = token + strlen(DEFINE_OPTION);
+
+      if (*definition == '\0')
+        definition = strtok(NULL, " \t\r\n");
+
+      if (!definition) {
+        fprintf(stderr, "(ERROR) [check] %s requires NAME[=value] in '%s'\n",
+                DEFINE_OPTION, filename);
+        ok = false;
+      } else {
+        ok = cond_define(definition);
+      }
+    } else {
+      fprintf(stderr, "(ERROR) [check] unknown option '%s' in '%s'\n", token,
+              filename);
+      ok = false;
+    }
+  }
+
+  free(text);
+  return ok;
+}
+
+/* finish_fixture -- the child of fixture ended with status, check what it
+ * wrote */
+static void finish_fixture(Fixture *fixture, int status, const char *scratch) {
+  fixture->seconds = wall_seconds() - fixture->started;
+  fixture->pid = 0;
+
+  if (WIFSIGNALED(status)) {
+    if (WTERMSIG(status) == SIGALRM)
+      sprintf(fixture->failure, "did not finish within %ds",
+              CHECK_TIMEOUT_SECONDS);
+    else
+      sprintf(fixture->failure, "crashed (signal %d)", WTERMSIG(status));
+    return;
+  }
+
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+    sprintf(fixture->failure, "could not be set up (flags, copy to '%s')",
+            scratch);
+    return;
+  }
+
+  compare_outputs(fixture, scratch);
+  if (fixture->passed)
+    remove_outputs(fixture->base, scratch);
+}
+
+/* compare_outputs -- compare every output of fixture with its golden,
+ * recording the first that doesn't match */
+static void compare_outputs(Fixture *fixture, const char *scratch) {
+  char expected[CHECK_PATH_LENGTH];
+  char actual[CHECK_PATH_LENGTH];
+  int idx;
+
+  for (idx = 0; output_suffixes[idx] != NULL; idx++) {
+    const char *suffix = output_suffixes[idx];
+    bool has_golden, has_output;
+    long line;
+
+    sprintf(expected, "%s%s", fixture->base, suffix);
+    sprintf(actual, "%s/%s%s", scratch, relative_base(fixture->base),
+            suffix);
+    has_golden = file_exists(expected);
+    has_output = file_exists(actual);
+
+    /* nothing expected (a stdout/stderr golden is optional) */
+    if (!has_golden &&
+        (!has_output || strcmp(suffix, GOLDEN_OUTPUT_SUFFIX) == 0))
+      continue;
+
+    if (!has_output) {
+      sprintf(fixture->failure, "'%s' was not written (golden '%s')", actual,
+              expected);
+      return;
+    }
+
+    if (!has_golden) {
+      sprintf(fixture->failure, "'%s' was written, there is no '%s'", actual,
+              expected);
+      return;
+    }
+
+    line = first_difference(expected, actual);
+    if (line < 0) {
+      sprintf(fixture->failure, "cannot read '%s'", actual);
+      return;
+    }
+    if (line > 0) {
+      sprintf(fixture->failure, "'%s' differs at line %ld (see '%s')",
+              expected, line, actual);
+      return;
+    }
+  }
+
+  fixture->passed = true;
+}
+
+/* first_difference -- compare two files byte for byte
+ *
+ * returns 0 if they're the same, else the line of the first difference, -1
+ * if one can't be read */
+static long first_difference(const char *expected_name,
+                             const char *actual_name) {
+  FILE *expected_fp = fopen(expected_name, "rb");
+  FILE *actual_fp = fopen(actual_name, "rb");
+  char *expected = NULL, *actual = NULL;
+  size_t expected_length = 0, actual_length = 0;
+  size_t shorter, idx;
+  long line = -1;
+
+  if (expected_fp && actual_fp) {
+    expected = read_file_contents(expected_fp, &expected_length);
+    actual = read_file_contents(actual_fp, &actual_length);
+  }
+
+  if (expected && actual) {
+    line = 0;
+    if (expected_length != actual_length ||
+        memcmp(expected, actual, expected_length) != 0) {
+      shorter = expected_length < actual_length ? expected_length
+                                                : actual_length;
+      line = 1;
+      for (idx = 0; idx < shorter && expected[idx] == actual[idx]; idx++) {
+        if (expected[idx] == '\n')
+          line++;
+      }
+    }
+  }
+
+  if (expected_fp)
+    fclose(expected_fp);
+  if (actual_fp)
+    fclose(actual_fp);
+  free(expected);
+  free(actual);
+  return line;
+}
+
+/* copy_file -- copy from to to (created or truncated)
+ *
+ * returns true on success, false on error (not printed) */
+static bool copy_file(const char *from, const char *to) {
+  char buffer[READ_CHUNK_SIZE];
+  FILE *in = fopen(from, "rb");
+  FILE *out = in ? fopen(to, "wb") : NULL;
+  size_t count;
+  bool ok = in && out;
+
+  while (ok && (count = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+    if (fwrite(buffer, 1, count, out) != count)
+      ok = false;
+  }
+
+  if (in && ferror(in))
+    ok = false;
+  if (in)
+    fclose(in);
+  if (out && fclose(out) != 0)
+    ok = false;
+  return ok;
+}
+
+/* file_exists -- true if filename is there */
+static bool file_exists(const char *filename) {
+  struct stat info;
+
+  return stat(filename, &info) == 0;
+}
+
+/* relative_base -- base as a path under scratch (an absolute one without
+ * its leading '/') */
+static const char *relative_base(const char *base) {
+  while (*base == '/')
+    base++;
+  return base;
+}
+
+/* remove_outputs -- delete the copy of base under scratch and everything
+ * assembling it wrote */
+static void remove_outputs(const char *base, const char *scratch) {
+  char filename[CHECK_PATH_LENGTH];
+  int idx;
+
+  base = relative_base(base);
+  sprintf(filename, "%s/%s.as", scratch, base);
+  remove(filename);
+
+  for (idx = 0; output_suffixes[idx] != NULL; idx++) {
+    sprintf(filename, "%s/%s%s", scratch, base, output_suffixes[idx]);
+    remove(filename);
+  }
+}
+
+/* report -- a row per fixture (in order) and the totals
+ *
+ * returns the number of fixtures that failed */
+static int report(const FixtureList *list, double seconds, int job_count) {
+  int failed = 0;
+  size_t idx;
+
+  for (idx = 0; idx < list->count; idx++) {
+    const Fixture *fixture = &list->fixtures[idx];
+
+    if (fixture->passed) {
+      printf("PASS %8.3fms %s\n", fixture->seconds * 1000, fixture->base);
+      continue;
+    }
+
+    failed++;
+    printf("FAIL %8.3fms %s: %s\n", fixture->seconds * 1000, fixture->base,
+           fixture->failure);
+  }
+
+  printf("%d passed, %d failed in %.3fs (%.0f fixtures/s, %d jobs)\n",
+         (int)list->count - failed, failed, seconds,
+         seconds > 0 ? list->count / seconds : 0.0, job_count);
+
+  return failed;
+}
+
+/* merge_traces -- put the spans every child wrote together in the trace
+ * filename, a thread per job slot
+ *
+ * returns true on success, false on error (error printed) */
+static bool merge_traces(const FixtureList *list, const char *scratch,
+                         const char *filename, int job_count) {
+  char buffer[READ_CHUNK_SIZE];
+  char fragment[CHECK_PATH_LENGTH];
+  FILE *out = trace_open_file(filename);
+  size_t idx;
+
+  if (!out)
+    return false;
+
+  for (idx = 0; idx < list->count; idx++) {
+    FILE *in;
+    size_t count;
+
+    sprintf(fragment, "%s/%s%s", scratch,
+            relative_base(list->fixtures[idx].base), TRACE_SUFFIX);
+    in = fopen(fragment, "rb");
+    if (!in)
+      continue; /* it didn't get to run */
+
+    while ((count = fread(buffer, 1, sizeof(buffer), in)) > 0)
+      fwrite(buffer, 1, count, out);
+    fclose(in);
+    remove(fragment);
+  }
+
+  return trace_close_file(out, filename, job_count, "worker");
+}
+
+/* core_count -- online processors, at least 1 */
+static int core_count(void) {
+#ifdef _SC_NPROCESSORS_ONLN
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+  if (cores > 0)
+    return (int)cores;
+#endif
+  return 1;
+}
+
+/* wall_seconds -- a wall clock in seconds (clock() doesn't count the time
+ * spent waiting for children, so it's only the fallback) */
+static double wall_seconds(void) {
+#ifdef CLOCK_MONOTONIC
+  struct timespec now;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &now) == 0)
+    return now.tv_sec + now.tv_nsec / 1e9;
+#endif
+  return (double)clock() / CLOCKS_PER_SEC;
+}
@@ -0,0 +1,415 @@
+#include "conditional.h"
+#include "assembler.h"
+#include "helpers.h"
+#include <ctype.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* conditional -- -D names and .if blocks, see header */
+
+#define TERM_LENGTH 16 /* longest number a term may be, sign included */
+
+/* definition -- a name defined for the run */
+typedef struct Definition {
+  char *name;
+  int value;
+  struct Definition *next;
+} Definition;
+
+/* keyword -- the conditionals */
+typedef enum Keyword {
+  KEYWORD_NONE,
+  KEYWORD_IF,
+  KEYWORD_IFDEF,
+  KEYWORD_IFNDEF,
+  KEYWORD_ELSE,
+  KEYWORD_ENDIF
+} Keyword;
+
+/* a run defines a few names, a walk finds one */
+static Definition *definitions = NULL;
+
+static Keyword match_keyword(const char *text, const char **rest_out);
+static bool open_block(CondStack *stack, bool is_true, int line_number);
+static bool apply_else(CondStack *stack, int line_number);
+static bool apply_endif(CondStack *stack, int line_number);
+static bool is_end(const char *text);
+static bool evaluate(const char *text, int line_number, bool *result_out);
+static bool read_term(const char **cursor, int line_number, int *value_out);
+static size_t name_length(const char *text);
+static Definition *find_definition(const char *name, size_t length);
+
+/* ======================================================================= */
+/* ===================== public api -- see header ======================== */
+/* ======================================================================= */
+
+bool cond_define(const char *definition) {
+  size_t length = name_length(definition);
+  Definition *entry;
+  int value = 1;
+
+  if (length == 0 || length >= MAX_LABEL_LENGTH ||
+      (definition[length] != '\0' && definition[length] != '=')) {
+    fprintf(stderr, "(ERROR) [conditional] '%s' should be NAME or NAME=value\n",
+            definition);
+    return false;
+  }
+
+  if (definition[length] == '=' &&
+      parse_number(definition + length + 1, INT_MIN, INT_MAX, &value) !=
+          NUM_OK) {
+    fprintf(stderr, "(ERROR) [conditional] the value of '%s' isn't a number\n",
+            definition);
+    return false;
+  }
+
+  /* a name defined again takes the last value, like cc -D */
+  entry = find_definition(definition, length);
+  if (entry) {
+    entry->value = value;
+    return true;
+  }
+
+  entry = safe_calloc(1, sizeof(Definition));
+  if (!entry)
+    return false;
+
+  entry->name = safe_calloc(length + 1, 1);
+  if (!entry->name) {
+    free(entry);
+    return false;
+  }
+  memcpy(entry->name, definition, length);
+  entry->value = value;
+  entry->next = definitions;
+  definitions = entry;
+
+  return true;
+}
+
+void cond_forget_defines(void) {
+  while (definitions) {
+    Definition *next = definitions->next;
+
+    free(definitions->name);
+    free(definitions);
+    definitions = next;
+  }
+}
+
+bool cond_is_active(const CondStack *stack) {
+  return stack->depth == 0 || stack->frames[stack->depth - 1].is_active;
+}
+
+bool cond_skip_line(CondStack *stack, const char *line, int line_number) {
+  const char *cursor = line + strspn(line, " \t");
+
+  /* most lines are done here */
+  if (*cursor != '.')
+    return true;
+
+  switch (match_keyword(cursor, NULL)) {
+  case KEYWORD_IF:
+  case KEYWORD_IFDEF:
+  case KEYWORD_IFNDEF:
+    stack->skipped_depth++;
+    return true;
+
+  case KEYWORD_ELSE:
+    return stack->skipped_depth > 0 || apply_else(stack, line_number);
+
+  case KEYWORD_ENDIF:
+    if (stack->skipped_depth > 0) {
+      stack->skipped_depth--;
+      return true;
+    }
+    return apply_endif(stack, line_number);
+
+  default:
+    return true;
+  }
+}
+
+CondResult cond_directive(CondStack *stack, const char *line,
+                          int line_number) {
+  const char *rest;
+  Keyword keyword;
+  bool is_true;
+  size_t length;
+
+  if (line[0] != '.')
+    return COND_NONE;
+
+  keyword = match_keyword(line, &rest);
+  if (keyword == KEYWORD_NONE)
+    return COND_NONE;
+  rest += strspn(rest, " \t");
+
+  switch (keyword) {
+  case KEYWORD_IFDEF:
+  case KEYWORD_IFNDEF:
+    length = name_length(rest);
+    if (length == 0 || !is_end(rest + length)) {
+      fprintf(stderr, "(ERROR) [conditional] expected %s NAME (line %d)\n",
+              keyword == KEYWORD_IFDEF ? IFDEF_DIRECTIVE : IFNDEF_DIRECTIVE,
+              line_number);
+      return COND_ERROR;
+    }
+    is_true = (find_definition(rest, length) != NULL) ==
+              (keyword == KEYWORD_IFDEF);
+    return open_block(stack, is_true, line_number) ? COND_DONE : COND_ERROR;
+
+  case KEYWORD_IF:
+    if (!evaluate(rest, line_number, &is_true))
+      return COND_ERROR;
+    return open_block(stack, is_true, line_number) ? COND_DONE : COND_ERROR;
+
+  case KEYWORD_ELSE:
+  case KEYWORD_ENDIF:
+    if (!is_end(rest)) {
+      fprintf(stderr, "(ERROR) [conditional] extra text after %s (line %d)\n",
+              keyword == KEYWORD_ELSE ? ELSE_DIRECTIVE : ENDIF_DIRECTIVE,
+              line_number);
+      return COND_ERROR;
+    }
+    if (keyword == KEYWORD_ELSE)
+      return apply_else(stack, line_number) ? COND_DONE : COND_ERROR;
+    return apply_endif(stack, line_number) ? COND_DONE : COND_ERROR;
+
+  default:
+    return COND_NONE;
+  }
+}
+
+bool cond_end(const CondStack *stack) {
+  if (stack->depth == 0)
+    return true;
+
+  fprintf(stderr, "(ERROR) [conditional] %s without %s (line %d)\n",
+          IF_DIRECTIVE, ENDIF_DIRECTIVE,
+          stack->frames[stack->depth - 1].line_number);
+  return false;
+}
+
+/* ======================================================================= */
+
+/* match_keyword -- the conditional text starts with (a whole word), the text
+ * after it goes to *rest_out (may be NULL) */
+static Keyword match_keyword(const char *text, const char **rest_out) {
+  static const struct {
+    const char *word;
+    Keyword keyword;
+  } KEYWORDS[] = {{IFDEF_DIRECTIVE, KEYWORD_IFDEF},
+                  {IFNDEF_DIRECTIVE, KEYWORD_IFNDEF},
+                  {IF_DIRECTIVE, KEYWORD_IF},
+                  {ELSE_DIRECTIVE, KEYWORD_ELSE},
+                  {ENDIF_DIRECTIVE, KEYWORD_ENDIF}};
+  size_t idx;
+
+  for (idx = 0; idx < sizeof(KEYWORDS) / sizeof(KEYWORDS[0]); idx++) {
+    size_t length = strlen(KEYWORDS[idx].word);
+    char after = text[length];
+
+    if (strncmp(text, KEYWORDS[idx].word, length) == 0 &&
+        (after == '\0' || after == ' ' || after == '\t' || after == '\n' ||
+         after == '\r' || after == ';')) {
+      if (rest_out)
+        *rest_out = text + length;
+      return KEYWORDS[idx].keyword;
+    }
+  }
+
+  return KEYWORD_NONE;
+}
+
+/* open_block -- push a block whose first branch is_true
+ *
+ * returns true on success, false if too deep (error printed) */
+static bool open_block(CondStack *stack, bool is_true, int line_number) {
+  CondFrame *frame;
+
+  if (stack->depth == COND_MAX_DEPTH) {
+    fprintf(stderr,
+            "(ERROR) [conditional] %s blocks nested more than %d deep (line "
+            "%d)\n",
+            IF_DIRECTIVE, COND_MAX_DEPTH, line_number);
+    return false;
+  }
+
+  frame = &stack->frames[stack->depth++];
+  frame->is_active = is_true;
+  frame->was_taken = is_true;
+  frame->has_else = false;
+  frame->line_number = line_number;
+  return true;
+}
+
+/* apply_else -- switch the innermost block to its .else branch, which is
+ * taken if no branch before it was
+ *
+ * returns true on success, false on error (error printed) */
+static bool apply_else(CondStack *stack, int line_number) {
+  CondFrame *frame;
+
+  if (stack->depth == 0) {
+    fprintf(stderr, "(ERROR) [conditional] %s without %s (line %d)\n",
+            ELSE_DIRECTIVE, IF_DIRECTIVE, line_number);
+    return false;
+  }
+
+  frame = &stack->frames[stack->depth - 1];
+  if (frame->has_else) {
+    fprintf(stderr, "(ERROR) [conditional] second %s for one %s (line %d)\n",
+            ELSE_DIRECTIVE, IF_DIRECTIVE, line_number);
+    return false;
+  }
+
+  frame->has_else = true;
+  frame->is_active = !frame->was_taken;
+  frame->was_taken = true;
+  return true;
+}
+
+/* apply_endif -- close the innermost block
+ *
+ * returns true on success, false if none is open (error printed) */
+static bool apply_endif(CondStack *stack, int line_number) {
+  if (stack->depth == 0) {
+    fprintf(stderr, "(ERROR) [conditional] %s without %s (line %d)\n",
+            ENDIF_DIRECTIVE, IF_DIRECTIVE, line_number);
+    return false;
+  }
+
+  stack->depth--;
+  return true;
+}
+
+/* is_end -- is there nothing but spaces left in text? */
+static bool is_end(const char *text) {
+  return text[strspn(text, " \t")] == '\0';
+}
+
+/* evaluate -- the condition of an .if: <term> [<op> <term>]
+ *
+ * returns true on success (the result in *result_out), false on error
+ * (error printed) */
+static bool evaluate(const char *text, int line_number, bool *result_out) {
+  const char *cursor = text;
+  char op[3] = {0};
+  int left, right;
+
+  if (!read_term(&cursor, line_number, &left))
+    return false;
+
+  cursor += strspn(cursor, " \t");
+  if (*cursor == '\0') {
+    *result_out = left != 0;
+    return true;
+  }
+
+  /* one or two chars: == != <= >= < > */
+  op[0] = *cursor++;
+  if (*cursor == '=')
+    op[1] = *cursor++;
+
+  if (!read_term(&cursor, line_number, &right))
+    return false;
+
+  if (!is_end(cursor)) {
+    fprintf(stderr, "(ERROR) [conditional] extra text after %s condition "
+                    "(line %d)\n",
+            IF_DIRECTIVE, line_number);
+    return false;
+  }
+
+  if (strcmp(op, "==") == 0) {
+    *result_out = left == right;
+  } else if (strcmp(op, "!=") == 0) {
+    *result_out = left != right;
+  } else if (strcmp(op, "<") == 0) {
+    *result_out = left < right;
+  } else if (strcmp(op, "<=") == 0) {
+    *result_out = left <= right;
+  } else if (strcmp(op, ">") == 0) {
+    *result_out = left > right;
+  } else if (strcmp(op, ">=") == 0) {
+    *result_out = left >= right;
+  } else {
+    fprintf(stderr, "(ERROR) [conditional] unknown operator '%s' (line %d)\n",
+            op, line_number);
+    return false;
+  }
+
+  return true;
+}
+
+/* read_term -- read a number or a defined name's value at *cursor (spaces
+ * before it skipped), moving *cursor past it
+ *
+ * returns true on success, false on error (error printed) */
+static bool read_term(const char **cursor, int line_number, int *value_out) {
+  const char *term = *cursor + strspn(*cursor, " \t");
+  size_t length = name_length(term);
+
+  if (length > 0) {
+    const Definition *definition = find_definition(term, length);
+
+    if (!definition) {
+      fprintf(stderr, "(ERROR) [conditional] '%.*s' is not defined (line %d)\n",
+              (int)length, term, line_number);
+      return false;
+    }
+    *value_out = definition->value;
+    *cursor = term + length;
+    return true;
+  }
+
+  length = (term[0] == '+' || term[0] == '-') ? 1 : 0;
+  length += strspn(term + length, "0123456789");
+
+  if (length > 0 && length < TERM_LENGTH) {
+    char number[TERM_LENGTH];
+
+    memcpy(number, term, length);
+    number[length] = '\0';
+    if (parse_number(number, INT_MIN, INT_MAX, value_out) == NUM_OK) {
+      *cursor = term + length;
+      return true;
+    }
+  }
+
+  fprintf(stderr,
+          "(ERROR) [conditional] expected a number or a defined name in %s "
+          "condition (line %d)\n",
+          IF_DIRECTIVE, line_number);
+  return false;
+}
+
+/* name_length -- the length of the name text starts with (a letter, then
+ * letters, digits and '_'), 0 if it doesn't start with one */
+static size_t name_length(const char *text) {
+  size_t length = 0;
+
+  if (!isalpha((unsigned char)text[0]))
+    return 0;
+
+  while (isalnum((unsigned char)text[length]) || text[length] == '_')
+    length++;
+
+  return length;
+}
+
+/* find_definition -- the definition of the length chars of name, or NULL */
+static Definition *find_definition(const char *name, size_t length) {
+  Definition *entry;
+
+  for (entry = definitions; entry; entry = entry->next) {
+    if (strlen(entry->name) == length &&
+        strncmp(entry->name, name, length) == 0)
+      return entry;
+  }
+
+  return NULL;
+}
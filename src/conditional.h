@@ -0,0 +1,83 @@
+#ifndef CONDITIONAL_H
+#define CONDITIONAL_H
+
+#include "types.h"
+
+/* conditional.h -- conditional assembly: the names defined for a run (-D)
+ * and the .if blocks of a file
+ *
+ *   .ifdef NAME      .ifndef NAME      .if <term> [<op> <term>]
+ *   ...              ...               ...
+ *   .else (optional)
+ *   ...
+ *   .endif
+ *
+ * a term is a decimal number or a defined name (its value), op one of == !=
+ * < <= > >=, a lone term is true if it isn't 0. blocks nest.
+ *
+ * conditionals are resolved while a file is read, before its lines are
+ * cleaned up: the lines of a block that's out go by with a look at their
+ * first chars only (for the conditionals nested in it), they're never
+ * cleaned, tokenized or macro-checked */
+
+#define IF_DIRECTIVE ".if"
+#define IFDEF_DIRECTIVE ".ifdef"
+#define IFNDEF_DIRECTIVE ".ifndef"
+#define ELSE_DIRECTIVE ".else"
+#define ENDIF_DIRECTIVE ".endif"
+#define COND_MAX_DEPTH 32 /* blocks open at once */
+
+/* cond_result -- what cond_directive made of a line */
+typedef enum CondResult {
+  COND_NONE,  /* not a conditional, the line is the file's */
+  COND_DONE,  /* a conditional, applied */
+  COND_ERROR  /* a conditional in error (error printed) */
+} CondResult;
+
+/* cond_frame -- an open block, the one being read (not one inside a block
+ * that's out, those are only counted) */
+typedef struct CondFrame {
+  bool is_active; /* lines of its current branch are the file's */
+  bool was_taken; /* a branch of it was */
+  bool has_else;
+  int line_number; /* of its .if */
+} CondFrame;
+
+/* cond_stack -- the open blocks of a file, start it zeroed */
+typedef struct CondStack {
+  CondFrame frames[COND_MAX_DEPTH];
+  int depth;
+  int skipped_depth; /* blocks open inside the innermost one that's out */
+} CondStack;
+
+/* cond_define -- define a name for every file of the run, definition is
+ * NAME (value 1) or NAME=value (a decimal number)
+ *
+ * returns true on success, false on error (error printed)
+ */
+bool cond_define(const char *definition);
+
+/* cond_forget_defines -- free the names cond_define defined */
+void cond_forget_defines(void);
+
+/* cond_is_active -- are the lines being read the file's? */
+bool cond_is_active(const CondStack *stack);
+
+/* cond_skip_line -- pass over a line (as read, not cleaned) of a block
+ * that's out, minding only the conditionals on it
+ *
+ * returns true on success, false on error (error printed)
+ */
+bool cond_skip_line(CondStack *stack, const char *line, int line_number);
+
+/* cond_directive -- apply a (cleaned) line if it's a conditional */
+CondResult cond_directive(CondStack *stack, const char *line,
+                          int line_number);
+
+/* cond_end -- at the end of the file: every block must be closed
+ *
+ * returns true if they are, false if not (error printed)
+ */
+bool cond_end(const CondStack *stack);
+
+#endif /* CONDITIONAL_H */
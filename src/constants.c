@@ -0,0 +1,409 @@
+#include "constants.h"
+#include "assembler.h"
+#include "helpers.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* constants -- .define/.equ and constant folding, see header */
+
+/* constant -- one name of the table */
+typedef struct Constant {
+  char name[MAX_LABEL_LENGTH];
+  int value;
+  int line_number;
+  struct Constant *bucket_next;
+} Constant;
+
+/* fold -- an expression being folded, left to right */
+typedef struct Fold {
+  const char *cursor;
+  int line_number;
+  FoldStatus status; /* FOLD_OK until something goes wrong */
+} Fold;
+
+/* the table of the file being read */
+static Constant **buckets = NULL;
+static size_t bucket_count = 0;
+static size_t constant_count = 0;
+static int use_count = 0;
+
+static long fold_sum(Fold *fold);
+static long fold_product(Fold *fold);
+static long fold_unary(Fold *fold);
+static long fold_primary(Fold *fold);
+static long fold_check(Fold *fold, long value);
+static void skip_blanks(Fold *fold);
+static size_t name_length(const char *text);
+static Constant *const_find(const char *name, size_t length);
+static bool const_grow(void);
+
+/* ======================================================================= */
+/* ===================== public api -- see header ======================== */
+/* ======================================================================= */
+
+bool const_define(const char *directive, const char *operands,
+                  int line_number) {
+  char separator = strcmp(directive, DEFINE_DIRECTIVE) == 0 ? '=' : ',';
+  char name[MAX_LABEL_LENGTH];
+  const char *cursor = operands ? operands + strspn(operands, " \t") : "";
+  size_t length = name_length(cursor);
+  const Constant *existing;
+  Constant *constant;
+  size_t bucket;
+  int value;
+
+  if (length == 0 || length >= MAX_LABEL_LENGTH ||
+      cursor[length + strspn(cursor + length, " \t")] != separator) {
+    fprintf(stderr,
+            "(ERROR) [constants] expected %s NAME%s value at line %d\n",
+            directive, separator == '=' ? " =" : ",", line_number);
+    return false;
+  }
+
+  memcpy(name, cursor, length);
+  name[length] = '\0';
+  cursor += length;
+  cursor += strspn(cursor, " \t") + 1; /* past the separator */
+  cursor += strspn(cursor, " \t");
+
+  if (is_reserved_word(name) || is_illegal_name(name)) {
+    fprintf(stderr,
+            "(ERROR) [constants] '%s' is a reserved word, not a constant at "
+            "line %d\n",
+            name, line_number);
+    return false;
+  }
+
+  existing = const_find(name, length);
+  if (existing) {
+    fprintf(stderr,
+            "(ERROR) [constants] constant '%s' at line %d was already "
+            "defined at line %d\n",
+            name, line_number, existing->line_number);
+    return false;
+  }
+
+  switch (const_number(cursor, -CONST_LIMIT, CONST_LIMIT, &value,
+                       line_number)) {
+  case FOLD_OK:
+    break;
+
+  case FOLD_OUT_OF_RANGE:
+    fprintf(stderr,
+            "(ERROR) [constants] value of '%s' out of range (%d to %d) at "
+            "line %d\n",
+            name, -CONST_LIMIT, CONST_LIMIT, line_number);
+    return false;
+
+  case FOLD_INVALID:
+    fprintf(stderr,
+            "(ERROR) [constants] invalid value for '%s' at line %d near "
+            "'%s'\n",
+            name, line_number, cursor);
+    return false;
+
+  default:
+    return false;
+  }
+
+  if (!const_grow())
+    return false;
+
+  constant = safe_calloc(1, sizeof(Constant));
+  if (!constant)
+    return false;
+
+  strcpy(constant->name, name);
+  constant->value = value;
+  constant->line_number = line_number;
+
+  bucket = hash_string(name) & (bucket_count - 1);
+  constant->bucket_next = buckets[bucket];
+  buckets[bucket] = constant;
+  constant_count++;
+
+  return true;
+}
+
+FoldStatus const_number(const char *text, int min, int max, int *out,
+                        int line_number) {
+  Fold fold;
+  long value;
+
+  /* literals, by far the most, don't need folding (parse_number checks
+   * the magnitude for the sign, a range above 0 is checked here) */
+  switch (parse_number(text, min, max, out)) {
+  case NUM_OK:
+    if (*out >= min && *out <= max)
+      return FOLD_OK;
+    *out = *out < min ? min : max;
+    return FOLD_OUT_OF_RANGE;
+  case NUM_OUT_OF_RANGE:
+    return FOLD_OUT_OF_RANGE;
+  default:
+    break;
+  }
+
+  *out = 0;
+  fold.cursor = text;
+  fold.line_number = line_number;
+  fold.status = FOLD_OK;
+
+  value = fold_sum(&fold);
+  skip_blanks(&fold);
+  if (fold.status == FOLD_OK && *fold.cursor != '\0')
+    fold.status = FOLD_INVALID;
+
+  if (fold.status == FOLD_OUT_OF_RANGE) {
+    *out = value < 0 ? min : max;
+    return FOLD_OUT_OF_RANGE;
+  }
+
+  if (fold.status != FOLD_OK)
+    return fold.status;
+
+  if (value < min || value > max) {
+    *out = value < min ? min : max;
+    return FOLD_OUT_OF_RANGE;
+  }
+
+  *out = (int)value;
+  return FOLD_OK;
+}
+
+int const_uses(void) { return use_count; }
+
+void const_forget(void) {
+  size_t bucket;
+
+  for (bucket = 0; bucket < bucket_count; bucket++) {
+    while (buckets[bucket]) {
+      Constant *next = buckets[bucket]->bucket_next;
+
+      free(buckets[bucket]);
+      buckets[bucket] = next;
+    }
+  }
+
+  free(buckets);
+  buckets = NULL;
+  bucket_count = 0;
+  constant_count = 0;
+  use_count = 0;
+}
+
+/* ======================================================================= */
+/* ========================== static helpers ============================== */
+/* ======================================================================= */
+
+/* fold_sum -- <product> [(+|-) <product>]... */
+static long fold_sum(Fold *fold) {
+  long value = fold_product(fold);
+
+  while (fold->status == FOLD_OK) {
+    char op;
+    long right;
+
+    skip_blanks(fold);
+    op = *fold->cursor;
+    if (op != '+' && op != '-')
+      break;
+
+    fold->cursor++;
+    right = fold_product(fold);
+    value = fold_check(fold, op == '+' ? value + right : value - right);
+  }
+
+  return value;
+}
+
+/* fold_product -- <unary> [(*|/|%) <unary>]... */
+static long fold_product(Fold *fold) {
+  long value = fold_unary(fold);
+
+  while (fold->status == FOLD_OK) {
+    char op;
+    long right;
+
+    skip_blanks(fold);
+    op = *fold->cursor;
+    if (op != '*' && op != '/' && op != '%')
+      break;
+
+    fold->cursor++;
+    right = fold_unary(fold);
+    if (fold->status != FOLD_OK)
+      break;
+
+    if (op == '*') {
+      /* both are within CONST_LIMIT, the product fits a long */
+      value = fold_check(fold, value * right);
+    } else if (right == 0) {
+      fprintf(stderr, "(ERROR) [constants] division by zero at line %d\n",
+              fold->line_number);
+      fold->status = FOLD_FAILED;
+    } else {
+      /* ldiv truncates toward zero, / on negatives may not (C89) */
+      ldiv_t result = ldiv(value, right);
+
+      value = op == '/' ? result.quot : result.rem;
+    }
+  }
+
+  return value;
+}
+
+/* fold_unary -- [+|-]... <primary> */
+static long fold_unary(Fold *fold) {
+  skip_blanks(fold);
+
+  if (*fold->cursor == '-') {
+    fold->cursor++;
+    return -fold_unary(fold);
+  }
+
+  if (*fold->cursor == '+') {
+    fold->cursor++;
+    return fold_unary(fold);
+  }
+
+  return fold_primary(fold);
+}
+
+/* fold_primary -- a number, a constant or (<sum>) */
+static long fold_primary(Fold *fold) {
+  const char *start;
+  long value = 0;
+  size_t length;
+
+  skip_blanks(fold);
+  start = fold->cursor;
+
+  if (*start == '(') {
+    fold->cursor++;
+    value = fold_sum(fold);
+    skip_blanks(fold);
+    if (*fold->cursor == ')')
+      fold->cursor++;
+    else if (fold->status == FOLD_OK)
+      fold->status = FOLD_INVALID;
+    return value;
+  }
+
+  if (isdigit((unsigned char)*start)) {
+    /* digits past the limit are still read, to report the range */
+    while (isdigit((unsigned char)*fold->cursor)) {
+      if (value <= CONST_LIMIT)
+        value = value * 10 + (*fold->cursor - '0');
+      fold->cursor++;
+    }
+    return fold_check(fold, value);
+  }
+
+  length = name_length(start);
+  if (length > 0) {
+    const Constant *constant = const_find(start, length);
+
+    if (!constant) {
+      fprintf(stderr,
+              "(ERROR) [constants] '%.*s' is not a defined constant at line "
+              "%d\n",
+              (int)length, start, fold->line_number);
+      fold->status = FOLD_FAILED;
+      return 0;
+    }
+
+    fold->cursor += length;
+    use_count++;
+    return constant->value;
+  }
+
+  fold->status = FOLD_INVALID;
+  return 0;
+}
+
+/* fold_check -- value, or the limit it passed (FOLD_OUT_OF_RANGE) */
+static long fold_check(Fold *fold, long value) {
+  if (value >= -CONST_LIMIT && value <= CONST_LIMIT)
+    return value;
+
+  if (fold->status == FOLD_OK)
+    fold->status = FOLD_OUT_OF_RANGE;
+  return value < 0 ? -CONST_LIMIT : CONST_LIMIT;
+}
+
+/* skip_blanks -- move the cursor past spaces and tabs */
+static void skip_blanks(Fold *fold) {
+  fold->cursor += strspn(fold->cursor, " \t");
+}
+
+/* name_length -- the length of the name text starts with (a letter, then
+ * letters and digits, like a label), 0 if it doesn't start with one */
+static size_t name_length(const char *text) {
+  size_t length = 0;
+
+  if (!isalpha((unsigned char)text[0]))
+    return 0;
+
+  while (isalnum((unsigned char)text[length]))
+    length++;
+
+  return length;
+}
+
+/* const_find -- the constant named by the length chars of name, or NULL */
+static Constant *const_find(const char *name, size_t length) {
+  char key[MAX_LABEL_LENGTH];
+  Constant *constant;
+
+  if (!buckets || length >= MAX_LABEL_LENGTH)
+    return NULL;
+
+  memcpy(key, name, length);
+  key[length] = '\0';
+
+  constant = buckets[hash_string(key) & (bucket_count - 1)];
+  for (; constant; constant = constant->bucket_next) {
+    if (strcmp(constant->name, key) == 0)
+      return constant;
+  }
+
+  return NULL;
+}
+
+/* const_grow -- make room for one more constant: the table is made the
+ * first time and rehashed twice as wide once it has more constants than
+ * buckets (without memory for that, the chains just get longer)
+ *
+ * returns true on success, false if there's no table (error printed) */
+static bool const_grow(void) {
+  size_t new_count;
+  Constant **grown;
+  size_t bucket;
+
+  if (constant_count + 1 <= bucket_count)
+    return true;
+
+  new_count = bucket_count ? bucket_count * 2 : CONST_MIN_BUCKETS;
+  grown = safe_calloc(new_count, sizeof(Constant *));
+  if (!grown)
+    return buckets != NULL;
+
+  for (bucket = 0; bucket < bucket_count; bucket++) {
+    while (buckets[bucket]) {
+      Constant *constant = buckets[bucket];
+      size_t slot = hash_string(constant->name) & (new_count - 1);
+
+      buckets[bucket] = constant->bucket_next;
+      constant->bucket_next = grown[slot];
+      grown[slot] = constant;
+    }
+  }
+
+  free(buckets);
+  buckets = grown;
+  bucket_count = new_count;
+  return true;
+}
@@ -0,0 +1,57 @@
+#ifndef CONSTANTS_H
+#define CONSTANTS_H
+
+#include "types.h"
+
+/* constants.h -- named constants and the constant expressions that use
+ * them, folded while the first pass reads a file
+ *
+ *   .define NAME = <expr>
+ *   .equ NAME, <expr>
+ *
+ * an expression is decimal numbers and constants (defined on an earlier
+ * line) with + - * / % (usual precedence, / and % truncate), unary + -
+ * and parentheses. one may go wherever a number does: an immediate
+ * (#<expr>), a .data or .mat value and a .mat dimension, the range is
+ * checked on the folded value. the table is hashed, a file's constants are
+ * forgotten when its first pass ends */
+
+#define DEFINE_DIRECTIVE ".define"
+#define EQU_DIRECTIVE ".equ"
+#define CONST_MIN_BUCKETS 64 /* smallest table (power of 2) */
+#define CONST_LIMIT 32767    /* largest magnitude a fold may reach */
+
+/* fold_status -- what const_number made of a text */
+typedef enum FoldStatus {
+  FOLD_OK,           /* a number or an expression, within range */
+  FOLD_INVALID,      /* neither */
+  FOLD_OUT_OF_RANGE, /* folded, but outside the requested range */
+  FOLD_FAILED        /* an expression in error (error printed) */
+} FoldStatus;
+
+/* const_define -- define the constant of a .define (NAME = <expr>) or .equ
+ * (NAME, <expr>) line, directive is which one
+ *
+ * returns true on success, false on error (error printed)
+ */
+bool const_define(const char *directive, const char *operands,
+                  int line_number);
+
+/* const_number -- parse_number for a place an expression may go: a literal
+ * is parsed as is, anything else is folded. on FOLD_OUT_OF_RANGE *out gets
+ * the value clamped to [min, max], on error 0
+ *
+ * returns a FoldStatus
+ */
+FoldStatus const_number(const char *text, int min, int max, int *out,
+                        int line_number);
+
+/* const_uses -- how many times a constant was read by const_number since
+ * the table was last forgotten (a line that read one can't be replayed
+ * from a line cache: the value may change from build to build) */
+int const_uses(void);
+
+/* const_forget -- free the table, for the next file */
+void const_forget(void);
+
+#endif /* CONSTANTS_H */
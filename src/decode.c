@@ -0,0 +1,73 @@
+#include "ob_reader.h"
+#include "instruction_image.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* decode -- prints the words of .ob files (make decode)
+ *
+ *   decode [-q] file.ob...
+ *
+ * one "address binary value" row per word, value is the word as a signed
+ * 10-bit number. -q prints one summary row per file instead */
+
+#define QUIET_OPTION "-q"
+
+static void print_image(const ObImage *image);
+
+int main(int argc, char **argv) {
+  bool is_quiet = false;
+  int failed = 0;
+  int idx;
+
+  for (idx = 1; idx < argc; idx++) {
+    ObImage *image;
+
+    if (strcmp(argv[idx], QUIET_OPTION) == 0) {
+      is_quiet = true;
+      continue;
+    }
+
+    image = ob_read(argv[idx]);
+    if (!image) {
+      failed++;
+      continue;
+    }
+
+    if (is_quiet)
+      printf("%s: %lu words from address %u\n", argv[idx],
+             (unsigned long)image->word_count, image->base);
+    else
+      print_image(image);
+
+    ob_free(image);
+  }
+
+  if (argc < 2) {
+    fprintf(stderr, "(ERROR) [decode] usage: %s [%s] [file.ob]...\n", argv[0],
+            QUIET_OPTION);
+    return EXIT_FAILURE;
+  }
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* print_image -- one row per word */
+static void print_image(const ObImage *image) {
+  size_t idx;
+
+  for (idx = 0; idx < image->word_count; idx++) {
+    char bits[WORD_SIZE + 1];
+    int word = image->words[idx];
+    int bit;
+
+    for (bit = 0; bit < WORD_SIZE; bit++)
+      bits[bit] = (word >> (WORD_SIZE - 1 - bit)) & 1 ? '1' : '0';
+    bits[WORD_SIZE] = '\0';
+
+    /* sign-extend the 10-bit word */
+    printf("%04lu  %s  %4d\n",
+           (unsigned long)((image->base + idx) & WORD_MASK), bits,
+           word > MAX_WORD_VAL ? word - (WORD_MASK + 1) : word);
+  }
+}
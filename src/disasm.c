@@ -0,0 +1,197 @@
+#include "disassembler.h"
+#include "helpers.h"
+#include "ob_reader.h"
+#include "object_file.h"
+#include "second_pass.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* disasm -- prints object files as assembly source (make disasm)
+ *
+ *   disasm file.ob|file.obj...
+ *
+ * the source goes to stdout, one file after the other (each starts with a
+ * comment naming it). an .ob gets its labels from file.ent and file.ext
+ * when they're there, an .obj has them inside. see disassembler.h */
+
+/* symbol_rows -- the rows of an .ent/.ext file */
+typedef struct SymbolRows {
+  DisasmSymbol symbols[MAX_WORDS_MEMORY];
+  char names[MAX_WORDS_MEMORY][MAX_SYMBOL_LENGTH];
+  int count;
+} SymbolRows;
+
+static bool disassemble_text(const char *filename);
+static bool disassemble_binary(const char *filename);
+static bool load_symbols(const char *filename, const char *ext,
+                         SymbolRows *rows);
+
+int main(int argc, char **argv) {
+  int failed = 0;
+  int idx;
+
+  if (argc < 2) {
+    fprintf(stderr, "(ERROR) [disasm] usage: %s [file.ob|file.obj]...\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  for (idx = 1; idx < argc; idx++) {
+    bool ok = object_file_is_binary(argv[idx]) ? disassemble_binary(argv[idx])
+                                               : disassemble_text(argv[idx]);
+    if (!ok)
+      failed++;
+  }
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* disassemble_text -- an .ob, with the .ent/.ext next to it
+ *
+ * returns true on success, false on error (error printed) */
+static bool disassemble_text(const char *filename) {
+  SymbolRows *entries = safe_calloc(1, sizeof(SymbolRows));
+  SymbolRows *externs = safe_calloc(1, sizeof(SymbolRows));
+  DisasmInput input;
+  ObImage *image = NULL;
+  bool ok = false;
+
+  if (entries && externs && load_symbols(filename, ".ent", entries) &&
+      load_symbols(filename, ".ext", externs))
+    image = ob_read(filename);
+
+  if (image) {
+    input.name = filename;
+    input.words = image->words;
+    input.word_count = image->word_count;
+    input.base = (int)image->base;
+    input.code_count = -1; /* an .ob doesn't say */
+    input.entries = entries->symbols;
+    input.entry_count = entries->count;
+    input.externs = externs->symbols;
+    input.extern_count = externs->count;
+    ok = disassemble(&input, stdout);
+  }
+
+  ob_free(image);
+  free(entries);
+  free(externs);
+  return ok;
+}
+
+/* disassemble_binary -- an .obj, its entries and extern words are inside
+ *
+ * returns true on success, false on error (error printed) */
+static bool disassemble_binary(const char *filename) {
+  ObjectFile *obj = object_file_open(filename);
+  DisasmSymbol *entries, *externs;
+  DisasmInput input;
+  unsigned int idx;
+  bool ok;
+
+  if (!obj)
+    return false;
+
+  entries = safe_calloc(obj->header.entry_count + 1, sizeof(DisasmSymbol));
+  externs = safe_calloc(obj->header.reloc_count + 1, sizeof(DisasmSymbol));
+  if (!entries || !externs) {
+    free(entries);
+    free(externs);
+    object_file_close(obj);
+    return false;
+  }
+
+  input.name = filename;
+  input.words = obj->words;
+  input.word_count = obj->header.code_count + obj->header.data_count;
+  input.base = (int)obj->header.code_base;
+  input.code_count = (int)obj->header.code_count;
+  input.entries = entries;
+  input.entry_count = (int)obj->header.entry_count;
+  input.externs = externs;
+  input.extern_count = 0;
+
+  for (idx = 0; idx < obj->header.entry_count; idx++) {
+    entries[idx].name = obj->strings + obj->entries[idx].name_offset;
+    entries[idx].address = (int)obj->entries[idx].address;
+  }
+
+  /* every external word is a reloc naming its extern */
+  for (idx = 0; idx < obj->header.reloc_count; idx++) {
+    const ObjectReloc *reloc = &obj->relocs[idx];
+
+    if (reloc->are != ARE_EXTERNAL)
+      continue;
+
+    externs[input.extern_count].name =
+        obj->strings + obj->externs[reloc->symbol].name_offset;
+    externs[input.extern_count].address = reloc->address;
+    input.extern_count++;
+  }
+
+  ok = disassemble(&input, stdout);
+
+  free(entries);
+  free(externs);
+  object_file_close(obj);
+  return ok;
+}
+
+/* load_symbols -- read the "<name> <address>" rows of filename with its
+ * extension swapped for ext, if that file exists
+ *
+ * returns true on success, false on error (error printed) */
+static bool load_symbols(const char *filename, const char *ext,
+                         SymbolRows *rows) {
+  char symbol_filename[MAX_FILENAME_LENGTH + EXT_LENGTH];
+  char line[MAX_LINE_LENGTH];
+  const char *dot = strrchr(filename, '.');
+  const char *slash = strrchr(filename, '/');
+  size_t base_length = strlen(filename);
+  int line_number = 0;
+  FILE *fp;
+
+  if (dot && (!slash || dot > slash))
+    base_length = (size_t)(dot - filename);
+
+  if (base_length + strlen(ext) >= sizeof(symbol_filename)) {
+    fprintf(stderr, "(ERROR) [disasm] filename too long for '%s'\n",
+            filename);
+    return false;
+  }
+
+  memcpy(symbol_filename, filename, base_length);
+  strcpy(symbol_filename + base_length, ext);
+
+  rows->count = 0;
+  fp = fopen(symbol_filename, "r");
+  if (!fp)
+    return true; /* no labels of that kind */
+
+  while (fgets(line, sizeof(line), fp)) {
+    char name[MAX_LINE_LENGTH];
+    char addr_letters[MAX_LINE_LENGTH];
+    int address;
+
+    line_number++;
+
+    if (sscanf(line, "%80s %80s", name, addr_letters) != 2 ||
+        strlen(name) >= MAX_SYMBOL_LENGTH ||
+        (address = base4_letters_to_decimal(addr_letters)) < 0 ||
+        rows->count == MAX_WORDS_MEMORY) {
+      fprintf(stderr, "(ERROR) [disasm] bad row in '%s' at line %d\n",
+              symbol_filename, line_number);
+      fclose(fp);
+      return false;
+    }
+
+    strcpy(rows->names[rows->count], name);
+    rows->symbols[rows->count].name = rows->names[rows->count];
+    rows->symbols[rows->count].address = address;
+    rows->count++;
+  }
+
+  fclose(fp);
+  return true;
+}
@@ -0,0 +1,488 @@
+#include "disassembler.h"
+#include "helpers.h"
+#include "instruction_image.h"
+#include "instruction_utils.h"
+#include "second_pass.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* disassembler -- decode table, label discovery and the source writer */
+
+#define SHAPE_COUNT (1 << WORD_SIZE) /* every possible first word */
+#define NOT_AN_INSTRUCTION (-1)
+#define REGISTER_COUNT 8
+#define WORD_SIGN_BIT 0x200 /* bit 9 */
+#define IMM_SIGN_BIT 0x80   /* bit 7 of the 8-bit immediate */
+#define SYNTHETIC_LENGTH 8  /* "L255"/"X255" and the terminator, rounded up */
+#define OPERAND_LENGTH (MAX_SYMBOL_LENGTH + 16) /* "LABEL[r1][r2]" and more */
+#define LABEL_COLUMN 8      /* instructions and .data start here */
+#define DATA_PER_LINE 6     /* keeps a .data line under MAX_LINE_LENGTH */
+
+/* opcodes, as in instruction_info_table */
+#define OP_JMP 9
+#define OP_BNE 10
+#define OP_JSR 11
+
+/* disasm_shape -- what a first word says about its instruction */
+typedef struct DisasmShape {
+  signed char opcode; /* NOT_AN_INSTRUCTION if the word can't start one */
+  unsigned char src_mode;
+  unsigned char dst_mode;
+  unsigned char has_src;
+  unsigned char has_dst;
+  unsigned char length; /* words, compute_instruction_length */
+} DisasmShape;
+
+/* disasm_operand -- one decoded operand */
+typedef struct DisasmOperand {
+  int mode;
+  int value; /* immediate value, register, or address (direct/matrix) */
+  int are;   /* of the address word (direct/matrix) */
+  int word;  /* address of the address word (direct/matrix) */
+  int row;   /* matrix index registers */
+  int col;
+} DisasmOperand;
+
+/* disasm -- one image being disassembled */
+typedef struct Disasm {
+  const DisasmInput *input;
+  int end;      /* first address after the image */
+  int code_end; /* first address of the data */
+  const char *labels[MAX_WORDS_MEMORY];  /* defined at address, or NULL */
+  const char *externs[MAX_WORDS_MEMORY]; /* used by the word at address */
+  char synthetic[MAX_WORDS_MEMORY][SYNTHETIC_LENGTH]; /* "L<address>" */
+  char synthetic_externs[MAX_WORDS_MEMORY][SYNTHETIC_LENGTH]; /* "X<...>" */
+} Disasm;
+
+typedef void (*OperandFormat)(const Disasm *d, const DisasmOperand *operand,
+                              char *out);
+
+static void build_shapes(void);
+static bool decode_operands(const Disasm *d, int address, DisasmOperand *src,
+                            DisasmOperand *dst);
+static bool decode_operand(const Disasm *d, int mode, int reg_shift,
+                           int *word_idx, DisasmOperand *operand);
+static int find_code_end(const Disasm *d, int limit, bool is_exact);
+static void collect_labels(Disasm *d);
+static void name_operand(Disasm *d, const DisasmOperand *operand);
+static void write_source(const Disasm *d, FILE *out);
+static void write_externs(const Disasm *d, FILE *out);
+static void write_label(const Disasm *d, int address, bool *is_placed,
+                        FILE *out);
+static void write_instruction(const Disasm *d, int address, FILE *out);
+static int write_data(const Disasm *d, int address, FILE *out);
+static void format_immediate(const Disasm *d, const DisasmOperand *operand,
+                             char *out);
+static void format_direct(const Disasm *d, const DisasmOperand *operand,
+                          char *out);
+static void format_matrix(const Disasm *d, const DisasmOperand *operand,
+                          char *out);
+static void format_register(const Disasm *d, const DisasmOperand *operand,
+                            char *out);
+static const char *symbol_of(const Disasm *d, const DisasmOperand *operand);
+static int word_at(const Disasm *d, int address);
+
+static DisasmShape shapes[SHAPE_COUNT];
+static bool shapes_ready = false;
+
+/* by addressing mode */
+static const OperandFormat operand_formats[] = {
+    format_immediate, format_direct, format_matrix, format_register};
+
+/* ======================================================================= */
+/* ===================== public api -- see header ======================== */
+/* ======================================================================= */
+
+bool disassemble(const DisasmInput *input, FILE *out) {
+  Disasm *d;
+  int limit;
+
+  if (input->base < 0 ||
+      (size_t)input->base + input->word_count > MAX_WORDS_MEMORY) {
+    fprintf(stderr, "(ERROR) [disassembler] '%s' does not fit in %d words\n",
+            input->name, MAX_WORDS_MEMORY);
+    return false;
+  }
+
+  if (!shapes_ready)
+    build_shapes();
+
+  d = safe_calloc(1, sizeof(Disasm));
+  if (!d)
+    return false;
+
+  d->input = input;
+  d->end = input->base + (int)input->word_count;
+
+  limit = d->end;
+  if (input->code_count >= 0 && input->base + input->code_count < limit)
+    limit = input->base + input->code_count;
+
+  d->code_end = find_code_end(d, limit, input->code_count >= 0);
+  if (input->code_count >= 0 && d->code_end < limit)
+    fprintf(stderr,
+            "(WARNING) [disassembler] '%s': the word at %d is not an "
+            "instruction, the code after it is written as .data\n",
+            input->name, d->code_end);
+
+  collect_labels(d);
+  write_source(d, out);
+
+  free(d);
+  return true;
+}
+
+/* ======================================================================= */
+
+/* build_shapes -- decode every possible first word once: opcode and modes
+ * from their fields, checked against instruction_info_table (a missing
+ * operand's mode is -1 masked, all ones, see emit_first_word; A/R/E is
+ * absolute) */
+static void build_shapes(void) {
+  int word;
+
+  for (word = 0; word < SHAPE_COUNT; word++) {
+    int opcode = (word >> OPCODE_SHIFT) & OPCODE_MASK;
+    int src_mode = (word >> SRC_MODE_SHIFT) & ADDR_MODE_MASK;
+    int dst_mode = (word >> DST_MODE_SHIFT) & ADDR_MODE_MASK;
+    const InstructionInfo *info = get_instruction_info(opcode);
+    DisasmShape *shape = &shapes[word];
+    bool has_src, has_dst;
+
+    shape->opcode = NOT_AN_INSTRUCTION;
+    if (!info || (word & ARE_MASK) != ARE_ABSOLUTE)
+      continue;
+
+    has_src = info->allowed_src != 0;
+    has_dst = info->allowed_dst != 0;
+    if (has_src ? !(info->allowed_src & (1 << src_mode))
+                : src_mode != ADDR_MODE_MASK)
+      continue;
+    if (has_dst ? !(info->allowed_dst & (1 << dst_mode))
+                : dst_mode != ADDR_MODE_MASK)
+      continue;
+
+    shape->opcode = (signed char)opcode;
+    shape->src_mode = (unsigned char)src_mode;
+    shape->dst_mode = (unsigned char)dst_mode;
+    shape->has_src = (unsigned char)has_src;
+    shape->has_dst = (unsigned char)has_dst;
+    shape->length = (unsigned char)compute_instruction_length(
+        has_src ? src_mode : -1, has_dst ? dst_mode : -1,
+        has_src ? "" : NULL, has_dst ? "" : NULL);
+  }
+
+  shapes_ready = true;
+}
+
+/* decode_operands -- the operands of the instruction at address (its shape
+ * is valid and it fits in the image), a missing one gets mode -1
+ *
+ * returns true if every operand word is well-formed */
+static bool decode_operands(const Disasm *d, int address, DisasmOperand *src,
+                            DisasmOperand *dst) {
+  const DisasmShape *shape = &shapes[word_at(d, address)];
+  int word_idx = address + 1;
+
+  src->mode = -1;
+  dst->mode = -1;
+
+  if (shape->has_src && shape->has_dst &&
+      shape->src_mode == ADDR_MODE_REGISTER &&
+      shape->dst_mode == ADDR_MODE_REGISTER) {
+    /* both registers share one word */
+    if (!decode_operand(d, shape->src_mode, REG_SRC_SHIFT, &word_idx, src))
+      return false;
+    word_idx--;
+    return decode_operand(d, shape->dst_mode, REG_DST_SHIFT, &word_idx, dst);
+  }
+
+  if (shape->has_src &&
+      !decode_operand(d, shape->src_mode, REG_SRC_SHIFT, &word_idx, src))
+    return false;
+
+  return !shape->has_dst ||
+         decode_operand(d, shape->dst_mode, REG_DST_SHIFT, &word_idx, dst);
+}
+
+/* decode_operand -- decode the operand words at *word_idx and move past
+ * them, reg_shift picks the register field (REG_SRC_SHIFT/REG_DST_SHIFT)
+ *
+ * returns true if the words are what the assembler writes for mode */
+static bool decode_operand(const Disasm *d, int mode, int reg_shift,
+                           int *word_idx, DisasmOperand *operand) {
+  int word = word_at(d, (*word_idx)++);
+
+  operand->mode = mode;
+
+  switch (mode) {
+  case ADDR_MODE_IMMEDIATE:
+    operand->value = (word >> IMM_DATA_SHIFT) & IMM_MASK;
+    if (operand->value & IMM_SIGN_BIT)
+      operand->value -= IMM_MASK + 1;
+    return (word & ARE_MASK) == ARE_ABSOLUTE;
+
+  case ADDR_MODE_REGISTER:
+    operand->value = (word >> reg_shift) & NIBBLE_MASK;
+    return (word & ARE_MASK) == ARE_ABSOLUTE &&
+           operand->value < REGISTER_COUNT;
+
+  case ADDR_MODE_DIRECT:
+  case ADDR_MODE_MATRIX:
+    operand->word = *word_idx - 1;
+    operand->are = word & ARE_MASK;
+    operand->value = word >> ADDRESS_PAYLOAD_SHIFT;
+    if (operand->are == ARE_ABSOLUTE ||
+        (operand->are == ARE_EXTERNAL && operand->value != 0))
+      return false;
+    if (mode == ADDR_MODE_DIRECT)
+      return true;
+
+    /* matrix: the index registers follow the address */
+    word = word_at(d, (*word_idx)++);
+    operand->row = (word >> REG_SRC_SHIFT) & NIBBLE_MASK;
+    operand->col = (word >> REG_DST_SHIFT) & NIBBLE_MASK;
+    return (word & ARE_MASK) == ARE_ABSOLUTE &&
+           operand->row < REGISTER_COUNT && operand->col < REGISTER_COUNT;
+  }
+
+  return false;
+}
+
+/* find_code_end -- walk the instructions from the base up to limit, unless
+ * is_exact, an operand that refers to data further on (not a jump target)
+ * moves limit down to it
+ *
+ * returns the address of the first word that isn't code */
+static int find_code_end(const Disasm *d, int limit, bool is_exact) {
+  int address = d->input->base;
+
+  while (address < limit) {
+    const DisasmShape *shape = &shapes[word_at(d, address)];
+    DisasmOperand operands[2];
+    int idx;
+
+    if (shape->opcode == NOT_AN_INSTRUCTION ||
+        address + shape->length > limit ||
+        !decode_operands(d, address, &operands[0], &operands[1]))
+      break;
+
+    for (idx = 0; idx < 2 && !is_exact; idx++) {
+      const DisasmOperand *operand = &operands[idx];
+
+      if (shape->opcode == OP_JMP || shape->opcode == OP_BNE ||
+          shape->opcode == OP_JSR)
+        break;
+
+      if ((operand->mode == ADDR_MODE_DIRECT ||
+           operand->mode == ADDR_MODE_MATRIX) &&
+          operand->are == ARE_RELOCATABLE && operand->value > address &&
+          operand->value < limit)
+        limit = operand->value;
+    }
+
+    address += shape->length;
+  }
+
+  return address;
+}
+
+/* collect_labels -- the known entries and externs, then a made up name for
+ * every other address or extern word the code refers to */
+static void collect_labels(Disasm *d) {
+  const DisasmInput *input = d->input;
+  int address;
+  int idx;
+
+  for (idx = 0; idx < input->entry_count; idx++) {
+    address = input->entries[idx].address;
+    if (address >= 0 && address < MAX_WORDS_MEMORY)
+      d->labels[address] = input->entries[idx].name;
+  }
+
+  for (idx = 0; idx < input->extern_count; idx++) {
+    address = input->externs[idx].address;
+    if (address >= 0 && address < MAX_WORDS_MEMORY)
+      d->externs[address] = input->externs[idx].name;
+  }
+
+  for (address = input->base; address < d->code_end;
+       address += shapes[word_at(d, address)].length) {
+    DisasmOperand src, dst;
+
+    decode_operands(d, address, &src, &dst);
+    name_operand(d, &src);
+    name_operand(d, &dst);
+  }
+}
+
+/* name_operand -- make up a name for what a direct/matrix operand refers to,
+ * if it has none */
+static void name_operand(Disasm *d, const DisasmOperand *operand) {
+  if (operand->mode != ADDR_MODE_DIRECT && operand->mode != ADDR_MODE_MATRIX)
+    return;
+
+  if (operand->are == ARE_EXTERNAL) {
+    if (!d->externs[operand->word]) {
+      sprintf(d->synthetic_externs[operand->word], "X%d", operand->word);
+      d->externs[operand->word] = d->synthetic_externs[operand->word];
+    }
+  } else if (!d->labels[operand->value]) {
+    sprintf(d->synthetic[operand->value], "L%d", operand->value);
+    d->labels[operand->value] = d->synthetic[operand->value];
+  }
+}
+
+/* write_source -- the header, .entry/.extern lines, the code, the data, and
+ * a warning for every label that landed inside an instruction or outside
+ * the image */
+static void write_source(const Disasm *d, FILE *out) {
+  const DisasmInput *input = d->input;
+  bool is_placed[MAX_WORDS_MEMORY];
+  int address;
+  int idx;
+
+  memset(is_placed, 0, sizeof(is_placed));
+
+  fprintf(out, "; %s: %d words of code and %d of data from address %d\n",
+          input->name, d->code_end - input->base, d->end - d->code_end,
+          input->base);
+
+  for (idx = 0; idx < input->entry_count; idx++)
+    fprintf(out, ".entry %s\n", input->entries[idx].name);
+  write_externs(d, out);
+  fputc('\n', out);
+
+  for (address = input->base; address < d->code_end;
+       address += shapes[word_at(d, address)].length) {
+    write_label(d, address, is_placed, out);
+    write_instruction(d, address, out);
+  }
+
+  while (address < d->end) {
+    write_label(d, address, is_placed, out);
+    address = write_data(d, address, out);
+  }
+
+  for (address = 0; address < MAX_WORDS_MEMORY; address++) {
+    if (d->labels[address] && !is_placed[address])
+      fprintf(stderr,
+              "(WARNING) [disassembler] '%s': label '%s' (address %d) is not "
+              "at an instruction or data word\n",
+              input->name, d->labels[address], address);
+  }
+}
+
+/* write_externs -- one .extern line per extern name the code uses */
+static void write_externs(const Disasm *d, FILE *out) {
+  int address, earlier;
+
+  for (address = d->input->base; address < d->code_end; address++) {
+    if (!d->externs[address])
+      continue;
+
+    for (earlier = d->input->base; earlier < address; earlier++) {
+      if (d->externs[earlier] &&
+          strcmp(d->externs[earlier], d->externs[address]) == 0)
+        break;
+    }
+
+    if (earlier == address)
+      fprintf(out, ".extern %s\n", d->externs[address]);
+  }
+}
+
+/* write_label -- "LABEL:" padded to LABEL_COLUMN, or just the padding */
+static void write_label(const Disasm *d, int address, bool *is_placed,
+                        FILE *out) {
+  int width = 0;
+
+  if (d->labels[address]) {
+    width = fprintf(out, "%s:", d->labels[address]);
+    is_placed[address] = true;
+  }
+
+  do {
+    fputc(' ', out);
+  } while (++width < LABEL_COLUMN);
+}
+
+/* write_instruction -- "name src, dst" of the instruction at address */
+static void write_instruction(const Disasm *d, int address, FILE *out) {
+  const DisasmShape *shape = &shapes[word_at(d, address)];
+  const InstructionInfo *info = get_instruction_info(shape->opcode);
+  char src_text[OPERAND_LENGTH], dst_text[OPERAND_LENGTH];
+  DisasmOperand src, dst;
+
+  decode_operands(d, address, &src, &dst);
+
+  if (shape->has_src && shape->has_dst) {
+    operand_formats[src.mode](d, &src, src_text);
+    operand_formats[dst.mode](d, &dst, dst_text);
+    fprintf(out, "%s %s, %s\n", info->name, src_text, dst_text);
+  } else if (shape->has_dst) {
+    operand_formats[dst.mode](d, &dst, dst_text);
+    fprintf(out, "%s %s\n", info->name, dst_text);
+  } else {
+    fprintf(out, "%s\n", info->name);
+  }
+}
+
+/* write_data -- a .data line from address, up to DATA_PER_LINE words and not
+ * past the next label
+ *
+ * returns the address after it */
+static int write_data(const Disasm *d, int address, FILE *out) {
+  int count = 0;
+
+  fputs(".data", out);
+  do {
+    int word = word_at(d, address);
+
+    /* the 10-bit word as a signed number */
+    fprintf(out, "%s%d", count ? ", " : " ",
+            ((word & WORD_MASK) ^ WORD_SIGN_BIT) - WORD_SIGN_BIT);
+    address++;
+  } while (++count < DATA_PER_LINE && address < d->end &&
+           !d->labels[address]);
+  fputc('\n', out);
+
+  return address;
+}
+
+static void format_immediate(const Disasm *d, const DisasmOperand *operand,
+                             char *out) {
+  (void)d;
+  sprintf(out, "#%d", operand->value);
+}
+
+static void format_direct(const Disasm *d, const DisasmOperand *operand,
+                          char *out) {
+  strcpy(out, symbol_of(d, operand));
+}
+
+static void format_matrix(const Disasm *d, const DisasmOperand *operand,
+                          char *out) {
+  sprintf(out, "%s[r%d][r%d]", symbol_of(d, operand), operand->row,
+          operand->col);
+}
+
+static void format_register(const Disasm *d, const DisasmOperand *operand,
+                            char *out) {
+  (void)d;
+  sprintf(out, "r%d", operand->value);
+}
+
+/* symbol_of -- the name a direct/matrix operand refers to (collect_labels
+ * gave every one a name) */
+static const char *symbol_of(const Disasm *d, const DisasmOperand *operand) {
+  if (operand->are == ARE_EXTERNAL)
+    return d->externs[operand->word];
+
+  return d->labels[operand->value];
+}
+
+/* word_at -- the image word at address (which is in the image) */
+static int word_at(const Disasm *d, int address) {
+  return d->input->words[address - d->input->base] & WORD_MASK;
+}
@@ -0,0 +1,58 @@
+#ifndef DISASSEMBLER_H
+#define DISASSEMBLER_H
+
+#include "assembler.h"
+#include "types.h"
+#include <stddef.h>
+#include <stdio.h>
+
+/* disassembler.h -- turns object images (.ob/.obj words) back into assembly
+ *
+ * the output is source the assembler takes again and assembles into the same
+ * words: .entry/.extern lines, the code, then the data as .data lines
+ * (.string and .mat can't be told apart from .data once assembled).
+ *
+ * first words are decoded through a table of all 2^WORD_SIZE of them (built
+ * once from instruction_info_table, the inverse of the OPCODE_SHIFT/
+ * SRC_MODE_SHIFT/DST_MODE_SHIFT layout, with compute_instruction_length for
+ * the operand words), operands are printed through a table by addressing
+ * mode. one pass finds the labels, one prints.
+ *
+ * labels come from the entries (names at addresses) and externs (names of
+ * the words that use them) when the caller has them (.ent/.ext, or the
+ * .obj), any other address an operand refers to gets "L<address>". extern
+ * words without a name get "X<address>", so the output still assembles.
+ *
+ * where code ends is known in an .obj (code_count). an .ob doesn't say, so
+ * code is taken to end at the first word that isn't a well-formed
+ * instruction, or at the first address a non-jump operand refers to
+ * (that's data, .data comes after the code) */
+
+/* disasm_symbol -- an entry (defined at address) or an extern (used by the
+ * word at address) */
+typedef struct DisasmSymbol {
+  const char *name;
+  int address;
+} DisasmSymbol;
+
+/* disasm_input -- an image and what's known about its symbols */
+typedef struct DisasmInput {
+  const char *name; /* for the header comment and messages */
+  const unsigned short *words;
+  size_t word_count;
+  int base;       /* address of words[0] */
+  int code_count; /* words of code, -1 if unknown (.ob) */
+  const DisasmSymbol *entries;
+  int entry_count;
+  const DisasmSymbol *externs;
+  int extern_count;
+} DisasmInput;
+
+/* disassemble -- write input as assembly source to out
+ *
+ * returns true on success, false if the image can't be disassembled (error
+ * printed), a label that can't be placed is only a warning
+ */
+bool disassemble(const DisasmInput *input, FILE *out);
+
+#endif /* DISASSEMBLER_H */
@@ -0,0 +1,86 @@
+/* mmap & friends are POSIX, not ANSI C */
+#define _POSIX_C_SOURCE 200112L
+
+#include "file_map.h"
+#include "helpers.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* file_map -- mmap with a read-it-all fallback */
+
+char *map_file(const char *filename, size_t *size_out, bool *is_mapped_out) {
+#ifdef HAVE_MMAP
+  int fd;
+  struct stat st;
+  void *mapped;
+
+  fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "(ERROR) [file_map] opening '%s' failed\n", filename);
+    return NULL;
+  }
+
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    fprintf(stderr, "(ERROR) [file_map] '%s' is empty\n", filename);
+    close(fd);
+    return NULL;
+  }
+
+  /* read-only & private, the image is never written to */
+  mapped = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    fprintf(stderr, "(ERROR) [file_map] mapping '%s' failed\n", filename);
+    return NULL;
+  }
+
+  *size_out = (size_t)st.st_size;
+  *is_mapped_out = true;
+  return mapped;
+#else
+  FILE *fp = fopen(filename, "rb");
+  char *image;
+
+  if (!fp) {
+    fprintf(stderr, "(ERROR) [file_map] opening '%s' failed\n", filename);
+    return NULL;
+  }
+
+  image = read_file_contents(fp, size_out);
+  fclose(fp);
+
+  if (image && *size_out == 0) {
+    fprintf(stderr, "(ERROR) [file_map] '%s' is empty\n", filename);
+    free(image);
+    return NULL;
+  }
+
+  *is_mapped_out = false;
+  return image;
+#endif
+}
+
+void unmap_file(char *image, size_t size, bool is_mapped) {
+  if (!image)
+    return;
+
+#ifdef HAVE_MMAP
+  if (is_mapped) {
+    munmap(image, size);
+    return;
+  }
+#else
+  (void)is_mapped;
+#endif
+
+  (void)size;
+  free(image);
+}
@@ -0,0 +1,24 @@
+#ifndef FILE_MAP_H
+#define FILE_MAP_H
+
+#include "types.h"
+#include <stddef.h>
+
+/* file_map.h -- read-only whole file mapping
+ *
+ * uses mmap where we have it (POSIX), otherwise the file is read into memory
+ * in one go. either way the caller gets one contiguous read-only image */
+
+/* map_file -- map all of filename, *size_out gets its size and
+ * *is_mapped_out tells unmap_file how to release it
+ *
+ * - MUST BE RELEASED! (unmap_file)
+ *
+ * returns the image, or NULL on error (error printed, empty files included)
+ */
+char *map_file(const char *filename, size_t *size_out, bool *is_mapped_out);
+
+/* unmap_file -- release an image returned by map_file */
+void unmap_file(char *image, size_t size, bool is_mapped);
+
+#endif /* FILE_MAP_H */
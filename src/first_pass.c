@@ -1,10 +1,13 @@
 #include "first_pass.h"
 #include "assembler.h"
+#include "constants.h"
 #include "data_image.h"
 #include "helpers.h"
 #include "instruction_image.h"
 #include "instruction_utils.h"
+#include "line_cache.h"
 #include "symbol_table.h"
+#include "trace.h"
 #include "types.h"
 #include <ctype.h>
 #include <stddef.h>
@@ -25,6 +28,9 @@ static int handle_mat_directive(char *operands, int *dc, char *label,
 static int handle_extern_directive(char *operands, Symbol **sym_table,
                                    char *label, int line_number,
                                    int *error_count);
+static int parse_data_values(char *operands, const char *directive,
+                             short *values, int line_number, int *error_count);
+static bool read_dimension(char **cursor, int line_number, int *out);
 static int handle_entry_directive(char *operands, char *label, int line_number,
                                   int *error_count);
 
@@ -36,33 +42,75 @@ static int process_instruction(char *line, bool has_label, char *label_name,
                                Symbol **sym_table, int *IC, int line_num,
                                int *err_count);
 static void relocate_data_symbols(Symbol *sym_table, int icf);
+static void place_data_lines(const int *data_lines, int dcf, int icf);
+static void replay_line(const LineEntry *entry, Symbol **sym_table, int *ic,
+                        int *dc, int line_number, int *error_count);
+static void store_line(LineCache *cache, const char *text, int start_ic,
+                       int ic, int first_command, int first_directive,
+                       bool is_clean);
 
 /* ======================================================================= */
 /* ===================== public api -- see header ======================== */
 /* ======================================================================= */
 
 int first_pass(FILE *input_file, Symbol **sym_table, int *icf, int *dcf) {
+  return first_pass_cached(input_file, NULL, sym_table, icf, dcf);
+}
+
+int first_pass_cached(FILE *input_file, LineCache *cache, Symbol **sym_table,
+                      int *icf, int *dcf) {
   char raw_line[MAX_LINE_LENGTH];
+  char text[MAX_LINE_LENGTH]; /* the line as read, its key in cache */
   int line_number = 0;
   int ic = IC_INIT_VALUE;
   int dc = DC_INIT_VALUE;
   int error_count = 0;
+  int data_lines[MAX_WORDS_MEMORY]; /* .am line of each data word, by dc */
 
   /* symbol table starts empty (sym_table points to NULL) */
 
+  /* no instruction has a line yet */
+  memset(line_table, 0, sizeof(line_table));
+
+  if (cache)
+    line_cache_begin(cache);
+
   /* read each line from the .am file */
   while (fgets(raw_line, MAX_LINE_LENGTH, input_file)) {
-    char *line = sanitize_line(raw_line); /* also replace newline with null */
+    char *line;
     char *directive;
     char *operands;
     char label[MAX_LABEL_LENGTH];
     bool has_label = false;
+    bool has_colon;
+    int line_dc = dc;
+    int line_ic = ic;
+    int line_errors = error_count;
+    int line_commands = command_count;
+    int line_directives = directive_count;
+    int line_uses = const_uses();
+    LineEntry *entry;
+
+    if (cache)
+      strcpy(text, raw_line);
+    line = sanitize_line(raw_line); /* also replace newline with null */
     line_number++;
 
     /* skip empty lines */
     if (*line == '\0')
       continue;
 
+    /* a line seen before: its result at this line's address */
+    if (cache && (entry = line_cache_find(cache, text)) != NULL) {
+      replay_line(entry, sym_table, &ic, &dc, line_number, &error_count);
+      for (; line_dc < dc && line_dc < MAX_WORDS_MEMORY; line_dc++)
+        data_lines[line_dc] = line_number;
+      continue;
+    }
+
+    /* a colon that doesn't make a label was reported as an illegal one */
+    has_colon = strchr(line, ':') != NULL;
+
     /* consume_label_prefix writes to label_out if a label was detected */
     directive = consume_label_prefix(line, line_number, label, &has_label);
 
@@ -80,6 +128,17 @@ int first_pass(FILE *input_file, Symbol **sym_table, int *icf, int *dcf) {
     /* handle directives (.data/.string/.extern/.entry/.mat) */
     if (process_directive(directive, operands, has_label ? label : NULL,
                           sym_table, &dc, line_number, &error_count)) {
+      for (; line_dc < dc && line_dc < MAX_WORDS_MEMORY; line_dc++)
+        data_lines[line_dc] = line_number;
+
+      /* kept unless it reported something or read a constant, a label
+       * before .extern/.entry is ignored with a warning */
+      if (cache)
+        store_line(cache, text, line_ic, ic, line_commands, line_directives,
+                   error_count == line_errors && has_colon == has_label &&
+                       const_uses() == line_uses &&
+                       !(has_label && (strcmp(directive, ".extern") == 0 ||
+                                       strcmp(directive, ".entry") == 0)));
       continue;
     }
 
@@ -97,15 +156,29 @@ int first_pass(FILE *input_file, Symbol **sym_table, int *icf, int *dcf) {
       process_instruction(inst_line, has_label, has_label ? label : NULL,
                           sym_table, &ic, line_number, &error_count);
     }
+
+    if (cache)
+      store_line(cache, text, line_ic, ic, line_commands, line_directives,
+                 error_count == line_errors && has_colon == has_label &&
+                     const_uses() == line_uses);
   }
 
+  if (cache)
+    line_cache_end(cache);
+
+  /* constants are the file's, they're folded by now */
+  const_forget();
+
   /* set final instruction and data counters */
   *icf = ic;
   *dcf = dc;
 
   /* update data symbol addresses for code section placement,
    * data symbols start at icf address (AFTER all code), so we add icf offset */
+  trace_begin(TRACE_STAGE, "relocate_data_symbols");
   relocate_data_symbols(*sym_table, *icf);
+  trace_end();
+  place_data_lines(data_lines, *dcf, *icf);
 
   return error_count ? 1 : 0;
 }
@@ -114,13 +187,26 @@ int first_pass(FILE *input_file, Symbol **sym_table, int *icf, int *dcf) {
 /* ========================== static helpers ============================== */
 /* ======================================================================= */
 
-/* process_directive -- handles data directives (.data, .string, .mat) during
- * first pass
+/* process_directive -- handles data directives (.data, .string, .mat) and
+ * constants (.define, .equ) during first pass
  *
  * returns 0 on success, 1 on error */
 static int process_directive(char *directive, char *operands, char *label,
                              Symbol **sym_table, int *dc, int line_number,
                              int *error_count) {
+  /* a constant takes no memory, see constants.h */
+  if (strcmp(directive, DEFINE_DIRECTIVE) == 0 ||
+      strcmp(directive, EQU_DIRECTIVE) == 0) {
+    if (label) {
+      fprintf(stderr,
+              "(WARNING) [first_pass] label before %s is ignored at line %d\n",
+              directive, line_number);
+    }
+    if (!const_define(directive, operands, line_number))
+      (*error_count)++;
+    return 1;
+  }
+
   /* handle .data, .string, .mat directives and record label in symbol table
    */
   if (strcmp(directive, ".data") == 0 || strcmp(directive, ".string") == 0 ||
@@ -245,6 +331,10 @@ static int process_instruction(char *line, bool has_label, char *label_name,
     /* continue */
   }
 
+  /* address -> source line, for the simulator's profiler and friends */
+  if (start_ic >= 0 && start_ic < MAX_WORDS_MEMORY)
+    line_table[start_ic] = line_num;
+
   /* EMITTING */
   /* emit the first word (opcode + modes)
    * TODO: A/R/E left 0 for now */
@@ -281,6 +371,101 @@ static void relocate_data_symbols(Symbol *sym_table, int icf) {
 
 /* ======================================================================= */
 
+/* replay_line -- what parsing entry's line at ic/dc would do: define its
+ * label, record its command and emit its words, or record its directive */
+static void replay_line(const LineEntry *entry, Symbol **sym_table, int *ic,
+                        int *dc, int line_number, int *error_count) {
+  const CommandFields *cmd = entry->command;
+  const DirectiveFields *df = entry->directive;
+  DirectiveFields *copy;
+  int start_ic = *ic;
+  int idx;
+
+  if (cmd) {
+    if (cmd->label && !add_symbol(sym_table, cmd->label, start_ic, SYMBOL_CODE))
+      (*error_count)++;
+
+    if (!record_command(start_ic, cmd->length, cmd->opcode, cmd->src,
+                        cmd->dst, cmd->label)) {
+      fprintf(stderr,
+              "(ERROR) [first_pass] internal: record_command failed at line "
+              "%d\n",
+              line_number);
+      (*error_count)++;
+    }
+
+    if (start_ic >= 0 && start_ic < MAX_WORDS_MEMORY)
+      line_table[start_ic] = line_number;
+
+    for (idx = 0; idx < cmd->length; idx++)
+      emit_word(entry->words[idx], ic);
+    return;
+  }
+
+  if (df->is_extern) {
+    if (!add_symbol(sym_table, df->arg_label, 0, SYMBOL_EXTERNAL))
+      (*error_count)++;
+  } else if (df->label) {
+    if (!add_symbol(sym_table, df->label, *dc, SYMBOL_DATA))
+      (*error_count)++;
+  }
+
+  copy = new_directive(df->data_length);
+  if (!copy) {
+    fprintf(stderr,
+            "(ERROR) [first_pass] memory allocation failed at line %d\n",
+            line_number);
+    (*error_count)++;
+    return;
+  }
+
+  if (df->data_length > 0)
+    memcpy(copy->data, df->data, df->data_length * sizeof(*df->data));
+  copy->label = df->label ? safe_strdup(df->label) : NULL;
+  copy->arg_label = df->arg_label ? safe_strdup(df->arg_label) : NULL;
+  copy->is_extern = df->is_extern;
+  copy->is_entry = df->is_entry;
+  copy->columns = df->columns;
+  copy->data_address = df->is_extern || df->is_entry ? -1 : *dc;
+  *dc += df->data_length;
+
+  append_directive(copy);
+}
+
+/* store_line -- put what text was just parsed into (from start_ic to ic, and
+ * the commands and directives from the first ones given) in cache, if the
+ * line is_clean (reported nothing) and all of it was recorded */
+static void store_line(LineCache *cache, const char *text, int start_ic,
+                       int ic, int first_command, int first_directive,
+                       bool is_clean) {
+  if (!is_clean)
+    return;
+
+  if (command_count == first_command + 1 &&
+      directive_count == first_directive) {
+    const CommandFields *cmd = command_list[first_command];
+
+    /* words past the end of memory were dropped */
+    if (ic - start_ic == cmd->length)
+      line_cache_add(cache, text, cmd,
+                     &instruction_image[start_ic - IC_INIT_VALUE], NULL);
+  } else if (directive_count == first_directive + 1 &&
+             command_count == first_command) {
+    line_cache_add(cache, text, NULL, NULL, directive_list[first_directive]);
+  }
+}
+
+/* place_data_lines -- give the data words their lines in line_table, at
+ * the addresses they get after the code */
+static void place_data_lines(const int *data_lines, int dcf, int icf) {
+  int offset;
+
+  for (offset = 0; offset < dcf && offset < MAX_WORDS_MEMORY &&
+                   icf + offset < MAX_WORDS_MEMORY;
+       offset++)
+    line_table[icf + offset] = data_lines[offset];
+}
+
 /* sanitize_line -- trim the trailing newline, strip comments, and clean up
  * whitespace. this uses cleanup_line() to remove ';' comments and normalize
  * spaces within the line
@@ -377,35 +562,13 @@ static char *consume_label_prefix(char *line, int line_number, char *label_out,
  */
 static int handle_data_directive(char *operands, int *dc, char *label,
                                  int line_number, int *error_count) {
-  char *delim = "\t ,";
-  char *copy = safe_strdup(operands);
-  char *tok;
+  short values[MAX_LINE_LENGTH]; /* a line can't hold more values than this */
   int count = 0;
   DirectiveFields *df = NULL;
-  int idx = 0;
-
-  /* make a working copy because strtok() modifies the buffer */
-  if (!copy) {
-    fprintf(stderr,
-            "(ERROR) [first_pass] memory allocation failed at line %d\n",
-            line_number);
-    (*error_count)++;
-    return 1;
-  }
 
-  /* validate each number and count how many values there are */
-  for (tok = strtok(copy, delim); tok; tok = strtok(NULL, delim)) {
-    if (!is_valid_data_num(tok)) {
-      fprintf(stderr,
-              "(ERROR) [first_pass] invalid number in .data at line %d near "
-              "'%s'\n",
-              line_number, tok);
-      (*error_count)++;
-    }
-    count++;
-  }
-
-  free(copy);
+  /* validate, convert and range check every value in one go */
+  count = parse_data_values(operands, ".data", values, line_number,
+                            error_count);
 
   /* .data must have at least one value */
   if (count <= 0) {
@@ -433,19 +596,8 @@ static int handle_data_directive(char *operands, int *dc, char *label,
   df->is_entry = false;
   df->data_address = *dc;
 
-  for (tok = strtok(operands, delim); tok; tok = strtok(NULL, delim)) {
-    short val = (short)atoi(tok);
-
-    if (!is_num_within_range(val)) {
-      fprintf(stderr,
-              "(ERROR) [first_pass] number out of range in .data at line %d "
-              "near '%s'\n",
-              line_number, tok);
-      (*error_count)++;
-    }
-    df->data[idx++] = val;
-    (*dc)++;
-  }
+  memcpy(df->data, values, count * sizeof(*values));
+  *dc += count;
 
   append_directive(df);
 
@@ -537,17 +689,15 @@ static int handle_mat_directive(char *operands, int *dc, char *label,
                                 int line_number, int *error_count) {
   int rows = 0;
   int cols = 0;
-  int consumed_chars = 0;
   int maximum_cells = 0;
-  char *copy = NULL;
-  char *tok = NULL;
+  short values[MAX_LINE_LENGTH]; /* a line can't hold more values than this */
   int count = 0;
   DirectiveFields *df = NULL;
-  int idx = 0;
 
-  /* attempt to read rows & cols, %n will give us the pointer offset */
-  if (sscanf(operands, " [%d] [%d] %n", &rows, &cols, &consumed_chars) != 2 ||
-      rows <= 0 || cols <= 0) {
+  /* read rows & cols (numbers or constant expressions), moving operands
+   * past them */
+  if (!read_dimension(&operands, line_number, &rows) ||
+      !read_dimension(&operands, line_number, &cols)) {
     fprintf(stderr,
             "(ERROR) [first_pass] .mat expects dimensions [r][c] at line %d\n",
             line_number);
@@ -560,32 +710,11 @@ static int handle_mat_directive(char *operands, int *dc, char *label,
 
   /* [r][c] v1 */
   /* ------^   */
-  operands += consumed_chars;
-
-  /* make a copy because strtok() modifies the buffer */
-  copy = safe_strdup(operands);
-  if (!copy) {
-    fprintf(stderr,
-            "(ERROR) [first_pass] memory allocation failed at line %d\n",
-            line_number);
-    (*error_count)++;
-    return 1;
-  }
+  operands += strspn(operands, " \t");
 
-  count = 0;
-
-  for (tok = strtok(copy, "\t ,"); tok; tok = strtok(NULL, "\t ,")) {
-    if (!is_valid_data_num(tok)) {
-      fprintf(stderr,
-              "(ERROR) [first_pass] invalid number in .mat at line %d near "
-              "'%s'\n",
-              line_number, tok);
-      (*error_count)++;
-    }
-    count++;
-  }
-
-  free(copy);
+  /* validate, convert and range check every value in one go */
+  count = parse_data_values(operands, ".mat", values, line_number,
+                            error_count);
 
   /* check the number of values passed */
   if (maximum_cells == 0 && count > 0) {
@@ -618,27 +747,112 @@ static int handle_mat_directive(char *operands, int *dc, char *label,
   df->is_extern = false;
   df->is_entry = false;
   df->data_address = *dc;
-  idx = 0;
+  df->columns = cols;
+
+  /* fill matrix data, cells without a value stay 0 */
+  memcpy(df->data, values,
+         (count < maximum_cells ? count : maximum_cells) * sizeof(*values));
+  *dc += maximum_cells;
 
-  /* fill matrix data */
-  for (tok = strtok(operands, "\t ,"); tok; tok = strtok(NULL, "\t ,")) {
-    short val = (short)atoi(tok);
+  append_directive(df);
 
-    /* check if val is within range */
-    if (!is_num_within_range(val)) {
+  return 1;
+}
+
+/* parse_data_values -- tokenize a comma separated list of numbers or
+ * constant expressions (.data and .mat values) and store each one in values,
+ * reporting invalid and out of range values as we go
+ *
+ * returns the number of values found
+ */
+static int parse_data_values(char *operands, const char *directive,
+                             short *values, int line_number, int *error_count) {
+  char *cursor = operands;
+  int count = 0;
+
+  /* no values at all is for the caller to report */
+  if (*trim(operands) == '\0')
+    return 0;
+
+  /* an expression may have spaces, so only commas split values */
+  while (cursor) {
+    char *comma = strchr(cursor, ',');
+    char *tok;
+    int val = 0;
+
+    if (comma)
+      *comma = '\0';
+    tok = trim(cursor);
+    cursor = comma ? comma + 1 : NULL;
+
+    /* 1,,2 or ,1 (a comma last was reported as a trailing comma) */
+    if (*tok == '\0') {
+      if (comma) {
+        fprintf(stderr,
+                "(ERROR) [first_pass] missing value in %s at line %d\n",
+                directive, line_number);
+        (*error_count)++;
+      }
+      continue;
+    }
+
+    switch (const_number(tok, MIN_WORD_VAL, MAX_WORD_VAL, &val,
+                         line_number)) {
+    case FOLD_INVALID:
+      fprintf(stderr,
+              "(ERROR) [first_pass] invalid number in %s at line %d near "
+              "'%s'\n",
+              directive, line_number, tok);
+      (*error_count)++;
+      break;
+
+    case FOLD_OUT_OF_RANGE:
       fprintf(stderr,
-              "(ERROR) [first_pass] number out of range in .mat at line %d "
+              "(ERROR) [first_pass] number out of range in %s at line %d "
               "near '%s'\n",
-              line_number, tok);
+              directive, line_number, tok);
       (*error_count)++;
+      break;
+
+    case FOLD_FAILED:
+      /* error reported in const_number */
+      (*error_count)++;
+      break;
+
+    default:
+      break;
     }
-    df->data[idx++] = val;
-    (*dc)++;
+
+    values[count++] = (short)val;
   }
 
-  append_directive(df);
+  return count;
+}
 
-  return 1;
+/* read_dimension -- read a .mat dimension, [n] (n a number or a constant
+ * expression) after optional spaces, at *cursor and move *cursor past it
+ *
+ * returns true on success, false if there's none or n isn't a size from 1
+ * to MAX_WORD_VAL */
+static bool read_dimension(char **cursor, int line_number, int *out) {
+  char *open = *cursor + strspn(*cursor, " \t");
+  char *close;
+  bool ok;
+
+  if (*open != '[')
+    return false;
+
+  close = strchr(open, ']');
+  if (!close)
+    return false;
+
+  *close = '\0';
+  ok = const_number(open + 1 + strspn(open + 1, " \t"), 1, MAX_WORD_VAL, out,
+                    line_number) == FOLD_OK;
+  *close = ']';
+
+  *cursor = close + 1;
+  return ok;
 }
 
 /* handle_extern_directive -- parse .extern operands, allocate and populate a
@@ -1,6 +1,7 @@
 #ifndef FIRST_PASS_H
 #define FIRST_PASS_H
 
+#include "line_cache.h"
 #include "symbol_table.h"
 #include <stdio.h>
 
@@ -12,4 +13,10 @@
    returns 0 if no errors, 1 if errors, -1 if invalid input */
 int first_pass(FILE *input_file, Symbol **sym_table, int *icf, int *dcf);
 
+/* first_pass_cached -- first_pass, replaying the lines found in cache (see
+   line_cache.h) instead of parsing them, and storing the rest. the result
+   and every message are the same as first_pass's, cache may be NULL */
+int first_pass_cached(FILE *input_file, LineCache *cache, Symbol **sym_table,
+                      int *icf, int *dcf);
+
 #endif /* FIRST_PASS_H */
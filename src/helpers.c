@@ -1,5 +1,6 @@
 #include "helpers.h"
 #include "assembler.h"
+#include "char_scan.h"
 #include "instruction_image.h"
 #include "types.h"
 #include <stdarg.h>
@@ -87,6 +88,17 @@ char *decimal_to_binary(int value, int bits) {
   return buf;
 }
 
+unsigned long hash_string(const char *str) {
+  unsigned long hash = 5381;
+
+  /* hash * 33 + c */
+  while (*str) {
+    hash = (hash << 5) + hash + (unsigned char)*str++;
+  }
+
+  return hash;
+}
+
 FILE *open_file_with_ext(const char *base, const char *ext, const char *mode) {
   char filename[MAX_FILENAME_LENGTH + EXT_LENGTH];
   FILE *temp;
@@ -136,22 +148,101 @@ int close_files(FILE *first, ...) {
   return closed;
 }
 
-void remove_comment(char *line) {
-  /* chop the line at ';' if present */
-  char *semicolon = strchr(line, ';');
-  if (semicolon) {
-    *semicolon = '\0';
+char *read_file_contents(FILE *fp, size_t *length_out) {
+  long start, end;
+  size_t length;
+  size_t capacity;
+  bool is_measured;
+  char *buf;
+
+  /* measure what's left of the file, pipes can't seek so they're read
+   * in growing chunks instead */
+  start = ftell(fp);
+  is_measured = start >= 0 && fseek(fp, 0, SEEK_END) == 0 &&
+                (end = ftell(fp)) >= start;
+  if (is_measured) {
+    fseek(fp, start, SEEK_SET);
+    capacity = (size_t)(end - start) + 1;
+  } else {
+    clearerr(fp);
+    capacity = READ_CHUNK_SIZE;
+  }
+
+  buf = malloc(capacity);
+  if (!buf) {
+    fprintf(stderr, "(ERROR) [helpers] malloc failed allocating %lu bytes\n",
+            (unsigned long)capacity);
+    return NULL;
+  }
+
+  /* one bulk read for a regular file */
+  length = fread(buf, 1, capacity - 1, fp);
+  while (!is_measured && length == capacity - 1 && !ferror(fp)) {
+    char *grown = realloc(buf, capacity * 2);
+
+    if (!grown) {
+      fprintf(stderr,
+              "(ERROR) [helpers] realloc failed allocating %lu bytes\n",
+              (unsigned long)(capacity * 2));
+      free(buf);
+      return NULL;
+    }
+
+    buf = grown;
+    capacity *= 2;
+    length += fread(buf + length, 1, capacity - 1 - length, fp);
   }
+
+  if (ferror(fp)) {
+    fprintf(stderr, "(ERROR) [helpers] read_file_contents read failed\n");
+    free(buf);
+    return NULL;
+  }
+  buf[length] = '\0';
+
+  if (length_out)
+    *length_out = length;
+
+  return buf;
 }
 
-char *trim_left(char *str) {
-  char *start = str; /* start of the data */
+const char **split_lines(char *text, int *line_count) {
+  const char **lines;
+  char *cursor;
+  int count = 1;
+
+  for (cursor = text; *cursor; cursor++) {
+    if (*cursor == '\n')
+      count++;
+  }
+
+  lines = safe_calloc((size_t)count, sizeof(char *));
+  if (!lines)
+    return NULL;
 
-  /* skip past any leading whitespace */
-  while (*start && isspace((unsigned char)*start)) {
-    start++;
+  *line_count = 0;
+  for (cursor = text; cursor;) {
+    char *newline = strchr(cursor, '\n');
+
+    lines[(*line_count)++] = cursor;
+    if (newline)
+      *newline++ = '\0';
+    cursor = newline;
   }
 
+  return lines;
+}
+
+void remove_comment(char *line) {
+  /* chop the line at ';' if present */
+  char *semicolon = (char *)scan_until(line, SCAN_COMMENT);
+  *semicolon = '\0';
+}
+
+char *trim_left(char *str) {
+  /* skip past any leading whitespace, block at a time */
+  char *start = (char *)scan_past_space(str);
+
   /* move the trimmed data to the original pointer */
   /* (instead of returning a new pointer) */
   if (start != str) {
@@ -169,7 +260,7 @@ char *trim_right(char *str) {
     return str;
 
   /* walk backwards over trailing spaces */
-  while (end > str && isspace((unsigned char)*(end - 1))) {
+  while (end > str && is_space_char(*(end - 1))) {
     end--;
   }
 
@@ -182,19 +273,46 @@ char *trim_inbetween(char *str) {
   char tmp[MAX_LINE_LENGTH];
   char *read = str;
   char *write = tmp;
+  const char *run;
+  size_t run_length;
   bool saw_space = false;
   bool in_string = false;
   char quote_char = '\0';
 
   while (*read) {
     if (in_string) {
-      /* if we're inside quotation marks */
-      *write++ = *read;
-      if (*read == quote_char) {
+      /* if we're inside quotation marks, copy everything up to (and
+       * including) the matching quote in one go */
+      run = scan_until(read, SCAN_QUOTE);
+      while (*run && *run != quote_char) {
+        run = scan_until(run + 1, SCAN_QUOTE);
+      }
+
+      if (*run) {
         /* end quotation mark */
+        run++;
         in_string = false;
       }
-    } else if (*read == ':') {
+
+      run_length = (size_t)(run - read);
+      memcpy(write, read, run_length);
+      write += run_length;
+      read += run_length;
+      continue;
+    }
+
+    /* plain text up to the next char we care about is copied as is */
+    run = scan_until(read, SCAN_SPACE | SCAN_QUOTE | SCAN_COMMA | SCAN_COLON);
+    if (run != read) {
+      run_length = (size_t)(run - read);
+      memcpy(write, read, run_length);
+      write += run_length;
+      read += run_length;
+      saw_space = false;
+      continue;
+    }
+
+    if (*read == ':') {
       if (!saw_space) {
         *write++ = *read;
       }
@@ -212,7 +330,7 @@ char *trim_inbetween(char *str) {
       quote_char = *read;
       *write++ = *read;
       saw_space = false;
-    } else if (isspace((unsigned char)*read)) {
+    } else if (is_space_char(*read)) {
       if (!saw_space) {
         *write++ = ' ';
         saw_space = true;
@@ -273,6 +391,22 @@ void check_trailing_comma(char *s, int line_number, int *error_count) {
   }
 }
 
+bool is_reserved_word(const char *name) {
+  const char *RESERVED_WORDS[] = {
+      "mov",  "cmp",    "add", "sub",    "not",   "clr", "lea", "inc",
+      "dec",  "jmp",    "bne", "red",    "prn",   "jsr", "rts", "stop",
+      "data", "string", "mat", "extern", "entry", "r0",  "r1",  "r2",
+      "r3",   "r4",     "r5",  "r6",     "r7",    NULL};
+  int idx;
+
+  for (idx = 0; RESERVED_WORDS[idx] != NULL; ++idx) {
+    if (strcmp(name, RESERVED_WORDS[idx]) == 0)
+      return true;
+  }
+
+  return false;
+}
+
 bool is_illegal_name(char *name) {
   /* list of reserved words that cannot be macro/label names */
   const char *ILLEGAL[] = {"mcro",   "mcroend", "mov",     "add",
@@ -288,34 +422,52 @@ bool is_illegal_name(char *name) {
   return false;
 }
 
-bool is_valid_data_num(const char *str) {
-  int length = strlen(str), idx = 0;
+NumStatus parse_number(const char *str, int min, int max, int *out) {
+  const char *ptr = str;
+  bool negative = false;
+  bool overflow = false;
+  long limit;
+  long value = 0;
 
-  if (str == NULL || str[0] == '\0')
-    return false;
+  if (str == NULL || *ptr == '\0')
+    return NUM_INVALID;
 
   /* if the number is being prepended with +/- */
-  if ((str[idx] == '+') || (str[idx] == '-')) {
-    idx++;
+  if (*ptr == '+' || *ptr == '-') {
+    negative = (*ptr == '-');
+    ptr++;
 
     /* invalid, +/- must be followed by a digit */
-    if (str[idx] == '\0')
-      return false;
+    if (*ptr == '\0')
+      return NUM_INVALID;
   }
 
-  while (idx < length) {
-    if (isdigit(str[idx]) == false) {
-      return false;
+  /* largest magnitude allowed for this sign */
+  limit = negative ? -(long)min : (long)max;
+
+  /* validate and accumulate at the same time, once we're past the limit we
+   * only keep checking that the rest are digits */
+  for (; *ptr; ptr++) {
+    if (*ptr < '0' || *ptr > '9')
+      return NUM_INVALID;
+
+    if (!overflow) {
+      value = value * 10 + (*ptr - '0');
+      if (value > limit)
+        overflow = true;
     }
-    idx++;
   }
 
-  return true;
-}
+  if (overflow) {
+    if (out)
+      *out = negative ? min : max;
+    return NUM_OUT_OF_RANGE;
+  }
+
+  if (out)
+    *out = (int)(negative ? -value : value);
 
-bool is_num_within_range(short num) {
-  /* 10 bit max signed values, defined in assembler.h */
-  return !(num < MIN_WORD_VAL || num > MAX_WORD_VAL);
+  return NUM_OK;
 }
 
 char *decimal_to_base4_letters(int decimal_value) {
@@ -361,3 +513,19 @@ char *decimal_to_base4_letters(int decimal_value) {
 
   return result;
 }
+
+int base4_letters_to_decimal(const char *letters) {
+  int value = 0;
+  int idx;
+
+  /* most significant digit first, 'a'=0 .. 'd'=3 */
+  for (idx = 0; idx < BASE4_DIGITS_PER_WORD; idx++) {
+    if (letters[idx] < 'a' || letters[idx] > 'd')
+      return -1;
+
+    value = (value << BITS_PER_BASE4_DIGIT) | (letters[idx] - 'a');
+  }
+
+  /* must end here */
+  return letters[idx] == '\0' ? value : -1;
+}
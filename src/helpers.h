@@ -12,6 +12,14 @@
 #define BITS_PER_BASE4_DIGIT 2  /* 1 base4 digit = 2 bits */
 #define BASE4_DIGITS_PER_WORD 5 /* 10 bits / 2 bits per digit = 5 digits */
 #define BASE4_STRING_LENGTH 6   /* 5 digits + null terminator = 6 */
+#define READ_CHUNK_SIZE 4096    /* first chunk read_file_contents reads (pipes) */
+
+/* parse_number results */
+typedef enum {
+  NUM_OK,          /* valid and within range */
+  NUM_INVALID,     /* not a (signed) decimal number */
+  NUM_OUT_OF_RANGE /* valid number, but outside the requested range */
+} NumStatus;
 
 /* safe_calloc -- allocate and zero memory
  *
@@ -38,6 +46,10 @@ char *safe_strdup(const char *s);
  */
 char *decimal_to_binary(int value, int bits);
 
+/* hash_string -- djb2 hash of a null-terminated string, used to index our
+ * hash tables (mask the result with a power of 2 bucket count) */
+unsigned long hash_string(const char *str);
+
 /* close_files -- close a number of files, remember to add NULL to the end */
 /* usage: close_files(f1, f2, NULL) */
 int close_files(FILE *, ...);
@@ -46,6 +58,25 @@ int close_files(FILE *, ...);
  * pointer or NULL */
 FILE *open_file_with_ext(const char *base, const char *ext, const char *mode);
 
+/* read_file_contents -- read everything from the current position of fp to
+ * EOF (pipes too) into one null-terminated buffer, the length (without the
+ * terminator) goes to *length_out
+ *
+ * - MUST BE FREED!
+ *
+ * returns the buffer, or NULL on failure
+ */
+char *read_file_contents(FILE *fp, size_t *length_out);
+
+/* split_lines -- cut text into lines (in place), the count goes to
+ * *line_count
+ *
+ * - MUST BE FREED! (only the array, the lines point into text)
+ *
+ * returns the lines or NULL on error
+ */
+const char **split_lines(char *text, int *line_count);
+
 /* remove_comment -- remove comment lines by inserting an \0 where ';' is
  * found, truncating the text
  */
@@ -84,14 +115,20 @@ void check_trailing_comma(char *s, int line_number, int *error_count);
  */
 bool is_illegal_name(char *name);
 
-/* is_valid_data_num -- used directly to check if a string contains only
- * digits, or +/- symbols (which are valid in .data directives) */
-bool is_valid_data_num(const char *str);
+/* is_reserved_word -- is name an opcode, a register or a directive's name
+ * (without the dot)? neither a label nor a constant may be one */
+bool is_reserved_word(const char *name);
 
-/* is_num_within_range -- returns true if num is within the allowed 10-bit word
- * range
+/* parse_number -- validate, convert and range check a decimal literal (with
+ * an optional +/- sign) in a single pass over the string
+ *
+ * digits stop accumulating once the magnitude passes the range, so very long
+ * literals are reported as out of range instead of wrapping around. on
+ * NUM_OUT_OF_RANGE, *out gets the value clamped to [min, max]
+ *
+ * returns NUM_OK, NUM_INVALID (not a number) or NUM_OUT_OF_RANGE
  */
-bool is_num_within_range(short num);
+NumStatus parse_number(const char *str, int min, int max, int *out);
 
 /* decimal_to_base4_letters -- convert decimal number directly to base 4 letters
  *
@@ -102,4 +139,11 @@ bool is_num_within_range(short num);
  */
 char *decimal_to_base4_letters(int decimal_value);
 
+/* base4_letters_to_decimal -- inverse of decimal_to_base4_letters, reads
+ * exactly BASE4_DIGITS_PER_WORD letters (a,b,c,d)
+ *
+ * returns the 10-bit value, or -1 if letters is not a valid word
+ */
+int base4_letters_to_decimal(const char *letters);
+
 #endif
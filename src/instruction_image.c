@@ -19,6 +19,9 @@ static int encode_matrix_indices(int row_reg_code_val, int col_reg_code_val);
 /* global instruction/code image (10-bit words) */
 int instruction_image[MAX_WORDS_MEMORY];
 
+/* source line of each instruction, by address */
+int line_table[MAX_WORDS_MEMORY];
+
 /* registry of parsed commands to help later stages (second pass .. ) */
 CommandFields *command_list[MAX_WORDS_MEMORY];
 
@@ -155,19 +158,8 @@ bool emit_operands(const char *src, int src_mode, const char *dst, int dst_mode,
       */
       int val;
 
-      /* validate immediate value syntax */
-      if (!is_valid_data_num(src + 1)) {
-        fprintf(stderr, "(ERROR) [first_pass] invalid immediate at line %d\n",
-                line_num);
-        if (err_count)
-          (*err_count)++;
-        had_error = 1;
-      }
-
-      val = atoi(src + 1);
-
-      /* validate immediate value range (8-bit signed) */
-      if (!validate_immediate_range(val, line_num, err_count)) {
+      /* validate syntax and range (8-bit signed) while converting */
+      if (!parse_immediate(src, &val, line_num, err_count)) {
         had_error = 1;
       }
 
@@ -231,17 +223,9 @@ bool emit_operands(const char *src, int src_mode, const char *dst, int dst_mode,
                   [   imm[7:0]   ][A/R/E]
       */
       int val;
-      if (!is_valid_data_num(dst + 1)) {
-        fprintf(stderr, "(ERROR) [first_pass] invalid immediate at line %d\n",
-                line_num);
-        if (err_count)
-          (*err_count)++;
-        had_error = 1;
-      }
-      val = atoi(dst + 1);
 
-      /* validate immediate value range (8-bit signed) */
-      if (!validate_immediate_range(val, line_num, err_count)) {
+      /* validate syntax and range (8-bit signed) while converting */
+      if (!parse_immediate(dst, &val, line_num, err_count)) {
         had_error = 1;
       }
 
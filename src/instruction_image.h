@@ -14,6 +14,11 @@
 #define REG_SRC_SHIFT 6    /* shift for source register field (bits 6-9) */
 
 extern int instruction_image[MAX_WORDS_MEMORY];
+
+/* .am line of the instruction that starts at each address and of each data
+ * word, 0 elsewhere (recorded by the first pass, for tools that map addresses
+ * to source) */
+extern int line_table[MAX_WORDS_MEMORY];
 extern CommandFields *command_list[MAX_WORDS_MEMORY];
 extern int command_count;
 
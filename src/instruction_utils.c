@@ -1,4 +1,5 @@
 #include "instruction_utils.h"
+#include "constants.h"
 #include "helpers.h"
 #include <ctype.h>
 #include <stdlib.h>
@@ -371,20 +372,36 @@ int compute_instruction_length(int src_mode, int dst_mode, const char *src,
   return L;
 }
 
-bool validate_immediate_range(int val, int line_num, int *err_count) {
+bool parse_immediate(const char *operand, int *val_out, int line_num,
+                     int *err_count) {
   /* immediate values are limited to 8-bit signed range
    * because only 8 bits are available in the instruction word for immediate
-   * payload */
-  if (val < MIN_IMMEDIATE_VAL || val > MAX_IMMEDIATE_VAL) {
+   * payload, a constant expression is checked once folded */
+  switch (const_number(operand + 1, MIN_IMMEDIATE_VAL, MAX_IMMEDIATE_VAL,
+                       val_out, line_num)) {
+  case FOLD_OK:
+    return true;
+
+  case FOLD_OUT_OF_RANGE:
     fprintf(stderr,
-            "(ERROR) [first_pass] immediate value %d out of range (%d to %d) "
+            "(ERROR) [first_pass] immediate value %s out of range (%d to %d) "
             "at line %d\n",
-            val, MIN_IMMEDIATE_VAL, MAX_IMMEDIATE_VAL, line_num);
+            operand + 1, MIN_IMMEDIATE_VAL, MAX_IMMEDIATE_VAL, line_num);
+    break;
+
+  case FOLD_FAILED:
+    /* error reported in const_number */
+    break;
+
+  default:
+    fprintf(stderr, "(ERROR) [first_pass] invalid immediate at line %d\n",
+            line_num);
+    *val_out = 0;
+    break;
+  }
 
-    if (err_count)
-      (*err_count)++;
+  if (err_count)
+    (*err_count)++;
 
-    return false;
-  }
-  return true;
+  return false;
 }
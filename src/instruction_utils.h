@@ -100,9 +100,12 @@ bool validate_operand_modes(const InstructionInfo *info, const char *src,
 int compute_instruction_length(int src_mode, int dst_mode, const char *src,
                                const char *dst);
 
-/* validate_immediate_range -- checks if value fits in 8-bit signed immediate
+/* parse_immediate -- parse an immediate operand ("#n") into val_out,
+ * checking that n is a number (or a constant expression, see constants.h)
+ * that fits in the 8-bit signed immediate
  *
- * returns true if valid, false if out of range */
-bool validate_immediate_range(int val, int line_num, int *err_count);
+ * returns true if valid, false on error (prints & bumps *err_count) */
+bool parse_immediate(const char *operand, int *val_out, int line_num,
+                     int *err_count);
 
 #endif /* INSTRUCTION_UTILS_H */
@@ -0,0 +1,241 @@
+#include "line_cache.h"
+#include "data_image.h"
+#include "helpers.h"
+#include "instruction_image.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* line_cache -- first pass results by line text, see header */
+
+static LineEntry **find_slot(LineCache *cache, const char *text);
+static void grow_buckets(LineCache *cache);
+static CommandFields *copy_command(const CommandFields *command);
+static DirectiveFields *copy_directive(const DirectiveFields *directive);
+static void free_entry(LineEntry *entry);
+
+/* ======================================================================= */
+/* ===================== public api -- see header ======================== */
+/* ======================================================================= */
+
+LineCache *line_cache_new(void) {
+  LineCache *cache = safe_calloc(1, sizeof(LineCache));
+
+  if (!cache)
+    return NULL;
+
+  cache->buckets = safe_calloc(LINE_CACHE_MIN_BUCKETS, sizeof(LineEntry *));
+  if (!cache->buckets) {
+    free(cache);
+    return NULL;
+  }
+  cache->bucket_count = LINE_CACHE_MIN_BUCKETS;
+
+  return cache;
+}
+
+void line_cache_free(LineCache *cache) {
+  size_t bucket;
+
+  if (!cache)
+    return;
+
+  for (bucket = 0; bucket < cache->bucket_count; bucket++) {
+    LineEntry *entry = cache->buckets[bucket];
+
+    while (entry) {
+      LineEntry *next = entry->bucket_next;
+
+      free_entry(entry);
+      entry = next;
+    }
+  }
+
+  free(cache->buckets);
+  free(cache);
+}
+
+void line_cache_begin(LineCache *cache) {
+  cache->generation++;
+  cache->hits = 0;
+  cache->misses = 0;
+}
+
+LineEntry *line_cache_find(LineCache *cache, const char *text) {
+  LineEntry *entry = *find_slot(cache, text);
+
+  if (!entry) {
+    cache->misses++;
+    return NULL;
+  }
+
+  entry->generation = cache->generation;
+  cache->hits++;
+  return entry;
+}
+
+bool line_cache_add(LineCache *cache, const char *text,
+                    const CommandFields *command, const int *words,
+                    const DirectiveFields *directive) {
+  LineEntry **slot = find_slot(cache, text);
+  LineEntry *entry;
+
+  if (*slot)
+    return true; /* an earlier line of this build had the same text */
+
+  entry = safe_calloc(1, sizeof(LineEntry));
+  if (!entry)
+    return false;
+
+  entry->text = safe_strdup(text);
+  if (command) {
+    entry->command = copy_command(command);
+    entry->words = safe_calloc(command->length ? command->length : 1,
+                               sizeof(int));
+    if (entry->words)
+      memcpy(entry->words, words, command->length * sizeof(int));
+  } else {
+    entry->directive = copy_directive(directive);
+  }
+
+  if (!entry->text || (command && (!entry->command || !entry->words)) ||
+      (!command && !entry->directive)) {
+    free_entry(entry);
+    return false;
+  }
+
+  entry->generation = cache->generation;
+  *slot = entry;
+  cache->entry_count++;
+  if (cache->entry_count > cache->bucket_count)
+    grow_buckets(cache);
+
+  return true;
+}
+
+void line_cache_end(LineCache *cache) {
+  size_t bucket;
+
+  for (bucket = 0; bucket < cache->bucket_count; bucket++) {
+    LineEntry **slot = &cache->buckets[bucket];
+
+    while (*slot) {
+      LineEntry *entry = *slot;
+
+      if (entry->generation == cache->generation) {
+        slot = &entry->bucket_next;
+        continue;
+      }
+
+      *slot = entry->bucket_next;
+      free_entry(entry);
+      cache->entry_count--;
+    }
+  }
+}
+
+/* ======================================================================= */
+
+/* find_slot -- the link that holds text's entry, or the empty one at the end
+ * of its bucket where it would go */
+static LineEntry **find_slot(LineCache *cache, const char *text) {
+  LineEntry **slot =
+      &cache->buckets[hash_string(text) & (cache->bucket_count - 1)];
+
+  while (*slot && strcmp((*slot)->text, text) != 0)
+    slot = &(*slot)->bucket_next;
+
+  return slot;
+}
+
+/* grow_buckets -- rehash every entry into twice as many buckets, keeping the
+ * old ones if there's no memory for that */
+static void grow_buckets(LineCache *cache) {
+  size_t bucket_count = cache->bucket_count * 2;
+  LineEntry **buckets = safe_calloc(bucket_count, sizeof(LineEntry *));
+  size_t bucket;
+
+  if (!buckets)
+    return;
+
+  for (bucket = 0; bucket < cache->bucket_count; bucket++) {
+    LineEntry *entry = cache->buckets[bucket];
+
+    while (entry) {
+      LineEntry *next = entry->bucket_next;
+      size_t slot = hash_string(entry->text) & (bucket_count - 1);
+
+      entry->bucket_next = buckets[slot];
+      buckets[slot] = entry;
+      entry = next;
+    }
+  }
+
+  free(cache->buckets);
+  cache->buckets = buckets;
+  cache->bucket_count = bucket_count;
+}
+
+/* copy_command -- a copy of command and its strings
+ *
+ * - MUST BE FREED! (free_command)
+ *
+ * returns the copy or NULL if out of memory */
+static CommandFields *copy_command(const CommandFields *command) {
+  CommandFields *copy = new_command();
+
+  if (!copy)
+    return NULL;
+
+  copy->label = command->label ? safe_strdup(command->label) : NULL;
+  copy->length = command->length;
+  copy->opcode = command->opcode;
+  copy->src = command->src ? safe_strdup(command->src) : NULL;
+  copy->dst = command->dst ? safe_strdup(command->dst) : NULL;
+
+  if ((command->label && !copy->label) || (command->src && !copy->src) ||
+      (command->dst && !copy->dst)) {
+    free_command(copy);
+    return NULL;
+  }
+
+  return copy;
+}
+
+/* copy_directive -- a copy of directive, its data and its strings
+ *
+ * - MUST BE FREED! (free_directive)
+ *
+ * returns the copy or NULL if out of memory */
+static DirectiveFields *copy_directive(const DirectiveFields *directive) {
+  DirectiveFields *copy = new_directive(directive->data_length);
+
+  if (!copy)
+    return NULL;
+
+  if (directive->data_length > 0)
+    memcpy(copy->data, directive->data,
+           directive->data_length * sizeof(*directive->data));
+  copy->label = directive->label ? safe_strdup(directive->label) : NULL;
+  copy->arg_label =
+      directive->arg_label ? safe_strdup(directive->arg_label) : NULL;
+  copy->is_extern = directive->is_extern;
+  copy->is_entry = directive->is_entry;
+  copy->columns = directive->columns;
+
+  if ((directive->label && !copy->label) ||
+      (directive->arg_label && !copy->arg_label)) {
+    free_directive(copy);
+    return NULL;
+  }
+
+  return copy;
+}
+
+/* free_entry -- free an entry and everything it holds */
+static void free_entry(LineEntry *entry) {
+  free(entry->text);
+  free_command(entry->command);
+  free(entry->words);
+  free_directive(entry->directive);
+  free(entry);
+}
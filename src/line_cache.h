@@ -0,0 +1,76 @@
+#ifndef LINE_CACHE_H
+#define LINE_CACHE_H
+
+#include "types.h"
+#include <stddef.h>
+
+/* line_cache.h -- what the first pass made of each .am line, kept between
+ * builds of a file so unchanged lines don't have to be parsed again
+ *
+ * a line's instruction (its words before the second pass) or directive
+ * depends on nothing but its text, only the address it lands on and the
+ * symbol table around it do. so entries are found by the text (hashed), and
+ * first_pass_cached replays a hit at the address the lines before it have
+ * reached, defining its label again, which reports duplicates just like
+ * parsing would. lines that reported anything aren't stored and get parsed
+ * (and reported) again every build.
+ *
+ * entries no line of a build used are dropped when it ends, the cache holds
+ * one file's lines (one cache per file) */
+
+/* smallest cache index (power of 2) */
+#define LINE_CACHE_MIN_BUCKETS 256
+
+/* line_entry -- one line's result, exactly one of command and directive */
+typedef struct LineEntry {
+  char *text;                 /* the line as read */
+  CommandFields *command;     /* the instruction, cmd_address unused */
+  int *words;                 /* its command->length words */
+  DirectiveFields *directive; /* the directive, data_address unused */
+  int generation;             /* last build that used it */
+  struct LineEntry *bucket_next;
+} LineEntry;
+
+/* line_cache -- the entries by text, and how the last build used them */
+typedef struct LineCache {
+  LineEntry **buckets;
+  size_t bucket_count; /* power of 2 */
+  size_t entry_count;
+  int generation; /* of the current build */
+  int hits;       /* lines replayed in the current build */
+  int misses;     /* lines parsed in the current build */
+} LineCache;
+
+/* line_cache_new -- an empty cache
+ *
+ * - MUST BE FREED! (line_cache_free)
+ *
+ * returns the cache or NULL if out of memory
+ */
+LineCache *line_cache_new(void);
+
+/* line_cache_free -- free the cache and every entry (safe with NULL) */
+void line_cache_free(LineCache *cache);
+
+/* line_cache_begin -- start a build, zeroing hits and misses */
+void line_cache_begin(LineCache *cache);
+
+/* line_cache_find -- the entry for text, marked used by this build
+ *
+ * returns the entry or NULL (counted as a hit or a miss)
+ */
+LineEntry *line_cache_find(LineCache *cache, const char *text);
+
+/* line_cache_add -- store copies of the command and its words, or of the
+ * directive, that text was parsed into
+ *
+ * returns true on success, false if out of memory (nothing stored)
+ */
+bool line_cache_add(LineCache *cache, const char *text,
+                    const CommandFields *command, const int *words,
+                    const DirectiveFields *directive);
+
+/* line_cache_end -- end a build, dropping the entries it didn't use */
+void line_cache_end(LineCache *cache);
+
+#endif /* LINE_CACHE_H */
@@ -0,0 +1,480 @@
+#include "linker.h"
+#include "assembler.h"
+#include "first_pass.h"
+#include "helpers.h"
+#include "instruction_image.h"
+#include "instruction_utils.h"
+#include "ob_reader.h"
+#include "second_pass.h"
+#include "types.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* linker -- loads modules, builds one hashed entry index, relocates and
+ * patches every module, then writes the linked image. every step is linear
+ * in the number of words/symbols */
+
+/* smallest entry index (power of 2) */
+#define LINK_MIN_BUCKETS 64
+
+/* entry_index -- global entries by name, chained through LinkSymbol->next
+ * (the nodes are moved from the modules' entry lists) */
+typedef struct EntryIndex {
+  LinkSymbol **buckets;
+  size_t bucket_count; /* power of 2 */
+} EntryIndex;
+
+static FILE *open_module_file(const char *name, const char *ext);
+static bool load_object(LinkModule *module);
+static int count_code_words(LinkModule *module);
+static int relocate_code(LinkModule *module, int delta);
+static bool build_entry_index(EntryIndex *index, LinkModule *modules,
+                              int module_count, int *error_count);
+static LinkSymbol *find_entry(const EntryIndex *index, const char *name);
+static int patch_externals(LinkModule *module, const EntryIndex *index);
+static bool write_linked_image(const char *output, LinkModule *modules,
+                               int module_count);
+
+/* ======================================================================= */
+/* ===================== public api -- see header ======================== */
+/* ======================================================================= */
+
+int link_modules(const char *output, char **module_names, int module_count) {
+  LinkModule *modules;
+  EntryIndex index = {NULL, 0};
+  int error_count = 0;
+  int next_base = IC_INIT_VALUE;
+  int idx;
+
+  modules = safe_calloc((size_t)module_count, sizeof(LinkModule));
+  if (!modules)
+    return 1;
+
+  /* load every module and place it right after the previous one */
+  for (idx = 0; idx < module_count; idx++) {
+    LinkModule *module = &modules[idx];
+
+    module->name = module_names[idx];
+    if (!load_object(module) ||
+        !link_load_symbols(module->name, idx, ".ent", &module->entries) ||
+        !link_load_symbols(module->name, idx, ".ext", &module->externals) ||
+        count_code_words(module) < 0) {
+      error_count++;
+      continue;
+    }
+
+    module->base = next_base;
+    next_base += module->word_count;
+  }
+
+  /* same limit as a single file, see assembler.c */
+  if (!error_count && next_base > MAX_WORDS_MEMORY) {
+    fprintf(stderr,
+            "(ERROR) [linker] memory overflow: linked program requires %d "
+            "words but maximum is %d words\n",
+            next_base, MAX_WORDS_MEMORY);
+    error_count++;
+  }
+
+  /* entries are relocated while being indexed */
+  if (!error_count)
+    build_entry_index(&index, modules, module_count, &error_count);
+
+  /* relocate first, so the external words we patch are not moved again */
+  for (idx = 0; idx < module_count && !error_count; idx++) {
+    error_count +=
+        relocate_code(&modules[idx], modules[idx].base - IC_INIT_VALUE);
+  }
+
+  for (idx = 0; idx < module_count && !error_count; idx++) {
+    error_count += patch_externals(&modules[idx], &index);
+  }
+
+  if (!error_count && !write_linked_image(output, modules, module_count))
+    error_count++;
+
+  /* cleanup, entries live in the index once it's built */
+  if (index.buckets) {
+    size_t bucket;
+    for (bucket = 0; bucket < index.bucket_count; bucket++)
+      link_free_symbols(index.buckets[bucket]);
+    free(index.buckets);
+  }
+
+  for (idx = 0; idx < module_count; idx++) {
+    link_free_symbols(modules[idx].entries);
+    link_free_symbols(modules[idx].externals);
+  }
+
+  free(modules);
+  return error_count;
+}
+
+bool link_load_symbols(const char *name, int module_idx, const char *ext,
+                       LinkSymbol **list_out) {
+  char line[MAX_LINE_LENGTH];
+  FILE *fp = open_module_file(name, ext);
+  int line_number = 0;
+
+  *list_out = NULL;
+  if (!fp)
+    return true; /* nothing exported/imported */
+
+  while (fgets(line, sizeof(line), fp)) {
+    char symbol[MAX_LINE_LENGTH];
+    char addr_letters[MAX_LINE_LENGTH];
+    LinkSymbol *sym;
+    int address;
+
+    line_number++;
+
+    if (sscanf(line, "%80s %80s", symbol, addr_letters) != 2 ||
+        strlen(symbol) >= MAX_SYMBOL_LENGTH ||
+        (address = base4_letters_to_decimal(addr_letters)) < 0) {
+      fprintf(stderr, "(ERROR) [linker] bad row in '%s%s' at line %d\n",
+              name, ext, line_number);
+      fclose(fp);
+      return false;
+    }
+
+    sym = safe_calloc(1, sizeof(LinkSymbol));
+    if (!sym) {
+      fclose(fp);
+      return false;
+    }
+
+    strcpy(sym->name, symbol);
+    sym->address = address;
+    sym->module = module_idx;
+
+    /* order doesn't matter, push to the front */
+    sym->next = *list_out;
+    *list_out = sym;
+  }
+
+  fclose(fp);
+  return true;
+}
+
+void link_free_symbols(LinkSymbol *list) {
+  while (list) {
+    LinkSymbol *next = list->next;
+    free(list);
+    list = next;
+  }
+}
+
+/* ======================================================================= */
+/* ========================== static helpers ============================== */
+/* ======================================================================= */
+
+/* open_module_file -- open <name><ext> for reading, quietly (a module without
+ * entries or externals has no .ent/.ext, that's fine) */
+static FILE *open_module_file(const char *name, const char *ext) {
+  char filename[MAX_FILENAME_LENGTH + EXT_LENGTH];
+
+  if (strlen(name) + strlen(ext) >= sizeof(filename)) {
+    fprintf(stderr, "(ERROR) [linker] filename too long for module '%s'\n",
+            name);
+    return NULL;
+  }
+
+  strcpy(filename, name);
+  strcat(filename, ext);
+
+  return fopen(filename, "r");
+}
+
+/* load_object -- read the words of <module>.ob (see ob_reader.h), they must
+ * start at IC_INIT_VALUE and fit in memory */
+static bool load_object(LinkModule *module) {
+  char filename[MAX_FILENAME_LENGTH + EXT_LENGTH];
+  ObImage *image;
+  size_t idx;
+
+  if (strlen(module->name) + strlen(".ob") >= sizeof(filename)) {
+    fprintf(stderr, "(ERROR) [linker] filename too long for module '%s'\n",
+            module->name);
+    return false;
+  }
+  strcpy(filename, module->name);
+  strcat(filename, ".ob");
+
+  image = ob_read(filename);
+  if (!image)
+    return false;
+
+  if (image->base != IC_INIT_VALUE || image->word_count > MAX_WORDS_MEMORY) {
+    fprintf(stderr,
+            "(ERROR) [linker] '%s' must hold at most %d words from address "
+            "%d\n",
+            filename, MAX_WORDS_MEMORY, IC_INIT_VALUE);
+    ob_free(image);
+    return false;
+  }
+
+  module->word_count = (int)image->word_count;
+  for (idx = 0; idx < image->word_count; idx++)
+    module->words[idx] = image->words[idx];
+
+  ob_free(image);
+  return true;
+}
+
+/* count_code_words -- sum the instruction lengths in <module>.am, which is
+ * where the code segment of the .ob ends
+ *
+ * returns the number of code words, or -1 on error */
+static int count_code_words(LinkModule *module) {
+  char line[MAX_LINE_LENGTH];
+  FILE *am_fp = open_module_file(module->name, ".am");
+  int code_count = 0;
+  int line_number = 0;
+  int error_count = 0;
+
+  if (!am_fp) {
+    fprintf(stderr, "(ERROR) [linker] cannot open '%s.am'\n", module->name);
+    return -1;
+  }
+
+  while (fgets(line, sizeof(line), am_fp)) {
+    char *text, *colon;
+    char *opcode_str = NULL, *operands_str = NULL;
+    char *src = NULL, *dst = NULL;
+
+    line_number++;
+    line[strcspn(line, "\n")] = '\0';
+
+    /* skip the label, if any */
+    colon = strchr(line, ':');
+    text = trim(colon ? colon + 1 : line);
+
+    /* directives take no code words */
+    if (*text == '\0' || *text == '.')
+      continue;
+
+    if (!parse_opcode_and_operands(text, &opcode_str, &operands_str) ||
+        opcode_from_string(opcode_str) < 0 ||
+        !parse_two_operands(operands_str, &src, &dst, line_number,
+                            &error_count)) {
+      fprintf(stderr, "(ERROR) [linker] bad instruction in '%s.am' at line "
+                      "%d\n",
+              module->name, line_number);
+      fclose(am_fp);
+      return -1;
+    }
+
+    code_count += compute_instruction_length(
+        src ? addr_mode(src) : -1, dst ? addr_mode(dst) : -1, src, dst);
+  }
+
+  fclose(am_fp);
+
+  if (code_count > module->word_count) {
+    fprintf(stderr, "(ERROR) [linker] '%s.am' does not match '%s.ob'\n",
+            module->name, module->name);
+    return -1;
+  }
+
+  module->code_count = code_count;
+  return code_count;
+}
+
+/* relocate_code -- walk the code segment one instruction at a time (decoding
+ * the first word, like compute_instruction_length) and add delta to the
+ * address of every relocatable operand word
+ *
+ * returns the number of errors (the walk must end exactly at code_count) */
+static int relocate_code(LinkModule *module, int delta) {
+  int idx = 0;
+
+  while (idx < module->code_count) {
+    int first = module->words[idx];
+    int opcode = (first >> OPCODE_SHIFT) & OPCODE_MASK;
+    int src_mode = (first >> SRC_MODE_SHIFT) & ADDR_MODE_MASK;
+    int dst_mode = (first >> DST_MODE_SHIFT) & ADDR_MODE_MASK;
+    const InstructionInfo *info = get_instruction_info(opcode);
+    bool has_src, has_dst;
+    int length, operand;
+
+    if (!info || (first & ARE_MASK) != ARE_ABSOLUTE)
+      break;
+
+    /* operands are there whenever the opcode takes them, the "" only mark
+     * presence for compute_instruction_length */
+    has_src = info->allowed_src != 0;
+    has_dst = info->allowed_dst != 0;
+    length = compute_instruction_length(has_src ? src_mode : -1,
+                                        has_dst ? dst_mode : -1,
+                                        has_src ? "" : NULL,
+                                        has_dst ? "" : NULL);
+
+    if (idx + length > module->code_count)
+      break;
+
+    for (operand = idx + 1; operand < idx + length; operand++) {
+      int word = module->words[operand];
+
+      if ((word & ARE_MASK) == ARE_RELOCATABLE) {
+        int addr = (word >> ADDRESS_PAYLOAD_SHIFT) + delta;
+        module->words[operand] =
+            ((addr << ADDRESS_PAYLOAD_SHIFT) | ARE_RELOCATABLE) & WORD_MASK;
+      }
+    }
+
+    idx += length;
+  }
+
+  if (idx != module->code_count) {
+    fprintf(stderr,
+            "(ERROR) [linker] code in '%s.ob' does not decode at address %d\n",
+            module->name, IC_INIT_VALUE + idx);
+    return 1;
+  }
+
+  return 0;
+}
+
+/* build_entry_index -- move every module's entries (relocated to their
+ * linked address) into one hash table, an entry exported twice is an error
+ *
+ * returns true on success, false on error */
+static bool build_entry_index(EntryIndex *index, LinkModule *modules,
+                              int module_count, int *error_count) {
+  size_t entry_count = 0;
+  LinkSymbol *sym;
+  int idx;
+
+  for (idx = 0; idx < module_count; idx++) {
+    for (sym = modules[idx].entries; sym; sym = sym->next)
+      entry_count++;
+  }
+
+  /* load factor of 1/2 at most */
+  index->bucket_count = LINK_MIN_BUCKETS;
+  while (index->bucket_count < entry_count * 2)
+    index->bucket_count *= 2;
+
+  index->buckets = safe_calloc(index->bucket_count, sizeof(LinkSymbol *));
+  if (!index->buckets) {
+    (*error_count)++;
+    return false;
+  }
+
+  for (idx = 0; idx < module_count; idx++) {
+    LinkModule *module = &modules[idx];
+
+    while (module->entries) {
+      LinkSymbol *existing;
+      size_t bucket;
+
+      sym = module->entries;
+      module->entries = sym->next;
+
+      existing = find_entry(index, sym->name);
+      if (existing) {
+        fprintf(stderr,
+                "(ERROR) [linker] entry '%s' is exported by both '%s' and "
+                "'%s'\n",
+                sym->name, modules[existing->module].name, module->name);
+        (*error_count)++;
+        free(sym);
+        continue;
+      }
+
+      sym->address += module->base - IC_INIT_VALUE;
+
+      bucket = hash_string(sym->name) & (index->bucket_count - 1);
+      sym->next = index->buckets[bucket];
+      index->buckets[bucket] = sym;
+    }
+  }
+
+  return *error_count == 0;
+}
+
+/* find_entry -- lookup an exported symbol, NULL if none */
+static LinkSymbol *find_entry(const EntryIndex *index, const char *name) {
+  LinkSymbol *sym =
+      index->buckets[hash_string(name) & (index->bucket_count - 1)];
+
+  for (; sym; sym = sym->next) {
+    if (strcmp(sym->name, name) == 0)
+      return sym;
+  }
+
+  return NULL;
+}
+
+/* patch_externals -- resolve every .ext row of the module, the word it points
+ * at becomes a relocatable word holding the entry's linked address
+ *
+ * returns the number of errors */
+static int patch_externals(LinkModule *module, const EntryIndex *index) {
+  LinkSymbol *ext;
+  int error_count = 0;
+
+  for (ext = module->externals; ext; ext = ext->next) {
+    int idx = ext->address - IC_INIT_VALUE;
+    LinkSymbol *entry;
+
+    if (idx < 0 || idx >= module->code_count ||
+        (module->words[idx] & ARE_MASK) != ARE_EXTERNAL) {
+      fprintf(stderr,
+              "(ERROR) [linker] '%s.ext' lists '%s' at address %d, which is "
+              "not an external word\n",
+              module->name, ext->name, ext->address);
+      error_count++;
+      continue;
+    }
+
+    entry = find_entry(index, ext->name);
+    if (!entry) {
+      fprintf(stderr,
+              "(ERROR) [linker] undefined external symbol '%s' in '%s'\n",
+              ext->name, module->name);
+      error_count++;
+      continue;
+    }
+
+    module->words[idx] =
+        ((entry->address << ADDRESS_PAYLOAD_SHIFT) | ARE_RELOCATABLE) &
+        WORD_MASK;
+  }
+
+  return error_count;
+}
+
+/* write_linked_image -- write <output>.ob, every module's words at its base */
+static bool write_linked_image(const char *output, LinkModule *modules,
+                               int module_count) {
+  FILE *ob_fp = open_file_with_ext(output, ".ob", "w");
+  int idx, j;
+
+  if (!ob_fp) {
+    fprintf(stderr, "(ERROR) [linker] failed to create '%s.ob'\n", output);
+    return false;
+  }
+
+  for (idx = 0; idx < module_count; idx++) {
+    for (j = 0; j < modules[idx].word_count; j++) {
+      char *addr_letters = decimal_to_base4_letters(modules[idx].base + j);
+      char *word_letters = decimal_to_base4_letters(modules[idx].words[j]);
+
+      /* write line in base-4 letter format */
+      if (addr_letters && word_letters) {
+        fprintf(ob_fp, "%s %s\n", addr_letters, word_letters);
+      } else {
+        /* fallback on allocation failure */
+        fprintf(ob_fp, "aaaaa aaaaa\n");
+      }
+
+      free(addr_letters);
+      free(word_letters);
+    }
+  }
+
+  fclose(ob_fp);
+  return true;
+}
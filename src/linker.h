@@ -0,0 +1,59 @@
+#ifndef LINKER_H
+#define LINKER_H
+
+#include "assembler.h"
+#include "types.h"
+
+/* linker.h -- links assembled modules (.ob/.ent/.ext) into one image
+ *
+ * modules are placed one after the other from IC_INIT_VALUE, in the order
+ * given. relocatable words (A/R/E = 10) are moved by their module's base, and
+ * every external word listed in a .ext file is patched with the address of
+ * the matching .ent entry from any module.
+ *
+ * .ob files don't say where code ends and data starts, so the code length is
+ * taken from each module's .am (see count_code_words), then checked by
+ * decoding the code words themselves */
+
+/* link_symbol -- one .ent or .ext row */
+typedef struct LinkSymbol {
+  char name[MAX_SYMBOL_LENGTH];
+  int address;   /* module address, then linked address for entries */
+  int module;    /* index of the module it came from */
+  struct LinkSymbol *next;
+} LinkSymbol;
+
+/* link_module -- one loaded module */
+typedef struct LinkModule {
+  const char *name;             /* base filename, without extension */
+  int words[MAX_WORDS_MEMORY];  /* .ob words, index 0 is IC_INIT_VALUE */
+  int word_count;               /* code + data words */
+  int code_count;               /* code words */
+  int base;                     /* first address in the linked image */
+  LinkSymbol *entries;          /* from .ent */
+  LinkSymbol *externals;        /* from .ext, address of the referencing word */
+} LinkModule;
+
+/* link_modules -- link module_count modules (base filenames) and write the
+ * linked image to <output>.ob
+ *
+ * returns the number of errors found (0 on success), nothing is written if
+ * there are any
+ */
+int link_modules(const char *output, char **module_names, int module_count);
+
+/* link_load_symbols -- read the "<name> <address>" rows of <name><ext> (.ent
+ * or .ext) into a list of symbols of module module_idx. a module without
+ * the file has none
+ *
+ * - MUST BE FREED! (link_free_symbols)
+ *
+ * returns true on success, false on error (error printed)
+ */
+bool link_load_symbols(const char *name, int module_idx, const char *ext,
+                       LinkSymbol **list_out);
+
+/* link_free_symbols -- free a LinkSymbol list (safe with NULL) */
+void link_free_symbols(LinkSymbol *list);
+
+#endif /* LINKER_H */
@@ -0,0 +1,253 @@
+#include "macro_library.h"
+#include "file_map.h"
+#include "helpers.h"
+#include "types.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* macro_library -- builds, saves, maps and searches macro library images */
+
+static size_t image_size_for(unsigned int bucket_count,
+                             unsigned int macro_count, unsigned int blob_size);
+static bool image_is_valid(const char *image, size_t image_size);
+
+/* ======================================================================= */
+/* ===================== public api -- see header ======================== */
+/* ======================================================================= */
+
+MacroLibrary *macro_library_build(const Macro *head) {
+  MacroLibrary *library = NULL;
+  MacroLibraryHeader *header;
+  MacroLibraryEntry *entries;
+  unsigned int *buckets;
+  char *blob;
+  const Macro *m;
+  unsigned int macro_count = 0;
+  unsigned int bucket_count = MACRO_LIBRARY_MIN_BUCKETS;
+  size_t bodies_size = 0, names_size = 0;
+  size_t body_at, name_at;
+  unsigned int idx;
+
+  /* measure everything first, so we allocate once */
+  for (m = head; m; m = m->next) {
+    macro_count++;
+    bodies_size += m->body_length;
+    names_size += strlen(m->name) + 1;
+  }
+
+  /* size the table for a load factor of 1/2 at most */
+  while (bucket_count < macro_count * 2)
+    bucket_count *= 2;
+
+  library = safe_calloc(1, sizeof(MacroLibrary));
+  if (!library)
+    return NULL;
+
+  library->image_size = image_size_for(bucket_count, macro_count,
+                                       (unsigned int)(bodies_size + names_size));
+  library->image = safe_calloc(library->image_size, 1);
+  if (!library->image) {
+    free(library);
+    return NULL;
+  }
+
+  header = (MacroLibraryHeader *)library->image;
+  buckets = (unsigned int *)(header + 1);
+  entries = (MacroLibraryEntry *)(buckets + bucket_count);
+  blob = (char *)(entries + macro_count);
+
+  header->magic = MACRO_LIBRARY_MAGIC;
+  header->version = MACRO_LIBRARY_VERSION;
+  header->bucket_count = bucket_count;
+  header->macro_count = macro_count;
+  header->blob_size = (unsigned int)(bodies_size + names_size);
+
+  /* bodies first and names last, so the blob always ends with a '\0' */
+  body_at = 0;
+  name_at = bodies_size;
+
+  for (m = head, idx = 0; m; m = m->next, idx++) {
+    MacroLibraryEntry *entry = &entries[idx];
+    size_t name_length = strlen(m->name) + 1;
+    unsigned int bucket;
+
+    memcpy(blob + body_at, m->body, m->body_length);
+    memcpy(blob + name_at, m->name, name_length);
+
+    entry->hash = (unsigned int)hash_string(m->name);
+    entry->body_offset = (unsigned int)body_at;
+    entry->body_length = (unsigned int)m->body_length;
+    entry->param_count = (unsigned int)m->param_count;
+    entry->name_offset = (unsigned int)name_at;
+
+    body_at += m->body_length;
+    name_at += name_length;
+
+    /* push to the front of its bucket */
+    bucket = entry->hash & (bucket_count - 1);
+    entry->next = buckets[bucket];
+    buckets[bucket] = idx + 1;
+  }
+
+  return library;
+}
+
+bool macro_library_is_compiled(const char *filename) {
+  FILE *fp = fopen(filename, "rb");
+  MacroLibraryHeader header;
+  bool compiled = false;
+
+  if (!fp)
+    return false;
+
+  if (fread(&header, sizeof(header), 1, fp) == 1)
+    compiled = (header.magic == MACRO_LIBRARY_MAGIC);
+
+  fclose(fp);
+  return compiled;
+}
+
+MacroLibrary *macro_library_open(const char *filename) {
+  MacroLibrary *library = safe_calloc(1, sizeof(MacroLibrary));
+
+  if (!library)
+    return NULL;
+
+  library->image = map_file(filename, &library->image_size,
+                            &library->is_mapped);
+  if (!library->image) {
+    free(library);
+    return NULL;
+  }
+
+  if (!image_is_valid(library->image, library->image_size)) {
+    fprintf(stderr,
+            "(ERROR) [macro_library] '%s' is not a valid compiled macro "
+            "library (version %d)\n",
+            filename, MACRO_LIBRARY_VERSION);
+    macro_library_free(library);
+    return NULL;
+  }
+
+  return library;
+}
+
+bool macro_library_save(const MacroLibrary *library, const char *filename) {
+  FILE *fp = fopen(filename, "wb");
+  bool ok;
+
+  if (!fp) {
+    fprintf(stderr, "(ERROR) [macro_library] creating '%s' failed\n",
+            filename);
+    return false;
+  }
+
+  ok = fwrite(library->image, 1, library->image_size, fp) ==
+       library->image_size;
+  if (fclose(fp) != 0)
+    ok = false;
+
+  if (!ok) {
+    fprintf(stderr, "(ERROR) [macro_library] writing '%s' failed\n",
+            filename);
+    remove(filename);
+  }
+
+  return ok;
+}
+
+bool macro_library_find(const MacroLibrary *library, const char *name,
+                        Macro *found) {
+  const MacroLibraryHeader *header;
+  const unsigned int *buckets;
+  const MacroLibraryEntry *entries;
+  const char *blob;
+  unsigned int hash, link;
+
+  if (!library)
+    return false;
+
+  header = (const MacroLibraryHeader *)library->image;
+  buckets = (const unsigned int *)(header + 1);
+  entries = (const MacroLibraryEntry *)(buckets + header->bucket_count);
+  blob = (const char *)(entries + header->macro_count);
+
+  hash = (unsigned int)hash_string(name);
+
+  /* walk the chain. entries are pushed to the front of their bucket, so a
+   * link is always below the one before it: a bad link in a corrupt image
+   * (out of range, or one that would loop) just ends the search */
+  for (link = buckets[hash & (header->bucket_count - 1)];
+       link != 0 && link <= header->macro_count;
+       link = entries[link - 1].next < link ? entries[link - 1].next : 0) {
+    const MacroLibraryEntry *entry = &entries[link - 1];
+
+    if (entry->hash != hash || entry->name_offset >= header->blob_size ||
+        entry->body_offset > header->blob_size ||
+        entry->body_length > header->blob_size - entry->body_offset)
+      continue;
+
+    if (strcmp(name, blob + entry->name_offset) == 0) {
+      if (found) {
+        found->name = (char *)(blob + entry->name_offset);
+        found->body = blob + entry->body_offset;
+        found->body_length = entry->body_length;
+        found->param_count = entry->param_count <= MACRO_MAX_PARAMS
+                                 ? (int)entry->param_count
+                                 : 0;
+        found->owned_body = NULL;
+        found->line_number = 0; /* callable from any line */
+        found->next = NULL;
+      }
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void macro_library_free(MacroLibrary *library) {
+  if (!library)
+    return;
+
+  unmap_file(library->image, library->image_size, library->is_mapped);
+  free(library);
+}
+
+/* ======================================================================= */
+/* ========================== static helpers ============================== */
+/* ======================================================================= */
+
+/* image_size_for -- total bytes of an image with these counts */
+static size_t image_size_for(unsigned int bucket_count,
+                             unsigned int macro_count, unsigned int blob_size) {
+  return sizeof(MacroLibraryHeader) +
+         (size_t)bucket_count * sizeof(unsigned int) +
+         (size_t)macro_count * sizeof(MacroLibraryEntry) + blob_size;
+}
+
+/* image_is_valid -- check the header against the real size of the image,
+ * this is O(1) and enough for macro_library_find to never read out of it */
+static bool image_is_valid(const char *image, size_t image_size) {
+  const MacroLibraryHeader *header = (const MacroLibraryHeader *)image;
+
+  if (image_size < sizeof(MacroLibraryHeader))
+    return false;
+
+  if (header->magic != MACRO_LIBRARY_MAGIC ||
+      header->version != MACRO_LIBRARY_VERSION)
+    return false;
+
+  /* bucket count must be a power of 2 */
+  if (header->bucket_count == 0 ||
+      (header->bucket_count & (header->bucket_count - 1)) != 0)
+    return false;
+
+  if (image_size_for(header->bucket_count, header->macro_count,
+                     header->blob_size) != image_size)
+    return false;
+
+  /* names are null-terminated and come last */
+  return header->blob_size == 0 || image[image_size - 1] == '\0';
+}
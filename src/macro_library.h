@@ -0,0 +1,117 @@
+#ifndef MACRO_LIBRARY_H
+#define MACRO_LIBRARY_H
+
+#include "types.h"
+#include <stddef.h>
+
+/* macro_library.h -- the compiled (indexed) form of a macro library
+ *
+ * a library is one flat image, the same bytes in memory and on disk:
+ *
+ *   MacroLibraryHeader
+ *   unsigned int       buckets[bucket_count]  entry index + 1, 0 = empty
+ *   MacroLibraryEntry  entries[macro_count]   chained through 'next'
+ *   char               blob[blob_size]        bodies, then names
+ *
+ * a text library (--macro-lib) is parsed once and built into an image, a
+ * compiled one (--compile-macros) is mapped as is and used without parsing.
+ * integers are in host byte order, a foreign image fails the magic check */
+
+#define MACRO_LIBRARY_MAGIC 0x424C434DU /* "MCLB" read as little endian */
+#define MACRO_LIBRARY_VERSION 2             /* 2: macro parameters */
+
+/* a parameter's uses in a body are this char followed by '1' + its index,
+ * so expanding a call is a splice of its arguments between the marks */
+#define MACRO_PARAM_MARK '\001'
+#define MACRO_MAX_PARAMS 9
+
+/* smallest hash table for a macro library (power of 2) */
+#define MACRO_LIBRARY_MIN_BUCKETS 16
+
+/* macro -- this struct holds info about a macro: its name, body, line number,
+ * and pointer to the next macro
+ *
+ * the body is NOT owned by the macro, it's a span (pointer + length) into the
+ * cleaned source text (or a library image), which has to outlive the macro.
+ * a macro with parameters has its body rewritten with their marks, that copy
+ * is owned (owned_body) by the macro that made it. the preprocessor keeps a
+ * hash index of a file's list on its head node */
+typedef struct Macro {
+  char *name;
+  const char *body;   /* first char of the body (the line after 'mcro') */
+  size_t body_length; /* bytes up to the 'mcroend' line, newlines included */
+  int param_count;    /* 0 if it takes no arguments */
+  char *owned_body;   /* body, when it's ours to free (else NULL) */
+  int line_number;
+  struct Macro *next;
+  struct Macro *bucket_next; /* next in its bucket of the index */
+  struct MacroIndex *index;  /* set on the head only, NULL elsewhere */
+} Macro;
+
+typedef struct MacroLibraryHeader {
+  unsigned int magic;        /* MACRO_LIBRARY_MAGIC */
+  unsigned int version;      /* MACRO_LIBRARY_VERSION */
+  unsigned int bucket_count; /* power of 2 */
+  unsigned int macro_count;
+  unsigned int blob_size;
+} MacroLibraryHeader;
+
+typedef struct MacroLibraryEntry {
+  unsigned int hash;        /* hash_string(name), truncated */
+  unsigned int name_offset; /* into the blob, null-terminated */
+  unsigned int body_offset; /* into the blob */
+  unsigned int body_length;
+  unsigned int param_count;
+  unsigned int next; /* entry index + 1 of the next one in the bucket */
+} MacroLibraryEntry;
+
+/* macro_library -- a read-only table of macros loaded once per run,
+ * consulted by every file before its own macros
+ *
+ * nothing in it changes after it's built or opened, so worker threads can
+ * share one library without locking */
+typedef struct MacroLibrary {
+  char *image;       /* see the layout above */
+  size_t image_size; /* bytes */
+  bool is_mapped;    /* image is mmap'ed (else malloc'ed) */
+} MacroLibrary;
+
+/* macro_library_build -- build an image from a list of macros (the bodies
+ * are copied, so the list and its text may be freed afterwards)
+ *
+ * - MUST BE FREED! (macro_library_free)
+ *
+ * returns the library or NULL on error
+ */
+MacroLibrary *macro_library_build(const Macro *head);
+
+/* macro_library_is_compiled -- true if filename holds a compiled image */
+bool macro_library_is_compiled(const char *filename);
+
+/* macro_library_open -- map a compiled image (no parsing, we only check the
+ * header and the sizes)
+ *
+ * - MUST BE FREED! (macro_library_free)
+ *
+ * returns the library or NULL on error (error printed)
+ */
+MacroLibrary *macro_library_open(const char *filename);
+
+/* macro_library_save -- write the image to filename
+ *
+ * returns true on success, false on error (error printed)
+ */
+bool macro_library_save(const MacroLibrary *library, const char *filename);
+
+/* macro_library_find -- lookup a macro by name, on success *found gets a
+ * view of it (body points into the image, line number 0)
+ *
+ * returns true if found, false if not (or if library is NULL)
+ */
+bool macro_library_find(const MacroLibrary *library, const char *name,
+                        Macro *found);
+
+/* macro_library_free -- unmap/free a library */
+void macro_library_free(MacroLibrary *library);
+
+#endif /* MACRO_LIBRARY_H */
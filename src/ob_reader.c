@@ -0,0 +1,219 @@
+#include "ob_reader.h"
+#include "file_map.h"
+#include "helpers.h"
+#include "instruction_image.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/* ob_reader -- table-driven .ob decoding, a block of rows per iteration */
+
+#define OB_ROW_LENGTH 12     /* "aaaaa aaaaa\n", as second_pass writes it */
+#define OB_MIN_ROW_LENGTH 11 /* last row, without its '\n' */
+#define OB_WORD_OFFSET 6     /* word letters start after "aaaaa " */
+#define OB_BLOCK_ROWS 4      /* rows decoded per fast path iteration */
+
+#define NOT_DIGIT 0x80  /* digit_of[] of anything but 'a'..'d' */
+#define ROW_BAD 0x8000U /* row_value() of a bad group of letters */
+
+#define BAD4 NOT_DIGIT, NOT_DIGIT, NOT_DIGIT, NOT_DIGIT
+#define BAD16 BAD4, BAD4, BAD4, BAD4
+#define BAD32 BAD16, BAD16
+
+/* base-4 digit of every byte, 'a'=0 .. 'd'=3 */
+static const unsigned char digit_of[256] = {
+    BAD32, BAD32, BAD32,                  /* 0x00 - 0x5f */
+    NOT_DIGIT, 0, 1, 2,                   /* ` a b c */
+    3, NOT_DIGIT, NOT_DIGIT, NOT_DIGIT,   /* d e f g */
+    BAD4, BAD4, BAD16, BAD32,             /* 0x68 - 0x9f */
+    BAD32, BAD32, BAD32                   /* 0xa0 - 0xff */
+};
+
+static unsigned int row_value(const unsigned char *letters);
+static bool is_row_space(int c);
+static int decode_row(const unsigned char **cursor, const unsigned char *end,
+                      unsigned int *address_out, unsigned int *word_out,
+                      unsigned long *line_number);
+
+/* ======================================================================= */
+/* ===================== public api -- see header ======================== */
+/* ======================================================================= */
+
+ObImage *ob_read(const char *filename) {
+  ObImage *image;
+  size_t size;
+  bool is_mapped;
+  char *text = map_file(filename, &size, &is_mapped);
+
+  if (!text)
+    return NULL;
+
+  image = ob_decode(text, size, filename);
+  unmap_file(text, size, is_mapped);
+  return image;
+}
+
+ObImage *ob_decode(const char *text, size_t length, const char *name) {
+  const unsigned char *cursor = (const unsigned char *)text;
+  const unsigned char *end = cursor + length;
+  unsigned long line_number = 0;
+  unsigned int expected = 0; /* address of the next row */
+  ObImage *image = safe_calloc(1, sizeof(ObImage));
+
+  if (!image)
+    return NULL;
+
+  /* every row takes at least OB_MIN_ROW_LENGTH bytes */
+  image->words =
+      safe_calloc(length / OB_MIN_ROW_LENGTH + 1, sizeof(unsigned short));
+  if (!image->words) {
+    free(image);
+    return NULL;
+  }
+
+  while (cursor < end) {
+    unsigned int address, word;
+    int status;
+
+    /* fast path: OB_BLOCK_ROWS well-formed, consecutive rows. anything else
+     * (the first row, a bad row, blank lines, \r\n ...) is left for
+     * decode_row, which also tells exactly what's wrong */
+    while (image->word_count > 0 &&
+           (size_t)(end - cursor) >= OB_BLOCK_ROWS * OB_ROW_LENGTH) {
+      unsigned int block[OB_BLOCK_ROWS];
+      unsigned int bad = 0;
+      int row;
+
+      for (row = 0; row < OB_BLOCK_ROWS; row++) {
+        const unsigned char *letters = cursor + row * OB_ROW_LENGTH;
+        unsigned int row_address = row_value(letters);
+
+        block[row] = row_value(letters + OB_WORD_OFFSET);
+        bad |= (block[row] | row_address) & ROW_BAD;
+        bad |= row_address ^ ((expected + row) & WORD_MASK);
+        bad |= (unsigned int)(letters[OB_WORD_OFFSET - 1] ^ ' ');
+        bad |= (unsigned int)(letters[OB_ROW_LENGTH - 1] ^ '\n');
+      }
+
+      if (bad)
+        break;
+
+      for (row = 0; row < OB_BLOCK_ROWS; row++)
+        image->words[image->word_count++] = (unsigned short)block[row];
+
+      cursor += OB_BLOCK_ROWS * OB_ROW_LENGTH;
+      expected = (expected + OB_BLOCK_ROWS) & WORD_MASK;
+      line_number += OB_BLOCK_ROWS;
+    }
+
+    /* one row the slow way */
+    status = decode_row(&cursor, end, &address, &word, &line_number);
+    if (status < 0) {
+      fprintf(stderr, "(ERROR) [ob_reader] bad row in '%s' at line %lu\n",
+              name, line_number);
+      ob_free(image);
+      return NULL;
+    }
+    if (status == 0)
+      break; /* only blank lines were left */
+
+    if (image->word_count == 0) {
+      image->base = address;
+    } else if (address != expected) {
+      fprintf(stderr,
+              "(ERROR) [ob_reader] address out of sequence in '%s' at line "
+              "%lu\n",
+              name, line_number);
+      ob_free(image);
+      return NULL;
+    }
+
+    image->words[image->word_count++] = (unsigned short)word;
+    expected = (address + 1) & WORD_MASK;
+  }
+
+  return image;
+}
+
+void ob_free(ObImage *image) {
+  if (!image)
+    return;
+
+  free(image->words);
+  free(image);
+}
+
+/* ======================================================================= */
+
+/* row_value -- the 5 base-4 letters at letters as one word, ROW_BAD is set
+ * if any of them isn't a digit */
+static unsigned int row_value(const unsigned char *letters) {
+  unsigned int d0 = digit_of[letters[0]];
+  unsigned int d1 = digit_of[letters[1]];
+  unsigned int d2 = digit_of[letters[2]];
+  unsigned int d3 = digit_of[letters[3]];
+  unsigned int d4 = digit_of[letters[4]];
+  unsigned int value = (d0 << 8) | (d1 << 6) | (d2 << 4) | (d3 << 2) | d4;
+
+  return (value & WORD_MASK) | (((d0 | d1 | d2 | d3 | d4) & NOT_DIGIT) << 8);
+}
+
+/* is_row_space -- blanks allowed around the two columns of a row */
+static bool is_row_space(int c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+/* decode_row -- decode the next row at *cursor (skipping blank lines) and
+ * move past it, *line_number follows every line read
+ *
+ * returns 1 for a row, 0 at the end of the text, -1 for a bad row
+ */
+static int decode_row(const unsigned char **cursor, const unsigned char *end,
+                      unsigned int *address_out, unsigned int *word_out,
+                      unsigned long *line_number) {
+  const unsigned char *p = *cursor;
+
+  for (;;) {
+    const unsigned char *line = p;
+
+    while (p < end && is_row_space(*p))
+      p++;
+
+    if (p == end) {
+      if (p > line)
+        (*line_number)++;
+      *cursor = p;
+      return 0;
+    }
+
+    (*line_number)++;
+    if (*p != '\n')
+      break;
+    p++; /* blank line */
+  }
+
+  /* address column */
+  if (end - p < BASE4_DIGITS_PER_WORD ||
+      (*address_out = row_value(p)) & ROW_BAD)
+    return -1;
+  p += BASE4_DIGITS_PER_WORD;
+
+  if (p == end || !is_row_space(*p))
+    return -1;
+  while (p < end && is_row_space(*p))
+    p++;
+
+  /* word column */
+  if (end - p < BASE4_DIGITS_PER_WORD || (*word_out = row_value(p)) & ROW_BAD)
+    return -1;
+  p += BASE4_DIGITS_PER_WORD;
+
+  /* and nothing else on the line */
+  while (p < end && is_row_space(*p))
+    p++;
+  if (p < end) {
+    if (*p != '\n')
+      return -1;
+    p++;
+  }
+
+  *cursor = p;
+  return 1;
+}
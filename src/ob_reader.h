@@ -0,0 +1,45 @@
+#ifndef OB_READER_H
+#define OB_READER_H
+
+#include "types.h"
+#include <stddef.h>
+
+/* ob_reader.h -- reads text .ob files ("aaaaa aaaaa" address/word rows)
+ *
+ * the file is mapped (see file_map.h) and decoded in blocks of rows with a
+ * letter -> digit table. a row is checked on its own only when its block
+ * doesn't look like the rows second_pass writes, so an ordinary .ob is never
+ * scanned char by char.
+ *
+ * addresses must be consecutive from the first row. they are 10-bit words,
+ * so they are compared modulo 2^10 (long streams wrap around), callers with
+ * a memory limit check word_count themselves */
+
+/* ob_image -- the decoded words of an .ob file */
+typedef struct ObImage {
+  unsigned short *words; /* word_count 10-bit words */
+  size_t word_count;
+  unsigned int base; /* address of words[0] */
+} ObImage;
+
+/* ob_read -- map filename (full filename) and decode it
+ *
+ * - MUST BE FREED! (ob_free)
+ *
+ * returns the image or NULL on error (error printed with its line number)
+ */
+ObImage *ob_read(const char *filename);
+
+/* ob_decode -- decode the length bytes at text (an .ob file already in
+ * memory), name is only used in error messages
+ *
+ * - MUST BE FREED! (ob_free)
+ *
+ * returns the image or NULL on error (error printed with its line number)
+ */
+ObImage *ob_decode(const char *text, size_t length, const char *name);
+
+/* ob_free -- free an image from ob_read/ob_decode */
+void ob_free(ObImage *image);
+
+#endif /* OB_READER_H */
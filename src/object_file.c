@@ -0,0 +1,195 @@
+#include "object_file.h"
+#include "file_map.h"
+#include "helpers.h"
+#include "second_pass.h"
+#include "types.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* object_file -- writes and maps the packed binary object format */
+
+/* offsets of every piece, from the header counts */
+typedef struct ObjectLayout {
+  size_t words;
+  size_t relocs;
+  size_t entries;
+  size_t externs;
+  size_t strings;
+  size_t total;
+} ObjectLayout;
+
+static void compute_layout(const ObjectHeader *header, ObjectLayout *layout);
+static bool symbols_are_valid(const ObjectSymbol *symbols, unsigned int count,
+                              const ObjectHeader *header);
+
+/* ======================================================================= */
+/* ===================== public api -- see header ======================== */
+/* ======================================================================= */
+
+bool object_file_write(const char *base_filename, const ObjectFile *obj) {
+  static const char padding[sizeof(unsigned int)] = {0};
+  ObjectHeader header = obj->header;
+  ObjectLayout layout;
+  size_t word_bytes;
+  FILE *fp;
+  bool ok;
+
+  header.magic = OBJECT_MAGIC;
+  header.version = OBJECT_VERSION;
+  compute_layout(&header, &layout);
+
+  fp = open_file_with_ext(base_filename, OBJECT_EXT, "wb");
+  if (!fp) {
+    fprintf(stderr, "(ERROR) [object_file] failed to create %s file\n",
+            OBJECT_EXT);
+    return false;
+  }
+
+  word_bytes = (header.code_count + header.data_count) * sizeof(*obj->words);
+
+  /* one fwrite per piece */
+  ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+  ok = ok && fwrite(obj->words, 1, word_bytes, fp) == word_bytes;
+  ok = ok && fwrite(padding, 1, layout.relocs - layout.words - word_bytes,
+                    fp) == layout.relocs - layout.words - word_bytes;
+  ok = ok && fwrite(obj->relocs, sizeof(ObjectReloc), header.reloc_count,
+                    fp) == header.reloc_count;
+  ok = ok && fwrite(obj->entries, sizeof(ObjectSymbol), header.entry_count,
+                    fp) == header.entry_count;
+  ok = ok && fwrite(obj->externs, sizeof(ObjectSymbol), header.extern_count,
+                    fp) == header.extern_count;
+  ok = ok && fwrite(obj->strings, 1, header.strings_size, fp) ==
+                 header.strings_size;
+
+  if (fclose(fp) != 0)
+    ok = false;
+
+  if (!ok) {
+    fprintf(stderr, "(ERROR) [object_file] writing %s%s failed\n",
+            base_filename, OBJECT_EXT);
+  }
+
+  return ok;
+}
+
+ObjectFile *object_file_open(const char *filename) {
+  ObjectFile *obj = safe_calloc(1, sizeof(ObjectFile));
+  const ObjectHeader *header;
+  ObjectLayout layout;
+  unsigned int idx;
+  bool valid = false;
+
+  if (!obj)
+    return NULL;
+
+  obj->image = map_file(filename, &obj->image_size, &obj->is_mapped);
+  if (!obj->image) {
+    free(obj);
+    return NULL;
+  }
+
+  header = (const ObjectHeader *)obj->image;
+  if (obj->image_size >= sizeof(ObjectHeader) &&
+      header->magic == OBJECT_MAGIC && header->version == OBJECT_VERSION) {
+    compute_layout(header, &layout);
+    valid = layout.total == obj->image_size;
+  }
+
+  if (valid) {
+    obj->header = *header;
+    obj->words = (const unsigned short *)(obj->image + layout.words);
+    obj->relocs = (const ObjectReloc *)(obj->image + layout.relocs);
+    obj->entries = (const ObjectSymbol *)(obj->image + layout.entries);
+    obj->externs = (const ObjectSymbol *)(obj->image + layout.externs);
+    obj->strings = obj->image + layout.strings;
+
+    /* names must end inside the string table */
+    valid = header->strings_size == 0 ||
+            obj->strings[header->strings_size - 1] == '\0';
+    valid = valid &&
+            symbols_are_valid(obj->entries, header->entry_count, header) &&
+            symbols_are_valid(obj->externs, header->extern_count, header);
+
+    /* every relocation must point at one of our words */
+    for (idx = 0; valid && idx < header->reloc_count; idx++) {
+      const ObjectReloc *reloc = &obj->relocs[idx];
+
+      valid = reloc->address >= header->code_base &&
+              reloc->address - header->code_base <
+                  header->code_count + header->data_count &&
+              (reloc->are == ARE_RELOCATABLE ||
+               (reloc->are == ARE_EXTERNAL &&
+                reloc->symbol < header->extern_count));
+    }
+  }
+
+  if (!valid) {
+    fprintf(stderr,
+            "(ERROR) [object_file] '%s' is not a valid object file (version "
+            "%d)\n",
+            filename, OBJECT_VERSION);
+    object_file_close(obj);
+    return NULL;
+  }
+
+  return obj;
+}
+
+void object_file_close(ObjectFile *obj) {
+  if (!obj)
+    return;
+
+  unmap_file(obj->image, obj->image_size, obj->is_mapped);
+  free(obj);
+}
+
+bool object_file_is_binary(const char *filename) {
+  FILE *fp = fopen(filename, "rb");
+  unsigned int magic = 0;
+  bool binary = false;
+
+  if (!fp)
+    return false;
+
+  if (fread(&magic, sizeof(magic), 1, fp) == 1)
+    binary = (magic == OBJECT_MAGIC);
+
+  fclose(fp);
+  return binary;
+}
+
+/* ======================================================================= */
+/* ========================== static helpers ============================== */
+/* ======================================================================= */
+
+/* compute_layout -- where every piece starts, the words are padded so the
+ * tables after them stay aligned */
+static void compute_layout(const ObjectHeader *header, ObjectLayout *layout) {
+  size_t word_bytes =
+      ((size_t)header->code_count + header->data_count) * sizeof(short);
+  size_t align = sizeof(unsigned int);
+
+  layout->words = sizeof(ObjectHeader);
+  layout->relocs = layout->words + (word_bytes + align - 1) / align * align;
+  layout->entries =
+      layout->relocs + (size_t)header->reloc_count * sizeof(ObjectReloc);
+  layout->externs =
+      layout->entries + (size_t)header->entry_count * sizeof(ObjectSymbol);
+  layout->strings =
+      layout->externs + (size_t)header->extern_count * sizeof(ObjectSymbol);
+  layout->total = layout->strings + header->strings_size;
+}
+
+/* symbols_are_valid -- every name offset is inside the string table */
+static bool symbols_are_valid(const ObjectSymbol *symbols, unsigned int count,
+                              const ObjectHeader *header) {
+  unsigned int idx;
+
+  for (idx = 0; idx < count; idx++) {
+    if (symbols[idx].name_offset >= header->strings_size)
+      return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,89 @@
+#ifndef OBJECT_FILE_H
+#define OBJECT_FILE_H
+
+#include "types.h"
+#include <stddef.h>
+
+/* object_file.h -- packed binary object format (--format=bin, .obj)
+ *
+ * the text .ob stays the default (it's what the spec asks for), this one is
+ * for tools: it's mapped and used in place, nothing to parse. layout:
+ *
+ *   ObjectHeader
+ *   unsigned short words[code_count + data_count]  10-bit words, code first
+ *   (padding to a 4 byte boundary)
+ *   ObjectReloc    relocs[reloc_count]     A/R/E of every symbol word
+ *   ObjectSymbol   entries[entry_count]    .entry symbols and addresses
+ *   ObjectSymbol   externs[extern_count]   .extern symbols (address 0)
+ *   char           strings[strings_size]   null-terminated symbol names
+ *
+ * integers are in host byte order, a foreign file fails the magic check */
+
+#define OBJECT_EXT ".obj"
+#define OBJECT_MAGIC 0x4A424F4DU /* "MOBJ" read as little endian */
+#define OBJECT_VERSION 1
+
+typedef struct ObjectHeader {
+  unsigned int magic;     /* OBJECT_MAGIC */
+  unsigned int version;   /* OBJECT_VERSION */
+  unsigned int code_base; /* address of words[0] (IC_INIT_VALUE) */
+  unsigned int code_count;
+  unsigned int data_count;
+  unsigned int reloc_count;
+  unsigned int entry_count;
+  unsigned int extern_count;
+  unsigned int strings_size;
+} ObjectHeader;
+
+/* object_reloc -- one word that holds a symbol address */
+typedef struct ObjectReloc {
+  unsigned short address; /* of the word */
+  unsigned short are;     /* ARE_RELOCATABLE or ARE_EXTERNAL */
+  unsigned int symbol;    /* externs[] index for ARE_EXTERNAL, else 0 */
+} ObjectReloc;
+
+typedef struct ObjectSymbol {
+  unsigned int name_offset; /* into strings */
+  unsigned int address;
+} ObjectSymbol;
+
+/* object_file -- an object image in pieces
+ *
+ * object_file_open points the pieces into a mapped file, to write one we
+ * fill in the header counts and the pieces (see object_file_write) */
+typedef struct ObjectFile {
+  ObjectHeader header;
+  const unsigned short *words;
+  const ObjectReloc *relocs;
+  const ObjectSymbol *entries;
+  const ObjectSymbol *externs;
+  const char *strings;
+
+  char *image; /* the mapped file, NULL when writing */
+  size_t image_size;
+  bool is_mapped;
+} ObjectFile;
+
+/* object_file_write -- write the pieces of obj to <base_filename>.obj (the
+ * header's magic and version are filled in here)
+ *
+ * returns true on success, false on error (error printed)
+ */
+bool object_file_write(const char *base_filename, const ObjectFile *obj);
+
+/* object_file_open -- map an .obj file (full filename) and check it, every
+ * offset and index in it is checked once here so readers can trust it
+ *
+ * - MUST BE CLOSED! (object_file_close)
+ *
+ * returns the object or NULL on error (error printed)
+ */
+ObjectFile *object_file_open(const char *filename);
+
+/* object_file_close -- unmap and free an object from object_file_open */
+void object_file_close(ObjectFile *obj);
+
+/* object_file_is_binary -- true if filename starts with OBJECT_MAGIC */
+bool object_file_is_binary(const char *filename);
+
+#endif /* OBJECT_FILE_H */
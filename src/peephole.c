@@ -0,0 +1,264 @@
+#include "peephole.h"
+#include "assembler.h"
+#include "first_pass.h"
+#include "helpers.h"
+#include "instruction_image.h"
+#include "instruction_utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* peephole -- the -O pass, see header */
+
+/* the opcodes the pass looks at (instruction_info_table) */
+#define OP_MOV 0
+#define OP_CLR 5
+#define OP_JMP 9
+#define OP_RTS 14
+#define OP_STOP 15
+
+/* action -- what the pass does to one command */
+typedef enum Action {
+  ACTION_KEEP,
+  ACTION_REMOVE,
+  ACTION_CLEAR /* mov #0, X -> clr X */
+} Action;
+
+static void plan_actions(Action *actions, PeepholeStats *stats);
+static bool is_self_move(const CommandFields *cmd);
+static const char *zeroed_operand(const CommandFields *cmd);
+static bool rewrite_am(const char *filename, const char *text,
+                       const Action *actions);
+static size_t next_piece(const char *cursor, char *piece);
+static bool is_instruction_piece(const char *piece);
+
+/* ======================================================================= */
+/* ===================== public api -- see header ======================== */
+/* ======================================================================= */
+
+bool peephole_optimize(const char *filename, PeepholeStats *stats) {
+  Action *actions;
+  FILE *am_fp;
+  char *text;
+  size_t length;
+  bool ok;
+
+  memset(stats, 0, sizeof(*stats));
+  if (command_count == 0)
+    return true;
+
+  actions = safe_calloc((size_t)command_count, sizeof(Action));
+  if (!actions)
+    return false;
+
+  plan_actions(actions, stats);
+  if (stats->words_saved == 0) {
+    free(actions);
+    return true;
+  }
+
+  am_fp = open_file_with_ext(filename, ".am", "r");
+  if (!am_fp) {
+    fprintf(stderr, "(ERROR) [peephole] failed to open '%s.am'\n", filename);
+    free(actions);
+    return false;
+  }
+
+  text = read_file_contents(am_fp, &length);
+  fclose(am_fp);
+  if (!text) {
+    fprintf(stderr, "(ERROR) [peephole] reading '%s.am' failed\n", filename);
+    free(actions);
+    return false;
+  }
+
+  ok = rewrite_am(filename, text, actions);
+
+  free(text);
+  free(actions);
+  return ok;
+}
+
+/* ======================================================================= */
+/* ========================== static helpers ============================== */
+/* ======================================================================= */
+
+/* plan_actions -- walk the commands in address order, deciding the action
+ * of each (actions has one per command) and counting what they save */
+static void plan_actions(Action *actions, PeepholeStats *stats) {
+  const char *zeroed = NULL; /* what the last instruction kept set to 0 */
+  bool is_reachable = true;
+  int idx;
+
+  for (idx = 0; idx < command_count; idx++) {
+    const CommandFields *cmd = command_list[idx];
+    const char *target;
+
+    actions[idx] = ACTION_KEEP;
+    if (!cmd)
+      continue;
+
+    /* a label may be jumped to from anywhere, nothing is known there */
+    if (cmd->label) {
+      is_reachable = true;
+      zeroed = NULL;
+    }
+
+    target = zeroed_operand(cmd);
+    if (!is_reachable || (!cmd->label && is_self_move(cmd)) ||
+        (!cmd->label && target && zeroed && strcmp(target, zeroed) == 0)) {
+      actions[idx] = ACTION_REMOVE;
+      stats->removed++;
+      stats->words_saved += cmd->length;
+      continue;
+    }
+
+    /* the immediate word goes, the first word and X's words stay */
+    if (target && cmd->opcode == OP_MOV) {
+      actions[idx] = ACTION_CLEAR;
+      stats->rewritten++;
+      stats->words_saved++;
+    }
+
+    zeroed = target;
+    is_reachable = cmd->opcode != OP_JMP && cmd->opcode != OP_RTS &&
+                   cmd->opcode != OP_STOP;
+  }
+}
+
+/* is_self_move -- is cmd mov rX, rX? */
+static bool is_self_move(const CommandFields *cmd) {
+  return cmd->opcode == OP_MOV && cmd->src && cmd->dst &&
+         is_register(cmd->src) && strcmp(cmd->src, cmd->dst) == 0;
+}
+
+/* zeroed_operand -- the operand cmd sets to 0 if it's clr X or mov #0, X
+ * (the immediate read from its word, it may have been an expression), NULL
+ * otherwise */
+static const char *zeroed_operand(const CommandFields *cmd) {
+  int idx;
+
+  if (cmd->opcode == OP_CLR)
+    return cmd->dst;
+
+  if (cmd->opcode != OP_MOV || !cmd->src ||
+      addr_mode(cmd->src) != ADDR_MODE_IMMEDIATE)
+    return NULL;
+
+  /* words past the end of memory weren't kept */
+  idx = cmd->cmd_address - IC_INIT_VALUE + 1;
+  if (idx < 0 || idx >= MAX_WORDS_MEMORY ||
+      ((instruction_image[idx] >> IMM_DATA_SHIFT) & IMM_MASK) != 0)
+    return NULL;
+
+  return cmd->dst;
+}
+
+/* rewrite_am -- write <filename>.am again from text (what it holds), with
+ * the actions applied to its instruction lines: a removed one is left
+ * empty, so every line keeps its number. text is checked to have one
+ * instruction line per command first, so a mismatch leaves it as is
+ *
+ * returns true on success, false on error (error printed) */
+static bool rewrite_am(const char *filename, const char *text,
+                       const Action *actions) {
+  char piece[MAX_LINE_LENGTH];
+  const char *cursor;
+  int command = 0;
+  FILE *am_fp;
+  bool ok;
+
+  cursor = text;
+  while (*cursor) {
+    cursor += next_piece(cursor, piece);
+    if (is_instruction_piece(piece))
+      command++;
+  }
+
+  if (command != command_count) {
+    fprintf(stderr, "(ERROR) [peephole] '%s.am' does not match its commands\n",
+            filename);
+    return false;
+  }
+
+  am_fp = open_file_with_ext(filename, ".am", "w");
+  if (!am_fp) {
+    fprintf(stderr, "(ERROR) [peephole] failed to rewrite '%s.am'\n",
+            filename);
+    return false;
+  }
+
+  command = 0;
+  cursor = text;
+  while (*cursor) {
+    const CommandFields *cmd;
+
+    cursor += next_piece(cursor, piece);
+    if (!is_instruction_piece(piece)) {
+      fputs(piece, am_fp);
+      continue;
+    }
+
+    cmd = command_list[command];
+    switch (actions[command++]) {
+    case ACTION_REMOVE:
+      if (strchr(piece, '\n'))
+        fputc('\n', am_fp);
+      break;
+
+    case ACTION_CLEAR:
+      fprintf(am_fp, "%s%sclr %s\n", cmd->label ? cmd->label : "",
+              cmd->label ? ": " : "", cmd->dst);
+      break;
+
+    default:
+      fputs(piece, am_fp);
+      break;
+    }
+  }
+
+  ok = !ferror(am_fp);
+  if (fclose(am_fp) != 0)
+    ok = false;
+
+  if (!ok)
+    fprintf(stderr, "(ERROR) [peephole] failed to rewrite '%s.am'\n",
+            filename);
+  return ok;
+}
+
+/* next_piece -- copy into piece (MAX_LINE_LENGTH) what fgets would read at
+ * cursor: a line, or as much of a long one as fits, like the first pass
+ * reads the .am
+ *
+ * returns the number of chars copied */
+static size_t next_piece(const char *cursor, char *piece) {
+  size_t length = 0;
+
+  while (length < MAX_LINE_LENGTH - 1 && cursor[length] != '\0') {
+    length++;
+    if (cursor[length - 1] == '\n')
+      break;
+  }
+
+  memcpy(piece, cursor, length);
+  piece[length] = '\0';
+  return length;
+}
+
+/* is_instruction_piece -- would the first pass take piece for an
+ * instruction (what's after its label isn't empty or a directive)? */
+static bool is_instruction_piece(const char *piece) {
+  char line[MAX_LINE_LENGTH];
+  char *colon, *text;
+
+  strcpy(line, piece);
+  line[strcspn(line, "\n")] = '\0';
+  cleanup_line(line);
+
+  colon = strchr(line, ':');
+  text = colon ? colon + 1 : line;
+  text += strspn(text, " \t");
+
+  return *text != '\0' && *text != '.';
+}
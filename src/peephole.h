@@ -0,0 +1,40 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include "types.h"
+
+/* peephole.h -- the assembler's -O pass: shrink the code a first pass
+ * recorded (command_list and instruction_image), memory being 256 words
+ *
+ *   mov rX, rX             removed (only cmp sets the zero flag)
+ *   mov #0, X              becomes clr X, a word shorter
+ *   clr X / mov #0, X      removed right after one of the two for the same X
+ *   after jmp, rts, stop   removed up to the next label (unreachable)
+ *
+ * code is taken to be entered only at its first instruction and at labels,
+ * so a labeled instruction is never removed (it may be jumped to).
+ *
+ * the changes are made to the .am: its instruction lines are emptied or
+ * rewritten in place, and the first pass is run on it again, which gives
+ * every label and address (and so .ent and .ext) from scratch. tools that
+ * read the .am (the linker, the simulator) see the program that was
+ * assembled, and as no line moves, the preprocessor's map of where each
+ * .am line came from (preprocess_line_map) still holds */
+
+/* peephole_stats -- what peephole_optimize did */
+typedef struct PeepholeStats {
+  int removed;     /* instructions removed */
+  int rewritten;   /* mov #0 made clr */
+  int words_saved; /* code words the two saved */
+} PeepholeStats;
+
+/* peephole_optimize -- plan the pass over the commands of a first pass that
+ * found no errors on <filename>.am (filename without extension) and, if it
+ * saves anything, rewrite the .am. the commands themselves are left as they
+ * are, the caller runs the first pass again when stats->words_saved > 0
+ *
+ * returns true on success, false on error (error printed)
+ */
+bool peephole_optimize(const char *filename, PeepholeStats *stats);
+
+#endif /* PEEPHOLE_H */
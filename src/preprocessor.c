@@ -1,47 +1,248 @@
+/* threads are POSIX, not ANSI C */
+#define _POSIX_C_SOURCE 200112L
+
 #include "preprocessor.h"
 #include "assembler.h"
+#include "conditional.h"
 #include "helpers.h"
+#include "trace.h"
 #include "types.h"
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
 /* preprocessor -- handles macro definitions and expansions in assembly files */
 
+/* smallest macro index (power of 2) */
+#define MACRO_MIN_BUCKETS 64
+
+/* macro_index -- a file's macros by name, chained through Macro->bucket_next,
+ * and the last one (macros are pushed at the end). it lives on the head of
+ * the list, which never changes, so finding a macro doesn't walk the list */
+typedef struct MacroIndex {
+  Macro **buckets;
+  size_t bucket_count; /* power of 2 */
+  size_t macro_count;
+  Macro *tail;
+} MacroIndex;
+
+/* macro_header -- what a 'mcro' line declares */
+typedef struct MacroHeader {
+  char name[MAX_LABEL_LENGTH];
+  char params[MACRO_MAX_PARAMS][MAX_LABEL_LENGTH];
+  int param_count;
+  int line_number;
+} MacroHeader;
+
+/* smallest expansion memo (power of 2) */
+#define MEMO_MIN_BUCKETS 64
+
+/* expansion -- what a call with arguments expanded to */
+typedef struct Expansion {
+  char *key; /* macro name, '\n', the arguments joined by ',' */
+  char *text;
+  size_t length;
+  struct Expansion *bucket_next;
+} Expansion;
+
+/* expansion_memo -- the expansions of calls with arguments in one scan, by
+ * macro and arguments, so a call made again is one write */
+typedef struct ExpansionMemo {
+  Expansion **buckets;
+  size_t bucket_count; /* power of 2 */
+  size_t expansion_count;
+} ExpansionMemo;
+
+/* .rept limits: a block's count, how deep blocks nest, and the bytes one
+ * may expand to */
+#define REPT_MAX_COUNT 65535
+#define REPT_MAX_DEPTH 8
+#define REPT_MAX_OUTPUT (64L * 1024 * 1024)
+
+/* rept_block -- an open .rept: its lines go to buffer, which is written
+ * count times to outer at its .endr */
+typedef struct ReptBlock {
+  FILE *outer;
+  FILE *buffer;
+  long count;
+  int map_start; /* map lines before its first line */
+} ReptBlock;
+
+/* scan_state -- what a scan keeps besides its lines */
+typedef struct ScanState {
+  ExpansionMemo memo;
+  ReptBlock repts[REPT_MAX_DEPTH]; /* open ones, innermost last */
+  int rept_depth;
+  int repeated_lines; /* written by repeating blocks (the copies) */
+} ScanState;
+
+/* smallest include cache (power of 2) */
+#define INCLUDE_MIN_BUCKETS 16
+
+/* include_state -- how far loading an included file got */
+typedef enum IncludeState {
+  INCLUDE_LOADING, /* being scanned, it was included through its includes */
+  INCLUDE_READY,
+  INCLUDE_FAILED /* errors were printed when it was loaded */
+} IncludeState;
+
+/* include_ref -- an .include in an included file: the file it names goes at
+ * offset of the includer's output */
+typedef struct IncludeRef {
+  size_t offset;
+  struct IncludedFile *file;
+} IncludeRef;
+
+/* included_file -- a file .include loaded, cleaned and scanned once per run.
+ * output is the expansion of its own lines, the files it includes stay refs
+ * and are spliced in by whoever includes it (so each one is spliced once).
+ * macros are the ones it imported (line 0) and the ones it defines, whose
+ * bodies point into text */
+typedef struct IncludedFile {
+  char *path;
+  IncludeState state;
+  char *text;
+  char *output;
+  size_t output_length;
+  IncludeRef *refs;
+  int ref_count;
+  int ref_capacity;
+  int repeated_lines; /* of output, see scan_state */
+  Macro *macros;
+  struct IncludedFile *bucket_next;
+} IncludedFile;
+
+/* include_cache -- every file loaded by .include this run, by path, shared
+ * by the scans of every thread. a .as file's scan holds include_lock while
+ * it loads a file (with what that includes) and splices it in, a file is
+ * never changed once it's loaded */
+typedef struct IncludeCache {
+  IncludedFile **buckets;
+  size_t bucket_count; /* power of 2 */
+  size_t file_count;
+} IncludeCache;
+
+/* include_scope -- the includes of one scan: its file (includes are relative
+ * to it), the files spliced into it so far and, when it loads an included
+ * file, that file (NULL for a .as file) */
+typedef struct IncludeScope {
+  const char *path;
+  IncludedFile **files;
+  int file_count;
+  int file_capacity;
+  IncludedFile *loading;
+  int repeated_lines; /* in what was written, spliced files included */
+} IncludeScope;
+
+static IncludeCache include_cache;
+#ifdef HAVE_PTHREADS
+static pthread_mutex_t include_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
 /* basic macro node funcs */
-static Macro *macro_create(Macro *head, char *name, char *body,
-                           int line_number);
+static Macro *macro_create(Macro *head, char *name, const char *body,
+                           size_t body_length, int line_number);
 static Macro *macro_find(Macro *head, char *name);
+static const Macro *macro_lookup(const MacroLibrary *library, Macro *head,
+                                 char *name, Macro *lib_view);
 static bool macro_is_already_defined(Macro *head, char *name);
+static bool macro_import(Macro **head, const Macro *macro);
 static int macro_push(Macro **head, Macro *macro_node);
 static void macro_free(Macro *macro_node);
 static void macro_free_all(Macro **head);
+static void macro_index_add(Macro *head, Macro *macro_node);
+static MacroIndex *macro_index_build(Macro *head, size_t bucket_count);
+static void macro_index_free(MacroIndex *index);
 
 /* macro handling funcs */
 static bool begin_macro_definition(const char *line, int line_num, Macro **head,
-                                   char *macro_name_out, int *start_line_out);
-static bool end_macro_definition(const char *macro_name, char **pbody,
-                                 size_t *p_len, size_t *p_cap, int start_line,
-                                 Macro **head);
+                                   const MacroLibrary *library,
+                                   MacroHeader *header_out);
+static bool parse_params(const char *text, MacroHeader *header);
+static bool end_macro_definition(const MacroHeader *header, const char *body,
+                                 size_t body_length, Macro **head);
+static char *mark_params(const MacroHeader *header, const char *body,
+                         size_t body_length, size_t *length_out);
 static bool expand_macro_or_emit_line(const char *line, char *first_token,
-                                      FILE *out, Macro **head, int line_num);
+                                      FILE *out, Macro **head,
+                                      const MacroLibrary *library,
+                                      int line_num, ExpansionMemo *memo,
+                                      Macro *expanded_out);
+static bool write_expansion(const Macro *m, const char *args, FILE *out,
+                            ExpansionMemo *memo);
+static int split_args(const char *args, const char **values_out,
+                      size_t *lengths_out);
+static char *splice_args(const Macro *m, const char **values,
+                         const size_t *lengths, size_t *length_out);
 static bool has_extra_after_macro(const char *line);
-static int macro_scan(FILE *in, FILE *out, Macro **head);
+static bool is_name_char(char c);
+static char *split_token(char **rest);
+
+/* expansion memo funcs */
+static Expansion **memo_slot(ExpansionMemo *memo, const char *key);
+static void memo_free(ExpansionMemo *memo);
+static const char *next_line(const char *cursor, const char *end,
+                             char *line_out);
+static bool preprocess_stream(const char *filename, FILE *input_file,
+                              FILE *output_file, const MacroLibrary *library,
+                              LineMap *map, int *repeated_lines_out);
+static char *load_cleaned_text(FILE *in, size_t *length_out,
+                               int **origins_out);
+static int macro_scan(const char *text, size_t text_length, FILE *out,
+                      Macro **head, const MacroLibrary *library,
+                      const int *origins, LineMap *map, IncludeScope *scope);
+static bool scan_lines(const char *text, size_t text_length, FILE *out,
+                       Macro **head, const MacroLibrary *library,
+                       const int *origins, LineMap *map, IncludeScope *scope,
+                       ScanState *state);
+static bool begin_rept(const char *line, FILE **out, LineMap *map,
+                       ScanState *state);
+static bool end_rept(const char *line, FILE **out, LineMap *map,
+                     ScanState *state);
+static bool record_origins(LineMap *map, const int *origins, int line_number,
+                           const Macro *expanded);
+static bool record_included(LineMap *map, const char *chunk, size_t length,
+                            int call_line);
+static bool grow_map(LineMap *map, int line_count);
+
+/* include funcs */
+static bool include_file(const char *line, int line_num, FILE *out,
+                         Macro **head, const MacroLibrary *library,
+                         IncludeScope *scope, int call_line, LineMap *map);
+static bool include_path(const char *line, const char *includer,
+                         char *path_out);
+static void normalize_path(char *path);
+static IncludedFile *include_load(const char *path,
+                                  const MacroLibrary *library);
+static IncludedFile **include_slot(const char *path);
+static bool include_splice(IncludedFile *file, IncludeScope *scope, FILE *out,
+                           Macro **head, int call_line, LineMap *map);
+static bool include_add_ref(IncludedFile *file, size_t offset,
+                            IncludedFile *included);
+static bool scope_has(const IncludeScope *scope, const IncludedFile *file);
+static bool scope_add(IncludeScope *scope, IncludedFile *file);
+static void include_free(IncludedFile *file);
 
 /* ======================================================================= */
 /* ===================== public api -- see header ======================== */
 /* ======================================================================= */
 
-int preprocess_file(char *filename_without_extension) {
-  FILE *input_file = NULL, *trimmed_file = NULL, *output_file = NULL;
+int preprocess_file(char *filename_without_extension,
+                    const MacroLibrary *library, int *repeated_lines_out) {
+  FILE *input_file = NULL, *output_file = NULL;
+  bool ok;
 
   char input_filename[MAX_FILENAME_LENGTH],
       output_filename[MAX_FILENAME_LENGTH];
 
   char *in_ext = ".as", *out_ext = ".am";
 
-  Macro *head = NULL;
-
   /* check if exceeds filename lenght */
   if (strlen(filename_without_extension) + strlen(in_ext) >
       MAX_FILENAME_LENGTH) {
@@ -69,39 +270,120 @@ int preprocess_file(char *filename_without_extension) {
     return 1;
   }
 
-  /* temporary file to hold cleaned lines */
-  trimmed_file = tmpfile();
-  if (!trimmed_file) {
+  ok = preprocess_stream(input_filename, input_file, output_file, library,
+                         NULL, repeated_lines_out);
+  close_files(input_file, output_file, NULL);
+  return ok ? 0 : 1;
+}
+
+bool preprocess_line_map(const char *filename_without_extension,
+                         const MacroLibrary *library, LineMap *map) {
+  char input_filename[MAX_FILENAME_LENGTH];
+  FILE *input_file, *sink;
+  bool ok;
+
+  memset(map, 0, sizeof(*map));
+
+  if (strlen(filename_without_extension) + strlen(".as") >=
+      MAX_FILENAME_LENGTH) {
+    fprintf(stderr, "(ERROR) [preprocessor] filename too long\n");
+    return false;
+  }
+  sprintf(input_filename, "%s.as", filename_without_extension);
+
+  input_file = open_file_with_ext(filename_without_extension, ".as", "r");
+  if (!input_file) {
+    fprintf(stderr, "(ERROR) [preprocessor] opening '%s.as' failed\n",
+            filename_without_extension);
+    return false;
+  }
+
+  /* the expansion is written all the same, just not kept */
+  sink = tmpfile();
+  if (!sink) {
     fprintf(stderr,
             "(ERROR) [preprocessor] creating & opening temp file failed\n");
-    close_files(input_file, output_file, NULL);
-    return 1;
+    fclose(input_file);
+    return false;
   }
 
-  /* strip comments and spaces into the temp file */
-  cleanup_file(input_file, trimmed_file);
+  ok = preprocess_stream(input_filename, input_file, sink, library, map,
+                         NULL);
+  close_files(input_file, sink, NULL);
 
-  /* stop early if the file ended up empty */
-  /* consider simplifying? */
-  fseek(trimmed_file, 0, SEEK_END);
-  if (ftell(trimmed_file) == 0) {
-    printf("(ERROR) [preprocessor] file empty after trimming, returning.\n");
-    close_files(input_file, trimmed_file, output_file, NULL);
-    return 0;
+  if (!ok)
+    line_map_free(map);
+  return ok;
+}
+
+void line_map_free(LineMap *map) {
+  free(map->lines);
+  memset(map, 0, sizeof(*map));
+}
+
+void preprocess_forget_includes(void) {
+  size_t bucket;
+
+#ifdef HAVE_PTHREADS
+  pthread_mutex_lock(&include_lock);
+#endif
+  for (bucket = 0; bucket < include_cache.bucket_count; bucket++) {
+    IncludedFile *file = include_cache.buckets[bucket];
+
+    while (file) {
+      IncludedFile *next = file->bucket_next;
+
+      include_free(file);
+      file = next;
+    }
   }
 
-  /* go to beginning of trimmed file */
-  rewind(trimmed_file);
+  free(include_cache.buckets);
+  memset(&include_cache, 0, sizeof(include_cache));
+
+#ifdef HAVE_PTHREADS
+  pthread_mutex_unlock(&include_lock);
+#endif
+}
+
+MacroLibrary *macro_library_load(const char *filename) {
+  FILE *lib_file = NULL;
+  MacroLibrary *library = NULL;
+  Macro *head = NULL;
+  char *text = NULL;
+  size_t text_length = 0;
 
-  if (!macro_scan(trimmed_file, output_file, &head)) {
+  /* a compiled library needs no parsing at all */
+  if (macro_library_is_compiled(filename))
+    return macro_library_open(filename);
+
+  lib_file = fopen(filename, "r");
+  if (!lib_file) {
+    fprintf(stderr, "(ERROR) [preprocessor] opening macro library '%s' failed\n",
+            filename);
+    return NULL;
+  }
+
+  text = load_cleaned_text(lib_file, &text_length, NULL);
+  fclose(lib_file);
+  if (!text)
+    return NULL;
+
+  /* no output file: a library may only define macros */
+  if (!macro_scan(text, text_length, NULL, &head, NULL, NULL, NULL, NULL)) {
+    fprintf(stderr, "(ERROR) [preprocessor] invalid macro library '%s'\n",
+            filename);
     macro_free_all(&head);
-    close_files(input_file, trimmed_file, output_file, NULL);
-    return 1;
+    free(text);
+    return NULL;
   }
 
+  /* the image gets its own copy of the bodies */
+  library = macro_library_build(head);
+
   macro_free_all(&head);
-  close_files(input_file, trimmed_file, output_file, NULL);
-  return 0;
+  free(text);
+  return library;
 }
 
 /* ======================================================================= */
@@ -111,8 +393,8 @@ int preprocess_file(char *filename_without_extension) {
 /* macro_create -- build a macro node and fill its fields
  * rejects a duplicate name so we do not shadow an existing macro
  */
-static Macro *macro_create(Macro *head, char *name, char *body,
-                           int line_number) {
+static Macro *macro_create(Macro *head, char *name, const char *body,
+                           size_t body_length, int line_number) {
   Macro *macro_node;
   /* reject duplicates before allocating */
   if (macro_is_already_defined(head, name)) {
@@ -128,6 +410,7 @@ static Macro *macro_create(Macro *head, char *name, char *body,
 
   macro_node->name = name;
   macro_node->body = body;
+  macro_node->body_length = body_length;
   macro_node->line_number = line_number;
   macro_node->next = NULL;
 
@@ -139,7 +422,18 @@ static Macro *macro_create(Macro *head, char *name, char *body,
 static Macro *macro_find(Macro *head, char *name) {
   Macro *temp = head;
 
-  /* iterate through macros and compare by name */
+  if (head && head->index) {
+    MacroIndex *index = head->index;
+
+    temp = index->buckets[hash_string(name) & (index->bucket_count - 1)];
+    for (; temp; temp = temp->bucket_next) {
+      if (strcmp(name, temp->name) == 0)
+        return temp;
+    }
+    return NULL;
+  }
+
+  /* no index, iterate through macros and compare by name */
   while (temp != NULL) {
     if (strcmp(name, temp->name) == 0) {
       return temp;
@@ -150,6 +444,17 @@ static Macro *macro_find(Macro *head, char *name) {
   return NULL;
 }
 
+/* macro_lookup -- looks for a macro in the library first (filling lib_view),
+ * then in the list of macros defined by the current file. returns pointer if
+ * found, null if not. */
+static const Macro *macro_lookup(const MacroLibrary *library, Macro *head,
+                                 char *name, Macro *lib_view) {
+  if (macro_library_find(library, name, lib_view))
+    return lib_view;
+
+  return macro_find(head, name);
+}
+
 /* macro_is_already_defined -- check if a macro is already defined, we compare
  * by name
  *
@@ -169,6 +474,30 @@ static bool macro_is_already_defined(Macro *head, char *name) {
   return false;
 }
 
+/* macro_import -- define a copy of macro (of an included file) in the list
+ * of head, at line 0 (its body isn't on a line of this file) and sharing
+ * its body
+ *
+ * returns true on success, false on error (error printed)
+ */
+static bool macro_import(Macro **head, const Macro *macro) {
+  char *name_copy = safe_strdup(macro->name);
+  Macro *m;
+
+  if (!name_copy)
+    return false;
+
+  m = macro_create(*head, name_copy, macro->body, macro->body_length, 0);
+  if (!m) {
+    free(name_copy);
+    return false;
+  }
+
+  m->param_count = macro->param_count;
+  macro_push(head, m);
+  return true;
+}
+
 /* macro_push -- adds a macro node to the end of the macro list
  *
  * returns 0 if ok, -1 if duplicate */
@@ -182,30 +511,36 @@ static int macro_push(Macro **head, Macro *macro_node) {
     return -1;
   }
 
+  macro_node->next = NULL;
   if (*head == NULL) {
     *head = macro_node;
-    macro_node->next = NULL;
+    macro_index_add(macro_node, macro_node);
     return 0;
   }
 
-  /* walk to the end */
-  temp = *head;
-  while (temp->next != NULL) {
-    temp = temp->next;
+  /* the index knows the end, without one we walk to it */
+  if ((*head)->index) {
+    temp = (*head)->index->tail;
+  } else {
+    temp = *head;
+    while (temp->next != NULL) {
+      temp = temp->next;
+    }
   }
 
   /* add the new macro node to the end of the list */
   temp->next = macro_node;
-  macro_node->next = NULL;
+  macro_index_add(*head, macro_node);
   return 0;
 }
 
-/* macro_free -- frees memory for a single macro node */
+/* macro_free -- frees memory for a single macro node (the body belongs to
+ * the source text, unless it was marked for parameters) */
 static void macro_free(Macro *macro_node) {
   if (!macro_node)
     return;
   free(macro_node->name);
-  free(macro_node->body);
+  free(macro_node->owned_body);
   free(macro_node);
 }
 
@@ -216,6 +551,8 @@ static void macro_free_all(Macro **head) {
   if (head == NULL || *head == NULL)
     return;
 
+  macro_index_free((*head)->index);
+
   /* pop each item and free it */
   while (*head) {
     temp = *head;
@@ -226,45 +563,106 @@ static void macro_free_all(Macro **head) {
   *head = NULL;
 }
 
+/* macro_index_add -- index macro_node, just pushed at the end of the list of
+ * head. the index is built (from the whole list) the first time and rebuilt
+ * twice as wide once it has more macros than buckets. without memory for it
+ * we keep no index and macro_find walks the list */
+static void macro_index_add(Macro *head, Macro *macro_node) {
+  MacroIndex *index = head->index;
+  size_t bucket;
+
+  if (!index) {
+    head->index = macro_index_build(head, MACRO_MIN_BUCKETS);
+    return;
+  }
+
+  if (index->macro_count + 1 > index->bucket_count) {
+    head->index = macro_index_build(head, index->bucket_count * 2);
+    macro_index_free(index);
+    return;
+  }
+
+  bucket = hash_string(macro_node->name) & (index->bucket_count - 1);
+  macro_node->bucket_next = index->buckets[bucket];
+  index->buckets[bucket] = macro_node;
+  index->macro_count++;
+  index->tail = macro_node;
+}
+
+/* macro_index_build -- index every macro of the list in bucket_count
+ * buckets (a power of 2)
+ *
+ * - MUST BE FREED! (macro_index_free)
+ *
+ * returns the index or NULL if out of memory */
+static MacroIndex *macro_index_build(Macro *head, size_t bucket_count) {
+  MacroIndex *index = safe_calloc(1, sizeof(MacroIndex));
+  Macro *temp;
+
+  if (!index)
+    return NULL;
+
+  index->buckets = safe_calloc(bucket_count, sizeof(Macro *));
+  if (!index->buckets) {
+    free(index);
+    return NULL;
+  }
+  index->bucket_count = bucket_count;
+
+  for (temp = head; temp; temp = temp->next) {
+    size_t bucket = hash_string(temp->name) & (bucket_count - 1);
+
+    temp->bucket_next = index->buckets[bucket];
+    index->buckets[bucket] = temp;
+    index->macro_count++;
+    index->tail = temp;
+  }
+
+  return index;
+}
+
+/* macro_index_free -- free an index from macro_index_build (safe with NULL) */
+static void macro_index_free(MacroIndex *index) {
+  if (!index)
+    return;
+
+  free(index->buckets);
+  free(index);
+}
+
 /* ======================================================================= */
 
-/* begin_macro_definition -- validate header and record name + start line
- * expects: "mcro <name>" and nothing else on the line
+/* begin_macro_definition -- validate header and record name, parameters
+ * and start line
+ * expects: "mcro <name>" and, optionally, parameter names separated by
+ * commas ("mcro <name> <param>, <param>...")
  *
  * we check:
  *  - name exists
- *  - no extra tokens
- *  - name is legal
- *  - no duplicate macro
+ *  - name is legal (and so is every parameter, each given once)
+ *  - no duplicate macro (in the file or in the library)
  *
  * returns true on success, false on error
  */
 static bool begin_macro_definition(const char *line, int line_num, Macro **head,
-                                   char *macro_name_out, int *start_line_out) {
+                                   const MacroLibrary *library,
+                                   MacroHeader *header_out) {
   char tmp[MAX_LINE_LENGTH];
+  char *rest = tmp;
   char *name = NULL;
-  char *extra = NULL;
 
-  /* copy and tokenize: get "mcro", then the name, then ensure no extra */
+  /* copy and tokenize: get "mcro", then the name, parameters after it */
   strcpy(tmp, line);
 
-  strtok(tmp, " \t");          /* "mcro", "skip it" (we don't need it) */
-  name = strtok(NULL, " \t");  /* name */
-  extra = strtok(NULL, " \t"); /* any extra text after */
+  split_token(&rest);        /* "mcro", "skip it" (we don't need it) */
+  name = split_token(&rest); /* name */
 
   if (!name) {
     fprintf(stderr, "(ERROR) [preprocessor] macro without name definition\n");
     return false;
   }
 
-  if (extra) {
-    /* extra text after macro name */
-    fprintf(stderr,
-            "(ERROR) [preprocessor] extra text after macro name definition\n");
-    return false;
-  }
-
-  if (is_illegal_name(name)) {
+  if (strlen(name) >= MAX_LABEL_LENGTH || is_illegal_name(name)) {
     fprintf(stderr, "(ERROR) [preprocessor] illegal name '%s' for a macro\n",
             name);
     return false;
@@ -275,81 +673,234 @@ static bool begin_macro_definition(const char *line, int line_num, Macro **head,
     return false;
   }
 
+  if (macro_library_find(library, name, NULL)) {
+    fprintf(stderr,
+            "(ERROR) [preprocessor] macro '%s' is already defined in the macro "
+            "library\n",
+            name);
+    return false;
+  }
+
   /* record name and start line for the body of the macro "recording" phase */
-  strcpy(macro_name_out, name);
-  *start_line_out = line_num;
+  strcpy(header_out->name, name);
+  header_out->line_number = line_num;
+
+  /* whatever follows the name (split_token ended it with a '\0') */
+  return parse_params(line + (name - tmp) + strlen(name), header_out);
+}
+
+/* parse_params -- read the parameter names of header's macro from text (what
+ * follows its name on the 'mcro' line)
+ *
+ * returns true on success, false on error (error printed)
+ */
+static bool parse_params(const char *text, MacroHeader *header) {
+  header->param_count = 0;
+  text += strspn(text, " \t");
+
+  while (*text) {
+    size_t length = strcspn(text, ", \t");
+    const char *after = text + length + strspn(text + length, " \t");
+    char *param = header->params[header->param_count];
+    int idx;
+
+    if (header->param_count == MACRO_MAX_PARAMS) {
+      fprintf(stderr,
+              "(ERROR) [preprocessor] macro '%s' has more than %d parameters\n",
+              header->name, MACRO_MAX_PARAMS);
+      return false;
+    }
+
+    /* a name, then a comma before the next one */
+    if (length == 0 || length >= MAX_LABEL_LENGTH || (*after && *after != ',')) {
+      fprintf(stderr,
+              "(ERROR) [preprocessor] extra text after macro name definition\n");
+      return false;
+    }
+
+    memcpy(param, text, length);
+    param[length] = '\0';
+
+    for (idx = 0; idx < (int)length && is_name_char(param[idx]); idx++)
+      ;
+    if (idx < (int)length || !isalpha((unsigned char)param[0]) ||
+        is_illegal_name(param)) {
+      fprintf(stderr,
+              "(ERROR) [preprocessor] illegal parameter '%s' for macro '%s'\n",
+              param, header->name);
+      return false;
+    }
+
+    for (idx = 0; idx < header->param_count; idx++) {
+      if (strcmp(header->params[idx], param) == 0) {
+        fprintf(stderr,
+                "(ERROR) [preprocessor] parameter '%s' of macro '%s' given "
+                "twice\n",
+                param, header->name);
+        return false;
+      }
+    }
+    header->param_count++;
+
+    if (*after == ',') {
+      text = after + 1 + strspn(after + 1, " \t");
+      if (*text == '\0') {
+        fprintf(stderr,
+                "(ERROR) [preprocessor] missing parameter after ',' for macro "
+                "'%s'\n",
+                header->name);
+        return false;
+      }
+    } else {
+      text = after;
+    }
+  }
 
   return true;
 }
 
-/* end_macro_definition -- create and push the macro object, then reset body
+/* end_macro_definition -- create and push the macro object
+ *
+ * the body is the span of source text between the 'mcro' and 'mcroend'
+ * lines, so nothing is copied here, unless the macro has parameters: then
+ * the macro gets a copy with their marks (mark_params)
  *
  * returns true on success, false on error
  */
-static bool end_macro_definition(const char *macro_name, char **pbody,
-                                 size_t *p_len, size_t *p_cap, int start_line,
-                                 Macro **head) {
+static bool end_macro_definition(const MacroHeader *header, const char *body,
+                                 size_t body_length, Macro **head) {
   char *name_copy = NULL;
-  char *body_copy = NULL;
+  char *marked = NULL;
   Macro *m = NULL;
 
-  /* duplicate name and body */
-  name_copy = safe_strdup(macro_name);
-  body_copy = safe_strdup((*pbody) ? (*pbody) : "");
+  /* duplicate name only */
+  name_copy = safe_strdup(header->name);
 
-  /* if malloc failed, error was reported in safe_strdup, we free and return
-   * false */
-  if (!name_copy || !body_copy) {
-    free(name_copy);
-    free(body_copy);
-    free(*pbody);
-    *pbody = NULL;
-    *p_len = 0;
-    *p_cap = 0;
+  /* if malloc failed, error was reported in safe_strdup */
+  if (!name_copy)
     return false;
+
+  if (header->param_count > 0) {
+    marked = mark_params(header, body, body_length, &body_length);
+    if (!marked) {
+      free(name_copy);
+      return false;
+    }
+    body = marked;
   }
 
   /* create and push the macro */
-  m = macro_create(*head, name_copy, body_copy, start_line);
+  m = macro_create(*head, name_copy, body, body_length, header->line_number);
 
   /* if macro_create returned NULL - i.e.it failed, we free and return */
   if (!m) {
     free(name_copy);
-    free(body_copy);
-    free(*pbody);
-    *pbody = NULL;
-    *p_len = 0;
-    *p_cap = 0;
+    free(marked);
     return false;
   }
 
+  m->param_count = header->param_count;
+  m->owned_body = marked;
   macro_push(head, m);
 
-  /* after use we free the buffers */
-  free(*pbody);
-  *pbody = NULL;
-  *p_len = 0;
-  *p_cap = 0;
-
   return true;
 }
 
+/* mark_params -- a copy of body with each use of a parameter of header (a
+ * whole name, outside strings) replaced by its mark, so a call only has to
+ * splice its arguments in
+ *
+ * - MUST BE FREED!
+ *
+ * returns the copy (its length in *length_out) or NULL on error (error
+ * printed)
+ */
+static char *mark_params(const MacroHeader *header, const char *body,
+                         size_t body_length, size_t *length_out) {
+  /* a mark is 2 chars, a name at least 1 */
+  char *marked = safe_calloc(body_length * 2 + 1, 1);
+  const char *end = body + body_length;
+  const char *cursor = body;
+  char *write = marked;
+  bool in_string = false;
+
+  if (!marked)
+    return NULL;
+
+  while (cursor < end) {
+    const char *name_end = cursor;
+    int idx = header->param_count;
+
+    if (*cursor == MACRO_PARAM_MARK) {
+      fprintf(stderr,
+              "(ERROR) [preprocessor] invalid character in the body of macro "
+              "'%s'\n",
+              header->name);
+      free(marked);
+      return NULL;
+    }
+
+    if (*cursor == '"' || *cursor == '\n') {
+      in_string = *cursor == '"' && !in_string;
+      *write++ = *cursor++;
+      continue;
+    }
+
+    if (in_string || !is_name_char(*cursor)) {
+      *write++ = *cursor++;
+      continue;
+    }
+
+    /* a whole name: is it a parameter? */
+    while (name_end < end && is_name_char(*name_end))
+      name_end++;
+
+    for (idx = 0; idx < header->param_count; idx++) {
+      if (strlen(header->params[idx]) == (size_t)(name_end - cursor) &&
+          memcmp(header->params[idx], cursor, (size_t)(name_end - cursor)) ==
+              0)
+        break;
+    }
+
+    if (idx < header->param_count) {
+      *write++ = MACRO_PARAM_MARK;
+      *write++ = (char)('1' + idx);
+    } else {
+      memcpy(write, cursor, (size_t)(name_end - cursor));
+      write += name_end - cursor;
+    }
+    cursor = name_end;
+  }
+
+  *write = '\0';
+  *length_out = (size_t)(write - marked);
+  return marked;
+}
+
 /* expand_macro_or_emit_line -- if first token is a known macro, expand it
- * otherwise write the original line to out
+ * otherwise write the original line to out. expanded_out gets the macro it
+ * expanded (body NULL for a plain line)
  *
  * returns true on success, false on error
  *
  * we're checking:
- *  - no extra text after the macro call
+ *  - no extra text after the call of a macro without parameters (one with
+ *    them checks its arguments, write_expansion)
  *  - if macro is used before its declared
  */
 static bool expand_macro_or_emit_line(const char *line, char *first_token,
-                                      FILE *out, Macro **head, int line_num) {
-  Macro *m = macro_find(*head, first_token);
+                                      FILE *out, Macro **head,
+                                      const MacroLibrary *library,
+                                      int line_num, ExpansionMemo *memo,
+                                      Macro *expanded_out) {
+  Macro lib_view; /* filled when the macro comes from the library */
+  const Macro *m = macro_lookup(library, *head, first_token, &lib_view);
+
+  expanded_out->body = NULL;
 
   if (m) {
     /* check that there is no extra token after the macro call name */
-    if (has_extra_after_macro(line)) {
+    if (m->param_count == 0 && has_extra_after_macro(line)) {
       fprintf(
           stderr,
           "(ERROR) [preprocessor] Macros expansion in an .as file failed\n");
@@ -362,27 +913,35 @@ static bool expand_macro_or_emit_line(const char *line, char *first_token,
       return false;
     }
 
-    /* write the macro body to the output stream */
-    /* no need for fprintf because we copy it "as is", newline is NOT needed! */
-    fputs(m->body, out);
+    /* write the macro body to the output stream in one bulk write */
+    /* we copy it "as is", newline is NOT needed! */
+    if (!write_expansion(m, line + strlen(first_token), out, memo))
+      return false;
+    *expanded_out = *m;
 
   } else {
     /* check if first token is a label and second token is a macro */
     int token_len = strlen(first_token);
     if (token_len > 1 && first_token[token_len - 1] == ':') {
       char tmp[MAX_LINE_LENGTH];
+      char *rest = tmp;
       char *second_token;
 
       strcpy(tmp, line);
-      strtok(tmp, " \t");                 /* skip label */
-      second_token = strtok(NULL, " \t"); /* get second token */
+      split_token(&rest);                /* skip label */
+      second_token = split_token(&rest); /* get second token */
 
       if (second_token) {
-        Macro *macro = macro_find(*head, second_token);
+        const Macro *macro =
+            macro_lookup(library, *head, second_token, &lib_view);
         if (macro) {
+          /* what follows the macro's name, before split_token cuts it */
+          const char *args =
+              line + (second_token - tmp) + strlen(second_token);
+
           /* ensure no extra text after label + macro */
-          char *third_token = strtok(NULL, " \t");
-          if (third_token) {
+          char *third_token = split_token(&rest);
+          if (macro->param_count == 0 && third_token) {
             fprintf(stderr,
                     "(ERROR) [preprocessor] Extra text after macro call\n");
             return false;
@@ -397,7 +956,9 @@ static bool expand_macro_or_emit_line(const char *line, char *first_token,
 
           /* write label followed by macro body */
           fprintf(out, "%s ", first_token);
-          fputs(macro->body, out);
+          if (!write_expansion(macro, args, out, memo))
+            return false;
+          *expanded_out = *macro;
           return true;
         }
       }
@@ -409,166 +970,696 @@ static bool expand_macro_or_emit_line(const char *line, char *first_token,
   return true;
 }
 
-/* has_extra_after_macro -- returns true if a macro name has text after it
+/* write_expansion -- write what a call of m expands to, args being the
+ * text after its name, to out. the arguments go between the marks of a
+ * body with parameters, such expansions are kept in memo for the next call
+ * with the same ones
  *
- * note: it will work for any text (not just a macro) */
-static bool has_extra_after_macro(const char *line) {
-  char tmp[MAX_LINE_LENGTH];
-  char *t = NULL;
-
-  strcpy(tmp, line);
-  t = strtok(tmp, " \t");  /* mcro token */
-  t = strtok(NULL, " \t"); /* second token/extra, if any */
-
-  /* returns true if macro (or any text really) has extra text after it */
-  return t != NULL;
-}
-
-/* append_body_line -- append the given line plus a newline to the growing body
- * returns true on success, false on failure
+ * returns true on success, false on error (error printed)
  */
-static bool append_body_line(char **pbody, size_t *p_len, size_t *p_cap,
-                             const char *line) {
-
-  int line_length = strlen(line);
+static bool write_expansion(const Macro *m, const char *args, FILE *out,
+                            ExpansionMemo *memo) {
+  char key[MAX_LABEL_LENGTH + MAX_LINE_LENGTH + 1];
+  const char *values[MACRO_MAX_PARAMS];
+  size_t lengths[MACRO_MAX_PARAMS];
+  Expansion **slot;
+  Expansion *expansion;
+  size_t key_length;
+  int count, idx;
+
+  if (m->param_count == 0) {
+    fwrite(m->body, 1, m->body_length, out);
+    return true;
+  }
 
-  size_t bytes_needed = *p_len + line_length + 2;
-  /* +2 for '\n' and '\0' */
+  count = split_args(args, values, lengths);
+  if (count < 0)
+    return false;
 
-  if (!pbody || !p_len || !p_cap || !line) {
-    fprintf(stderr, "(ERROR) [preprocessor] Missing one or more params in "
-                    "append_body_line\n");
+  if (count != m->param_count) {
+    fprintf(stderr,
+            "(ERROR) [preprocessor] macro '%s' takes %d argument(s), %d "
+            "given\n",
+            m->name, m->param_count, count);
     return false;
   }
 
-  /* if we need more space, wegrow buffer by GROW_BY bytes */
-  if (bytes_needed > *p_cap) {
-    int new_capacity = bytes_needed + GROW_BY;
+  /* name and arguments, which fit: both came from one line */
+  key_length = strlen(m->name);
+  memcpy(key, m->name, key_length);
+  key[key_length++] = '\n';
+  for (idx = 0; idx < count; idx++) {
+    if (idx > 0)
+      key[key_length++] = ',';
+    memcpy(key + key_length, values[idx], lengths[idx]);
+    key_length += lengths[idx];
+  }
+  key[key_length] = '\0';
+
+  slot = memo_slot(memo, key);
+  if (!slot)
+    return false;
 
-    char *new_buffer = realloc(*pbody, new_capacity);
+  if (!*slot) {
+    expansion = safe_calloc(1, sizeof(Expansion));
+    if (!expansion)
+      return false;
 
-    if (new_buffer == NULL) {
-      /* realloc failed */
+    expansion->key = safe_strdup(key);
+    expansion->text = splice_args(m, values, lengths, &expansion->length);
+    if (!expansion->key || !expansion->text) {
+      free(expansion->key);
+      free(expansion->text);
+      free(expansion);
       return false;
     }
 
-    /* update */
-    *pbody = new_buffer;
-    *p_cap = new_capacity;
+    *slot = expansion;
+    memo->expansion_count++;
   }
 
-  /* copy line to body */
-  strcpy((*pbody) + *p_len, line);
+  fwrite((*slot)->text, 1, (*slot)->length, out);
+  return true;
+}
+
+/* split_args -- find the comma separated arguments in args (spaces around
+ * them aren't theirs), values_out[n] and lengths_out[n] get the nth
+ *
+ * returns how many there are, or -1 on error (error printed)
+ */
+static int split_args(const char *args, const char **values_out,
+                      size_t *lengths_out) {
+  int count = 0;
+
+  args += strspn(args, " \t");
+  if (*args == '\0')
+    return 0;
 
-  /* update length */
-  *p_len += line_length;
+  for (;;) {
+    size_t length = strcspn(args, ",");
 
-  /* add newline */
-  (*pbody)[*p_len] = '\n';
+    if (count == MACRO_MAX_PARAMS) {
+      fprintf(stderr,
+              "(ERROR) [preprocessor] more than %d arguments in a macro "
+              "call\n",
+              MACRO_MAX_PARAMS);
+      return -1;
+    }
 
-  /* update length again (because of newline) */
-  (*p_len)++;
+    values_out[count] = args;
+    while (length > 0 &&
+           (args[length - 1] == ' ' || args[length - 1] == '\t'))
+      length--;
+    lengths_out[count] = length;
 
-  /* make sure the body is null terminated */
-  (*pbody)[*p_len] = '\0';
+    if (length == 0) {
+      fprintf(stderr, "(ERROR) [preprocessor] empty argument in a macro "
+                      "call\n");
+      return -1;
+    }
+    count++;
 
-  /* success */
-  return true;
+    args = strchr(args, ',');
+    if (!args)
+      return count;
+    args++;
+    args += strspn(args, " \t");
+  }
 }
 
-/* macro_scan -- reads macros from input file, expands them, and writes to
- * output file
+/* splice_args -- the body of m with each mark replaced by its argument
+ * (values[n], lengths[n] chars long)
  *
- *  - we read each line:
- *    - if inside a macro, we either add lines from it or end it
- *    - if we're outside a macro, we either start defining a new macro, start
- *      expanding a new macro, or copy the line as is
- *
- *  - at EOF wee fail if macro is left open
- *  - we do not allow extra tokens after macro directives
- *  - macro must be declared before use
+ * - MUST BE FREED!
  *
- * returns true on success, false on error
+ * returns the text (its length in *length_out) or NULL on error (error
+ * printed)
  */
-static bool macro_scan(FILE *in, FILE *out, Macro **head) {
-  char line[MAX_LINE_LENGTH];
-  char copy[MAX_LINE_LENGTH];        /* local copy for tokenization */
-  char macro_name[MAX_LABEL_LENGTH]; /* current macro name when inside */
-  char *body = NULL;                 /* growing buffer for macro body */
-  size_t body_len = 0;               /* used bytes in body */
-  size_t body_cap = 0;               /* allocated bytes in body */
+static char *splice_args(const Macro *m, const char **values,
+                         const size_t *lengths, size_t *length_out) {
+  const char *end = m->body + m->body_length;
+  const char *cursor = m->body;
+  const char *mark;
+  size_t length = m->body_length;
+  size_t line_length;
+  char *text, *write;
+
+  /* measure first, so we allocate once */
+  while ((mark = memchr(cursor, MACRO_PARAM_MARK, (size_t)(end - cursor))) &&
+         mark + 1 < end) {
+    int idx = mark[1] - '1';
+
+    if (idx >= 0 && idx < m->param_count)
+      length = length - 2 + lengths[idx];
+    cursor = mark + 2;
+  }
 
-  int line_number = 0;  /* current input line number */
-  int start_line = 0;   /* first line number of current macro */
-  int inside_macro = 0; /* 0 = not inside, 1 = inside */
+  text = safe_calloc(length + 1, 1);
+  if (!text)
+    return NULL;
 
-  /* line temporaries (per line) */
-  char *token = NULL;
-  size_t newline_position = 0;
+  /* copy runs between marks, an invalid mark (a corrupt library) is text */
+  write = text;
+  cursor = m->body;
+  while ((mark = memchr(cursor, MACRO_PARAM_MARK, (size_t)(end - cursor))) &&
+         mark + 1 < end) {
+    int idx = mark[1] - '1';
+
+    memcpy(write, cursor, (size_t)(mark - cursor));
+    write += mark - cursor;
+
+    if (idx >= 0 && idx < m->param_count) {
+      memcpy(write, values[idx], lengths[idx]);
+      write += lengths[idx];
+    } else {
+      memcpy(write, mark, 2);
+      write += 2;
+    }
+    cursor = mark + 2;
+  }
+  memcpy(write, cursor, (size_t)(end - cursor));
+  write += end - cursor;
+  *write = '\0';
+  *length_out = (size_t)(write - text);
+
+  /* the passes read lines of the same size as the source's */
+  for (cursor = text; cursor < write; cursor += line_length + 1) {
+    line_length = strcspn(cursor, "\n");
+    if (line_length > MAX_LINE_LENGTH - 1) {
+      fprintf(stderr,
+              "(ERROR) [preprocessor] a line of macro '%s' gets longer than "
+              "%d chars with these arguments\n",
+              m->name, MAX_LINE_LENGTH - 1);
+      free(text);
+      return NULL;
+    }
+  }
 
-  /* read lines one by one */
-  while (fgets(line, (int)sizeof(line), in)) {
-    line_number++;
+  return text;
+}
 
-    /* replace newlines with \0 so comparisons are simpler */
-    newline_position = strcspn(line, "\n");
-    line[newline_position] = '\0';
+/* has_extra_after_macro -- returns true if a macro name has text after it
+ *
+ * note: it will work for any text (not just a macro) */
+static bool has_extra_after_macro(const char *line) {
+  char tmp[MAX_LINE_LENGTH];
+  char *rest = tmp;
+  char *t = NULL;
 
-    /* prepare a copy for strtok (strtok modifies buffer) */
-    strcpy(copy, line);
+  strcpy(tmp, line);
+  t = split_token(&rest); /* mcro token */
+  t = split_token(&rest); /* second token/extra, if any */
 
-    /* first token on the line (space or tab separated) */
-    token = strtok(copy, " \t");
-    if (!token) {
-      /* we don't really need it because we trim, but this is here for safetey,
-       * if we have a blank line - we skip */
-      continue;
-    }
+  /* returns true if macro (or any text really) has extra text after it */
+  return t != NULL;
+}
 
-    /* we're inside a macro, so we collect its body */
-    if (inside_macro) {
-      /* end directive closes the macro */
-      if (strcmp(token, MACRO_END_DIRECTIVE) == 0) {
+/* is_name_char -- can c be part of a name (of a label, macro, parameter)? */
+static bool is_name_char(char c) {
+  return isalnum((unsigned char)c) || c == '_';
+}
 
-        /* ensure there is no extra text after the end directive */
-        if (has_extra_after_macro(line)) {
-          fprintf(stderr, "(ERROR) [preprocessor] extra text after macro name "
-                          "definition\n");
-          free(body);
+/* split_token -- strtok(rest, " \t") that keeps its place in *rest, not in
+ * a static, so scans on two threads don't cut each other's lines
+ *
+ * returns the next token of *rest (cut at the blank after it) or NULL
+ */
+static char *split_token(char **rest) {
+  char *token = *rest + strspn(*rest, " \t");
+
+  if (*token == '\0') {
+    *rest = token;
+    return NULL;
+  }
+
+  *rest = token + strcspn(token, " \t");
+  if (**rest != '\0')
+    *(*rest)++ = '\0';
+  return token;
+}
+
+/* memo_slot -- the link of memo that holds key's expansion, or the empty one
+ * where it would go (the memo is created, or grown, first)
+ *
+ * returns the link or NULL if out of memory
+ */
+static Expansion **memo_slot(ExpansionMemo *memo, const char *key) {
+  Expansion **slot;
+
+  if (memo->expansion_count + 1 > memo->bucket_count) {
+    size_t bucket_count =
+        memo->bucket_count ? memo->bucket_count * 2 : MEMO_MIN_BUCKETS;
+    Expansion **buckets = safe_calloc(bucket_count, sizeof(Expansion *));
+    size_t bucket;
+
+    if (!buckets && !memo->buckets)
+      return NULL;
+
+    /* without memory for more buckets the chains just get longer */
+    if (buckets) {
+      for (bucket = 0; bucket < memo->bucket_count; bucket++) {
+        Expansion *expansion = memo->buckets[bucket];
+
+        while (expansion) {
+          Expansion *next = expansion->bucket_next;
+          size_t index = hash_string(expansion->key) & (bucket_count - 1);
+
+          expansion->bucket_next = buckets[index];
+          buckets[index] = expansion;
+          expansion = next;
+        }
+      }
+
+      free(memo->buckets);
+      memo->buckets = buckets;
+      memo->bucket_count = bucket_count;
+    }
+  }
+
+  slot = &memo->buckets[hash_string(key) & (memo->bucket_count - 1)];
+  while (*slot && strcmp((*slot)->key, key) != 0)
+    slot = &(*slot)->bucket_next;
+
+  return slot;
+}
+
+/* memo_free -- free every expansion of memo (not memo itself) */
+static void memo_free(ExpansionMemo *memo) {
+  size_t bucket;
+
+  for (bucket = 0; bucket < memo->bucket_count; bucket++) {
+    Expansion *expansion = memo->buckets[bucket];
+
+    while (expansion) {
+      Expansion *next = expansion->bucket_next;
+
+      free(expansion->key);
+      free(expansion->text);
+      free(expansion);
+      expansion = next;
+    }
+  }
+
+  free(memo->buckets);
+  memset(memo, 0, sizeof(*memo));
+}
+
+/* preprocess_stream -- clean up input_file (named filename), expand its
+ * macros and includes into output_file and, when map isn't NULL, record where
+ * each written line came from
+ *
+ * returns true on success, false on error (error printed)
+ */
+static bool preprocess_stream(const char *filename, FILE *input_file,
+                              FILE *output_file, const MacroLibrary *library,
+                              LineMap *map, int *repeated_lines_out) {
+  char *text = NULL;      /* cleaned source, macro bodies point into it */
+  size_t text_length = 0; /* bytes in text */
+  int *origins = NULL;    /* .as line of every cleaned line (map only) */
+  Macro *head = NULL;
+  IncludeScope scope;
+  bool ok;
+
+  /* strip comments and spaces, and load the cleaned text in one go, so macro
+   * bodies can be stored as spans into it instead of being copied */
+  trace_begin(TRACE_STAGE, "cleanup_file");
+  text = load_cleaned_text(input_file, &text_length, map ? &origins : NULL);
+  trace_end();
+  if (!text)
+    return false;
+
+  /* stop early if the file ended up empty */
+  if (text_length == 0) {
+    printf("(ERROR) [preprocessor] file empty after trimming, returning.\n");
+    free(origins);
+    free(text);
+    return true;
+  }
+
+  memset(&scope, 0, sizeof(scope));
+  scope.path = filename;
+
+  trace_begin(TRACE_STAGE, "macro_scan");
+  ok = macro_scan(text, text_length, output_file, &head, library, origins,
+                  map, &scope);
+  trace_end();
+  if (repeated_lines_out)
+    *repeated_lines_out = scope.repeated_lines;
+
+  /* macros point into text, so they go first */
+  macro_free_all(&head);
+  free(scope.files);
+  free(origins);
+  free(text);
+  return ok;
+}
+
+/* load_cleaned_text -- strip comments and spaces from in (through a temp
+ * file, like cleanup_file) and load the result into one buffer. with
+ * origins_out, (*origins_out)[n - 1] is the line of in that cleaned line n
+ * came from. conditionals are resolved here: the lines of a block that's out
+ * never reach cleanup_line
+ *
+ * - MUST BE FREED! (and *origins_out)
+ *
+ * returns the buffer or NULL on error
+ */
+static char *load_cleaned_text(FILE *in, size_t *length_out,
+                               int **origins_out) {
+  char line[MAX_LINE_LENGTH];
+  FILE *trimmed_file = NULL;
+  char *text = NULL;
+  int *origins = NULL;
+  int origin_count = 0;
+  int origin_capacity = 0;
+  int line_number = 1; /* of in */
+  bool starts_line = true; /* the piece read is a line's first */
+  bool ok = true;
+  CondStack conditionals;
+
+  memset(&conditionals, 0, sizeof(conditionals));
+
+  /* temporary file to hold cleaned lines */
+  trimmed_file = tmpfile();
+  if (!trimmed_file) {
+    fprintf(stderr,
+            "(ERROR) [preprocessor] creating & opening temp file failed\n");
+    return NULL;
+  }
+
+  /* cleanup_file, counting lines (a line too long for the buffer comes in
+   * pieces, each a line of its own) */
+  while (ok && fgets(line, sizeof(line), in)) {
+    int current = line_number;
+    bool is_first_piece = starts_line;
+
+    starts_line = strchr(line, '\n') != NULL;
+    if (starts_line)
+      line_number++;
+
+    /* a block that's out: only its conditionals count */
+    if (!cond_is_active(&conditionals)) {
+      if (is_first_piece)
+        ok = cond_skip_line(&conditionals, line, current);
+      continue;
+    }
+
+    cleanup_line(line);
+    if (line[0] == '\0')
+      continue;
+
+    switch (cond_directive(&conditionals, line, current)) {
+    case COND_DONE:
+      continue;
+    case COND_ERROR:
+      ok = false;
+      continue;
+    default:
+      break;
+    }
+
+    fprintf(trimmed_file, "%s\n", line);
+
+    if (!origins_out)
+      continue;
+
+    if (origin_count == origin_capacity) {
+      int capacity = origin_capacity ? origin_capacity * 2 : LINE_MAP_MIN_LINES;
+      int *grown = realloc(origins, (size_t)capacity * sizeof(int));
+
+      if (!grown) {
+        fprintf(stderr, "(ERROR) [preprocessor] out of memory for line map\n");
+        ok = false;
+        continue;
+      }
+      origins = grown;
+      origin_capacity = capacity;
+    }
+    origins[origin_count++] = current;
+  }
+
+  if (!ok || !cond_end(&conditionals)) {
+    free(origins);
+    fclose(trimmed_file);
+    return NULL;
+  }
+
+  rewind(trimmed_file);
+  text = read_file_contents(trimmed_file, length_out);
+  if (!text) {
+    fprintf(stderr, "(ERROR) [preprocessor] reading trimmed file failed\n");
+    free(origins);
+    origins = NULL;
+  }
+
+  if (origins_out)
+    *origins_out = origins;
+
+  fclose(trimmed_file);
+  return text;
+}
+
+/* record_origins -- add the .am lines written for cleaned line line_number
+ * to map: the line itself, or every line of the macro body it expanded
+ *
+ * returns true on success, false on error (error printed)
+ */
+static bool record_origins(LineMap *map, const int *origins, int line_number,
+                           const Macro *expanded) {
+  int call_line = origins[line_number - 1];
+  int written = 1;
+  int idx;
+
+  if (expanded) {
+    const char *cursor = expanded->body;
+    const char *end = expanded->body + expanded->body_length;
+
+    written = 0;
+    while ((cursor = memchr(cursor, '\n', (size_t)(end - cursor))) != NULL) {
+      cursor++;
+      written++;
+    }
+  }
+
+  if (!grow_map(map, written))
+    return false;
+
+  for (idx = 0; idx < written; idx++) {
+    LineOrigin *origin = &map->lines[map->count++];
+
+    if (!expanded) {
+      origin->line = call_line;
+      origin->call_line = 0;
+      continue;
+    }
+
+    /* body line idx is cleaned line line_number + 1 + idx of its 'mcro',
+     * library macros (line 0) aren't in this file */
+    origin->line = expanded->line_number > 0
+                       ? origins[expanded->line_number + idx]
+                       : 0;
+    origin->call_line = call_line;
+  }
+
+  return true;
+}
+
+/* record_included -- add the .am lines of chunk, written for the .include
+ * on .as line call_line, to map
+ *
+ * returns true on success, false on error (error printed)
+ */
+static bool record_included(LineMap *map, const char *chunk, size_t length,
+                            int call_line) {
+  const char *end = chunk + length;
+  int written = 0;
+
+  while ((chunk = memchr(chunk, '\n', (size_t)(end - chunk))) != NULL) {
+    chunk++;
+    written++;
+  }
+
+  if (!grow_map(map, written))
+    return false;
+
+  for (; written > 0; written--) {
+    LineOrigin *origin = &map->lines[map->count++];
+
+    origin->line = 0;
+    origin->call_line = call_line;
+  }
+
+  return true;
+}
+
+/* grow_map -- make room in map for line_count more lines
+ *
+ * returns true on success, false if out of memory (error printed)
+ */
+static bool grow_map(LineMap *map, int line_count) {
+  int capacity = map->capacity ? map->capacity : LINE_MAP_MIN_LINES;
+  LineOrigin *grown;
+
+  if (map->count + line_count <= map->capacity)
+    return true;
+
+  while (capacity < map->count + line_count)
+    capacity *= 2;
+
+  grown = realloc(map->lines, (size_t)capacity * sizeof(LineOrigin));
+  if (!grown) {
+    fprintf(stderr, "(ERROR) [preprocessor] out of memory for line map\n");
+    return false;
+  }
+  map->lines = grown;
+  map->capacity = capacity;
+  return true;
+}
+
+/* next_line -- copy the line starting at cursor (without its newline) into
+ * line_out, which holds MAX_LINE_LENGTH chars
+ *
+ * returns a pointer to the start of the following line, or NULL at the end
+ */
+static const char *next_line(const char *cursor, const char *end,
+                             char *line_out) {
+  const char *newline;
+  size_t length;
+
+  if (cursor >= end)
+    return NULL;
+
+  newline = memchr(cursor, '\n', (size_t)(end - cursor));
+  if (!newline)
+    newline = end;
+
+  /* cleanup_file already split lines to fit, this is just for safety */
+  length = (size_t)(newline - cursor);
+  if (length > MAX_LINE_LENGTH - 1)
+    length = MAX_LINE_LENGTH - 1;
+
+  memcpy(line_out, cursor, length);
+  line_out[length] = '\0';
+
+  return newline < end ? newline + 1 : end;
+}
+
+/* macro_scan -- reads macros from the cleaned text, expands them, and writes
+ * to output file
+ *
+ *  - we read each line:
+ *    - if inside a macro, we just keep going until its end, the body is the
+ *      span of text between the two directives
+ *    - if we're outside a macro, we either start defining a new macro, start
+ *      expanding a new macro, or copy the line as is
+ *
+ *  - at EOF wee fail if macro is left open
+ *  - we do not allow extra tokens after macro directives
+ *  - macro must be declared before use
+ *  - without an output file (macro library) only definitions are allowed
+ *  - with a map, the origin of every line written is recorded in it
+ *  - with a scope, .include lines splice in other files (include_file)
+ *  - calls with arguments are memoized for the scan (write_expansion)
+ *  - a .rept block is expanded once and written as many times as asked
+ *
+ * returns true on success, false on error
+ */
+static bool macro_scan(const char *text, size_t text_length, FILE *out,
+                       Macro **head, const MacroLibrary *library,
+                       const int *origins, LineMap *map, IncludeScope *scope) {
+  ScanState state;
+  bool ok;
+
+  memset(&state, 0, sizeof(state));
+  ok = scan_lines(text, text_length, out, head, library, origins, map, scope,
+                  &state);
+  if (scope)
+    scope->repeated_lines += state.repeated_lines;
+
+  /* blocks left open by an error */
+  while (state.rept_depth > 0)
+    fclose(state.repts[--state.rept_depth].buffer);
+  memo_free(&state.memo);
+  return ok;
+}
+
+/* scan_lines -- macro_scan, with the scan's state
+ *
+ * returns true on success, false on error
+ */
+static bool scan_lines(const char *text, size_t text_length, FILE *out,
+                       Macro **head, const MacroLibrary *library,
+                       const int *origins, LineMap *map, IncludeScope *scope,
+                       ScanState *state) {
+  char line[MAX_LINE_LENGTH];
+  char copy[MAX_LINE_LENGTH]; /* local copy for tokenization */
+  MacroHeader header;         /* current macro when inside */
+  const char *end = text + text_length;
+  const char *cursor = text;       /* start of the current line */
+  const char *next = NULL;         /* start of the next line */
+  const char *body_start = NULL;   /* first body line of current macro */
+
+  int line_number = 0;  /* current input line number */
+  int inside_macro = 0; /* 0 = not inside, 1 = inside */
+
+  /* line temporaries (per line) */
+  char *rest = NULL;
+  char *token = NULL;
+  Macro expanded; /* what expand_macro_or_emit_line expanded, if anything */
+
+  /* read lines one by one */
+  for (; (next = next_line(cursor, end, line)) != NULL; cursor = next) {
+    line_number++;
+
+    /* prepare a copy for split_token (it modifies the buffer) */
+    strcpy(copy, line);
+    rest = copy;
+
+    /* first token on the line (space or tab separated) */
+    token = split_token(&rest);
+    if (!token) {
+      /* we don't really need it because we trim, but this is here for safetey,
+       * if we have a blank line - we skip */
+      continue;
+    }
+
+    /* we're inside a macro, so we look for its end */
+    if (inside_macro) {
+      /* end directive closes the macro */
+      if (strcmp(token, MACRO_END_DIRECTIVE) == 0) {
+
+        /* ensure there is no extra text after the end directive */
+        if (has_extra_after_macro(line)) {
+          fprintf(stderr, "(ERROR) [preprocessor] extra text after macro name "
+                          "definition\n");
           return false;
         }
 
-        /* finalize and store the macro (alloc checks inside) */
-        if (!end_macro_definition(macro_name, &body, &body_len, &body_cap,
-                                  start_line, head)) {
+        /* store the macro, its body ends right before this line */
+        if (!end_macro_definition(&header, body_start,
+                                  (size_t)(cursor - body_start), head)) {
           /* end_macro_definition already printed a message if needed */
           return false;
         }
 
         inside_macro = 0;
-        continue;
-      }
-
-      /* 'normal' body line - append to growing buffer with a newline */
-      if (!append_body_line(&body, &body_len, &body_cap, line)) {
-        fprintf(
-            stderr,
-            "(ERROR) [preprocessor] reallocating memory for macro failed\n");
-        return false;
       }
 
+      /* 'normal' body lines are already part of the span */
       continue;
     } /* end if inside_macro */
 
     /* if we're outside a macro
      * maybe we're starting one with 'mcro X', so we check */
     if (strcmp(token, MACRO_START_DIRECTIVE) == 0) {
-      if (!begin_macro_definition(line, line_number, head, macro_name,
-                                  &start_line)) {
+      if (!begin_macro_definition(line, line_number, head, library,
+                                  &header)) {
         /* begin_macro_definition prints the specific error */
         return false;
       }
 
+      /* the body starts with the next line */
+      body_start = next;
       inside_macro = 1;
       continue;
     }
@@ -580,20 +1671,604 @@ static bool macro_scan(FILE *in, FILE *out, Macro **head) {
       return false;
     }
 
+    /* another file's expansion and macros */
+    if (scope && strcmp(token, INCLUDE_DIRECTIVE) == 0) {
+      if (state->rept_depth > 0) {
+        fprintf(stderr,
+                "(ERROR) [preprocessor] %s inside a %s block (line %d)\n",
+                INCLUDE_DIRECTIVE, REPT_DIRECTIVE, line_number);
+        return false;
+      }
+      if (!include_file(line, line_number, out, head, library, scope,
+                        map ? origins[line_number - 1] : 0, map))
+        return false;
+      continue;
+    }
+
+    /* a macro library has nowhere to write lines to */
+    if (!out) {
+      fprintf(stderr,
+              "(ERROR) [preprocessor] only macro definitions are allowed in a "
+              "macro library (line %d)\n",
+              line_number);
+      return false;
+    }
+
+    /* lines repeated, or the end of them */
+    if (strcmp(token, REPT_DIRECTIVE) == 0) {
+      if (!begin_rept(line, &out, map, state))
+        return false;
+      continue;
+    }
+
+    if (strcmp(token, REPT_END_DIRECTIVE) == 0) {
+      if (!end_rept(line, &out, map, state))
+        return false;
+      continue;
+    }
+
     /* macro OR a normal line */
     /* we pass the first_token (i.e. the name of the macro) to the function */
-    if (!expand_macro_or_emit_line(line, token, out, head, line_number)) {
+    if (!expand_macro_or_emit_line(line, token, out, head, library,
+                                   line_number, &state->memo, &expanded)) {
       /*  expand_macro_or_emit_line prints the specific error */
       return false;
     }
+
+    if (map && !record_origins(map, origins, line_number,
+                               expanded.body ? &expanded : NULL))
+      return false;
   }
 
   /* reached eof. if a macro is still open, it is an error */
   if (inside_macro) {
     fprintf(stderr, "(ERROR) [preprocessor] macro without name definition\n");
+    return false;
+  }
+
+  if (state->rept_depth > 0) {
+    fprintf(stderr, "(ERROR) [preprocessor] %s without %s\n", REPT_DIRECTIVE,
+            REPT_END_DIRECTIVE);
+    return false;
+  }
+
+  return true;
+}
+
+/* ======================================================================= */
+
+/* include_file -- handle the .include on line (cleaned line line_num) of the
+ * scope's file: load the file it names and splice it in, or, when the scope
+ * is loading an included file, note where it goes and import its macros.
+ * call_line is the .as line of the .include, for the map
+ *
+ * returns true on success, false on error (error printed)
+ */
+static bool include_file(const char *line, int line_num, FILE *out,
+                         Macro **head, const MacroLibrary *library,
+                         IncludeScope *scope, int call_line, LineMap *map) {
+  char path[MAX_FILENAME_LENGTH];
+  IncludedFile *file;
+  bool ok;
+
+  if (!include_path(line, scope->path, path)) {
+    fprintf(stderr, "(ERROR) [preprocessor] in '%s' (line %d)\n", scope->path,
+            line_num);
+    return false;
+  }
+
+  /* a file including itself has nothing to add */
+  if (strcmp(path, scope->path) == 0)
+    return true;
+
+  /* an included file's includes are loaded under its includer's lock */
+#ifdef HAVE_PTHREADS
+  if (!scope->loading)
+    pthread_mutex_lock(&include_lock);
+#endif
+
+  trace_begin(TRACE_STAGE, "load_include");
+  file = include_load(path, library);
+  trace_end();
+
+  if (!file) {
+    fprintf(stderr, "(ERROR) [preprocessor] included from '%s' (line %d)\n",
+            scope->path, line_num);
+    ok = false;
+  } else if (!scope->loading) {
+    ok = include_splice(file, scope, out, head, call_line, map);
+  } else {
+    /* the includer splices it, the loaded file only needs its macros */
+    ok = (scope_has(scope, file) ||
+          include_add_ref(scope->loading, (size_t)ftell(out), file)) &&
+         include_splice(file, scope, NULL, head, 0, NULL);
+  }
+
+#ifdef HAVE_PTHREADS
+  if (!scope->loading)
+    pthread_mutex_unlock(&include_lock);
+#endif
+  return ok;
+}
+
+/* include_path -- the path of the file named by the .include on line, in
+ * the file includer: relative to includer's directory unless it's absolute
+ *
+ * returns true on success, false on error (error printed)
+ */
+static bool include_path(const char *line, const char *includer,
+                         char *path_out) {
+  const char *name = line + strlen(INCLUDE_DIRECTIVE);
+  const char *name_end;
+  const char *slash = strrchr(includer, '/');
+  size_t directory_length = 0;
+
+  while (*name == ' ' || *name == '\t')
+    name++;
+
+  name_end = *name == '"' ? strchr(name + 1, '"') : NULL;
+  if (!name_end || name_end == name + 1) {
+    fprintf(stderr, "(ERROR) [preprocessor] expected %s \"file\"\n",
+            INCLUDE_DIRECTIVE);
+    return false;
+  }
+  name++;
+
+  if (name_end[1 + strspn(name_end + 1, " \t")] != '\0') {
+    fprintf(stderr, "(ERROR) [preprocessor] extra text after %s \"file\"\n",
+            INCLUDE_DIRECTIVE);
+    return false;
+  }
+
+  if (slash && name[0] != '/')
+    directory_length = (size_t)(slash - includer) + 1;
+
+  if (directory_length + (size_t)(name_end - name) >= MAX_FILENAME_LENGTH) {
+    fprintf(stderr, "(ERROR) [preprocessor] included filename too long\n");
+    return false;
+  }
+
+  memcpy(path_out, includer, directory_length);
+  memcpy(path_out + directory_length, name, (size_t)(name_end - name));
+  path_out[directory_length + (size_t)(name_end - name)] = '\0';
+  normalize_path(path_out);
+  return true;
+}
+
+/* normalize_path -- drop the "." and "dir/.." parts of path (in place), so
+ * one file reached through different directories has one path in the cache.
+ * links aren't followed, a file reached through one is a file of its own */
+static void normalize_path(char *path) {
+  char *read = path;
+  char *write = path;
+  char *start = path; /* where the first part that ".." may drop starts */
+
+  if (*read == '/') {
+    read++;
+    write++;
+    start++;
+  }
+
+  while (*read) {
+    const char *part = read;
+    size_t length = strcspn(part, "/");
+
+    /* past the part first, writing it may overwrite it */
+    read += length;
+    if (*read == '/')
+      read++;
+
+    if (length == 1 && part[0] == '.')
+      continue; /* "." is where we are */
+
+    if (length == 2 && part[0] == '.' && part[1] == '.' && write > start) {
+      /* drop the last part written, start keeps the ".." ones */
+      write--;
+      while (write > start && write[-1] != '/')
+        write--;
+      continue;
+    }
+
+    if (length > 0) {
+      memmove(write, part, length);
+      write += length;
+      if (*read == '\0')
+        break; /* the last part, no slash after it */
+      *write++ = '/';
+      if (length == 2 && part[0] == '.' && part[1] == '.')
+        start = write;
+    }
+  }
+
+  /* a path ending in "." or ".." ends in a slash, keep "/" itself */
+  if (write - 1 > path && write[-1] == '/')
+    write--;
+  *write = '\0';
+}
+
+/* include_load -- the included file at path from the cache, loading it (and
+ * what it includes) the first time: cleaned, scanned on its own and its
+ * expansion kept. a file that failed once fails again without a rescan
+ *
+ * returns the file (still loading if it includes itself through other
+ * files) or NULL on error (error printed)
+ */
+static IncludedFile *include_load(const char *path,
+                                  const MacroLibrary *library) {
+  IncludedFile **slot = include_slot(path);
+  IncludedFile *file;
+  IncludeScope scope;
+  FILE *in, *out = NULL;
+  size_t text_length = 0;
+  bool ok = false;
+
+  if (!slot)
+    return NULL;
+
+  if (*slot) {
+    if ((*slot)->state == INCLUDE_FAILED) {
+      fprintf(stderr, "(ERROR) [preprocessor] included file '%s' has errors\n",
+              path);
+      return NULL;
+    }
+    return *slot;
+  }
+
+  file = safe_calloc(1, sizeof(IncludedFile));
+  if (!file)
+    return NULL;
+  file->path = safe_strdup(path);
+  if (!file->path) {
+    free(file);
+    return NULL;
+  }
+
+  /* in the cache before the scan, so an include of it from its own includes
+   * finds it loading instead of loading it again */
+  file->state = INCLUDE_LOADING;
+  *slot = file;
+  include_cache.file_count++;
+
+  in = fopen(path, "r");
+  if (!in) {
+    fprintf(stderr, "(ERROR) [preprocessor] opening included file '%s' failed\n",
+            path);
+    file->state = INCLUDE_FAILED;
+    return NULL;
+  }
+
+  file->text = load_cleaned_text(in, &text_length, NULL);
+  fclose(in);
+
+  memset(&scope, 0, sizeof(scope));
+  scope.path = file->path;
+  scope.loading = file;
+
+  if (file->text) {
+    out = tmpfile();
+    if (!out)
+      fprintf(stderr,
+              "(ERROR) [preprocessor] creating & opening temp file failed\n");
+  }
+
+  if (out && macro_scan(file->text, text_length, out, &file->macros, library,
+                        NULL, NULL, &scope)) {
+    rewind(out);
+    file->output = read_file_contents(out, &file->output_length);
+    ok = file->output != NULL;
+  }
+
+  if (out)
+    fclose(out);
+  free(scope.files);
+
+  if (!ok) {
+    fprintf(stderr, "(ERROR) [preprocessor] in included file '%s'\n", path);
+    file->state = INCLUDE_FAILED;
+    return NULL;
+  }
+
+  file->repeated_lines = scope.repeated_lines;
+  file->state = INCLUDE_READY;
+  return file;
+}
+
+/* include_slot -- the link of the cache that holds path's file, or the empty
+ * one where it would go (the cache is created, or grown, first)
+ *
+ * returns the link or NULL if out of memory
+ */
+static IncludedFile **include_slot(const char *path) {
+  IncludedFile **slot;
+
+  if (include_cache.file_count + 1 > include_cache.bucket_count) {
+    size_t bucket_count = include_cache.bucket_count
+                              ? include_cache.bucket_count * 2
+                              : INCLUDE_MIN_BUCKETS;
+    IncludedFile **buckets = safe_calloc(bucket_count, sizeof(IncludedFile *));
+    size_t bucket;
+
+    if (!buckets && !include_cache.buckets)
+      return NULL;
+
+    /* without memory for more buckets the chains just get longer */
+    if (buckets) {
+      for (bucket = 0; bucket < include_cache.bucket_count; bucket++) {
+        IncludedFile *file = include_cache.buckets[bucket];
+
+        while (file) {
+          IncludedFile *next = file->bucket_next;
+          size_t index = hash_string(file->path) & (bucket_count - 1);
+
+          file->bucket_next = buckets[index];
+          buckets[index] = file;
+          file = next;
+        }
+      }
+
+      free(include_cache.buckets);
+      include_cache.buckets = buckets;
+      include_cache.bucket_count = bucket_count;
+    }
+  }
+
+  slot = &include_cache
+              .buckets[hash_string(path) & (include_cache.bucket_count - 1)];
+  while (*slot && strcmp((*slot)->path, path) != 0)
+    slot = &(*slot)->bucket_next;
+
+  return slot;
+}
+
+/* include_splice -- splice file into the scope, unless it's there already:
+ * its output (when out isn't NULL) with the files it includes in their
+ * places, and the macros it defines. with a map, the lines written are
+ * recorded as coming from the .include on .as line call_line
+ *
+ * returns true on success, false on error (error printed)
+ */
+static bool include_splice(IncludedFile *file, IncludeScope *scope, FILE *out,
+                           Macro **head, int call_line, LineMap *map) {
+  size_t offset = 0;
+  Macro *macro;
+  int idx;
+
+  if (strcmp(file->path, scope->path) == 0 || scope_has(scope, file))
+    return true;
+
+  if (!scope_add(scope, file))
+    return false;
+
+  /* its macros aren't known until it's loaded */
+  if (file->state != INCLUDE_READY)
+    return true;
+
+  for (idx = 0; idx < file->ref_count; idx++) {
+    const IncludeRef *ref = &file->refs[idx];
+
+    if (out) {
+      fwrite(file->output + offset, 1, ref->offset - offset, out);
+      if (map && !record_included(map, file->output + offset,
+                                  ref->offset - offset, call_line))
+        return false;
+      offset = ref->offset;
+    }
+
+    if (!include_splice(ref->file, scope, out, head, call_line, map))
+      return false;
+  }
+
+  if (out) {
+    fwrite(file->output + offset, 1, file->output_length - offset, out);
+    if (map && !record_included(map, file->output + offset,
+                                file->output_length - offset, call_line))
+      return false;
+    scope->repeated_lines += file->repeated_lines;
+  }
+
+  /* the ones it imported (line 0) came with its refs. a copy is line 0, its
+   * body isn't on a line of the includer */
+  for (macro = file->macros; macro; macro = macro->next) {
+    if (macro->line_number > 0 && !macro_import(head, macro))
+      return false;
+  }
+
+  return true;
+}
+
+/* include_add_ref -- note that included goes at offset of file's output
+ *
+ * returns true on success, false if out of memory
+ */
+static bool include_add_ref(IncludedFile *file, size_t offset,
+                            IncludedFile *included) {
+  if (file->ref_count == file->ref_capacity) {
+    int capacity = file->ref_capacity ? file->ref_capacity * 2 : 4;
+    IncludeRef *grown =
+        realloc(file->refs, (size_t)capacity * sizeof(IncludeRef));
+
+    if (!grown) {
+      fprintf(stderr, "(ERROR) [preprocessor] out of memory for includes\n");
+      return false;
+    }
+    file->refs = grown;
+    file->ref_capacity = capacity;
+  }
+
+  file->refs[file->ref_count].offset = offset;
+  file->refs[file->ref_count].file = included;
+  file->ref_count++;
+  return true;
+}
+
+/* scope_has -- was file spliced into the scope already? (a file includes
+ * few, so a walk does) */
+static bool scope_has(const IncludeScope *scope, const IncludedFile *file) {
+  int idx;
+
+  for (idx = 0; idx < scope->file_count; idx++) {
+    if (scope->files[idx] == file)
+      return true;
+  }
+
+  return false;
+}
+
+/* scope_add -- note file as spliced into the scope
+ *
+ * returns true on success, false if out of memory
+ */
+static bool scope_add(IncludeScope *scope, IncludedFile *file) {
+  if (scope->file_count == scope->file_capacity) {
+    int capacity = scope->file_capacity ? scope->file_capacity * 2 : 4;
+    IncludedFile **grown =
+        realloc(scope->files, (size_t)capacity * sizeof(IncludedFile *));
+
+    if (!grown) {
+      fprintf(stderr, "(ERROR) [preprocessor] out of memory for includes\n");
+      return false;
+    }
+    scope->files = grown;
+    scope->file_capacity = capacity;
+  }
+
+  scope->files[scope->file_count++] = file;
+  return true;
+}
+
+/* include_free -- free an included file and everything it holds (its macros
+ * first, they point into its text) */
+static void include_free(IncludedFile *file) {
+  macro_free_all(&file->macros);
+  free(file->text);
+  free(file->output);
+  free(file->refs);
+  free(file->path);
+  free(file);
+}
+
+/* ======================================================================= */
+
+/* begin_rept -- open the .rept block of line: the lines up to its .endr go
+ * to a buffer instead of *out (expanded once, they're written as many times
+ * as it says at the .endr)
+ *
+ * returns true on success, false on error (error printed)
+ */
+static bool begin_rept(const char *line, FILE **out, LineMap *map,
+                       ScanState *state) {
+  const char *count_text = line + strlen(REPT_DIRECTIVE);
+  ReptBlock *block;
+  char *count_end = NULL;
+  long count;
+
+  count_text += strspn(count_text, " \t");
+  count = isdigit((unsigned char)*count_text) ? strtol(count_text, &count_end, 10)
+                                               : -1;
+  if (count < 0 || count > REPT_MAX_COUNT ||
+      count_end[strspn(count_end, " \t")] != '\0') {
+    fprintf(stderr,
+            "(ERROR) [preprocessor] expected %s <count>, a count from 0 to "
+            "%d\n",
+            REPT_DIRECTIVE, REPT_MAX_COUNT);
+    return false;
+  }
+
+  if (state->rept_depth == REPT_MAX_DEPTH) {
+    fprintf(stderr, "(ERROR) [preprocessor] %s blocks nested more than %d deep\n",
+            REPT_DIRECTIVE, REPT_MAX_DEPTH);
+    return false;
+  }
+
+  block = &state->repts[state->rept_depth];
+  block->buffer = tmpfile();
+  if (!block->buffer) {
+    fprintf(stderr,
+            "(ERROR) [preprocessor] creating & opening temp file failed\n");
+    return false;
+  }
+  block->outer = *out;
+  block->count = count;
+  block->map_start = map ? map->count : 0;
+  state->rept_depth++;
+
+  *out = block->buffer;
+  return true;
+}
+
+/* end_rept -- close the innermost .rept block (at its .endr line): write
+ * what its lines expanded to, count times, to the output it replaced, and
+ * repeat their origins in map
+ *
+ * returns true on success, false on error (error printed)
+ */
+static bool end_rept(const char *line, FILE **out, LineMap *map,
+                     ScanState *state) {
+  ReptBlock *block;
+  const char *cursor;
+  char *body;
+  size_t body_length;
+  int body_lines = 0;
+  long copy;
+
+  if (state->rept_depth == 0) {
+    fprintf(stderr, "(ERROR) [preprocessor] %s without %s\n",
+            REPT_END_DIRECTIVE, REPT_DIRECTIVE);
+    return false;
+  }
+
+  if (has_extra_after_macro(line)) {
+    fprintf(stderr, "(ERROR) [preprocessor] extra text after %s\n",
+            REPT_END_DIRECTIVE);
+    return false;
+  }
+
+  block = &state->repts[--state->rept_depth];
+  rewind(block->buffer);
+  body = read_file_contents(block->buffer, &body_length);
+  fclose(block->buffer);
+  *out = block->outer;
+  if (!body) {
+    fprintf(stderr, "(ERROR) [preprocessor] reading %s block failed\n",
+            REPT_DIRECTIVE);
+    return false;
+  }
+
+  if (block->count > 0 &&
+      body_length > (size_t)(REPT_MAX_OUTPUT / block->count)) {
+    fprintf(stderr,
+            "(ERROR) [preprocessor] %s block expands to more than %ld bytes\n",
+            REPT_DIRECTIVE, REPT_MAX_OUTPUT);
     free(body);
     return false;
   }
 
+  for (cursor = body; (cursor = memchr(cursor, '\n',
+                                       body_length - (size_t)(cursor - body)));
+       cursor++)
+    body_lines++;
+
+  /* one bulk write per copy */
+  for (copy = 0; copy < block->count; copy++)
+    fwrite(body, 1, body_length, *out);
+  free(body);
+
+  /* the map got the lines once, while they were expanded */
+  if (map) {
+    if (block->count == 0) {
+      map->count = block->map_start;
+    } else if (!grow_map(map, body_lines * (int)(block->count - 1))) {
+      return false;
+    } else {
+      for (copy = 1; copy < block->count; copy++) {
+        memcpy(map->lines + map->count, map->lines + block->map_start,
+               (size_t)body_lines * sizeof(LineOrigin));
+        map->count += body_lines;
+      }
+    }
+  }
+
+  if (block->count > 1)
+    state->repeated_lines += body_lines * (int)(block->count - 1);
   return true;
 }
@@ -1,27 +1,89 @@
 #ifndef PREPROCESSOR_H
 #define PREPROCESSOR_H
 
+#include "macro_library.h"
+
 #define MACRO_START_DIRECTIVE "mcro"  /* start of a macro */
 #define MACRO_END_DIRECTIVE "mcroend" /* end of a macro */
+#define INCLUDE_DIRECTIVE ".include"  /* .include "file" */
+#define REPT_DIRECTIVE ".rept"        /* .rept <count>, lines repeated */
+#define REPT_END_DIRECTIVE ".endr"    /* end of them */
+#define LINE_MAP_MIN_LINES 64
+
+/* line_origin -- where one .am line came from */
+typedef struct LineOrigin {
+  int line;      /* .as line it was written from, 0 if none (library macro or
+                    included file) */
+  int call_line; /* .as line of the macro call or .include that wrote it, 0
+                    if none */
+} LineOrigin;
 
-/* these are arbitrary values */
-#define GROW_BY 256
+/* line_map -- the origin of every .am line, lines[n - 1] is .am line n */
+typedef struct LineMap {
+  LineOrigin *lines;
+  int count;
+  int capacity;
+} LineMap;
 
-/* macro -- this struct holds info about a macro: its name, body, line number,
- * and pointer to the next macro */
-typedef struct Macro {
-  char *name;
-  char *body;
-  int line_number;
-  struct Macro *next;
-} Macro;
+/* macro_library_load -- load a macro library, either compiled (mapped as is)
+ * or a text file holding only mcro/mcroend definitions (the full filename,
+ * extension included), which we clean up, parse and index
+ *
+ * - MUST BE FREED! (macro_library_free)
+ *
+ * returns the library or NULL on error (error printed)
+ */
+MacroLibrary *macro_library_load(const char *filename);
 
 /* preprocess_file -- runs the preprocessing step for a file (without .as
    extension) cleans up the file, removes comments, finds macros and expands
-   them
+   them. macros in library (may be NULL) are visible before the file's own
+
+   .include "name" (relative to the including file's directory) splices in
+   the expansion of another file and makes its macros visible from there on.
+   an included file is expanded on its own (it sees the library and its own
+   includes, not the includer's macros), so it's cleaned and scanned once per
+   run and every file that includes it gets the same expansion. a file is
+   spliced into a .as file once, later includes of it (directly or through
+   other files) are skipped, like a header with include guards
+
+   .rept <count> ... .endr writes the lines between them count times (blocks
+   may nest). they're expanded once, the copies are written from that
+
+   .ifdef/.ifndef/.if ... .else ... .endif blocks (see conditional.h) are
+   resolved first, as the file is read: the lines they drop are never
+   cleaned up or scanned for macros
+
+   repeated_lines_out (may be NULL) gets how many lines of the .am were
+   written by repeating .rept blocks (the copies after the first, an
+   included file's too): they're all copies of lines written before them
+
+   files may be preprocessed on several threads at once, they share the
+   files loaded by .include
 
    returns 0 if ok, 1 if error. consider returning true/false (and inverting)
    */
-int preprocess_file(char *filename_without_extension);
+int preprocess_file(char *filename_without_extension,
+                    const MacroLibrary *library, int *repeated_lines_out);
+
+/* preprocess_line_map -- run the same preprocessing step for a file (without
+ * .as extension) but only record where each line of its .am comes from, the
+ * .am itself isn't written. library must be the one the .am was made with
+ *
+ * - MUST BE FREED! (line_map_free)
+ *
+ * returns true on success, false on error (error printed)
+ */
+bool preprocess_line_map(const char *filename_without_extension,
+                         const MacroLibrary *library, LineMap *map);
+
+/* line_map_free -- free the lines of a map from preprocess_line_map */
+void line_map_free(LineMap *map);
+
+/* preprocess_forget_includes -- free the files .include loaded this run, the
+ * next include of each one reads it again (after it changed, or at exit).
+ * not while a file is being preprocessed, its macros may point into them
+ */
+void preprocess_forget_includes(void);
 
 #endif /* PREPROCESSOR_H */
@@ -5,13 +5,24 @@
 #include "helpers.h"
 #include "instruction_image.h"
 #include "instruction_utils.h"
+#include "object_file.h"
 #include "symbol_table.h"
+#include "trace.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 /* second_pass.c -- implementation of the assembler second pass */
 
+/* every word encode_symbol_word fills (its A/R/E and extern), for .obj */
+static ObjectReloc relocations[MAX_WORDS_MEMORY];
+static int relocation_count = 0;
+
+/* the file's .extern symbols, relocations refer to them by index */
+static Symbol *extern_symbols[MAX_WORDS_MEMORY];
+static int extern_count = 0;
+
+static void collect_externs(Symbol *symtab);
 static void mark_word_absolute(int idx);
 static void write_external_reference(FILE **ext_fp, const char *base_filename,
                                      const char *sym_name, int idx);
@@ -38,35 +49,57 @@ static void write_object(FILE *ob_fp, int icf, DirectiveFields *directives[],
 static void write_entries(const char *base_filename, Symbol *symtab,
                           DirectiveFields *directives[], int directive_count,
                           int *error_count);
+static void write_object_binary(const char *base_filename, int icf,
+                                Symbol *symtab, DirectiveFields *directives[],
+                                int directive_count, int *error_count);
 
 /* ======================================================================= */
 /* ===================== public api -- see header ======================== */
 /* ======================================================================= */
 
-int second_pass(Symbol *symtab, int icf, const char *base_filename) {
+int second_pass(Symbol *symtab, int icf, const char *base_filename,
+                OutputFormat format) {
   FILE *ob_fp = NULL;
   FILE *ext_fp = NULL;
   int error_count = 0;
 
   /* we open .ob first
    * .ext/.ent files are opened later if when needed */
-  ob_fp = open_file_with_ext(base_filename, ".ob", "w");
-  if (!ob_fp) {
-    fprintf(stderr, "(ERROR) [second_pass] failed to create object file\n");
-    return -1;
+  if (format == OUTPUT_TEXT) {
+    ob_fp = open_file_with_ext(base_filename, ".ob", "w");
+    if (!ob_fp) {
+      fprintf(stderr, "(ERROR) [second_pass] failed to create object file\n");
+      return -1;
+    }
   }
 
+  relocation_count = 0;
+  collect_externs(symtab);
+
   /* resolve symbolic operands into the image */
+  trace_begin(TRACE_STAGE, "resolve_symbols");
   resolve_symbols(symtab, command_list, command_count, &ext_fp, base_filename,
                   &error_count);
+  trace_end();
 
   /* write object file (code then data) */
-  write_object(ob_fp, icf, directive_list, directive_count);
-  fclose(ob_fp);
+  if (format == OUTPUT_TEXT) {
+    trace_begin(TRACE_STAGE, "write_object");
+    write_object(ob_fp, icf, directive_list, directive_count);
+    fclose(ob_fp);
+    trace_end();
+  } else {
+    trace_begin(TRACE_STAGE, "write_object_binary");
+    write_object_binary(base_filename, icf, symtab, directive_list,
+                        directive_count, &error_count);
+    trace_end();
+  }
 
   /* write entries file if any entries exist */
+  trace_begin(TRACE_STAGE, "write_entries");
   write_entries(base_filename, symtab, directive_list, directive_count,
                 &error_count);
+  trace_end();
 
   /* close .ext if it was opened during resolve */
   if (ext_fp) {
@@ -250,8 +283,115 @@ static void write_entries(const char *base_filename, Symbol *symtab,
   }
 }
 
+/* write_object_binary -- same image as write_object, plus the relocations,
+ * entries and externs, packed into .obj (see object_file.h) */
+static void write_object_binary(const char *base_filename, int icf,
+                                Symbol *symtab, DirectiveFields *directives[],
+                                int directive_count, int *error_count) {
+  unsigned short words[MAX_WORDS_MEMORY];
+  ObjectSymbol entries[MAX_WORDS_MEMORY];
+  ObjectSymbol externs[MAX_WORDS_MEMORY];
+  char *strings = NULL;
+  size_t strings_size = 0;
+  ObjectFile obj;
+  int word_count = 0;
+  int entry_count = 0;
+  int idx, j;
+
+  /* code segment, then every data directive in order */
+  for (idx = 0; idx < icf - IC_INIT_VALUE; idx++) {
+    words[word_count++] = (unsigned short)(instruction_image[idx] & WORD_MASK);
+  }
+
+  for (idx = 0; idx < directive_count; idx++) {
+    DirectiveFields *df = directives[idx];
+
+    for (j = 0; df && j < df->data_length && word_count < MAX_WORDS_MEMORY;
+         j++) {
+      words[word_count++] = (unsigned short)(df->data[j] & WORD_MASK);
+    }
+  }
+
+  /* names of entries and externs, all in one string table
+   * (write_entries already reported entries that don't resolve) */
+  for (idx = 0; idx < extern_count; idx++) {
+    strings_size += strlen(extern_symbols[idx]->name) + 1;
+  }
+  for (idx = 0; idx < directive_count; idx++) {
+    DirectiveFields *df = directives[idx];
+
+    if (df && df->is_entry && df->arg_label)
+      strings_size += strlen(df->arg_label) + 1;
+  }
+
+  strings = safe_calloc(strings_size ? strings_size : 1, 1);
+  if (!strings) {
+    (*error_count)++;
+    return;
+  }
+  strings_size = 0;
+
+  for (idx = 0; idx < extern_count; idx++) {
+    externs[idx].name_offset = (unsigned int)strings_size;
+    externs[idx].address = 0;
+    strcpy(strings + strings_size, extern_symbols[idx]->name);
+    strings_size += strlen(extern_symbols[idx]->name) + 1;
+  }
+
+  for (idx = 0; idx < directive_count; idx++) {
+    DirectiveFields *df = directives[idx];
+    Symbol *sym;
+
+    if (!df || !df->is_entry || !df->arg_label)
+      continue;
+
+    sym = find_symbol(symtab, df->arg_label);
+    if (!sym)
+      continue;
+
+    entries[entry_count].name_offset = (unsigned int)strings_size;
+    entries[entry_count].address = (unsigned int)sym->address;
+    entry_count++;
+    strcpy(strings + strings_size, sym->name);
+    strings_size += strlen(sym->name) + 1;
+  }
+
+  memset(&obj, 0, sizeof(obj));
+  obj.header.code_base = IC_INIT_VALUE;
+  obj.header.code_count = (unsigned int)(icf - IC_INIT_VALUE);
+  obj.header.data_count = (unsigned int)(word_count - (icf - IC_INIT_VALUE));
+  obj.header.reloc_count = (unsigned int)relocation_count;
+  obj.header.entry_count = (unsigned int)entry_count;
+  obj.header.extern_count = (unsigned int)extern_count;
+  obj.header.strings_size = (unsigned int)strings_size;
+  obj.words = words;
+  obj.relocs = relocations;
+  obj.entries = entries;
+  obj.externs = externs;
+  obj.strings = strings;
+
+  if (!object_file_write(base_filename, &obj))
+    (*error_count)++;
+
+  free(strings);
+}
+
 /* ======================================================================= */
 
+/* collect_externs -- list the file's external symbols, so relocations can
+ * refer to them by index (kept in each symbol's extern_index) */
+static void collect_externs(Symbol *symtab) {
+  Symbol *sym;
+
+  extern_count = 0;
+  for (sym = symtab; sym && extern_count < MAX_WORDS_MEMORY; sym = sym->next) {
+    if (sym->type == SYMBOL_EXTERNAL) {
+      sym->extern_index = extern_count;
+      extern_symbols[extern_count++] = sym;
+    }
+  }
+}
+
 /* mark_word_absolute -- set A/R/E bits to 00 at index in code image */
 static void mark_word_absolute(int idx) {
   int word;
@@ -294,11 +434,17 @@ static void write_external_reference(FILE **ext_fp, const char *base_filename,
  */
 static void encode_symbol_word(int idx, Symbol *sym, FILE **ext_fp,
                                const char *base_filename) {
+  ObjectReloc *reloc = &relocations[relocation_count++];
+
+  reloc->address = (unsigned short)(IC_INIT_VALUE + idx);
+  reloc->symbol = 0;
 
   if (sym->type == SYMBOL_EXTERNAL) {
     /* external symbol processing */
     /* payload is unknown here, so 0. ARE bits are 01 (external) */
     instruction_image[idx] = ARE_EXTERNAL;
+    reloc->are = ARE_EXTERNAL;
+    reloc->symbol = (unsigned int)sym->extern_index;
 
     /* write to .ext */
     write_external_reference(ext_fp, base_filename, sym->name, idx);
@@ -310,6 +456,7 @@ static void encode_symbol_word(int idx, Symbol *sym, FILE **ext_fp,
 
     /* pack address into bits 2-9 and set A/R/E to 10 (relocatable) */
     instruction_image[idx] = (addr << ADDRESS_PAYLOAD_SHIFT) | ARE_RELOCATABLE;
+    reloc->are = ARE_RELOCATABLE;
   }
 }
 
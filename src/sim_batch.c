@@ -0,0 +1,454 @@
+/* threads and the monotonic clock are POSIX, not ANSI C */
+#define _POSIX_C_SOURCE 200112L
+
+#include "sim_batch.h"
+#include "assembler.h"
+#include "helpers.h"
+#include "sim_coverage.h"
+#include "simulator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_PTHREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+/* sim_batch -- manifest loading, a shared job queue and the report */
+
+#define BATCH_LINE_LENGTH (4 * MAX_FILENAME_LENGTH) /* 3 names and spaces */
+#define BATCH_MIN_JOBS 64
+#define BATCH_PROGRAM_BUCKETS 256 /* power of 2 */
+#define NO_INPUT "-"
+
+/* batch_program -- a loaded program, shared by its tests */
+typedef struct BatchProgram {
+  char *name;
+  SimProgram *program;
+  SimCoverage coverage;      /* of all its tests, merged after the runs */
+  struct BatchProgram *next; /* same bucket */
+} BatchProgram;
+
+/* batch_job -- one test and (once it ran) its result */
+typedef struct BatchJob {
+  BatchProgram *program;
+  char *input_name;
+  char *input;
+  size_t input_length;
+  char *expected_name;
+  char *expected;
+  size_t expected_length;
+
+  SimStatus status;
+  bool passed;
+  unsigned long steps;
+  unsigned long differs_at; /* first output line that's wrong */
+  const char *fault;
+  int fault_address;
+  SimCoverage coverage;
+} BatchJob;
+
+/* batch_queue -- everything the workers share */
+typedef struct BatchQueue {
+  BatchJob *jobs;
+  size_t job_count;
+  size_t next_job; /* next one to hand out */
+  unsigned long max_steps;
+  bool is_covered;
+#ifdef HAVE_PTHREADS
+  pthread_mutex_t lock;
+#endif
+} BatchQueue;
+
+static bool load_manifest(const char *manifest, BatchQueue *queue,
+                          BatchProgram **programs);
+static BatchProgram *find_program(BatchProgram **programs, const char *name);
+static char *load_input(const char *filename, size_t *length_out);
+static void *run_jobs(void *queue);
+static void run_job(SimMachine *machine, BatchJob *job,
+                    unsigned long max_steps, bool is_covered);
+static int report(const BatchQueue *queue, double seconds, int thread_count);
+static bool write_coverage(const BatchQueue *queue, BatchProgram **programs);
+static int core_count(void);
+static double wall_seconds(void);
+static void free_batch(BatchQueue *queue, BatchProgram **programs);
+
+/* ======================================================================= */
+/* ===================== public api -- see header ======================== */
+/* ======================================================================= */
+
+int sim_batch(const char *manifest, int thread_count, unsigned long max_steps,
+              bool is_covered) {
+  BatchProgram *programs[BATCH_PROGRAM_BUCKETS];
+  BatchQueue queue;
+  double started;
+  int failed;
+
+  memset(programs, 0, sizeof(programs));
+  memset(&queue, 0, sizeof(queue));
+  queue.max_steps = max_steps;
+  queue.is_covered = is_covered;
+
+  /* all the file work happens up front, workers only simulate */
+  if (!load_manifest(manifest, &queue, programs)) {
+    free_batch(&queue, programs);
+    return -1;
+  }
+
+  if (thread_count <= 0)
+    thread_count = core_count();
+  if ((size_t)thread_count > queue.job_count)
+    thread_count = queue.job_count ? (int)queue.job_count : 1;
+
+  started = wall_seconds();
+
+#ifdef HAVE_PTHREADS
+  {
+    pthread_t *threads = safe_calloc((size_t)thread_count, sizeof(pthread_t));
+    int started_count = 0;
+
+    pthread_mutex_init(&queue.lock, NULL);
+
+    /* the main thread runs jobs too, it's one of the workers */
+    while (threads && started_count < thread_count - 1 &&
+           pthread_create(&threads[started_count], NULL, run_jobs, &queue) ==
+               0)
+      started_count++;
+
+    run_jobs(&queue);
+
+    while (started_count > 0)
+      pthread_join(threads[--started_count], NULL);
+
+    pthread_mutex_destroy(&queue.lock);
+    free(threads);
+  }
+#else
+  thread_count = 1;
+  run_jobs(&queue);
+#endif
+
+  failed = report(&queue, wall_seconds() - started, thread_count);
+  if (is_covered && !write_coverage(&queue, programs))
+    failed = -1;
+  free_batch(&queue, programs);
+  return failed;
+}
+
+/* ======================================================================= */
+
+/* load_manifest -- read every test of the manifest into queue->jobs, loading
+ * each program (once) and each input/expected file
+ *
+ * returns true on success, false on error (error printed) */
+static bool load_manifest(const char *manifest, BatchQueue *queue,
+                          BatchProgram **programs) {
+  char line[BATCH_LINE_LENGTH];
+  size_t capacity = 0;
+  int line_number = 0;
+  FILE *fp = fopen(manifest, "r");
+
+  if (!fp) {
+    fprintf(stderr, "(ERROR) [sim_batch] cannot open manifest '%s'\n",
+            manifest);
+    return false;
+  }
+
+  while (fgets(line, sizeof(line), fp)) {
+    char program_name[BATCH_LINE_LENGTH];
+    char input_name[BATCH_LINE_LENGTH];
+    char expected_name[BATCH_LINE_LENGTH];
+    char extra[2];
+    BatchJob *job;
+    int fields;
+
+    line_number++;
+
+    if (!strchr(line, '\n') && !feof(fp)) {
+      fprintf(stderr, "(ERROR) [sim_batch] line %d of '%s' is too long\n",
+              line_number, manifest);
+      fclose(fp);
+      return false;
+    }
+
+    remove_comment(line);
+    fields = sscanf(line, "%s %s %s %1s", program_name, input_name,
+                    expected_name, extra);
+    if (fields <= 0)
+      continue; /* blank */
+
+    if (fields != 3) {
+      fprintf(stderr,
+              "(ERROR) [sim_batch] line %d of '%s' must be '<program> "
+              "<input-file> <expected-file>'\n",
+              line_number, manifest);
+      fclose(fp);
+      return false;
+    }
+
+    if (queue->job_count == capacity) {
+      size_t grown_capacity = capacity ? capacity * 2 : BATCH_MIN_JOBS;
+      BatchJob *grown =
+          realloc(queue->jobs, grown_capacity * sizeof(BatchJob));
+
+      if (!grown) {
+        fprintf(stderr, "(ERROR) [sim_batch] out of memory for %lu tests\n",
+                (unsigned long)grown_capacity);
+        fclose(fp);
+        return false;
+      }
+      queue->jobs = grown;
+      capacity = grown_capacity;
+    }
+
+    job = &queue->jobs[queue->job_count++];
+    memset(job, 0, sizeof(*job));
+    job->input_name = safe_strdup(input_name);
+    job->expected_name = safe_strdup(expected_name);
+    job->program = find_program(programs, program_name);
+
+    if (!job->input_name || !job->expected_name || !job->program) {
+      fclose(fp);
+      return false;
+    }
+
+    if (strcmp(input_name, NO_INPUT) != 0) {
+      job->input = load_input(input_name, &job->input_length);
+      if (!job->input) {
+        fclose(fp);
+        return false;
+      }
+    }
+
+    job->expected = load_input(expected_name, &job->expected_length);
+    if (!job->expected) {
+      fclose(fp);
+      return false;
+    }
+  }
+
+  fclose(fp);
+  return true;
+}
+
+/* find_program -- the loaded program called name, loading it the first time
+ *
+ * returns the program or NULL on error (error printed) */
+static BatchProgram *find_program(BatchProgram **programs, const char *name) {
+  size_t bucket = hash_string(name) & (BATCH_PROGRAM_BUCKETS - 1);
+  BatchProgram *entry;
+
+  for (entry = programs[bucket]; entry; entry = entry->next) {
+    if (strcmp(entry->name, name) == 0)
+      return entry;
+  }
+
+  entry = safe_calloc(1, sizeof(BatchProgram));
+  if (!entry)
+    return NULL;
+
+  entry->name = safe_strdup(name);
+  entry->program = entry->name ? sim_load(name) : NULL;
+  if (!entry->program) {
+    free(entry->name);
+    free(entry);
+    return NULL;
+  }
+
+  entry->next = programs[bucket];
+  programs[bucket] = entry;
+  return entry;
+}
+
+/* load_input -- all of filename
+ *
+ * returns the contents or NULL on error (error printed) */
+static char *load_input(const char *filename, size_t *length_out) {
+  FILE *fp = fopen(filename, "rb");
+  char *contents;
+
+  if (!fp) {
+    fprintf(stderr, "(ERROR) [sim_batch] cannot open '%s'\n", filename);
+    return NULL;
+  }
+
+  contents = read_file_contents(fp, length_out);
+  fclose(fp);
+  return contents;
+}
+
+/* run_jobs -- a worker: take the next job off the queue until there are
+ * none left, with a machine of its own */
+static void *run_jobs(void *arg) {
+  BatchQueue *queue = arg;
+  SimMachine *machine = safe_calloc(1, sizeof(SimMachine));
+
+  if (!machine)
+    return NULL; /* the other workers take over its share */
+
+  for (;;) {
+    size_t job;
+
+#ifdef HAVE_PTHREADS
+    pthread_mutex_lock(&queue->lock);
+#endif
+    job = queue->next_job++;
+#ifdef HAVE_PTHREADS
+    pthread_mutex_unlock(&queue->lock);
+#endif
+
+    if (job >= queue->job_count)
+      break;
+
+    run_job(machine, &queue->jobs[job], queue->max_steps, queue->is_covered);
+  }
+
+  free(machine);
+  return NULL;
+}
+
+/* run_job -- run one test on machine and record how it went */
+static void run_job(SimMachine *machine, BatchJob *job,
+                    unsigned long max_steps, bool is_covered) {
+  size_t same = 0;
+  size_t idx;
+
+  sim_init(machine, job->program->program, job->input, job->input_length);
+  if (is_covered)
+    machine->coverage = &job->coverage;
+  job->status = sim_run(machine, max_steps);
+  job->steps = machine->steps;
+  job->fault = machine->fault;
+  job->fault_address = machine->fault_address;
+
+  /* length of the common prefix, the line it ends on is the first wrong one */
+  while (same < machine->output_length && same < job->expected_length &&
+         machine->output[same] == job->expected[same])
+    same++;
+
+  job->passed = job->status == SIM_HALTED &&
+                same == machine->output_length &&
+                same == job->expected_length;
+
+  job->differs_at = 1;
+  for (idx = 0; idx < same; idx++) {
+    if (machine->output[idx] == '\n')
+      job->differs_at++;
+  }
+
+  sim_release(machine);
+}
+
+/* report -- one row per test, in manifest order, then the totals
+ *
+ * returns the number of failed tests */
+static int report(const BatchQueue *queue, double seconds, int thread_count) {
+  unsigned long steps = 0;
+  int failed = 0;
+  size_t idx;
+
+  for (idx = 0; idx < queue->job_count; idx++) {
+    const BatchJob *job = &queue->jobs[idx];
+
+    steps += job->steps;
+
+    if (job->passed) {
+      printf("PASS %s < %s\n", job->program->name, job->input_name);
+      continue;
+    }
+
+    failed++;
+    printf("FAIL %s < %s: ", job->program->name, job->input_name);
+    if (job->status == SIM_FAULT)
+      printf("faulted at address %d: %s\n", job->fault_address, job->fault);
+    else if (job->status == SIM_STEP_LIMIT)
+      printf("did not stop within %lu instructions\n", job->steps);
+    else
+      printf("output differs from '%s' at line %lu\n", job->expected_name,
+             job->differs_at);
+  }
+
+  printf("%d passed, %d failed, %lu instructions in %.3fs (%.0f "
+         "instructions/s, %d threads)\n",
+         (int)queue->job_count - failed, failed, steps, seconds,
+         seconds > 0 ? steps / seconds : 0.0, thread_count);
+
+  return failed;
+}
+
+/* write_coverage -- merge the coverage of every test into its program's, and
+ * those into the <program>.cov files
+ *
+ * returns true on success, false on error (error printed) */
+static bool write_coverage(const BatchQueue *queue, BatchProgram **programs) {
+  char filename[MAX_FILENAME_LENGTH + EXT_LENGTH];
+  bool ok = true;
+  size_t idx;
+
+  for (idx = 0; idx < queue->job_count; idx++)
+    sim_coverage_merge(&queue->jobs[idx].program->coverage,
+                       &queue->jobs[idx].coverage);
+
+  for (idx = 0; idx < BATCH_PROGRAM_BUCKETS; idx++) {
+    const BatchProgram *entry;
+
+    for (entry = programs[idx]; entry; entry = entry->next) {
+      /* sim_load took the name, so it fits */
+      sprintf(filename, "%s.cov", entry->name);
+      if (!sim_coverage_accumulate(&entry->coverage, filename))
+        ok = false;
+    }
+  }
+
+  return ok;
+}
+
+/* core_count -- online cores, 1 if we can't tell */
+static int core_count(void) {
+#if defined(HAVE_PTHREADS) && defined(_SC_NPROCESSORS_ONLN)
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+  if (cores > 0)
+    return (int)cores;
+#endif
+  return 1;
+}
+
+/* wall_seconds -- a wall clock in seconds (clock() adds up every thread's
+ * cpu time, so it's only the fallback) */
+static double wall_seconds(void) {
+#if defined(HAVE_PTHREADS) && defined(CLOCK_MONOTONIC)
+  struct timespec now;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &now) == 0)
+    return now.tv_sec + now.tv_nsec / 1e9;
+#endif
+  return (double)clock() / CLOCKS_PER_SEC;
+}
+
+/* free_batch -- release the jobs and the loaded programs */
+static void free_batch(BatchQueue *queue, BatchProgram **programs) {
+  size_t idx;
+
+  for (idx = 0; idx < queue->job_count; idx++) {
+    free(queue->jobs[idx].input_name);
+    free(queue->jobs[idx].input);
+    free(queue->jobs[idx].expected_name);
+    free(queue->jobs[idx].expected);
+  }
+  free(queue->jobs);
+
+  for (idx = 0; idx < BATCH_PROGRAM_BUCKETS; idx++) {
+    while (programs[idx]) {
+      BatchProgram *next = programs[idx]->next;
+
+      sim_free(programs[idx]->program);
+      free(programs[idx]->name);
+      free(programs[idx]);
+      programs[idx] = next;
+    }
+  }
+}
@@ -0,0 +1,32 @@
+#ifndef SIM_BATCH_H
+#define SIM_BATCH_H
+
+#include "types.h"
+
+/* sim_batch.h -- runs many simulated test programs at once (simulate --batch)
+ *
+ * a manifest lists one test per line:
+ *
+ *   <program> <input-file> <expected-file>
+ *
+ * program is a base filename (its .ob is loaded), input-file is what red
+ * reads ("-" for no input) and expected-file is the exact prn output the run
+ * must produce. blank lines and ';' comments are skipped.
+ *
+ * every program is loaded once and shared read-only by all of its tests.
+ * tests are handed out from one queue to thread_count workers, each with its
+ * own machine (memory, registers, output), and reported in manifest order.
+ * with coverage, every test records its own and they're merged (OR) into
+ * <program>.cov once all of them ran */
+
+/* sim_batch -- run every test of the manifest, thread_count workers (0 for
+ * one per core), each run stops after max_steps instructions (0 for no
+ * limit), is_covered adds the coverage of the tests to <program>.cov
+ *
+ * returns the number of tests that failed, or -1 if the manifest (or a
+ * file it names) couldn't be loaded (error printed)
+ */
+int sim_batch(const char *manifest, int thread_count, unsigned long max_steps,
+              bool is_covered);
+
+#endif /* SIM_BATCH_H */
@@ -0,0 +1,222 @@
+#include "sim_coverage.h"
+#include "helpers.h"
+#include "preprocessor.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* sim_coverage -- .cov files and the per-line report */
+
+/* line marks, kind is a mask of LINE_CODE and LINE_DATA */
+#define LINE_CODE 1
+#define LINE_DATA 2
+
+/* line_state -- what the addresses of one .as line did */
+typedef struct LineState {
+  unsigned char kind; /* LINE_CODE/LINE_DATA, 0 for neither */
+  unsigned char hit;  /* some address of it was run/touched */
+} LineState;
+
+static void mark_line(LineState *states, int state_count, int line, int kind,
+                      bool hit);
+static void write_listing(FILE *out, const LineState *states,
+                          const char **source, int line_count);
+
+/* ======================================================================= */
+/* ===================== public api -- see header ======================== */
+/* ======================================================================= */
+
+void sim_coverage_merge(SimCoverage *into, const SimCoverage *from) {
+  int idx;
+
+  for (idx = 0; idx < SIM_COVERAGE_BYTES; idx++) {
+    into->executed[idx] |= from->executed[idx];
+    into->touched[idx] |= from->touched[idx];
+  }
+}
+
+bool sim_coverage_load(SimCoverage *coverage, const char *filename) {
+  char magic[SIM_COVERAGE_MAGIC_LENGTH];
+  FILE *fp = fopen(filename, "rb");
+  bool ok;
+
+  memset(coverage, 0, sizeof(*coverage));
+  if (!fp)
+    return true; /* nothing ran yet */
+
+  ok = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+       memcmp(magic, SIM_COVERAGE_MAGIC, sizeof(magic)) == 0 &&
+       fread(coverage->executed, 1, SIM_COVERAGE_BYTES, fp) ==
+           SIM_COVERAGE_BYTES &&
+       fread(coverage->touched, 1, SIM_COVERAGE_BYTES, fp) ==
+           SIM_COVERAGE_BYTES &&
+       fgetc(fp) == EOF;
+  fclose(fp);
+
+  if (!ok)
+    fprintf(stderr, "(ERROR) [sim_coverage] '%s' is not a coverage file\n",
+            filename);
+  return ok;
+}
+
+bool sim_coverage_accumulate(const SimCoverage *coverage,
+                             const char *filename) {
+  SimCoverage merged;
+  FILE *fp;
+  bool ok;
+
+  if (!sim_coverage_load(&merged, filename))
+    return false;
+  sim_coverage_merge(&merged, coverage);
+
+  fp = fopen(filename, "wb");
+  if (!fp) {
+    fprintf(stderr, "(ERROR) [sim_coverage] failed to create '%s'\n",
+            filename);
+    return false;
+  }
+
+  ok = fwrite(SIM_COVERAGE_MAGIC, 1, SIM_COVERAGE_MAGIC_LENGTH, fp) ==
+           SIM_COVERAGE_MAGIC_LENGTH &&
+       fwrite(merged.executed, 1, SIM_COVERAGE_BYTES, fp) ==
+           SIM_COVERAGE_BYTES &&
+       fwrite(merged.touched, 1, SIM_COVERAGE_BYTES, fp) == SIM_COVERAGE_BYTES;
+  if (fclose(fp) != 0)
+    ok = false;
+
+  if (!ok)
+    fprintf(stderr, "(ERROR) [sim_coverage] failed to write '%s'\n",
+            filename);
+  return ok;
+}
+
+bool sim_coverage_report(const SimCoverage *coverage,
+                         const SimProgram *program, const char *base_filename,
+                         const MacroLibrary *library, FILE *out) {
+  char filename[MAX_FILENAME_LENGTH + EXT_LENGTH];
+  LineMap map;
+  LineState *states;
+  const char **source;
+  char *as_text;
+  int line_count = 0;
+  int code_lines = 0, code_hit = 0, data_lines = 0, data_hit = 0;
+  int unused_words = 0;
+  int address, line;
+  FILE *fp;
+
+  if (strlen(base_filename) + EXT_LENGTH >= sizeof(filename)) {
+    fprintf(stderr, "(ERROR) [sim_coverage] filename too long for '%s'\n",
+            base_filename);
+    return false;
+  }
+
+  sprintf(filename, "%s.as", base_filename);
+  fp = fopen(filename, "r");
+  if (!fp) {
+    fprintf(stderr, "(ERROR) [sim_coverage] cannot open '%s'\n", filename);
+    return false;
+  }
+  as_text = read_file_contents(fp, NULL);
+  fclose(fp);
+  if (!as_text)
+    return false;
+
+  source = split_lines(as_text, &line_count);
+  if (source && line_count > 0 && source[line_count - 1][0] == '\0')
+    line_count--; /* the file's last newline doesn't start a line */
+
+  states = source ? safe_calloc((size_t)line_count + 1, sizeof(LineState))
+                  : NULL;
+  if (!states || !preprocess_line_map(base_filename, library, &map)) {
+    free(states);
+    free(source);
+    free(as_text);
+    return false;
+  }
+
+  /* every address with a line marks its .am line's origins */
+  for (address = 0; address < MAX_WORDS_MEMORY; address++) {
+    bool is_code = address < program->code_end;
+    bool hit;
+    int am_line = program->lines[address];
+
+    if (am_line <= 0)
+      continue;
+
+    if (am_line > map.count) {
+      fprintf(stderr,
+              "(ERROR) [sim_coverage] '%s.am' does not match '%s', "
+              "assemble it again\n",
+              base_filename, filename);
+      line_map_free(&map);
+      free(states);
+      free(source);
+      free(as_text);
+      return false;
+    }
+
+    hit = is_code ? SIM_COVERAGE_HAS(coverage->executed, address)
+                  : SIM_COVERAGE_HAS(coverage->touched, address);
+    if (!hit)
+      unused_words += is_code && program->code[address].op != SIM_OP_DECODE
+                          ? program->code[address].length
+                          : 1;
+
+    mark_line(states, line_count, map.lines[am_line - 1].line,
+              is_code ? LINE_CODE : LINE_DATA, hit);
+    mark_line(states, line_count, map.lines[am_line - 1].call_line,
+              is_code ? LINE_CODE : LINE_DATA, hit);
+  }
+
+  for (line = 1; line <= line_count; line++) {
+    if (states[line].kind & LINE_CODE) {
+      code_lines++;
+      code_hit += states[line].hit;
+    } else if (states[line].kind & LINE_DATA) {
+      data_lines++;
+      data_hit += states[line].hit;
+    }
+  }
+
+  fprintf(out,
+          "; coverage of %s: %d of %d code lines run, %d of %d data lines "
+          "touched, %d of %d image words unused\n",
+          filename, code_hit, code_lines, data_hit, data_lines, unused_words,
+          program->end - program->entry);
+  write_listing(out, states, source, line_count);
+
+  line_map_free(&map);
+  free(states);
+  free(source);
+  free(as_text);
+  return true;
+}
+
+/* ======================================================================= */
+
+/* mark_line -- record an address of kind on line (if it's a line of the
+ * file, 0 is none) */
+static void mark_line(LineState *states, int state_count, int line, int kind,
+                      bool hit) {
+  if (line <= 0 || line > state_count)
+    return;
+
+  states[line].kind |= (unsigned char)kind;
+  if (hit)
+    states[line].hit = 1;
+}
+
+/* write_listing -- every source line behind its mark: "+" used, "#####"
+ * never used, "-" neither code nor data */
+static void write_listing(FILE *out, const LineState *states,
+                          const char **source, int line_count) {
+  int line;
+
+  for (line = 1; line <= line_count; line++) {
+    const char *mark = "-";
+
+    if (states[line].kind)
+      mark = states[line].hit ? "+" : "#####";
+
+    fprintf(out, "%6s %5d: %s\n", mark, line, source[line - 1]);
+  }
+}
@@ -0,0 +1,67 @@
+#ifndef SIM_COVERAGE_H
+#define SIM_COVERAGE_H
+
+#include "macro_library.h"
+#include "simulator.h"
+#include <limits.h>
+#include <stdio.h>
+
+/* sim_coverage.h -- which parts of a program its runs used (simulate -c)
+ *
+ * coverage is two fixed-size bitmaps of the MAX_WORDS_MEMORY addresses: the
+ * instructions executed and the memory words read or written by operands.
+ * sim_run sets the bits when SimMachine->coverage is set, through its own
+ * dispatch table like the profiler. runs combine with a bitwise OR, so the
+ * coverage of any number of runs (threads, processes, days) is merged in a
+ * few dozen bytes, in any order.
+ *
+ * <file>.cov holds the merged bitmaps, every run ORs itself into it. the
+ * report maps addresses to .am lines (the first pass's line table) and .am
+ * lines to .as lines (preprocess_line_map), macro bodies count for both
+ * their definition and their call */
+
+#define SIM_COVERAGE_BYTES ((MAX_WORDS_MEMORY + CHAR_BIT - 1) / CHAR_BIT)
+#define SIM_COVERAGE_MAGIC "SCOV" /* first bytes of a .cov */
+#define SIM_COVERAGE_MAGIC_LENGTH 4
+
+typedef struct SimCoverage {
+  unsigned char executed[SIM_COVERAGE_BYTES]; /* instruction at address ran */
+  unsigned char touched[SIM_COVERAGE_BYTES];  /* word at address was used */
+} SimCoverage;
+
+/* SIM_COVERAGE_SET -- set the bit of address in bits (a bitmap above) */
+#define SIM_COVERAGE_SET(bits, address)                                        \
+  ((bits)[(address) / CHAR_BIT] |= (unsigned char)(1U << ((address) % CHAR_BIT)))
+
+/* SIM_COVERAGE_HAS -- the bit of address in bits, 0 or 1 */
+#define SIM_COVERAGE_HAS(bits, address)                                        \
+  (((bits)[(address) / CHAR_BIT] >> ((address) % CHAR_BIT)) & 1U)
+
+/* sim_coverage_merge -- into |= from */
+void sim_coverage_merge(SimCoverage *into, const SimCoverage *from);
+
+/* sim_coverage_load -- read a .cov file, a missing one is empty coverage
+ *
+ * returns true on success, false on error (error printed)
+ */
+bool sim_coverage_load(SimCoverage *coverage, const char *filename);
+
+/* sim_coverage_accumulate -- merge coverage into the .cov file filename
+ * (creating it)
+ *
+ * returns true on success, false on error (error printed)
+ */
+bool sim_coverage_accumulate(const SimCoverage *coverage, const char *filename);
+
+/* sim_coverage_report -- write the lines of <base_filename>.as to out, each
+ * marked as run/touched, never run/touched or neither (not code or data),
+ * after a summary with the image words no run used. library is the macro
+ * library the program was assembled with (may be NULL)
+ *
+ * returns true on success, false on error (error printed)
+ */
+bool sim_coverage_report(const SimCoverage *coverage,
+                         const SimProgram *program, const char *base_filename,
+                         const MacroLibrary *library, FILE *out);
+
+#endif /* SIM_COVERAGE_H */
@@ -0,0 +1,239 @@
+#include "sim_profile.h"
+#include "helpers.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* sim_profile -- call tree upkeep and the two reports */
+
+#define NO_FRAME (-1)
+
+/* hot_row -- one instruction of the hot lines report */
+typedef struct HotRow {
+  int address;
+  unsigned long cycles;
+  unsigned long executions;
+} HotRow;
+
+static int add_frame(SimProfile *profile, int function, int parent);
+static void write_stack(FILE *fp, const SimProfile *profile,
+                        const SimProgram *program, int frame);
+static int compare_hot_rows(const void *a, const void *b);
+
+/* ======================================================================= */
+/* ===================== public api -- see header ======================== */
+/* ======================================================================= */
+
+SimProfile *sim_profile_new(int entry) {
+  SimProfile *profile = safe_calloc(1, sizeof(SimProfile));
+
+  if (!profile)
+    return NULL;
+
+  if (add_frame(profile, entry, NO_FRAME) == NO_FRAME) {
+    free(profile);
+    return NULL;
+  }
+
+  return profile;
+}
+
+void sim_profile_free(SimProfile *profile) {
+  if (!profile)
+    return;
+
+  free(profile->frames);
+  free(profile);
+}
+
+void sim_profile_call(SimProfile *profile, int function) {
+  int child;
+
+  if (profile->lost_depth > 0) {
+    profile->lost_depth++;
+    return;
+  }
+
+  /* been here before? */
+  for (child = profile->frames[profile->current].first_child;
+       child != NO_FRAME; child = profile->frames[child].next_sibling) {
+    if (profile->frames[child].function == function) {
+      profile->current = child;
+      return;
+    }
+  }
+
+  child = add_frame(profile, function, profile->current);
+  if (child == NO_FRAME) {
+    profile->lost_depth++; /* charged to the current frame */
+    return;
+  }
+
+  profile->current = child;
+}
+
+void sim_profile_return(SimProfile *profile) {
+  if (profile->lost_depth > 0) {
+    profile->lost_depth--;
+    return;
+  }
+
+  /* an rts the root can't match (the program played with its stack) */
+  if (profile->frames[profile->current].parent != NO_FRAME)
+    profile->current = profile->frames[profile->current].parent;
+}
+
+bool sim_profile_write_folded(const SimProfile *profile,
+                              const SimProgram *program, const char *filename) {
+  FILE *fp = fopen(filename, "w");
+  int frame;
+
+  if (!fp) {
+    fprintf(stderr, "(ERROR) [sim_profile] failed to create '%s'\n",
+            filename);
+    return false;
+  }
+
+  for (frame = 0; frame < profile->frame_count; frame++) {
+    if (profile->frames[frame].cycles == 0)
+      continue;
+
+    write_stack(fp, profile, program, frame);
+    fprintf(fp, " %lu\n", profile->frames[frame].cycles);
+  }
+
+  fclose(fp);
+  return true;
+}
+
+bool sim_profile_write_hot(const SimProfile *profile, const SimProgram *program,
+                           const char *am_filename, const char *filename) {
+  HotRow rows[MAX_WORDS_MEMORY];
+  const char **source = NULL;
+  char *am_text = NULL;
+  int source_lines = 0;
+  int row_count = 0;
+  unsigned long total = 0;
+  int address, idx;
+  FILE *fp;
+
+  for (address = 0; address < MAX_WORDS_MEMORY; address++) {
+    if (profile->executions[address] == 0)
+      continue;
+
+    rows[row_count].address = address;
+    rows[row_count].cycles = profile->cycles[address];
+    rows[row_count].executions = profile->executions[address];
+    total += profile->cycles[address];
+    row_count++;
+  }
+  qsort(rows, (size_t)row_count, sizeof(HotRow), compare_hot_rows);
+
+  /* source text is a nicety, the report works without it */
+  fp = fopen(am_filename, "r");
+  if (fp) {
+    am_text = read_file_contents(fp, NULL);
+    fclose(fp);
+    if (am_text)
+      source = split_lines(am_text, &source_lines);
+  }
+
+  fp = fopen(filename, "w");
+  if (!fp) {
+    fprintf(stderr, "(ERROR) [sim_profile] failed to create '%s'\n",
+            filename);
+    free(source);
+    free(am_text);
+    return false;
+  }
+
+  fprintf(fp, "; hot lines of %s, %lu cycles in total\n", am_filename, total);
+  fprintf(fp, "; %10s %7s %10s %7s %5s  %s\n", "cycles", "share", "executed",
+          "address", "line", "source");
+
+  for (idx = 0; idx < row_count; idx++) {
+    int line = program->lines[rows[idx].address];
+
+    fprintf(fp, "  %10lu %6.2f%% %10lu %7d ", rows[idx].cycles,
+            total ? 100.0 * rows[idx].cycles / total : 0.0,
+            rows[idx].executions, rows[idx].address);
+
+    if (line > 0 && line <= source_lines)
+      fprintf(fp, "%5d  %s\n", line, source[line - 1]);
+    else if (line > 0)
+      fprintf(fp, "%5d\n", line);
+    else
+      fprintf(fp, "%5s\n", "?"); /* not in the line table (data, linked) */
+  }
+
+  fclose(fp);
+  free(source);
+  free(am_text);
+  return true;
+}
+
+/* ======================================================================= */
+
+/* add_frame -- append a frame for function under parent
+ *
+ * returns its index, NO_FRAME when out of room */
+static int add_frame(SimProfile *profile, int function, int parent) {
+  SimFrame *frame;
+
+  if (profile->frame_count == profile->frame_capacity) {
+    int capacity = profile->frame_capacity ? profile->frame_capacity * 2
+                                           : SIM_PROFILE_MIN_FRAMES;
+    SimFrame *grown;
+
+    if (capacity > SIM_PROFILE_MAX_FRAMES)
+      return NO_FRAME;
+
+    grown = realloc(profile->frames, (size_t)capacity * sizeof(SimFrame));
+    if (!grown)
+      return NO_FRAME;
+
+    profile->frames = grown;
+    profile->frame_capacity = capacity;
+  }
+
+  frame = &profile->frames[profile->frame_count];
+  frame->function = function;
+  frame->parent = parent;
+  frame->first_child = NO_FRAME;
+  frame->next_sibling = NO_FRAME;
+  frame->cycles = 0;
+
+  if (parent != NO_FRAME) {
+    frame->next_sibling = profile->frames[parent].first_child;
+    profile->frames[parent].first_child = profile->frame_count;
+  }
+
+  return profile->frame_count++;
+}
+
+/* write_stack -- "root;...;frame", outermost first */
+static void write_stack(FILE *fp, const SimProfile *profile,
+                        const SimProgram *program, int frame) {
+  int function = profile->frames[frame].function;
+
+  if (profile->frames[frame].parent != NO_FRAME) {
+    write_stack(fp, profile, program, profile->frames[frame].parent);
+    fputc(';', fp);
+  }
+
+  if (program->labels[function][0])
+    fputs(program->labels[function], fp);
+  else
+    fprintf(fp, "@%d", function);
+}
+
+/* compare_hot_rows -- most cycles first, then by address */
+static int compare_hot_rows(const void *a, const void *b) {
+  const HotRow *row_a = a;
+  const HotRow *row_b = b;
+
+  if (row_a->cycles != row_b->cycles)
+    return row_a->cycles > row_b->cycles ? -1 : 1;
+
+  return row_a->address - row_b->address;
+}
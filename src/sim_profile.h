@@ -0,0 +1,74 @@
+#ifndef SIM_PROFILE_H
+#define SIM_PROFILE_H
+
+#include "simulator.h"
+
+/* sim_profile.h -- where a simulated program spends its cycles (simulate -p)
+ *
+ * counting is flat arrays indexed by address (executions and cycles of every
+ * instruction) plus the cycles of the current jsr call stack, which is a
+ * node of a call tree that jsr/rts walk down and up. sim_run does the
+ * counting when SimMachine->profile is set, through its own dispatch table,
+ * so runs without a profile don't pay for it.
+ *
+ * the results are written as folded stacks ("MAIN;SUB;INNER cycles" rows,
+ * what flame graph tools read) and as a report of the hottest source lines
+ * (using the first pass's line table, see SimProgram->lines) */
+
+#define SIM_PROFILE_MAX_FRAMES 65536 /* deeper calls count for their caller */
+#define SIM_PROFILE_MIN_FRAMES 64
+
+/* sim_frame -- one call stack: the frames from the root to here */
+typedef struct SimFrame {
+  int function;     /* address jsr went to, the entry for the root */
+  int parent;       /* frame index, -1 for the root */
+  int first_child;  /* frame index, -1 if none */
+  int next_sibling; /* frame index, -1 if none */
+  unsigned long cycles; /* spent in this frame itself */
+} SimFrame;
+
+typedef struct SimProfile {
+  unsigned long executions[MAX_WORDS_MEMORY]; /* by address */
+  unsigned long cycles[MAX_WORDS_MEMORY];     /* by address */
+  SimFrame *frames;                           /* frames[0] is the root */
+  int frame_count;
+  int frame_capacity;
+  int current;        /* frame being run */
+  int lost_depth;     /* calls past SIM_PROFILE_MAX_FRAMES not yet returned */
+} SimProfile;
+
+/* sim_profile_new -- an empty profile for a program starting at entry
+ *
+ * - MUST BE FREED! (sim_profile_free)
+ *
+ * returns the profile or NULL on error
+ */
+SimProfile *sim_profile_new(int entry);
+
+/* sim_profile_free -- free a profile (safe with NULL) */
+void sim_profile_free(SimProfile *profile);
+
+/* sim_profile_call -- jsr to function: move to its frame under the
+ * current one */
+void sim_profile_call(SimProfile *profile, int function);
+
+/* sim_profile_return -- rts: move back to the caller's frame */
+void sim_profile_return(SimProfile *profile);
+
+/* sim_profile_write_folded -- write one "frame;frame;... cycles" row per
+ * call stack that used cycles, frames are named by program's labels
+ *
+ * returns true on success, false on error (error printed)
+ */
+bool sim_profile_write_folded(const SimProfile *profile,
+                              const SimProgram *program, const char *filename);
+
+/* sim_profile_write_hot -- write the instructions that used cycles, hottest
+ * first, with their line and text in am_filename (the program's .am)
+ *
+ * returns true on success, false on error (error printed)
+ */
+bool sim_profile_write_hot(const SimProfile *profile, const SimProgram *program,
+                           const char *am_filename, const char *filename);
+
+#endif /* SIM_PROFILE_H */
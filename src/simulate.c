@@ -0,0 +1,335 @@
+#include "assembler.h"
+#include "conditional.h"
+#include "helpers.h"
+#include "preprocessor.h"
+#include "sim_batch.h"
+#include "sim_coverage.h"
+#include "sim_profile.h"
+#include "simulator.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* simulate -- runs assembled programs (make simulate)
+ *
+ *   simulate [-n max_steps] [-s] [-p] [-c] file...
+ *   simulate [-n max_steps] [-j threads] [-c] --batch manifest
+ *   simulate -r [--macro-lib library] [-D NAME[=value]]... file...
+ *
+ * every file (base filename, like the assembler takes) runs on its own
+ * machine with all of stdin as red input, prn output goes to stdout. -n
+ * stops a run after max_steps instructions (0 for no limit), -s prints the
+ * instruction and cycle counts of every run to stderr. -p profiles every run
+ * into <file>.folded (folded call stacks) and <file>.hot (hot lines), see
+ * sim_profile.h. -c adds the coverage of every run to <file>.cov, see
+ * sim_coverage.h.
+ *
+ * --batch runs the tests of a manifest instead (see sim_batch.h) on -j
+ * threads (default: one per core) and exits with failure if any failed.
+ *
+ * -r runs nothing, it prints the coverage in <file>.cov line by line of
+ * <file>.as (--macro-lib and -D: the library and the definitions the file was
+ * assembled with) */
+
+#define MAX_STEPS_OPTION "-n"
+#define STATS_OPTION "-s"
+#define PROFILE_OPTION "-p"
+#define COVERAGE_OPTION "-c"
+#define REPORT_OPTION "-r"
+#define THREADS_OPTION "-j"
+#define BATCH_OPTION "--batch"
+#define DEFAULT_MAX_STEPS 100000000UL
+
+static bool run_program(const char *filename, const char *input,
+                        size_t input_length, unsigned long max_steps,
+                        bool print_stats, bool is_profiled, bool is_covered);
+static bool write_profile(const char *filename, const SimProfile *profile,
+                          const SimProgram *program);
+static bool write_coverage(const char *filename, const SimCoverage *coverage);
+static bool report_coverage(const char *filename, const MacroLibrary *library);
+static bool coverage_filename(const char *filename, char *out);
+
+int main(int argc, char **argv) {
+  unsigned long max_steps = DEFAULT_MAX_STEPS;
+  bool print_stats = false;
+  bool is_profiled = false;
+  bool is_covered = false;
+  bool is_report = false;
+  const char *manifest = NULL;
+  const char *library_name = NULL;
+  MacroLibrary *library = NULL;
+  int thread_count = 0;
+  char *input;
+  size_t input_length;
+  int file_count = 0;
+  int define_count = 0;
+  int failed = 0;
+  int idx;
+
+  /* options */
+  for (idx = 1; idx < argc; idx++) {
+    if (strcmp(argv[idx], MAX_STEPS_OPTION) == 0) {
+      int value;
+
+      if (idx + 1 >= argc ||
+          parse_number(argv[++idx], 0, INT_MAX, &value) != NUM_OK) {
+        fprintf(stderr,
+                "(ERROR) [simulate] %s expects a number of instructions\n",
+                MAX_STEPS_OPTION);
+        return EXIT_FAILURE;
+      }
+      max_steps = (unsigned long)value;
+    } else if (strcmp(argv[idx], THREADS_OPTION) == 0) {
+      if (idx + 1 >= argc ||
+          parse_number(argv[++idx], 1, INT_MAX, &thread_count) != NUM_OK) {
+        fprintf(stderr, "(ERROR) [simulate] %s expects a number of threads\n",
+                THREADS_OPTION);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[idx], BATCH_OPTION) == 0) {
+      if (idx + 1 >= argc) {
+        fprintf(stderr, "(ERROR) [simulate] %s requires a manifest\n",
+                BATCH_OPTION);
+        return EXIT_FAILURE;
+      }
+      manifest = argv[++idx];
+    } else if (strcmp(argv[idx], MACRO_LIB_OPTION) == 0) {
+      if (idx + 1 >= argc) {
+        fprintf(stderr, "(ERROR) [simulate] %s requires a file\n",
+                MACRO_LIB_OPTION);
+        return EXIT_FAILURE;
+      }
+      library_name = argv[++idx];
+    } else if (strncmp(argv[idx], DEFINE_OPTION, strlen(DEFINE_OPTION)) ==
+               0) {
+      /* -DNAME or -D NAME */
+      const char *definition = argv[idx] + strlen(DEFINE_OPTION);
+
+      if (*definition == '\0') {
+        if (idx + 1 >= argc) {
+          fprintf(stderr, "(ERROR) [simulate] %s requires NAME[=value]\n",
+                  DEFINE_OPTION);
+          return EXIT_FAILURE;
+        }
+        definition = argv[++idx];
+      }
+      if (!cond_define(definition)) {
+        cond_forget_defines();
+        return EXIT_FAILURE;
+      }
+      define_count++;
+    } else if (strcmp(argv[idx], STATS_OPTION) == 0) {
+      print_stats = true;
+    } else if (strcmp(argv[idx], PROFILE_OPTION) == 0) {
+      is_profiled = true;
+    } else if (strcmp(argv[idx], COVERAGE_OPTION) == 0) {
+      is_covered = true;
+    } else if (strcmp(argv[idx], REPORT_OPTION) == 0) {
+      is_report = true;
+    } else {
+      file_count++;
+    }
+  }
+
+  if (manifest && file_count == 0 && !is_profiled && !is_report &&
+      !library_name && define_count == 0)
+    return sim_batch(manifest, thread_count, max_steps, is_covered) == 0
+               ? EXIT_SUCCESS
+               : EXIT_FAILURE;
+
+  if (manifest || file_count == 0 ||
+      ((library_name || define_count > 0) && !is_report) ||
+      (is_report && (is_profiled || is_covered))) {
+    fprintf(stderr,
+            "(ERROR) [simulate] usage: %s [%s max_steps] [%s] [%s] [%s] "
+            "[filename-1]...\n"
+            "       %s [%s max_steps] [%s threads] [%s] %s manifest\n"
+            "       %s %s [%s library] [%s NAME[=value]]... "
+            "[filename-1]...\n",
+            argv[0], MAX_STEPS_OPTION, STATS_OPTION, PROFILE_OPTION,
+            COVERAGE_OPTION, argv[0], MAX_STEPS_OPTION, THREADS_OPTION,
+            COVERAGE_OPTION, BATCH_OPTION, argv[0], REPORT_OPTION,
+            MACRO_LIB_OPTION, DEFINE_OPTION);
+    cond_forget_defines();
+    return EXIT_FAILURE;
+  }
+
+  if (library_name) {
+    library = macro_library_load(library_name);
+    if (!library) {
+      cond_forget_defines();
+      return EXIT_FAILURE;
+    }
+  }
+
+  /* every program gets the same input (a report runs nothing) */
+  input = is_report ? NULL : read_file_contents(stdin, &input_length);
+  if (!is_report && !input)
+    return EXIT_FAILURE;
+
+  for (idx = 1; idx < argc; idx++) {
+    if (strcmp(argv[idx], MAX_STEPS_OPTION) == 0 ||
+        strcmp(argv[idx], THREADS_OPTION) == 0 ||
+        strcmp(argv[idx], MACRO_LIB_OPTION) == 0) {
+      idx++; /* skip the option and its value */
+      continue;
+    }
+    if (strncmp(argv[idx], DEFINE_OPTION, strlen(DEFINE_OPTION)) == 0) {
+      if (argv[idx][strlen(DEFINE_OPTION)] == '\0')
+        idx++; /* -D NAME */
+      continue;
+    }
+    if (strcmp(argv[idx], STATS_OPTION) == 0 ||
+        strcmp(argv[idx], PROFILE_OPTION) == 0 ||
+        strcmp(argv[idx], COVERAGE_OPTION) == 0 ||
+        strcmp(argv[idx], REPORT_OPTION) == 0)
+      continue;
+
+    if (is_report ? !report_coverage(argv[idx], library)
+                  : !run_program(argv[idx], input, input_length, max_steps,
+                                 print_stats, is_profiled, is_covered))
+      failed++;
+  }
+
+  macro_library_free(library);
+  preprocess_forget_includes();
+  cond_forget_defines();
+  free(input);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* run_program -- load and run one program
+ *
+ * returns true if it ran to its stop, false otherwise (error printed) */
+static bool run_program(const char *filename, const char *input,
+                        size_t input_length, unsigned long max_steps,
+                        bool print_stats, bool is_profiled, bool is_covered) {
+  SimProgram *program = sim_load(filename);
+  SimProfile *profile = NULL;
+  SimCoverage coverage;
+  SimMachine *machine;
+  SimStatus status;
+  clock_t started;
+  double seconds;
+  bool ok;
+
+  if (!program)
+    return false;
+
+  machine = safe_calloc(1, sizeof(SimMachine));
+  if (is_profiled && machine)
+    profile = sim_profile_new(program->entry);
+  if (!machine || (is_profiled && !profile)) {
+    free(machine);
+    sim_free(program);
+    return false;
+  }
+
+  sim_init(machine, program, input, input_length);
+  machine->profile = profile;
+  memset(&coverage, 0, sizeof(coverage));
+  if (is_covered)
+    machine->coverage = &coverage;
+  started = clock();
+  status = sim_run(machine, max_steps);
+  seconds = (double)(clock() - started) / CLOCKS_PER_SEC;
+
+  fwrite(machine->output, 1, machine->output_length, stdout);
+  fflush(stdout);
+
+  if (status == SIM_FAULT)
+    fprintf(stderr, "(ERROR) [simulate] '%s' faulted at address %d: %s\n",
+            filename, machine->fault_address, machine->fault);
+  else if (status == SIM_STEP_LIMIT)
+    fprintf(stderr,
+            "(ERROR) [simulate] '%s' did not stop within %lu instructions\n",
+            filename, machine->steps);
+
+  if (print_stats)
+    fprintf(stderr, "%s: %lu instructions, %lu cycles, %.0f instructions/s\n",
+            filename, machine->steps, machine->cycles,
+            seconds > 0 ? machine->steps / seconds : 0.0);
+
+  /* a profile of a run that went wrong is still worth having */
+  ok = status == SIM_HALTED;
+  if (profile && !write_profile(filename, profile, program))
+    ok = false;
+  if (is_covered && !write_coverage(filename, &coverage))
+    ok = false;
+
+  sim_profile_free(profile);
+  sim_release(machine);
+  free(machine);
+  sim_free(program);
+  return ok;
+}
+
+/* write_profile -- <filename>.folded and <filename>.hot
+ *
+ * returns true on success, false on error (error printed) */
+static bool write_profile(const char *filename, const SimProfile *profile,
+                          const SimProgram *program) {
+  char folded[MAX_FILENAME_LENGTH + EXT_LENGTH + 3];
+  char hot[MAX_FILENAME_LENGTH + EXT_LENGTH + 3];
+  char am[MAX_FILENAME_LENGTH + EXT_LENGTH + 3];
+
+  if (strlen(filename) >= MAX_FILENAME_LENGTH) {
+    fprintf(stderr, "(ERROR) [simulate] filename too long for '%s'\n",
+            filename);
+    return false;
+  }
+
+  sprintf(folded, "%s.folded", filename);
+  sprintf(hot, "%s.hot", filename);
+  sprintf(am, "%s.am", filename);
+
+  return sim_profile_write_folded(profile, program, folded) &&
+         sim_profile_write_hot(profile, program, am, hot);
+}
+
+/* write_coverage -- add coverage to <filename>.cov
+ *
+ * returns true on success, false on error (error printed) */
+static bool write_coverage(const char *filename, const SimCoverage *coverage) {
+  char cov[MAX_FILENAME_LENGTH + EXT_LENGTH + 3];
+
+  return coverage_filename(filename, cov) &&
+         sim_coverage_accumulate(coverage, cov);
+}
+
+/* report_coverage -- print the coverage report of filename to stdout
+ *
+ * returns true on success, false on error (error printed) */
+static bool report_coverage(const char *filename, const MacroLibrary *library) {
+  char cov[MAX_FILENAME_LENGTH + EXT_LENGTH + 3];
+  SimCoverage coverage;
+  SimProgram *program;
+  bool ok;
+
+  if (!coverage_filename(filename, cov) || !sim_coverage_load(&coverage, cov))
+    return false;
+
+  program = sim_load(filename);
+  if (!program)
+    return false;
+
+  ok = sim_coverage_report(&coverage, program, filename, library, stdout);
+  sim_free(program);
+  return ok;
+}
+
+/* coverage_filename -- <filename>.cov into out
+ *
+ * returns true on success, false if it's too long (error printed) */
+static bool coverage_filename(const char *filename, char *out) {
+  if (strlen(filename) >= MAX_FILENAME_LENGTH) {
+    fprintf(stderr, "(ERROR) [simulate] filename too long for '%s'\n",
+            filename);
+    return false;
+  }
+
+  sprintf(out, "%s.cov", filename);
+  return true;
+}
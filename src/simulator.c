@@ -0,0 +1,717 @@
+#include "simulator.h"
+#include "data_image.h"
+#include "first_pass.h"
+#include "helpers.h"
+#include "instruction_image.h"
+#include "instruction_utils.h"
+#include "ob_reader.h"
+#include "second_pass.h"
+#include "sim_coverage.h"
+#include "sim_profile.h"
+#include "symbol_table.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* simulator -- load time decoding, then threaded dispatch over SimInsn
+ *
+ * computed goto ("labels as values") is a GNU C extension, other compilers
+ * get the same handlers as cases of a switch */
+#if defined(__GNUC__) && !defined(SIM_NO_THREADING)
+#define SIM_THREADED
+#endif
+
+/* opcodes, as in instruction_info_table */
+#define OP_MOV 0
+#define OP_CMP 1
+#define OP_ADD 2
+#define OP_SUB 3
+#define OP_LEA 4
+#define OP_CLR 5
+#define OP_NOT 6
+#define OP_INC 7
+#define OP_DEC 8
+#define OP_JMP 9
+#define OP_BNE 10
+#define OP_JSR 11
+#define OP_RED 12
+#define OP_PRN 13
+#define OP_RTS 14
+#define OP_STOP 15
+
+#define WORD_SIGN_BIT 0x200 /* bit 9 */
+#define IMM_SIGN_BIT 0x80   /* bit 7 of the 8-bit immediate */
+#define SIM_INPUT_END (-1)  /* red past the end of the input */
+#define SIM_OUTPUT_MIN 64   /* first prn buffer size */
+#define SIM_NUMBER_LENGTH 8 /* "-512\n" and the terminator, rounded up */
+
+/* TO_WORD -- v wrapped around to a signed 10-bit word */
+#define TO_WORD(v) ((short)((((v) & WORD_MASK) ^ WORD_SIGN_BIT) - WORD_SIGN_BIT))
+
+static int load_program_info(SimProgram *program, const char *filename);
+static const char *decode_insn(const short *memory, const short *columns,
+                               int address, SimInsn *insn_out);
+static const char *decode_operand(const short *memory, const short *columns,
+                                  int mode, int reg_shift, int *word_idx,
+                                  SimOperand *operand);
+static void cover_insn(SimMachine *machine, int address);
+static void drop_decoded(SimMachine *machine, int address);
+static int matrix_cell(const short *cells, const SimOperand *operand);
+static void mark_coverage(SimCoverage *coverage, const short *cells, int pc,
+                          const SimInsn *insn);
+static void mark_touched(SimCoverage *coverage, const short *cells,
+                         const SimOperand *operand);
+static bool append_number(SimMachine *machine, int value);
+
+/* ======================================================================= */
+/* ===================== public api -- see header ======================== */
+/* ======================================================================= */
+
+SimProgram *sim_load(const char *base_filename) {
+  char filename[MAX_FILENAME_LENGTH + EXT_LENGTH];
+  SimProgram *program;
+  ObImage *image;
+  int code_end;
+  int address;
+  size_t idx;
+
+  if (strlen(base_filename) + EXT_LENGTH >= sizeof(filename)) {
+    fprintf(stderr, "(ERROR) [simulator] filename too long for '%s'\n",
+            base_filename);
+    return NULL;
+  }
+
+  program = safe_calloc(1, sizeof(SimProgram));
+  if (!program)
+    return NULL;
+
+  sprintf(filename, "%s.ob", base_filename);
+  image = ob_read(filename);
+  if (!image) {
+    free(program);
+    return NULL;
+  }
+
+  if (image->base + image->word_count > MAX_WORDS_MEMORY) {
+    fprintf(stderr, "(ERROR) [simulator] '%s' does not fit in %d words\n",
+            filename, MAX_WORDS_MEMORY);
+    ob_free(image);
+    free(program);
+    return NULL;
+  }
+
+  for (idx = 0; idx < image->word_count; idx++)
+    program->memory[image->base + idx] = TO_WORD(image->words[idx]);
+  program->entry = (int)image->base;
+  program->end = (int)(image->base + image->word_count);
+  ob_free(image);
+
+  /* matrix shapes, and where code ends, when we have the .am */
+  sprintf(filename, "%s.am", base_filename);
+  code_end = load_program_info(program, filename);
+  if (code_end < program->entry || code_end > program->end)
+    code_end = program->end;
+  program->code_end = code_end;
+
+  /* decode the code segment, anything else is decoded when it's reached */
+  for (address = 0; address <= MAX_WORDS_MEMORY; address++)
+    program->code[address].op = SIM_OP_DECODE;
+
+  address = program->entry;
+  while (address < code_end) {
+    SimInsn insn;
+
+    if (decode_insn(program->memory, program->columns, address, &insn))
+      break; /* data (no .am), or a word the program never runs */
+
+    program->code[address] = insn;
+    address += insn.length;
+  }
+
+  return program;
+}
+
+void sim_free(SimProgram *program) { free(program); }
+
+void sim_init(SimMachine *machine, const SimProgram *program,
+              const char *input, size_t input_length) {
+  int address;
+
+  memset(machine, 0, sizeof(*machine));
+  machine->program = program;
+  memcpy(machine->cells, program->memory, sizeof(program->memory));
+  memcpy(machine->code, program->code, sizeof(program->code));
+
+  for (address = 0; address < MAX_WORDS_MEMORY; address++) {
+    if (machine->code[address].op != SIM_OP_DECODE)
+      cover_insn(machine, address);
+  }
+
+  machine->pc = program->entry;
+  machine->sp = IC_INIT_VALUE;
+  machine->input = input;
+  machine->input_length = input_length;
+}
+
+/* -pedantic rejects the extension, it's allowed in sim_run alone */
+#ifdef SIM_THREADED
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+SimStatus sim_run(SimMachine *machine, unsigned long max_steps) {
+  short *cells = machine->cells;
+  SimInsn *code = machine->code;
+  const SimInsn *insn;
+  unsigned long steps = machine->steps;
+  unsigned long cycles = machine->cycles;
+  unsigned long limit = ULONG_MAX;
+  int pc = machine->pc;
+  int cell, a, b;
+  SimStatus status;
+  SimProfile *profile = machine->profile;
+  SimCoverage *coverage = machine->coverage;
+
+#ifdef SIM_THREADED
+  static const void *const handlers[] = {
+      &&op_mov, &&op_cmp, &&op_add, &&op_sub, &&op_lea, &&op_clr,
+      &&op_not, &&op_inc, &&op_dec, &&op_jmp, &&op_bne, &&op_jsr,
+      &&op_red, &&op_prn, &&op_rts, &&op_stop, &&op_decode};
+
+  /* profiling goes through op_profile first (decoding isn't counted, the
+   * decoded instruction is) */
+  static const void *const profile_handlers[] = {
+      &&op_profile, &&op_profile, &&op_profile, &&op_profile, &&op_profile,
+      &&op_profile, &&op_profile, &&op_profile, &&op_profile, &&op_profile,
+      &&op_profile, &&op_profile, &&op_profile, &&op_profile, &&op_profile,
+      &&op_profile, &&op_decode};
+
+  /* coverage goes through op_cover before that */
+  static const void *const cover_handlers[] = {
+      &&op_cover, &&op_cover, &&op_cover, &&op_cover, &&op_cover, &&op_cover,
+      &&op_cover, &&op_cover, &&op_cover, &&op_cover, &&op_cover, &&op_cover,
+      &&op_cover, &&op_cover, &&op_cover, &&op_cover, &&op_decode};
+  const void *const *counted = profile ? profile_handlers : handlers;
+  const void *const *table = coverage ? cover_handlers : counted;
+
+#define HANDLER(label, op) label
+#define DISPATCH() goto *table[insn->op]
+#else
+#define HANDLER(label, op) case op
+#define DISPATCH() goto dispatch
+#endif
+
+/* PROFILE_COUNT -- charge the instruction at pc to its address and to the
+ * current call stack */
+#define PROFILE_COUNT()                                                        \
+  do {                                                                         \
+    profile->executions[pc]++;                                                 \
+    profile->cycles[pc] += insn->length;                                       \
+    profile->frames[profile->current].cycles += insn->length;                  \
+  } while (0)
+
+/* CELL_OF -- cells[] index of a register, direct or matrix operand (-1 when
+ * a matrix index lands outside memory) */
+#define CELL_OF(operand)                                                       \
+  ((operand).kind == SIM_CELL ? (operand).value                                \
+                              : matrix_cell(cells, &(operand)))
+
+#define LOAD(var, operand)                                                     \
+  do {                                                                         \
+    if ((operand).kind == SIM_IMMEDIATE) {                                     \
+      var = (operand).value;                                                   \
+    } else {                                                                   \
+      cell = CELL_OF(operand);                                                 \
+      if (cell < 0)                                                            \
+        goto bad_address;                                                      \
+      var = cells[cell];                                                       \
+    }                                                                          \
+  } while (0)
+
+#define STORE(operand, value)                                                  \
+  do {                                                                         \
+    cell = CELL_OF(operand);                                                   \
+    if (cell < 0)                                                              \
+      goto bad_address;                                                        \
+    cells[cell] = (value);                                                     \
+    if (machine->covered[cell])                                                \
+      drop_decoded(machine, cell);                                             \
+  } while (0)
+
+/* TARGET -- where a jump operand goes: a register holds the address, any
+ * other operand is the address */
+#define TARGET(var, operand)                                                   \
+  do {                                                                         \
+    if ((operand).kind == SIM_CELL && (operand).value >= SIM_REGISTER_BASE)    \
+      var = cells[(operand).value];                                            \
+    else                                                                       \
+      var = CELL_OF(operand);                                                  \
+    if (var < 0 || var >= MAX_WORDS_MEMORY)                                    \
+      goto bad_jump;                                                           \
+  } while (0)
+
+#define RETIRE()                                                               \
+  do {                                                                         \
+    cycles += insn->length;                                                    \
+    if (++steps >= limit)                                                      \
+      goto step_limit;                                                         \
+  } while (0)
+
+#define NEXT()                                                                 \
+  do {                                                                         \
+    pc += insn->length;                                                        \
+    RETIRE();                                                                  \
+    insn = &code[pc];                                                          \
+    DISPATCH();                                                                \
+  } while (0)
+
+#define JUMP(target)                                                           \
+  do {                                                                         \
+    pc = (target);                                                             \
+    RETIRE();                                                                  \
+    insn = &code[pc];                                                          \
+    DISPATCH();                                                                \
+  } while (0)
+
+  if (max_steps && ULONG_MAX - steps > max_steps)
+    limit = steps + max_steps;
+
+  insn = &code[pc];
+  DISPATCH();
+
+#ifdef SIM_THREADED
+op_cover:
+  mark_coverage(coverage, cells, pc, insn);
+  goto *counted[insn->op];
+
+op_profile:
+  PROFILE_COUNT();
+  goto *handlers[insn->op];
+#else
+dispatch:
+  if (coverage && insn->op != SIM_OP_DECODE)
+    mark_coverage(coverage, cells, pc, insn);
+  if (profile && insn->op != SIM_OP_DECODE)
+    PROFILE_COUNT();
+
+  switch (insn->op) {
+#endif
+
+  HANDLER(op_mov, OP_MOV):
+    LOAD(a, insn->src);
+    STORE(insn->dst, (short)a);
+    NEXT();
+
+  HANDLER(op_cmp, OP_CMP):
+    LOAD(a, insn->src);
+    LOAD(b, insn->dst);
+    machine->zero = TO_WORD(a - b) == 0;
+    NEXT();
+
+  HANDLER(op_add, OP_ADD):
+    LOAD(a, insn->src);
+    LOAD(b, insn->dst);
+    STORE(insn->dst, TO_WORD(b + a));
+    NEXT();
+
+  HANDLER(op_sub, OP_SUB):
+    LOAD(a, insn->src);
+    LOAD(b, insn->dst);
+    STORE(insn->dst, TO_WORD(b - a));
+    NEXT();
+
+  HANDLER(op_lea, OP_LEA):
+    a = CELL_OF(insn->src);
+    if (a < 0)
+      goto bad_address;
+    STORE(insn->dst, (short)a);
+    NEXT();
+
+  HANDLER(op_clr, OP_CLR):
+    STORE(insn->dst, 0);
+    NEXT();
+
+  HANDLER(op_not, OP_NOT):
+    LOAD(a, insn->dst);
+    STORE(insn->dst, TO_WORD(~a));
+    NEXT();
+
+  HANDLER(op_inc, OP_INC):
+    LOAD(a, insn->dst);
+    STORE(insn->dst, TO_WORD(a + 1));
+    NEXT();
+
+  HANDLER(op_dec, OP_DEC):
+    LOAD(a, insn->dst);
+    STORE(insn->dst, TO_WORD(a - 1));
+    NEXT();
+
+  HANDLER(op_jmp, OP_JMP):
+    TARGET(a, insn->dst);
+    JUMP(a);
+
+  HANDLER(op_bne, OP_BNE):
+    if (machine->zero)
+      NEXT();
+    TARGET(a, insn->dst);
+    JUMP(a);
+
+  HANDLER(op_jsr, OP_JSR):
+    TARGET(a, insn->dst);
+    if (machine->sp <= 0) {
+      machine->fault = "stack overflow";
+      goto fault;
+    }
+    cells[--machine->sp] = (short)(pc + insn->length);
+    if (machine->covered[machine->sp])
+      drop_decoded(machine, machine->sp);
+    if (profile)
+      sim_profile_call(profile, a);
+    JUMP(a);
+
+  HANDLER(op_red, OP_RED):
+    a = SIM_INPUT_END;
+    if (machine->input_pos < machine->input_length)
+      a = (unsigned char)machine->input[machine->input_pos++];
+    STORE(insn->dst, TO_WORD(a));
+    NEXT();
+
+  HANDLER(op_prn, OP_PRN):
+    LOAD(a, insn->dst);
+    if (!append_number(machine, a)) {
+      machine->fault = "out of memory for prn output";
+      goto fault;
+    }
+    NEXT();
+
+  HANDLER(op_rts, OP_RTS):
+    if (machine->sp >= IC_INIT_VALUE) {
+      machine->fault = "rts with an empty stack";
+      goto fault;
+    }
+    a = cells[machine->sp++];
+    if (a < 0 || a >= MAX_WORDS_MEMORY)
+      goto bad_jump;
+    if (profile)
+      sim_profile_return(profile);
+    JUMP(a);
+
+  HANDLER(op_stop, OP_STOP):
+    cycles += insn->length;
+    steps++;
+    status = SIM_HALTED;
+    goto done;
+
+  HANDLER(op_decode, SIM_OP_DECODE):
+    machine->fault = decode_insn(cells, machine->program->columns, pc,
+                                 &code[pc]);
+    if (machine->fault)
+      goto fault;
+    cover_insn(machine, pc);
+    DISPATCH();
+
+#ifndef SIM_THREADED
+  }
+#endif
+
+bad_address:
+  machine->fault = "operand address outside memory";
+  goto fault;
+
+bad_jump:
+  machine->fault = "jump outside memory";
+  goto fault;
+
+step_limit:
+  status = SIM_STEP_LIMIT;
+  goto done;
+
+fault:
+  machine->fault_address = pc;
+  status = SIM_FAULT;
+
+done:
+  machine->pc = pc;
+  machine->steps = steps;
+  machine->cycles = cycles;
+  return status;
+
+#undef PROFILE_COUNT
+#undef HANDLER
+#undef DISPATCH
+#undef CELL_OF
+#undef LOAD
+#undef STORE
+#undef TARGET
+#undef RETIRE
+#undef NEXT
+#undef JUMP
+}
+#ifdef SIM_THREADED
+#pragma GCC diagnostic pop
+#endif
+
+void sim_release(SimMachine *machine) {
+  free(machine->output);
+  machine->output = NULL;
+  machine->output_length = 0;
+  machine->output_capacity = 0;
+}
+
+/* ======================================================================= */
+
+/* load_program_info -- run the first pass on the program's .am to learn the
+ * row length of every .mat, the line of every instruction and the labels
+ * (by address)
+ *
+ * returns where code ends (icf), -1 without a usable .am */
+static int load_program_info(SimProgram *program, const char *filename) {
+  FILE *am_fp = fopen(filename, "r");
+  Symbol *symtab = NULL;
+  int icf = -1, dcf;
+  int idx;
+
+  if (!am_fp)
+    return -1; /* linked images have no .am, that's fine */
+
+  if (first_pass(am_fp, &symtab, &icf, &dcf) != 0) {
+    fprintf(stderr,
+            "(WARNING) [simulator] '%s' does not assemble, matrix shapes are "
+            "unknown\n",
+            filename);
+    icf = -1;
+  } else {
+    Symbol *sym;
+
+    memcpy(program->lines, line_table, sizeof(program->lines));
+
+    for (sym = symtab; sym; sym = sym->next) {
+      if (sym->type != SYMBOL_EXTERNAL && sym->address >= 0 &&
+          sym->address < MAX_WORDS_MEMORY)
+        strcpy(program->labels[sym->address], sym->name);
+    }
+
+    for (idx = 0; idx < directive_count; idx++) {
+      DirectiveFields *df = directive_list[idx];
+      int address = icf + df->data_address;
+
+      if (df->columns > 0 && address < MAX_WORDS_MEMORY)
+        program->columns[address] = (short)df->columns;
+    }
+  }
+
+  fclose(am_fp);
+  free_directives();
+  free_commands();
+  free_symbol_table(symtab);
+  return icf;
+}
+
+/* decode_insn -- decode the instruction at address (same checks as
+ * compute_instruction_length and the operand layouts in emit_operands)
+ *
+ * returns NULL on success, or why the words aren't an instruction */
+static const char *decode_insn(const short *memory, const short *columns,
+                               int address, SimInsn *insn_out) {
+  const InstructionInfo *info;
+  SimInsn insn;
+  int first, opcode, src_mode, dst_mode, length;
+  int word_idx = address + 1;
+  bool has_src, has_dst;
+  const char *error = NULL;
+
+  if (address < 0 || address >= MAX_WORDS_MEMORY)
+    return "ran past the end of memory";
+
+  first = memory[address] & WORD_MASK;
+  opcode = (first >> OPCODE_SHIFT) & OPCODE_MASK;
+  src_mode = (first >> SRC_MODE_SHIFT) & ADDR_MODE_MASK;
+  dst_mode = (first >> DST_MODE_SHIFT) & ADDR_MODE_MASK;
+  info = get_instruction_info(opcode);
+
+  if (!info || (first & ARE_MASK) != ARE_ABSOLUTE)
+    return "not an instruction";
+
+  has_src = info->allowed_src != 0;
+  has_dst = info->allowed_dst != 0;
+  if ((has_src && !(info->allowed_src & (1 << src_mode))) ||
+      (has_dst && !(info->allowed_dst & (1 << dst_mode))))
+    return "illegal addressing mode";
+
+  length = compute_instruction_length(has_src ? src_mode : -1,
+                                      has_dst ? dst_mode : -1,
+                                      has_src ? "" : NULL, has_dst ? "" : NULL);
+  if (address + length > MAX_WORDS_MEMORY)
+    return "instruction runs past the end of memory";
+
+  memset(&insn, 0, sizeof(insn));
+  insn.op = (unsigned char)opcode;
+  insn.length = (unsigned char)length;
+
+  if (has_src && has_dst && src_mode == ADDR_MODE_REGISTER &&
+      dst_mode == ADDR_MODE_REGISTER) {
+    /* both registers share one word */
+    error = decode_operand(memory, columns, src_mode, REG_SRC_SHIFT, &word_idx,
+                           &insn.src);
+    word_idx--;
+    if (!error)
+      error = decode_operand(memory, columns, dst_mode, REG_DST_SHIFT,
+                             &word_idx, &insn.dst);
+  } else {
+    if (has_src)
+      error = decode_operand(memory, columns, src_mode, REG_SRC_SHIFT,
+                             &word_idx, &insn.src);
+    if (has_dst && !error)
+      error = decode_operand(memory, columns, dst_mode, REG_DST_SHIFT,
+                             &word_idx, &insn.dst);
+  }
+
+  if (error)
+    return error;
+
+  *insn_out = insn;
+  return NULL;
+}
+
+/* decode_operand -- decode the operand words at *word_idx and move past them,
+ * reg_shift picks the register field (REG_SRC_SHIFT/REG_DST_SHIFT)
+ *
+ * returns NULL on success, or what's wrong with the words */
+static const char *decode_operand(const short *memory, const short *columns,
+                                  int mode, int reg_shift, int *word_idx,
+                                  SimOperand *operand) {
+  int word = memory[(*word_idx)++] & WORD_MASK;
+  int reg;
+
+  switch (mode) {
+  case ADDR_MODE_IMMEDIATE:
+    operand->kind = SIM_IMMEDIATE;
+    operand->value = (short)((word >> IMM_DATA_SHIFT) & IMM_MASK);
+    if (operand->value & IMM_SIGN_BIT)
+      operand->value -= IMM_MASK + 1;
+    return NULL;
+
+  case ADDR_MODE_REGISTER:
+    reg = (word >> reg_shift) & NIBBLE_MASK;
+    if (reg >= SIM_REGISTER_COUNT)
+      return "bad register";
+    operand->kind = SIM_CELL;
+    operand->value = (short)(SIM_REGISTER_BASE + reg);
+    return NULL;
+
+  case ADDR_MODE_DIRECT:
+  case ADDR_MODE_MATRIX:
+    if ((word & ARE_MASK) == ARE_EXTERNAL)
+      return "unresolved external (link the program first)";
+
+    operand->kind = SIM_CELL;
+    operand->value = (short)(word >> ADDRESS_PAYLOAD_SHIFT);
+    if (mode == ADDR_MODE_DIRECT)
+      return NULL;
+
+    /* matrix: the index registers follow the address */
+    word = memory[(*word_idx)++] & WORD_MASK;
+    operand->kind = SIM_MATRIX;
+    operand->row = (short)((word >> REG_SRC_SHIFT) & NIBBLE_MASK);
+    operand->col = (short)((word >> REG_DST_SHIFT) & NIBBLE_MASK);
+    if (operand->row >= SIM_REGISTER_COUNT ||
+        operand->col >= SIM_REGISTER_COUNT)
+      return "bad matrix index register";
+
+    operand->row += SIM_REGISTER_BASE;
+    operand->col += SIM_REGISTER_BASE;
+    operand->columns = columns[operand->value] ? columns[operand->value] : 1;
+    return NULL;
+  }
+
+  return "bad addressing mode";
+}
+
+/* cover_insn -- mark the words of the decoded instruction at address */
+static void cover_insn(SimMachine *machine, int address) {
+  int idx;
+
+  for (idx = 0; idx < machine->code[address].length; idx++)
+    machine->covered[address + idx] = 1;
+}
+
+/* drop_decoded -- address was written, drop every decoded instruction that
+ * has a word there (its words stay marked, the next write just finds
+ * nothing to drop) */
+static void drop_decoded(SimMachine *machine, int address) {
+  int start;
+
+  for (start = address; start >= 0 && start > address - SIM_MAX_INSN_WORDS;
+       start--) {
+    SimInsn *insn = &machine->code[start];
+
+    if (insn->op != SIM_OP_DECODE && start + insn->length > address)
+      insn->op = SIM_OP_DECODE;
+  }
+}
+
+/* matrix_cell -- cells[] index of a matrix element, -1 outside memory */
+static int matrix_cell(const short *cells, const SimOperand *operand) {
+  int address = operand->value + cells[operand->row] * operand->columns +
+                cells[operand->col];
+
+  return address >= 0 && address < MAX_WORDS_MEMORY ? address : -1;
+}
+
+/* mark_coverage -- the instruction at pc runs: set its bit and the bits of
+ * the memory words its operands use (a jump's operand is where it goes, and
+ * lea's source is only an address, neither is used) */
+static void mark_coverage(SimCoverage *coverage, const short *cells, int pc,
+                          const SimInsn *insn) {
+  SIM_COVERAGE_SET(coverage->executed, pc);
+
+  if (insn->op == OP_JMP || insn->op == OP_BNE || insn->op == OP_JSR)
+    return;
+
+  if (insn->op != OP_LEA)
+    mark_touched(coverage, cells, &insn->src);
+  mark_touched(coverage, cells, &insn->dst);
+}
+
+/* mark_touched -- set the bit of the memory word operand uses, if any */
+static void mark_touched(SimCoverage *coverage, const short *cells,
+                         const SimOperand *operand) {
+  int cell;
+
+  if (operand->kind == SIM_CELL)
+    cell = operand->value;
+  else if (operand->kind == SIM_MATRIX)
+    cell = matrix_cell(cells, operand);
+  else
+    return;
+
+  if (cell >= 0 && cell < MAX_WORDS_MEMORY)
+    SIM_COVERAGE_SET(coverage->touched, cell);
+}
+
+/* append_number -- add "value\n" to the prn output
+ *
+ * returns true on success, false if out of memory */
+static bool append_number(SimMachine *machine, int value) {
+  char number[SIM_NUMBER_LENGTH];
+  size_t length;
+
+  sprintf(number, "%d\n", value);
+  length = strlen(number);
+
+  if (machine->output_length + length > machine->output_capacity) {
+    size_t capacity = machine->output_capacity ? machine->output_capacity * 2
+                                               : SIM_OUTPUT_MIN;
+    char *grown = realloc(machine->output, capacity);
+
+    if (!grown)
+      return false;
+
+    machine->output = grown;
+    machine->output_capacity = capacity;
+  }
+
+  memcpy(machine->output + machine->output_length, number, length);
+  machine->output_length += length;
+  return true;
+}
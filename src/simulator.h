@@ -0,0 +1,135 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include "assembler.h"
+#include "types.h"
+#include <stddef.h>
+
+/* simulator.h -- runs assembled programs (.ob images) on the 10-bit machine
+ *
+ * machine model:
+ * - MAX_WORDS_MEMORY words of memory, the image is loaded at its .ob
+ *   addresses (code from IC_INIT_VALUE, data right after it)
+ * - registers r0-r7 and a zero flag (set by cmp, tested by bne)
+ * - the stack grows down from IC_INIT_VALUE, below the image (jsr/rts)
+ * - red reads one char of the input (-1 once it's used up), prn prints its
+ *   operand as a signed number on its own line
+ * - every word is a signed 10-bit value, arithmetic wraps around
+ * - every word fetched costs one cycle
+ *
+ * the image is decoded once, at load time, into a SimInsn per address (same
+ * instruction_info_table and word layouts as instruction_image.c), and runs
+ * are dispatched over that form. a write into decoded code drops the decoded
+ * instructions it touches, they are decoded again when reached.
+ *
+ * matrix operands need the row length of their .mat, which the .ob doesn't
+ * have, so it's taken from the program's .am (running the first pass on it).
+ * a matrix without one (no .am, or not a .mat label) is one word per row.
+ * the same first pass gives the source line of every instruction and data
+ * word and the labels, for the profiler and coverage */
+
+#define SIM_REGISTER_COUNT 8
+#define SIM_REGISTER_BASE MAX_WORDS_MEMORY /* cells[] index of r0 */
+#define SIM_CELL_COUNT (MAX_WORDS_MEMORY + SIM_REGISTER_COUNT)
+#define SIM_MAX_INSN_WORDS 5 /* first word + 2 matrix operands */
+
+/* sim_operand kinds */
+#define SIM_NONE 0
+#define SIM_IMMEDIATE 1 /* value is the operand */
+#define SIM_CELL 2      /* cells[value], a register or a direct address */
+#define SIM_MATRIX 3    /* value + cells[row] * columns + cells[col] */
+
+typedef struct SimOperand {
+  short kind;
+  short value;
+  short row; /* cells[] index of the row register (SIM_MATRIX) */
+  short col; /* cells[] index of the column register (SIM_MATRIX) */
+  short columns;
+} SimOperand;
+
+/* sim_insn -- one decoded instruction */
+typedef struct SimInsn {
+  unsigned char op;     /* opcode, or SIM_OP_DECODE when not decoded (yet) */
+  unsigned char length; /* words */
+  SimOperand src;
+  SimOperand dst;
+} SimInsn;
+
+#define SIM_OP_DECODE 16 /* past the last opcode */
+
+/* sim_program -- a loaded image, read-only once loaded so any number of
+ * machines can share it */
+typedef struct SimProgram {
+  short memory[MAX_WORDS_MEMORY];  /* initial memory */
+  SimInsn code[MAX_WORDS_MEMORY + 1]; /* decoded at each address (+ the end) */
+  short columns[MAX_WORDS_MEMORY]; /* .mat row length by address, or 0 */
+  int lines[MAX_WORDS_MEMORY];     /* .am line by address (line_table), or 0 */
+  char labels[MAX_WORDS_MEMORY][MAX_SYMBOL_LENGTH]; /* by address, or "" */
+  int entry;                       /* address of the first instruction */
+  int code_end;                    /* first address after the code */
+  int end;                         /* first address after the image */
+} SimProgram;
+
+typedef enum {
+  SIM_HALTED,    /* ran stop */
+  SIM_FAULT,     /* see SimMachine->fault */
+  SIM_STEP_LIMIT /* ran max_steps instructions */
+} SimStatus;
+
+/* sim_machine -- the state of one run */
+typedef struct SimMachine {
+  const SimProgram *program;
+  short cells[SIM_CELL_COUNT]; /* memory, then the registers */
+  SimInsn code[MAX_WORDS_MEMORY + 1];
+  unsigned char covered[SIM_CELL_COUNT]; /* cell holds decoded code */
+  int pc;
+  int sp;
+  bool zero;
+
+  unsigned long steps;  /* instructions run */
+  unsigned long cycles; /* words fetched */
+
+  const char *input; /* for red */
+  size_t input_length;
+  size_t input_pos;
+
+  char *output; /* from prn, output_length chars (no terminator) */
+  size_t output_length;
+  size_t output_capacity;
+
+  const char *fault; /* why the run stopped on SIM_FAULT */
+  int fault_address;
+
+  struct SimProfile *profile;   /* set after sim_init to profile the run */
+  struct SimCoverage *coverage; /* set after sim_init to add to it */
+} SimMachine;
+
+/* sim_load -- load <base_filename>.ob, and matrix shapes from
+ * <base_filename>.am when it's there, and decode it
+ *
+ * - MUST BE FREED! (sim_free)
+ *
+ * returns the program or NULL on error (error printed)
+ */
+SimProgram *sim_load(const char *base_filename);
+
+/* sim_free -- free a program from sim_load */
+void sim_free(SimProgram *program);
+
+/* sim_init -- reset machine to run program from its entry, red reads the
+ * input_length chars at input (kept by the caller)
+ */
+void sim_init(SimMachine *machine, const SimProgram *program,
+              const char *input, size_t input_length);
+
+/* sim_run -- run until stop, a fault or max_steps instructions (0 for no
+ * limit), the machine can be run again to continue after SIM_STEP_LIMIT
+ *
+ * returns how the run ended
+ */
+SimStatus sim_run(SimMachine *machine, unsigned long max_steps);
+
+/* sim_release -- free the machine's prn output */
+void sim_release(SimMachine *machine);
+
+#endif /* SIMULATOR_H */
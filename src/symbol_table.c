@@ -4,15 +4,24 @@
 #include <stdlib.h>
 #include <string.h>
 
+/* symbol_index -- the symbols of a list by name, chained through
+ * Symbol->bucket_next */
+typedef struct SymbolIndex {
+  Symbol **buckets;
+  size_t bucket_count; /* power of 2 */
+  size_t symbol_count;
+} SymbolIndex;
+
+static void index_symbol(Symbol *head);
+static SymbolIndex *build_index(Symbol *head, size_t bucket_count);
+static void free_index(SymbolIndex *index);
+
+/* ======================================================================= */
+/* ===================== public api -- see header ======================== */
+/* ======================================================================= */
+
 Symbol *add_symbol(Symbol **head, char *name, int address, SymbolType type) {
   size_t name_len;
-  const char *RESERVED_WORDS[] = {
-      "mov",  "cmp",    "add", "sub",    "not",   "clr", "lea", "inc",
-      "dec",  "jmp",    "bne", "red",    "prn",   "jsr", "rts", "stop",
-      "data", "string", "mat", "extern", "entry", "r0",  "r1",  "r2",
-      "r3",   "r4",     "r5",  "r6",     "r7",    NULL};
-  int idx;
-
   Symbol *sym;
 
   /* to be used for checking duplicates */
@@ -32,14 +41,11 @@ Symbol *add_symbol(Symbol **head, char *name, int address, SymbolType type) {
   }
 
   /* reject reserved words like opcodes and register names */
-  for (idx = 0; RESERVED_WORDS[idx] != NULL; ++idx) {
-    if (strcmp(name, RESERVED_WORDS[idx]) == 0) {
-      fprintf(stderr,
-              "(ERROR) [symbol] '%s' is a reserved word and must be "
-              "changed\n",
-              name);
-      return NULL;
-    }
+  if (is_reserved_word(name)) {
+    fprintf(stderr,
+            "(ERROR) [symbol] '%s' is a reserved word and must be changed\n",
+            name);
+    return NULL;
   }
 
   /* NOTE: macro name conflicts not checked here because macros are expanded
@@ -77,6 +83,8 @@ Symbol *add_symbol(Symbol **head, char *name, int address, SymbolType type) {
 
   /* create new symbol node and initialize fields */
   sym = safe_calloc(1, sizeof(Symbol));
+  if (!sym)
+    return NULL;
 
   /* copy name safely with null termination guarantee */
   strncpy(sym->name, name, MAX_LABEL_LENGTH);
@@ -87,9 +95,15 @@ Symbol *add_symbol(Symbol **head, char *name, int address, SymbolType type) {
   sym->type = type;
   sym->next = NULL;
 
-  /* add to beginning of linked list (faster & no need for it to be last) */
+  /* add to beginning of linked list (faster & no need for it to be last),
+   * the index moves along to the new head */
   sym->next = *head;
+  if (*head) {
+    sym->index = (*head)->index;
+    (*head)->index = NULL;
+  }
   *head = sym;
+  index_symbol(sym);
 
   return sym;
 }
@@ -100,7 +114,18 @@ Symbol *find_symbol(Symbol *head, char *name) {
   if (!name)
     return NULL;
 
-  /* walk the linked list looking for exact name match */
+  if (head && head->index) {
+    SymbolIndex *index = head->index;
+
+    current = index->buckets[hash_string(name) & (index->bucket_count - 1)];
+    for (; current; current = current->bucket_next) {
+      if (strcmp(current->name, name) == 0)
+        return current;
+    }
+    return NULL;
+  }
+
+  /* no index, walk the linked list looking for exact name match */
   current = head;
 
   while (current) {
@@ -112,3 +137,82 @@ Symbol *find_symbol(Symbol *head, char *name) {
 
   return NULL;
 }
+
+void free_symbol_table(Symbol *head) {
+  if (head)
+    free_index(head->index);
+
+  while (head) {
+    Symbol *next = head->next;
+
+    free(head);
+    head = next;
+  }
+}
+
+/* ======================================================================= */
+
+/* index_symbol -- add the new head of a list to its index, which is built
+ * (from the whole list) the first time and rebuilt twice as wide once it has
+ * more symbols than buckets. without memory for it we keep no index and
+ * find_symbol walks the list */
+static void index_symbol(Symbol *head) {
+  SymbolIndex *index = head->index;
+  size_t bucket;
+
+  if (!index) {
+    head->index = build_index(head, SYMBOL_MIN_BUCKETS);
+    return;
+  }
+
+  if (index->symbol_count + 1 > index->bucket_count) {
+    head->index = build_index(head, index->bucket_count * 2);
+    free_index(index);
+    return;
+  }
+
+  bucket = hash_string(head->name) & (index->bucket_count - 1);
+  head->bucket_next = index->buckets[bucket];
+  index->buckets[bucket] = head;
+  index->symbol_count++;
+}
+
+/* build_index -- index every symbol of the list in bucket_count buckets (a
+ * power of 2)
+ *
+ * - MUST BE FREED! (free_index)
+ *
+ * returns the index or NULL if out of memory */
+static SymbolIndex *build_index(Symbol *head, size_t bucket_count) {
+  SymbolIndex *index = safe_calloc(1, sizeof(SymbolIndex));
+  Symbol *sym;
+
+  if (!index)
+    return NULL;
+
+  index->buckets = safe_calloc(bucket_count, sizeof(Symbol *));
+  if (!index->buckets) {
+    free(index);
+    return NULL;
+  }
+  index->bucket_count = bucket_count;
+
+  for (sym = head; sym; sym = sym->next) {
+    size_t bucket = hash_string(sym->name) & (bucket_count - 1);
+
+    sym->bucket_next = index->buckets[bucket];
+    index->buckets[bucket] = sym;
+    index->symbol_count++;
+  }
+
+  return index;
+}
+
+/* free_index -- free an index from build_index (safe with NULL) */
+static void free_index(SymbolIndex *index) {
+  if (!index)
+    return;
+
+  free(index->buckets);
+  free(index);
+}
@@ -3,7 +3,14 @@
 
 #include "assembler.h"
 
-/* symbol_table.h -- linked-list symbol table for labels */
+/* symbol_table.h -- linked-list symbol table for labels
+ *
+ * the list is what callers walk, lookups go through a hash index of the
+ * whole list kept on its head node, so defining and finding n labels is
+ * linear in n (the index moves to each new head) */
+
+/* smallest symbol index (power of 2) */
+#define SYMBOL_MIN_BUCKETS 64
 
 /* symbol types (mutually exclusive) */
 typedef enum {
@@ -18,7 +25,10 @@ typedef struct Symbol {
   int address;
   SymbolType type; /* code/data/external */
   int line_number;
+  int extern_index; /* position among the file's externs (second pass) */
   struct Symbol *next;
+  struct Symbol *bucket_next; /* next in its bucket of the index */
+  struct SymbolIndex *index;  /* set on the head only, NULL elsewhere */
 } Symbol;
 
 /* add_symbol -- define a new label
@@ -29,10 +39,15 @@ typedef struct Symbol {
  */
 Symbol *add_symbol(Symbol **head, char *name, int address, SymbolType type);
 
-/* find_symbol -- exact name lookup
+/* find_symbol -- exact name lookup (through the index, or a walk of the
+ * list if it couldn't be allocated)
  *
  * returns the symbol ptr or NULL if not found
  */
 Symbol *find_symbol(Symbol *head, char *name);
 
+/* free_symbol_table -- release every node of the list and the index (safe
+ * with NULL) */
+void free_symbol_table(Symbol *head);
+
 #endif /* SYMBOL_TABLE_H */
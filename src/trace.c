@@ -0,0 +1,191 @@
+/* the monotonic clock is POSIX, not ANSI C */
+#define _POSIX_C_SOURCE 200112L
+
+#include "trace.h"
+#include <string.h>
+#include <time.h>
+
+/* trace -- the span ring buffer and its JSON */
+
+#define TRACE_PID 1          /* every thread goes under one process */
+#define THREAD_NAME_LENGTH 64 /* "<thread_prefix> <n>" */
+
+/* trace_span -- a closed span, times in microseconds */
+typedef struct TraceSpan {
+  const char *category;
+  const char *name;
+  double start;
+  double duration;
+} TraceSpan;
+
+/* open_span -- a span trace_end hasn't closed yet */
+typedef struct OpenSpan {
+  const char *category;
+  const char *name;
+  double start;
+} OpenSpan;
+
+static TraceSpan ring[TRACE_RING_SIZE];
+static unsigned long recorded = 0; /* closed spans ever, ring holds the last */
+static OpenSpan open_spans[TRACE_MAX_DEPTH];
+static int depth = 0; /* open spans, including lost ones past the max */
+static bool is_on = false;
+
+static double now_microseconds(void);
+static void write_string(FILE *out, const char *str);
+
+/* ======================================================================= */
+/* ===================== public api -- see header ======================== */
+/* ======================================================================= */
+
+void trace_start(void) {
+  recorded = 0;
+  depth = 0;
+  is_on = true;
+}
+
+void trace_begin(const char *category, const char *name) {
+  if (!is_on)
+    return;
+
+  if (depth < TRACE_MAX_DEPTH) {
+    open_spans[depth].category = category;
+    open_spans[depth].name = name;
+    open_spans[depth].start = now_microseconds();
+  }
+  depth++;
+}
+
+void trace_end(void) {
+  TraceSpan *span;
+
+  if (!is_on || depth == 0)
+    return;
+
+  depth--;
+  if (depth >= TRACE_MAX_DEPTH)
+    return;
+
+  span = &ring[recorded % TRACE_RING_SIZE];
+  span->category = open_spans[depth].category;
+  span->name = open_spans[depth].name;
+  span->start = open_spans[depth].start;
+  span->duration = now_microseconds() - span->start;
+  recorded++;
+}
+
+bool trace_write(const char *filename, const char *thread_name) {
+  FILE *out = trace_open_file(filename);
+  bool ok;
+
+  if (!out)
+    return false;
+
+  ok = trace_write_events(out, 1);
+  if (!trace_close_file(out, filename, 1, thread_name))
+    return false;
+
+  if (!ok)
+    fprintf(stderr, "(ERROR) [trace] failed to write '%s'\n", filename);
+  return ok;
+}
+
+FILE *trace_open_file(const char *filename) {
+  FILE *out = fopen(filename, "w");
+
+  if (!out) {
+    fprintf(stderr, "(ERROR) [trace] failed to create '%s'\n", filename);
+    return NULL;
+  }
+
+  fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  return out;
+}
+
+bool trace_write_events(FILE *out, int tid) {
+  unsigned long first = 0;
+  unsigned long idx;
+
+  if (recorded > TRACE_RING_SIZE) {
+    first = recorded - TRACE_RING_SIZE;
+    fprintf(out,
+            "{\"name\":\"dropped spans\",\"ph\":\"i\",\"s\":\"t\","
+            "\"ts\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"count\":%lu}},\n",
+            ring[first % TRACE_RING_SIZE].start, TRACE_PID, tid, first);
+  }
+
+  for (idx = first; idx < recorded; idx++) {
+    const TraceSpan *span = &ring[idx % TRACE_RING_SIZE];
+
+    fprintf(out, "{\"name\":");
+    write_string(out, span->name);
+    fprintf(out, ",\"cat\":");
+    write_string(out, span->category);
+    fprintf(out, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,"
+                 "\"tid\":%d},\n",
+            span->start, span->duration, TRACE_PID, tid);
+  }
+
+  return !ferror(out);
+}
+
+bool trace_close_file(FILE *out, const char *filename, int thread_count,
+                      const char *thread_prefix) {
+  char thread_name[THREAD_NAME_LENGTH];
+  bool ok;
+  int tid;
+
+  fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+               "\"args\":{\"name\":\"assembler\"}}",
+          TRACE_PID);
+
+  for (tid = 1; tid <= thread_count; tid++) {
+    fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+                 "\"tid\":%d,\"args\":{\"name\":",
+            TRACE_PID, tid);
+    sprintf(thread_name, "%.40s", thread_prefix);
+    if (thread_count > 1)
+      sprintf(thread_name + strlen(thread_name), " %d", tid);
+    write_string(out, thread_name);
+    fprintf(out, "}}");
+  }
+
+  fprintf(out, "\n]}\n");
+  ok = !ferror(out);
+  if (fclose(out) != 0)
+    ok = false;
+
+  if (!ok)
+    fprintf(stderr, "(ERROR) [trace] failed to write '%s'\n", filename);
+  return ok;
+}
+
+/* ======================================================================= */
+
+/* now_microseconds -- the monotonic clock (shared by every process), or
+ * processor time where there's none */
+static double now_microseconds(void) {
+#ifdef CLOCK_MONOTONIC
+  struct timespec now;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &now) == 0)
+    return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+#endif
+  return (double)clock() * 1e6 / CLOCKS_PER_SEC;
+}
+
+/* write_string -- str as a JSON string */
+static void write_string(FILE *out, const char *str) {
+  fputc('"', out);
+  for (; *str; str++) {
+    unsigned char c = (unsigned char)*str;
+
+    if (c == '"' || c == '\\')
+      fprintf(out, "\\%c", c);
+    else if (c < 0x20)
+      fprintf(out, "\\u%04x", c);
+    else
+      fputc(c, out);
+  }
+  fputc('"', out);
+}
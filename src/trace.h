@@ -0,0 +1,70 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "types.h"
+#include <stdio.h>
+
+/* trace.h -- timestamped spans of the assembler's work (--trace=<file>),
+ * written as Chrome trace-event JSON for Perfetto or chrome://tracing
+ *
+ * a span is opened with trace_begin and closed with trace_end (they nest),
+ * closed spans go into a fixed ring buffer of TRACE_RING_SIZE, once it's full
+ * the oldest are dropped (the file says how many). recording is a clock read
+ * and a few stores, nothing is allocated, and until trace_start every call
+ * returns at once.
+ *
+ * the buffer belongs to the process. the assembler does its files one after
+ * the other on one thread, workers that run in parallel are forked
+ * (check_runner) and each fills its own. trace_write_events writes one
+ * buffer's events on their own, so the workers' files can be put together
+ * between trace_open_file and trace_close_file, one thread (tid) each, where
+ * they show side by side. times come from the monotonic clock, which every
+ * process shares */
+
+#define TRACE_RING_SIZE 8192 /* closed spans kept */
+#define TRACE_MAX_DEPTH 16   /* spans open at once, deeper ones are lost */
+
+/* span categories */
+#define TRACE_FILE "file"   /* a whole file, named after it */
+#define TRACE_STAGE "stage" /* a stage of one file, named after its function */
+
+/* trace_start -- empty the buffer and start recording */
+void trace_start(void);
+
+/* trace_begin -- open a span of category named name, both must live until
+ * the trace is written (literals, argv) */
+void trace_begin(const char *category, const char *name);
+
+/* trace_end -- close the innermost open span */
+void trace_end(void);
+
+/* trace_write -- write the recorded spans to filename as a complete trace,
+ * on one thread named thread_name
+ *
+ * returns true on success, false on error (error printed)
+ */
+bool trace_write(const char *filename, const char *thread_name);
+
+/* trace_open_file -- create filename and write the start of a trace
+ *
+ * returns the file, or NULL on error (error printed)
+ */
+FILE *trace_open_file(const char *filename);
+
+/* trace_write_events -- write the recorded spans to out, oldest first, as
+ * events of thread tid: one per line, each followed by a comma, so the
+ * events of several processes can be concatenated into one trace
+ *
+ * returns true on success, false if writing failed
+ */
+bool trace_write_events(FILE *out, int tid);
+
+/* trace_close_file -- name threads 1 to thread_count "<thread_prefix> <n>"
+ * (or thread_prefix alone if there's one), end the trace and close out
+ *
+ * returns true on success, false on error (error printed)
+ */
+bool trace_close_file(FILE *out, const char *filename, int thread_count,
+                      const char *thread_prefix);
+
+#endif /* TRACE_H */
@@ -22,6 +22,7 @@ typedef struct DirectiveFields {
   char *arg_label;  /* for .entry and .extern, e.g. .entry arg_label */
   bool is_extern;
   bool is_entry;
+  int columns; /* .mat row length, 0 for anything else */
 } DirectiveFields;
 
 typedef struct CommandFields {
@@ -33,4 +34,10 @@ typedef struct CommandFields {
   char *dst;
 } CommandFields;
 
+/* object file format, see --format */
+typedef enum {
+  OUTPUT_TEXT,  /* .ob, base-4 letters (default, spec) */
+  OUTPUT_BINARY /* .obj, packed binary (object_file.h) */
+} OutputFormat;
+
 #endif /* TYPES_H */
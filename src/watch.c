@@ -0,0 +1,307 @@
+/* inotify, select, sigaction and the monotonic clock are not ANSI C */
+#define _POSIX_C_SOURCE 200112L
+
+#include "watch.h"
+#include "assemble.h"
+#include "assembler.h"
+#include "helpers.h"
+#include "line_cache.h"
+#include "preprocessor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+#define HAVE_INOTIFY
+#include <errno.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <sys/select.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+/* watch -- the --watch loop, see header */
+
+#ifdef HAVE_INOTIFY
+
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO)
+#define WATCH_BUFFER_SIZE 4096 /* events read at once */
+
+/* watched_file -- a file we rebuild for, by its directory's watch */
+typedef struct WatchedFile {
+  char directory[MAX_FILENAME_LENGTH];
+  char name[MAX_FILENAME_LENGTH + EXT_LENGTH]; /* in directory */
+  int wd;                                      /* directory's watch */
+  bool is_changed;
+} WatchedFile;
+
+static volatile sig_atomic_t is_interrupted = 0;
+
+static bool watch_file(int fd, const char *filename, const char *ext,
+                       WatchedFile *file);
+static bool read_events(int fd, WatchedFile *files, int count);
+static bool wait_for_events(int fd, int milliseconds);
+static void rebuild(char *filename, const MacroLibrary *macro_lib,
+                    OutputFormat format, LineCache *cache);
+static double now_milliseconds(void);
+static void on_interrupt(int signum);
+
+#endif /* HAVE_INOTIFY */
+
+/* ======================================================================= */
+/* ===================== public api -- see header ======================== */
+/* ======================================================================= */
+
+#ifdef HAVE_INOTIFY
+
+bool watch_files(char **filenames, int file_count,
+                 const char *macro_lib_filename, MacroLibrary **macro_lib,
+                 OutputFormat format) {
+  struct sigaction action;
+  WatchedFile *files; /* the library last, if any */
+  LineCache **caches;
+  int count = file_count + (macro_lib_filename ? 1 : 0);
+  bool ok = true;
+  int fd, idx;
+
+  fd = inotify_init();
+  if (fd < 0) {
+    fprintf(stderr, "(ERROR) [watch] inotify is not available\n");
+    return false;
+  }
+
+  files = safe_calloc((size_t)count, sizeof(WatchedFile));
+  caches = safe_calloc((size_t)file_count, sizeof(LineCache *));
+  if (!files || !caches) {
+    free(files);
+    free(caches);
+    close(fd);
+    return false;
+  }
+
+  for (idx = 0; ok && idx < file_count; idx++) {
+    ok = watch_file(fd, filenames[idx], ".as", &files[idx]);
+    caches[idx] = ok ? line_cache_new() : NULL;
+    if (ok && !caches[idx])
+      ok = false;
+  }
+  if (ok && macro_lib_filename)
+    ok = watch_file(fd, macro_lib_filename, "", &files[file_count]);
+
+  /* SIGINT/SIGTERM interrupt the read, not the process */
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = on_interrupt;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  /* the first build of every file fills its cache */
+  for (idx = 0; ok && idx < file_count; idx++)
+    rebuild(filenames[idx], *macro_lib, format, caches[idx]);
+
+  if (ok) {
+    printf("Watching %d file(s) for changes, Ctrl-C to stop...\n", count);
+    fflush(stdout);
+  }
+
+  while (ok && !is_interrupted) {
+    if (!wait_for_events(fd, -1))
+      continue; /* interrupted */
+
+    /* one save is often several events, wait for them to settle */
+    do {
+      if (!read_events(fd, files, count)) {
+        ok = false;
+        break;
+      }
+    } while (!is_interrupted && wait_for_events(fd, WATCH_SETTLE_MS));
+
+    if (!ok || is_interrupted)
+      break;
+
+    if (macro_lib_filename && files[file_count].is_changed) {
+      MacroLibrary *reloaded = macro_library_load(macro_lib_filename);
+
+      files[file_count].is_changed = false;
+      if (reloaded) {
+        printf("=== RELOADED MACRO LIBRARY %s ===\n", macro_lib_filename);
+        macro_library_free(*macro_lib);
+        *macro_lib = reloaded;
+        for (idx = 0; idx < file_count; idx++)
+          files[idx].is_changed = true;
+      } else {
+        fprintf(stderr,
+                "(ERROR) [watch] keeping the previous '%s', fix it and save "
+                "again\n",
+                macro_lib_filename);
+      }
+    }
+
+    /* an included file may be what changed, read them all again */
+    preprocess_forget_includes();
+
+    for (idx = 0; idx < file_count; idx++) {
+      if (!files[idx].is_changed)
+        continue;
+
+      files[idx].is_changed = false;
+      printf("=== CHANGED %s.as ===\n", filenames[idx]);
+      rebuild(filenames[idx], *macro_lib, format, caches[idx]);
+    }
+    fflush(stdout);
+  }
+
+  for (idx = 0; idx < file_count; idx++)
+    line_cache_free(caches[idx]);
+  free(caches);
+  free(files);
+  close(fd);
+
+  if (ok)
+    printf("Stopped watching\n");
+  return ok;
+}
+
+#else /* !HAVE_INOTIFY */
+
+bool watch_files(char **filenames, int file_count,
+                 const char *macro_lib_filename, MacroLibrary **macro_lib,
+                 OutputFormat format) {
+  (void)filenames;
+  (void)file_count;
+  (void)macro_lib_filename;
+  (void)macro_lib;
+  (void)format;
+  fprintf(stderr, "(ERROR) [watch] %s needs inotify (linux)\n", WATCH_OPTION);
+  return false;
+}
+
+#endif /* HAVE_INOTIFY */
+
+/* ======================================================================= */
+
+#ifdef HAVE_INOTIFY
+
+/* watch_file -- watch the directory of filename + ext for it to be written
+ * or moved in, filling file
+ *
+ * returns true on success, false on error (error printed) */
+static bool watch_file(int fd, const char *filename, const char *ext,
+                       WatchedFile *file) {
+  const char *slash = strrchr(filename, '/');
+
+  if (strlen(filename) >= MAX_FILENAME_LENGTH) {
+    fprintf(stderr, "(ERROR) [watch] '%s' is too long a filename\n",
+            filename);
+    return false;
+  }
+
+  if (!slash) {
+    strcpy(file->directory, ".");
+    sprintf(file->name, "%s%s", filename, ext);
+  } else {
+    size_t length = slash == filename ? 1 : (size_t)(slash - filename);
+
+    memcpy(file->directory, filename, length);
+    file->directory[length] = '\0';
+    sprintf(file->name, "%s%s", slash + 1, ext);
+  }
+
+  /* a directory watched twice gets the same descriptor */
+  file->wd = inotify_add_watch(fd, file->directory, WATCH_EVENTS);
+  if (file->wd < 0) {
+    fprintf(stderr, "(ERROR) [watch] failed to watch '%s'\n",
+            file->directory);
+    return false;
+  }
+
+  file->is_changed = false;
+  return true;
+}
+
+/* read_events -- read the waiting events, marking the files they name
+ * changed (every one if the kernel dropped events)
+ *
+ * returns true on success, false if reading failed (error printed) */
+static bool read_events(int fd, WatchedFile *files, int count) {
+  union {
+    struct inotify_event event; /* aligns the buffer for it */
+    char bytes[WATCH_BUFFER_SIZE];
+  } buffer;
+  ssize_t length;
+  size_t offset;
+  int idx;
+
+  length = read(fd, buffer.bytes, sizeof(buffer.bytes));
+  if (length < 0) {
+    if (errno == EINTR)
+      return true;
+    fprintf(stderr, "(ERROR) [watch] failed to read inotify events\n");
+    return false;
+  }
+
+  for (offset = 0; offset < (size_t)length;) {
+    const struct inotify_event *event =
+        (const struct inotify_event *)(buffer.bytes + offset);
+
+    for (idx = 0; idx < count; idx++) {
+      if ((event->mask & IN_Q_OVERFLOW) ||
+          (event->wd == files[idx].wd && event->len > 0 &&
+           strcmp(event->name, files[idx].name) == 0))
+        files[idx].is_changed = true;
+    }
+
+    offset += sizeof(struct inotify_event) + event->len;
+  }
+
+  return true;
+}
+
+/* wait_for_events -- wait up to milliseconds (forever if negative) for
+ * events to read
+ *
+ * returns true if there are some, false on timeout or interrupt */
+static bool wait_for_events(int fd, int milliseconds) {
+  struct timeval timeout;
+  fd_set readable;
+
+  FD_ZERO(&readable);
+  FD_SET(fd, &readable);
+  timeout.tv_sec = milliseconds / 1000;
+  timeout.tv_usec = (milliseconds % 1000) * 1000;
+
+  return select(fd + 1, &readable, NULL, NULL,
+                milliseconds < 0 ? NULL : &timeout) > 0;
+}
+
+/* rebuild -- assemble filename through its cache, then say how long it
+ * took and how much of it the cache had */
+static void rebuild(char *filename, const MacroLibrary *macro_lib,
+                    OutputFormat format, LineCache *cache) {
+  double start = now_milliseconds();
+
+  /* a file that fails to preprocess never reaches the cache */
+  cache->hits = 0;
+  cache->misses = 0;
+  assemble_file_cached(filename, macro_lib, format, cache);
+  printf("Rebuilt %s in %.1f ms (%d of %d lines from the cache)\n", filename,
+         now_milliseconds() - start, cache->hits,
+         cache->hits + cache->misses);
+}
+
+/* now_milliseconds -- the monotonic clock */
+static double now_milliseconds(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+/* on_interrupt -- SIGINT/SIGTERM handler, ends the loop */
+static void on_interrupt(int signum) {
+  (void)signum;
+  is_interrupted = 1;
+}
+
+#endif /* HAVE_INOTIFY */
@@ -0,0 +1,31 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "macro_library.h"
+#include "types.h"
+
+/* watch.h -- the assembler's --watch mode: assemble the files, then again
+ * whenever one of them is saved, until interrupted
+ *
+ * the process stays up between builds, so what a build needs is there
+ * already: the macro library stays loaded and every file keeps a line cache
+ * (line_cache.h) of its last build, whose unchanged lines the first pass
+ * replays instead of parsing. changes are seen through inotify on the
+ * files' directories (editors that save by renaming a new file over the old
+ * one included), events that come within WATCH_SETTLE_MS of each other make
+ * one rebuild */
+
+#define WATCH_SETTLE_MS 50 /* quiet time before rebuilding */
+
+/* watch_files -- assemble the file_count filenames (without .as extension)
+ * and reassemble each one that changes, until SIGINT or SIGTERM. if
+ * macro_lib_filename (may be NULL) changes, *macro_lib is loaded from it
+ * again (the old one stays on error) and every file is reassembled
+ *
+ * returns true once interrupted, false on error (error printed)
+ */
+bool watch_files(char **filenames, int file_count,
+                 const char *macro_lib_filename, MacroLibrary **macro_lib,
+                 OutputFormat format);
+
+#endif /* WATCH_H */
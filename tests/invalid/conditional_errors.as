@@ -0,0 +1,8 @@
+; conditional_errors.as - test an .if that is never closed
+
+START:  mov #1, r1
+.ifndef DEBUG
+        prn r1
+.if 1
+        stop
+.endif
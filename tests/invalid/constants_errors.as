@@ -0,0 +1,16 @@
+; constants_errors.as - test constants and folding errors
+
+.define SIZE = 4
+.define ZERO = SIZE - 4
+.define mov = 1                ; reserved word
+.define r1 = 3                 ; a register
+.equ inc, 2                    ; an opcode
+.define BIG = 32767 + 1        ; past the folding limit
+
+START:  mov #SIZE / ZERO, r1   ; division by zero
+        prn #SIZE * 100        ; out of range for an immediate
+        stop
+
+DATA:   .data SIZE * 200       ; out of range for a word
+LIST:   .data 1,,2             ; empty value
+GRID:   .mat [SIZE - 4][1]     ; dimension below 1
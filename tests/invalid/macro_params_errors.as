@@ -0,0 +1,9 @@
+; macro_params_errors.as - test a call with the wrong number of arguments
+
+mcro load reg, val
+    mov #val, reg
+mcroend
+
+START:  load r1, 4
+        load r1, 2, 3      ; load takes 2 arguments
+        stop
@@ -0,0 +1,7 @@
+; rept_include.as - test an .include inside a .rept block
+
+START:  mov #1, r1
+.rept 2
+.include "rept_missing_endr.as"
+.endr
+        stop
@@ -0,0 +1,6 @@
+; rept_missing_endr.as - test a .rept block that is never closed
+
+START:  mov #1, r1
+.rept 2
+        inc r1
+        stop
@@ -0,0 +1,28 @@
+; conditional_test.as - test conditional assembly (-D DEBUG -D LEVEL=2)
+
+.entry START
+
+START:  mov #1, r1
+.ifdef DEBUG
+        prn r1
+.if LEVEL >= 2
+        prn #2
+.else
+        prn #1
+.endif
+.endif
+.ifndef DEBUG
+        prn #-1            ; dropped, DEBUG is defined
+.endif
+.ifdef RELEASE
+        mcro broken        ; never read as a macro
+.else
+        inc r1
+.if LEVEL == 3
+        dec r1
+.endif
+.endif
+.if 0
+        this line is never assembled
+.endif
+        stop
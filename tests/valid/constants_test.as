@@ -0,0 +1,17 @@
+; constants_test.as - test .define/.equ constants and folding
+
+.entry START
+
+.define SIZE = 4
+.equ ROWS, 2
+.define COLS = SIZE / ROWS
+.define STEP = -(SIZE - 1) * 2
+
+START:  mov #SIZE, r1
+        add #STEP + 10, r1
+        sub #(ROWS + COLS) % 3, r1
+        prn r1
+        stop
+
+DATA:   .data SIZE, -SIZE, SIZE * SIZE, STEP
+GRID:   .mat [ROWS][COLS] 1, ROWS, COLS, SIZE * 100
@@ -0,0 +1,9 @@
+; macro_lib_cycle.as - test a corrupt macro library whose chain loops
+; (macro_lib_cycle.mlib: foo's entry links to itself, LOOP: and .extern
+; hash to foo's bucket, so looking them up walks the loop)
+
+.extern EXT
+
+MAIN:   foo
+LOOP:   jsr EXT
+        stop
@@ -0,0 +1,26 @@
+; macro_params.as - test macro parameters
+
+.entry START
+
+mcro load reg, val
+    mov #val, reg
+mcroend
+
+mcro addto dst, src
+    add src, dst
+    prn dst
+mcroend
+
+mcro halt
+    stop
+mcroend
+
+START:  load r1, 5
+        load r2, -3
+        addto r1, r2
+        addto r1, r2
+LOOP:   load r3, 1
+        addto VALUE, r3
+        halt
+
+VALUE:  .data 7
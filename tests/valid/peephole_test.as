@@ -0,0 +1,25 @@
+; peephole_test.as - test the -O pass (dead code, mov #0 and self moves)
+
+.extern EXT
+.entry MAIN
+
+MAIN:   mov r1, r1         ; kept, it's labeled
+        mov #0, r2         ; becomes clr r2
+        clr r2             ; removed, r2 is 0 already
+        mov #0, r2         ; removed too
+        mov #5, r3
+        mov #0, DATA       ; becomes clr DATA
+        jmp LOOP
+        inc r4             ; unreachable up to LOOP
+        prn #3
+LOOP:   mov r2, r2         ; kept, it's labeled
+        mov r3, r3         ; removed
+        clr r5
+        mov #0, r5         ; removed
+        jsr EXT
+        lea DATA, r6
+        stop
+        add r1, r2         ; unreachable
+
+DATA:   .data 1, 2
+.entry LOOP
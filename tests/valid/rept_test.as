@@ -0,0 +1,21 @@
+; rept_test.as - test .rept/.endr blocks
+
+.entry START
+
+START:  mov #0, r1
+.rept 0
+        prn #99            ; a count of 0 writes nothing
+.endr
+.rept 2
+        inc r1
+.rept 3
+        add #2, r1
+.endr
+        prn r1
+.endr
+        stop
+
+TABLE:  .data 0
+.rept 3
+        .data 1, 2
+.endr